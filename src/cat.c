@@ -13,6 +13,7 @@
 #include "slow5_extra.h"
 #include "read_fast5.h"
 #include "misc.h"
+#include "out_index.h"
 #include <slow5/slow5_press.h>
 
 #define USAGE_MSG "Usage: %s [SLOW5_FILE/DIR]\n"
@@ -22,6 +23,7 @@
     "\n" \
     "OPTIONS:\n"       \
     HELP_MSG_OUTPUT_FILE \
+    HELP_MSG_INDEX_OUT \
 
 extern int slow5tools_verbosity_level;
 int close_files_and_exit(slow5_file_t *slow5_file, slow5_file_t *slow5_file_i, char *arg_fname_out);
@@ -121,6 +123,7 @@ int cat_main(int argc, char **argv, struct program_meta *meta){
     static struct option long_opts[] = {
             {"help", no_argument, NULL, 'h' }, //0
             {"output", required_argument, NULL, 'o'}, //1
+            {"index", no_argument, NULL, 'I'}, //2
             {NULL, 0, NULL, 0 }
     };
 
@@ -143,6 +146,9 @@ int cat_main(int argc, char **argv, struct program_meta *meta){
             case 'o':
                 user_opts.arg_fname_out = optarg;
                 break;
+            case 'I':
+                user_opts.flag_index = 1;
+                break;
             case 'h':
                 DEBUG("displaying large help message%s","");
                 fprintf(stdout, HELP_LARGE_MSG, argv[0]);
@@ -158,6 +164,11 @@ int cat_main(int argc, char **argv, struct program_meta *meta){
         EXIT_MSG(EXIT_FAILURE, argv, meta);
         return EXIT_FAILURE;
     }
+    if (user_opts.flag_index && user_opts.arg_fname_out == NULL) {
+        ERROR("--index needs an output file (-o)%s", "");
+        EXIT_MSG(EXIT_FAILURE, argv, meta);
+        return EXIT_FAILURE;
+    }
 
     // Check for remaining files to parse
     if (optind >= argc) {
@@ -202,6 +213,7 @@ int cat_main(int argc, char **argv, struct program_meta *meta){
     WARNING("%s","slow5tools cat is much faster than merge, but performs minimal input validation. Use with caution.");
 
     slow5_file_t* slow5File = NULL;
+    out_index_t *oi = NULL;
     int first_iteration = 1;
     uint32_t num_read_groups = 1;
     std::vector<std::string> run_ids;
@@ -284,6 +296,9 @@ int cat_main(int argc, char **argv, struct program_meta *meta){
                 ERROR("Could not write the header to %s\n", user_opts.arg_fname_out);
                 return close_files_and_exit(slow5File, slow5File_i, user_opts.arg_fname_out);
             }
+            if (user_opts.flag_index) {
+                oi = out_index_init(user_opts.arg_fname_out, slow5File->header->version);
+            }
             first_iteration = 0;
         }else {
             if (lossy == 0 && slow5File_i->header->aux_meta == NULL) {
@@ -347,6 +362,31 @@ int cat_main(int argc, char **argv, struct program_meta *meta){
         // BUFSIZE of 1 means one chareter at time
         // good values should fit to blocksize, like 1024 or 4096
         // higher values reduce number of system calls
+        if (oi) {
+            // with --index the records are copied one by one, so that their read ids and offsets are known
+            char *mem;
+            size_t bytes;
+            while ((mem = (char *) slow5_get_next_mem(&bytes, slow5File_i))) {
+                off_t offset = ftello(slow5File->fp);
+                if (format_out == SLOW5_FORMAT_BINARY) {
+                    slow5_rec_size_t record_size = bytes;
+                    fwrite(&record_size, 1, sizeof record_size, slow5File->fp);
+                }
+                fwrite(mem, 1, bytes, slow5File->fp);
+                if (format_out == SLOW5_FORMAT_ASCII) {
+                    fwrite("\n", 1, 1, slow5File->fp);
+                }
+                out_index_add(oi, out_index_mem_id(slow5File_i, mem, bytes), offset, ftello(slow5File->fp) - offset);
+                free(mem);
+            }
+            if (slow5_errno != SLOW5_ERR_EOF) {
+                ERROR("Could not read the records of %s.", slow5_files[i].c_str());
+                out_index_free(oi);
+                return close_files_and_exit(slow5File, slow5File_i, user_opts.arg_fname_out);
+            }
+            slow5_close(slow5File_i);
+            continue;
+        }
         char buf[BUFSIZ];
         size_t size;
         while ((size = fread(buf, 1, BUFSIZ, slow5File_i->fp))) {
@@ -363,6 +403,9 @@ int cat_main(int argc, char **argv, struct program_meta *meta){
         slow5_eof_fwrite(slow5File->fp);
     }
     slow5_close(slow5File);
+    if (oi && out_index_close(oi) != 0) {
+        return EXIT_FAILURE;
+    }
 
     return EXIT_SUCCESS;
 }
@@ -6,6 +6,10 @@
 #define DEFAULT_NUM_THREADS 8
 #define DEFAULT_NUM_PROCESSES 8
 #define DEFAULT_BATCH_SIZE 4096
+#define DEFAULT_MAX_MEM 0 //no limit
+#define DEFAULT_NUM_READERS 1
+#define MAX_NUM_READERS 256
+#define DEFAULT_WRITE_BUF 0 //WRITER_BUF_SIZE
 #define DEFAULT_AUXILIARY_FIELDS_NOT_OUT 0
 #define DEFAULT_ALLOW_RUN_ID_MISMATCH 0
 #define DEFAULT_RETAIN_DIR_STRUCTURE 0
@@ -48,6 +52,27 @@
 #define HELP_MSG_BATCH \
     "    -K, --batchsize INT           number of records loaded to the memory at once [" TO_STR(DEFAULT_BATCH_SIZE) "]\n"
 
+//for commands that adapt the batch size
+#define HELP_MSG_BATCH_ADAPTIVE \
+    "    -K, --batchsize INT           initial number of records loaded to the memory at once, adapted at runtime [" TO_STR(DEFAULT_BATCH_SIZE) "]\n" \
+    "        --max-mem SIZE            limit the memory used by the records loaded at once, e.g. 8G [no limit]\n"
+
+//for commands that can read a BLOW5 file with several threads
+#define HELP_MSG_READERS \
+    "        --readers INT             number of threads reading the BLOW5 input in parallel [" TO_STR(DEFAULT_NUM_READERS) "]\n"
+
+#define HELP_MSG_MMAP \
+    "        --mmap                    read the BLOW5 input through a memory map\n"
+
+//for commands that write their records through writer_t
+#define HELP_MSG_WRITER \
+    "        --write-buf SIZE          output gathered before each write call, e.g. 16M [4M]\n" \
+    "        --direct                  write the output with O_DIRECT, bypassing the page cache\n"
+
+//for commands that can index their output as they write it
+#define HELP_MSG_INDEX_OUT \
+    "        --index                   also write the index of each output file (FILE.idx) in the same pass\n"
+
 //for f2s
 #define HELP_MSG_RETAIN_DIR_STRUCTURE \
     "        --retain                  retain the same directory structure in the converted output as the input (experimental)\n"
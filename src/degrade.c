@@ -9,6 +9,7 @@
 #include "cmd.h"
 #include "misc.h"
 #include "thread.h"
+#include "reader.h"
 #include "degrade.h"
 #include <slow5/slow5.h>
 #include "slow5_extra.h"
@@ -27,7 +28,8 @@
     "    -c, --compress REC_MTD        record compression method [zlib] (only for blow5 format)\n" \
     "    -s, --sig-compress SIG_MTD    signal compression method [ex-zd] (only for blow5 format)\n" \
     HELP_MSG_THREADS \
-    HELP_MSG_BATCH \
+    HELP_MSG_BATCH_ADAPTIVE \
+    HELP_MSG_READERS \
     "        --from FORMAT             specify input file format [auto]\n" \
     "    -b, --bits INT                specify the number of least significant bits to eliminate [auto]\n" \
     HELP_MSG_HELP \
@@ -43,7 +45,7 @@ static inline uint8_t slow5_suggest_qts(const struct slow5_file *p,
                                         struct dataset *d);
 static inline void slow5_hdrcmp_log(const char *a, uint32_t i, const char *x,
                                     const char *v);
-static int slow5_convert_parallel(struct slow5_file *from, FILE *to_fp, enum slow5_fmt to_format, slow5_press_method_t to_compress, size_t num_threads, int64_t batch_size, struct program_meta *meta, uint8_t b, const struct dataset *d);
+static int slow5_convert_parallel(struct slow5_file *from, FILE *to_fp, enum slow5_fmt to_format, slow5_press_method_t to_compress, const opt_t *opt, struct program_meta *meta, uint8_t b, const struct dataset *d);
 static int slow5_get_dataset(const struct slow5_file *p, struct dataset *d);
 static int slow5_hdr_get_dataset(const struct slow5_hdr *h, struct dataset *d);
 static int slow5_hdrcmp(const struct slow5_hdr *h, const char *a,
@@ -51,7 +53,7 @@ static int slow5_hdrcmp(const struct slow5_hdr *h, const char *a,
 static int slow5_hdrcmp_sample_freq(const struct slow5_hdr *h, const char *f);
 static int slow5_reccmp(const struct slow5_rec *r, float dig, float sr);
 static int8_t parse_bits(const char *s);
-static void depress_parse_rec_to_mem(core_t *core, db_t *db, int32_t i);
+static void depress_parse_rec_to_mem(core_t *core, rec_batch_t *db, int32_t i);
 
 /*
  * Return a suggestion for the number of bits to use with qts degradation given
@@ -239,12 +241,16 @@ static int8_t parse_bits(const char *s)
     return (int8_t) b;
 }
 
-static void depress_parse_rec_to_mem(core_t *core, db_t *db, int32_t i) {
+static void depress_parse_rec_to_mem(core_t *core, rec_batch_t *db, int32_t i) {
     //
     struct slow5_rec *read = NULL;
     const struct dataset *d;
 
-    if (slow5_rec_depress_parse(&db->mem_records[i], &db->mem_bytes[i], NULL, &read, core->fp) != 0) {
+    if (db->mapped) {
+        if (mmap_rec_depress_parse(db->mem_records[i], db->mem_bytes[i], &read, core->fp) != 0) {
+            exit(EXIT_FAILURE);
+        }
+    } else if (slow5_rec_depress_parse(&db->mem_records[i], &db->mem_bytes[i], NULL, &read, core->fp) != 0) {
         exit(EXIT_FAILURE);
     } else {
         free(db->mem_records[i]);
@@ -261,18 +267,16 @@ static void depress_parse_rec_to_mem(core_t *core, db_t *db, int32_t i) {
 
     slow5_rec_qts_round(read, (uint8_t) core->lossy);
 
-    struct slow5_press *press_ptr = slow5_press_init(core->press_method);
+    struct slow5_press *press_ptr = press_cache_get(core->press_method);
     if(!press_ptr){
         ERROR("Could not initialize the slow5 compression method%s","");
         exit(EXIT_FAILURE);
     }
     size_t len;
     if ((db->read_record[i].buffer = slow5_rec_to_mem(read, core->fp->header->aux_meta, core->format_out, press_ptr, &len)) == NULL) {
-        slow5_press_free(press_ptr);
         slow5_rec_free(read);
         exit(EXIT_FAILURE);
     }
-    slow5_press_free(press_ptr);
     db->read_record[i].len = len;
     slow5_rec_free(read);
 }
@@ -299,6 +303,8 @@ int degrade_main(int argc, char **argv, struct program_meta *meta) {
         {"to",              required_argument,  NULL, 'T'},
         {"threads",         required_argument,  NULL, 't' },
         {"batchsize",       required_argument, NULL, 'K'},
+        {"max-mem",         required_argument, NULL, 'M'},
+        {"readers",         required_argument, NULL, 'R'},
         {"bits",            required_argument, NULL, 'b'},
         {NULL, 0, NULL, 0}
     };
@@ -332,6 +338,12 @@ int degrade_main(int argc, char **argv, struct program_meta *meta) {
             case 'K':
                 user_opts.arg_batch = optarg;
                 break;
+            case 'M':
+                user_opts.arg_max_mem = optarg;
+                break;
+            case 'R':
+                user_opts.arg_num_readers = optarg;
+                break;
             case 'h':
                 DEBUG("displaying large help message%s","");
                 fprintf(stdout, HELP_LARGE_MSG, argv[0]);
@@ -370,6 +382,14 @@ int degrade_main(int argc, char **argv, struct program_meta *meta) {
         EXIT_MSG(EXIT_FAILURE, argv, meta);
         return EXIT_FAILURE;
     }
+    if(parse_max_mem(&user_opts,argc,argv) < 0){
+        EXIT_MSG(EXIT_FAILURE, argv, meta);
+        return EXIT_FAILURE;
+    }
+    if(parse_num_readers(&user_opts,argc,argv) < 0){
+        EXIT_MSG(EXIT_FAILURE, argv, meta);
+        return EXIT_FAILURE;
+    }
     if(parse_format_args(&user_opts,argc,argv,meta) < 0){
         EXIT_MSG(EXIT_FAILURE, argv, meta);
         return EXIT_FAILURE;
@@ -448,7 +468,7 @@ int degrade_main(int argc, char **argv, struct program_meta *meta) {
 
         // TODO if output is the same format just duplicate file
         slow5_press_method_t press_out = {user_opts.record_press_out,user_opts.signal_press_out};
-        if (slow5_convert_parallel(s5p, user_opts.f_out, (enum slow5_fmt) user_opts.fmt_out, press_out, user_opts.num_threads, user_opts.read_id_batch_capacity, meta, (uint8_t) b, dp) != 0) {
+        if (slow5_convert_parallel(s5p, user_opts.f_out, (enum slow5_fmt) user_opts.fmt_out, press_out, &user_opts, meta, (uint8_t) b, dp) != 0) {
             ERROR("File conversion failed.%s", "");
             view_ret = EXIT_FAILURE;
         }
@@ -488,7 +508,7 @@ err:
     return view_ret;
 }
 
-static int slow5_convert_parallel(struct slow5_file *from, FILE *to_fp, enum slow5_fmt to_format, slow5_press_method_t to_compress, size_t num_threads, int64_t batch_size, struct program_meta *meta, uint8_t b, const struct dataset *d) {
+static int slow5_convert_parallel(struct slow5_file *from, FILE *to_fp, enum slow5_fmt to_format, slow5_press_method_t to_compress, const opt_t *opt, struct program_meta *meta, uint8_t b, const struct dataset *d) {
     if (from == NULL || to_fp == NULL || to_format == SLOW5_FORMAT_UNKNOWN) {
         return -1;
     }
@@ -501,37 +521,78 @@ static int slow5_convert_parallel(struct slow5_file *from, FILE *to_fp, enum slo
     double time_thread_execution = 0;
     double time_write = 0;
     int flag_end_of_file = 0;
+    batch_ctl_t ctl;
+    batch_ctl_init(&ctl, opt, 1);
+    arena_t arena; // per-batch arrays and BLOW5 records, reused across batches
+    arena_init(&arena, 0);
+    range_reader_t *rr = NULL;
+    if (opt->num_readers > 1) {
+        // segments hold at most ctl.batch_size records, which then stays fixed
+        rr = range_reader_init(from, opt->num_readers, ctl.batch_size, ctl.max_bytes);
+        if (rr == NULL) {
+            WARNING("Could not read '%s' with %d readers, reading it sequentially.", from->meta.pathname, opt->num_readers);
+        }
+    }
     while(1) {
 
-        db_t db = { 0 };
-        db.mem_records = (char **) malloc(batch_size * sizeof(char*));
-        db.mem_bytes = (size_t *) malloc(batch_size * sizeof(size_t));
-        MALLOC_CHK(db.mem_records);
-        MALLOC_CHK(db.mem_bytes);
+        rec_batch_t db = { 0 };
+        int64_t batch_size = ctl.batch_size;
+        arena_reset(&arena);
+        db.mem_records = (char **) arena_alloc(&arena, batch_size * sizeof(char*));
+        db.mem_bytes = (size_t *) arena_alloc(&arena, batch_size * sizeof(size_t));
         int64_t record_count = 0;
         size_t bytes;
+        size_t bytes_in = 0;
+        profile_mark_t start;
+        profile_mark(&start);
         char *mem;
         double realtime = slow5_realtime();
-        while (record_count < batch_size) {
-            if (!(mem = (char *) slow5_get_next_mem(&bytes, from))) {
-                if (slow5_errno != SLOW5_ERR_EOF) {
-                    return EXIT_FAILURE;
+        if (rr) {
+            range_batch_t *rb;
+            int rr_ret = range_reader_next(rr, &rb);
+            if (rr_ret < 0) {
+                range_reader_free(rr);
+                arena_free(&arena);
+                return EXIT_FAILURE;
+            } else if (rr_ret == 0) {
+                flag_end_of_file = 1;
+            } else {
+                record_count = rb->n_batch;
+                bytes_in = rb->bytes;
+                memcpy(db.mem_records, rb->mem_records, record_count * sizeof(char*));
+                memcpy(db.mem_bytes, rb->mem_bytes, record_count * sizeof(size_t));
+                range_batch_free(rb);
+            }
+        } else {
+            db.mapped = from->format == SLOW5_FORMAT_BINARY;
+            while (!batch_ctl_full(&ctl, record_count, bytes_in)) {
+                int ret = batch_rec_next(from, &arena, &mem, &bytes);
+                if (ret <= 0) {
+                    if (ret < 0) {
+                        arena_free(&arena);
+                        return EXIT_FAILURE;
+                    } else {
+                        flag_end_of_file = 1;
+                        break;
+                    }
                 } else {
-                    flag_end_of_file = 1;
-                    break;
+                    db.mem_records[record_count] = mem;
+                    db.mem_bytes[record_count] = bytes;
+                    bytes_in += bytes;
+                    record_count++;
                 }
-            } else {
-                db.mem_records[record_count] = mem;
-                db.mem_bytes[record_count] = bytes;
-                record_count++;
             }
         }
         time_get_to_mem += slow5_realtime() - realtime;
+        if (!rr) { // the readers record their own time
+            profile_stage("read", &start, record_count, bytes_in, 0);
+        }
 
         realtime = slow5_realtime();
+        profile_mark(&start);
         // Setup multithreading structures
         core_t core;
-        core.num_thread = num_threads;
+        core.num_thread = opt->num_threads;
         core.fp = from;
         core.format_out = to_format;
         core.press_method = to_compress;
@@ -539,28 +600,35 @@ static int slow5_convert_parallel(struct slow5_file *from, FILE *to_fp, enum slo
         core.param = (void *) d;
 
         db.n_batch = record_count;
-        db.read_record = (raw_record_t*) malloc(record_count * sizeof *db.read_record);
-        MALLOC_CHK(db.read_record);
-        work_db(&core,&db,depress_parse_rec_to_mem);
-        time_thread_execution += slow5_realtime() - realtime;
+        db.read_record = (raw_record_t*) arena_alloc(&arena, record_count * sizeof *db.read_record);
+        work_db(&core,&db,work_fn<rec_batch_t, depress_parse_rec_to_mem>(),db.mem_bytes);
+        double time_batch = slow5_realtime() - realtime;
+        time_thread_execution += time_batch;
+        profile_stage("process", &start, record_count, 0, 0);
 
         realtime = slow5_realtime();
+        profile_mark(&start);
+        size_t bytes_out = 0;
         for (int64_t i = 0; i < record_count; i++) {
             fwrite(db.read_record[i].buffer,1,db.read_record[i].len,to_fp);
+            bytes_out += db.read_record[i].len;
             free(db.read_record[i].buffer);
         }
         time_write += slow5_realtime() - realtime;
-
-        // Free everything
-        free(db.mem_bytes);
-        free(db.mem_records);
-        free(db.read_record);
+        profile_stage("write", &start, record_count, 0, bytes_out);
+        if (!rr) {
+            batch_ctl_update(&ctl, record_count, bytes_in, bytes_out, time_batch);
+        }
 
         if(flag_end_of_file == 1){
             break;
         }
 
     }
+    if (rr) {
+        range_reader_free(rr);
+    }
+    arena_free(&arena);
     if (to_format == SLOW5_FORMAT_BINARY) {
         if (slow5_eof_fwrite(to_fp) == -1) {
             return -2;
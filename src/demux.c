@@ -11,8 +11,11 @@
 #include "error.h"
 #include "khash.h"
 #include "kvec.h"
+#include "reader.h"
 #include "slow5_extra.h"
 #include "thread.h"
+#include "writer.h"
+#include "out_index.h"
 
 extern int slow5tools_verbosity_level;
 
@@ -33,6 +36,16 @@ struct bsum {
     uint16_t rid_pos;      // Read ID column number
 };
 
+struct demux_db {
+    int64_t n_batch;            // Number of records in the batch
+    int64_t cap;                // Number of records the arrays can hold
+    char **mem_records;         // Records from batch_rec_next()
+    size_t *mem_bytes;          // Record sizes
+    arena_t arena;              // Holds the BLOW5 records of the batch
+    raw_record_t *read_record;  // Converted records
+    struct kvec_u16 *rec_codes; // Barcode indices of each record
+};
+
 struct demux_info {
     char **codes;            // Barcode arrangements
     khash_t(svu16) *rid_map; // Hash map of read ID to barcode indices
@@ -50,7 +63,7 @@ static char **paths_spawn(const char *in_path, const char **names,
 static core_t *demux_core_init(struct slow5_file *in,
                                struct slow5_aux_meta *aux_meta,
                                khash_t(svu16) *rid_map, const opt_t *opt);
-static db_t *demux_db_init(int n);
+static struct demux_db *demux_db_init(int64_t n);
 static inline void slow5_hdr_link(const struct slow5_hdr *in_hdr,
                                   struct slow5_hdr *out_hdr, int lossy);
 static inline void slow5_hdr_unlink(struct slow5_hdr *hdr);
@@ -60,10 +73,13 @@ static int bsum_parsehdr(struct bsum *bs);
 static int demux2(struct slow5_file *in, const struct demux_info *d,
                   const opt_t *opt);
 static int demux3(struct slow5_file *in, struct slow5_file **out,
-                  khash_t(svu16) *rid_map, const opt_t *opt);
-static int demux_db_setup(db_t *db, const struct slow5_file *in, int max);
-static int demux_write(struct slow5_file **out, const db_t *db,
-                       const struct kvec_u16 *rec_codes);
+                  out_index_t **oi, uint16_t count, khash_t(svu16) *rid_map,
+                  const opt_t *opt);
+static int demux_db_setup(struct demux_db *db, struct slow5_file *in,
+                          const batch_ctl_t *ctl, size_t *bytes);
+static int demux_write(writer_t **w, out_index_t **oi, uint16_t count,
+                       const struct demux_db *db,
+                       const struct kvec_u16 *rec_codes, size_t *bytes);
 static int extmod(char *path, enum slow5_fmt fmt);
 static int map_su16_getpush(khash_t(su16) *m, char *s, uint16_t *v);
 static int map_su16_getpushdup(khash_t(su16) *m, const char *s, uint16_t *v);
@@ -82,11 +98,11 @@ static struct slow5_file *slow5_birth(const struct slow5_file *in,
                                       const char *path, const opt_t *opt);
 static struct slow5_file **slow5_spawn(const struct slow5_file *in,
                                        const char **names, uint16_t count,
-                                       const opt_t *opt);
+                                       const opt_t *opt, out_index_t **oi);
 static uint8_t *getocc(uint16_t n, const khash_t(svu16) *rid_map);
-static void demux_db_destroy(db_t *db);
+static void demux_db_destroy(struct demux_db *db);
 static void demux_info_destroy(struct demux_info *d);
-static void demux_setup(core_t *core, db_t *db, int i);
+static void demux_setup(core_t *core, struct demux_db *db, int i);
 static void map_svu16_destroy(khash_t(svu16) *m);
 static void underscore_prepend(const char *s, char **out, size_t *n);
 static void vec_chkpush(struct kvec_u16 *v, uint16_t x);
@@ -302,6 +318,7 @@ static core_t *demux_core_init(struct slow5_file *in,
     c->param = (void *) rid_map;
     c->press_method.record_method = opt->record_press_out;
     c->press_method.signal_method = opt->signal_press_out;
+    c->index_out = opt->flag_index;
 
     return c;
 }
@@ -309,22 +326,24 @@ static core_t *demux_core_init(struct slow5_file *in,
 /*
  * Initialise the demultiplexing multi-threading database for n records.
  */
-static db_t *demux_db_init(int n)
+static struct demux_db *demux_db_init(int64_t n)
 {
-    db_t *db;
+    struct demux_db *db;
 
-    db = (db_t *) calloc(1, sizeof (*db));
+    db = (struct demux_db *) calloc(1, sizeof (*db));
     MALLOC_CHK(db);
 
+    db->cap = n;
     db->mem_bytes = (size_t *) malloc(n * sizeof (*db->mem_bytes));
     db->mem_records = (char **) malloc(n * sizeof (*db->mem_records));
     db->read_record = (raw_record_t *) malloc(n * sizeof (*db->read_record));
-    db->read_group_vector = (uint32_t *) malloc(n * sizeof (struct kvec_u16));
+    db->rec_codes = (struct kvec_u16 *) malloc(n * sizeof (*db->rec_codes));
 
     MALLOC_CHK(db->mem_bytes);
     MALLOC_CHK(db->mem_records);
     MALLOC_CHK(db->read_record);
-    MALLOC_CHK(db->read_group_vector);
+    MALLOC_CHK(db->rec_codes);
+    arena_init(&db->arena, 0);
 
     return db;
 }
@@ -449,14 +468,21 @@ static int demux2(struct slow5_file *in, const struct demux_info *d,
 {
     int ret;
     ssize_t n;
+    out_index_t **oi;
     struct slow5_file **out;
     uint16_t i;
 
-    out = slow5_spawn(in, (const char **) d->codes, d->count, opt);
+    oi = NULL;
+    if (opt->flag_index) {
+        oi = (out_index_t **) calloc(d->count, sizeof (*oi));
+        MALLOC_CHK(oi);
+    }
+
+    out = slow5_spawn(in, (const char **) d->codes, d->count, opt, oi);
     if (!out)
         return -1;
 
-    ret = demux3(in, out, d->rid_map, opt);
+    ret = demux3(in, out, oi, d->count, d->rid_map, opt);
     if (ret)
         return -1;
 
@@ -471,49 +497,81 @@ static int demux2(struct slow5_file *in, const struct demux_info *d,
             ret = slow5_close(out[i]);
             if (ret)
                 return -1;
+            // The index goes last, so that it is not older than the file
+            if (oi && oi[i] && out_index_close(oi[i]))
+                return -1;
         }
     }
     free(out);
+    free(oi);
 
     return 0;
 }
 
 /*
- * Demultiplex a slow5 file given the output files, demultiplexing information
- * and user options. Return -1 on error, 0 on success.
+ * Demultiplex a slow5 file given the output files, their indexes (NULL if not
+ * indexing), demultiplexing information and user options.
+ * Return -1 on error, 0 on success.
  */
 static int demux3(struct slow5_file *in, struct slow5_file **out,
-                  khash_t(svu16) *rid_map, const opt_t *opt)
+                  out_index_t **oi, uint16_t count, khash_t(svu16) *rid_map,
+                  const opt_t *opt)
 {
+    batch_ctl_t ctl;
+    profile_mark_t start;
     core_t *core;
-    db_t *db;
+    struct demux_db *db;
+    writer_t **w;
+    double t;
     int iseof;
     int ret;
     khint_t n;
-    struct kvec_u16 *rec_codes;
+    size_t in_bytes;
+    size_t out_bytes;
     uint16_t i;
 
+    w = (writer_t **) calloc(count, sizeof (*w));
+    MALLOC_CHK(w);
+    for (i = 0; i < count; i++) {
+        if (out[i]) {
+            w[i] = writer_init(out[i]->fp, opt->write_buf, opt->flag_direct);
+            if (!w[i])
+                return -1;
+        }
+    }
+
     for (i = 0; !out[i]; i++); // Get the first non-NULL output file
 
     core = demux_core_init(in, out[i]->header->aux_meta, rid_map, opt);
-    db = demux_db_init(opt->read_id_batch_capacity);
-    rec_codes = (struct kvec_u16 *) db->read_group_vector;
+    batch_ctl_init(&ctl, opt, 1);
+    db = demux_db_init(ctl.batch_size);
 
     iseof = 0;
     n = 0;
     while (!iseof) {
-        ret = demux_db_setup(db, in, opt->read_id_batch_capacity);
+        profile_mark(&start);
+        ret = demux_db_setup(db, in, &ctl, &in_bytes);
         if (ret == 1)
             iseof = 1;
         else if (ret == -1)
             return -1;
+        profile_stage("read", &start, db->n_batch, in_bytes, 0);
 
-        work_db(core, db, demux_setup);
+        profile_mark(&start);
+        t = slow5_realtime();
+        work_db(core, db, work_fn<struct demux_db, demux_setup>(),
+                db->mem_bytes);
+        t = slow5_realtime() - t;
         n += db->n_batch;
+        profile_stage("process", &start, db->n_batch, 0, 0);
 
-        ret = demux_write(out, db, rec_codes);
+        profile_mark(&start);
+        ret = demux_write(w, oi, count, db, db->rec_codes, &out_bytes);
         if (ret)
             return -1;
+        profile_stage("write", &start, db->n_batch, 0, out_bytes);
+
+        batch_ctl_update(&ctl, db->n_batch, in_bytes, out_bytes, t);
     }
 
     if (n < kh_size(rid_map)) {
@@ -521,6 +579,11 @@ static int demux3(struct slow5_file *in, struct slow5_file **out,
         return -1;
     }
 
+    for (i = 0; i < count; i++) {
+        if (w[i] && writer_close(w[i]))
+            return -1;
+    }
+    free(w);
     free(core);
     demux_db_destroy(db);
 
@@ -528,57 +591,99 @@ static int demux3(struct slow5_file *in, struct slow5_file **out,
 }
 
 /*
- * Store the next max records in the demultiplexing multi-threading database.
- * Return -1 on error, 0 on success, 1 on end of file.
+ * Store the next batch of records, as sized by the batch controller, in the
+ * demultiplexing multi-threading database. Set *bytes to the total size of the
+ * records read. Return -1 on error, 0 on success, 1 on end of file.
  */
-static int demux_db_setup(db_t *db, const struct slow5_file *in, int max)
+static int demux_db_setup(struct demux_db *db, struct slow5_file *in,
+                          const batch_ctl_t *ctl, size_t *bytes)
 {
     char *mem;
-    int n;
+    int64_t n;
     int ret;
     size_t len;
 
+    if (ctl->batch_size > db->cap) {
+        db->cap = ctl->batch_size;
+        db->mem_bytes = (size_t *) realloc(db->mem_bytes,
+                                           db->cap * sizeof (*db->mem_bytes));
+        db->mem_records = (char **) realloc(db->mem_records,
+                                            db->cap * sizeof (*db->mem_records));
+        db->read_record = (raw_record_t *) realloc(db->read_record,
+                                                   db->cap * sizeof (*db->read_record));
+        db->rec_codes = (struct kvec_u16 *) realloc(db->rec_codes,
+                                                    db->cap * sizeof (*db->rec_codes));
+        MALLOC_CHK(db->mem_bytes);
+        MALLOC_CHK(db->mem_records);
+        MALLOC_CHK(db->read_record);
+        MALLOC_CHK(db->rec_codes);
+    }
+
+    arena_reset(&db->arena);
     n = 0;
     ret = 0;
-    while (!ret && n < max) {
-        mem = (char *) slow5_get_next_mem(&len, in);
-        if (!mem) {
-            if (slow5_errno == SLOW5_ERR_EOF)
-                ret = 1;
-            else
-                ret = -1;
+    *bytes = 0;
+    while (!ret && !batch_ctl_full(ctl, n, *bytes)) {
+        ret = batch_rec_next(in, &db->arena, &mem, &len);
+        if (ret <= 0) {
+            ret = ret ? -1 : 1;
         } else {
+            ret = 0;
             db->mem_records[n] = mem;
             db->mem_bytes[n] = len;
+            *bytes += len;
             n++;
         }
     }
-    db->n_batch = (int64_t) n;
+    db->n_batch = n;
 
     return ret;
 }
 
 /*
- * Write the demultiplexing multi-threading database records to their
- * corresponding barcode files. Return -1 on error, 0 on success.
+ * Write the demultiplexing multi-threading database records to the writers
+ * of their corresponding barcode files, of which there are count, and add
+ * them to the indexes of those files if oi is not NULL. Set *bytes to the
+ * total size written. Return -1 on error, 0 on success.
  */
-static int demux_write(struct slow5_file **out, const db_t *db,
-                       const struct kvec_u16 *rec_codes)
+static int demux_write(writer_t **w, out_index_t **oi, uint16_t count,
+                       const struct demux_db *db,
+                       const struct kvec_u16 *rec_codes, size_t *bytes)
 {
+    char *rid;
     int i;
     size_t len;
+    uint64_t off;
+    uint16_t c;
     uint16_t j;
 
+    *bytes = 0;
     for (i = 0; i < (int) db->n_batch; i++) {
+        len = db->read_record[i].len;
         for (j = 0; j < kv_size(rec_codes[i]); j++) {
-            len = fwrite(db->read_record[i].buffer, 1, db->read_record[i].len,
-                         out[kv_A(rec_codes[i], j)]->fp);
-            if (len != (size_t) db->read_record[i].len) {
+            c = kv_A(rec_codes[i], j);
+            off = writer_tell(w[c]);
+            if (writer_add(w[c], db->read_record[i].buffer, len)) {
                 ERROR("Failed to write slow5 record%s", "");
                 return -1;
             }
+            if (oi) {
+                rid = strdup(db->read_record[i].read_id);
+                MALLOC_CHK(rid);
+                out_index_add(oi[c], rid, off, len);
+            }
+            *bytes += len;
         }
+    }
+    // A record may go to several files, free it once all are written
+    for (j = 0; j < count; j++) {
+        if (w[j] && writer_flush(w[j]))
+            return -1;
+    }
+    for (i = 0; i < (int) db->n_batch; i++) {
         free(db->read_record[i].buffer);
+        if (oi)
+            free(db->read_record[i].read_id);
     }
     return 0;
 }
@@ -978,11 +1083,12 @@ static struct slow5_file *slow5_birth(const struct slow5_file *in,
 
 /*
  * Shallow copy the skeleton of a slow5 file to count new paths appended with an
- * underscore and name before its extension. Return NULL on error.
+ * underscore and name before its extension. If oi is not NULL, also start the
+ * index of each new file in it. Return NULL on error.
  */
 static struct slow5_file **slow5_spawn(const struct slow5_file *in,
                                        const char **names, uint16_t count,
-                                       const opt_t *opt)
+                                       const opt_t *opt, out_index_t **oi)
 {
     char **paths;
     int ret;
@@ -1003,6 +1109,8 @@ static struct slow5_file **slow5_spawn(const struct slow5_file *in,
     for (i = 0; i < count; i++) {
         if (paths[i]) {
             out[i] = slow5_birth(in, paths[i], opt);
+            if (out[i] && oi)
+                oi[i] = out_index_init(paths[i], out[i]->header->version);
             free(paths[i]);
             if (!out[i])
                 return NULL;
@@ -1049,12 +1157,13 @@ static uint8_t *getocc(uint16_t n, const khash_t(svu16) *rid_map)
 /*
  * Free the demultiplexing multi-threading database.
  */
-static void demux_db_destroy(db_t *db)
+static void demux_db_destroy(struct demux_db *db)
 {
     free(db->mem_bytes);
     free(db->mem_records);
     free(db->read_record);
-    free(db->read_group_vector);
+    free(db->rec_codes);
+    arena_free(&db->arena);
     free(db);
 }
 
@@ -1077,7 +1186,7 @@ static void demux_info_destroy(struct demux_info *d)
  * Decompress, parse and convert the record at index i to the desired output
  * format.
  */
-static void demux_setup(core_t *core, db_t *db, int i)
+static void demux_setup(core_t *core, struct demux_db *db, int i)
 {
     const khash_t(svu16) *rid_map;
     int ret;
@@ -1088,14 +1197,19 @@ static void demux_setup(core_t *core, db_t *db, int i)
     struct slow5_rec *rec;
 
     rec = NULL;
-    ret = slow5_rec_depress_parse(db->mem_records + i, db->mem_bytes + i, NULL,
-                                  &rec, core->fp);
-    free(db->mem_records[i]);
+    if (core->fp->format == SLOW5_FORMAT_BINARY) { // In the batch arena
+        ret = mmap_rec_depress_parse(db->mem_records[i], db->mem_bytes[i],
+                                     &rec, core->fp);
+    } else {
+        ret = slow5_rec_depress_parse(db->mem_records + i, db->mem_bytes + i,
+                                      NULL, &rec, core->fp);
+        free(db->mem_records[i]);
+    }
     if (ret)
         exit(EXIT_FAILURE);
 
     rid_map = (const khash_t(svu16) *) core->param;
-    rec_codes = (struct kvec_u16 *) db->read_group_vector;
+    rec_codes = db->rec_codes;
 
     k = kh_get(svu16, rid_map, rec->read_id);
     if (k == kh_end(rid_map)) {
@@ -1106,7 +1220,7 @@ static void demux_setup(core_t *core, db_t *db, int i)
     } else {
         rec_codes[i] = kh_val(rid_map, k);
 
-        press = slow5_press_init(core->press_method);
+        press = press_cache_get(core->press_method);
         if (!press)
             exit(EXIT_FAILURE);
         db->read_record[i].buffer = slow5_rec_to_mem(rec, core->aux_meta,
@@ -1115,7 +1229,10 @@ static void demux_setup(core_t *core, db_t *db, int i)
         if (!db->read_record[i].buffer)
             exit(EXIT_FAILURE);
         db->read_record[i].len = (int) len; // TODO should be size_t or uint32_t
-        slow5_press_free(press);
+        if (core->index_out) {
+            db->read_record[i].read_id = strdup(rec->read_id);
+            MALLOC_CHK(db->read_record[i].read_id);
+        }
     }
     slow5_rec_free(rec);
 }
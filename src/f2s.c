@@ -37,6 +37,7 @@
     HELP_MSG_LOSSLESS \
     HELP_MSG_CONTINUE_F2S \
     HELP_MSG_RETAIN_DIR_STRUCTURE \
+    HELP_MSG_INDEX_OUT \
     HELP_MSG_HELP \
     HELP_FORMATS_METHODS
 
@@ -48,6 +49,8 @@ void f2s_child_worker(opt_t *user_opts, std::vector<std::string>& fast5_files, r
     static size_t call_count = 0;
     slow5_file_t* slow5File = NULL;
     slow5_file_t* slow5File_outputdir_single_fast5 = NULL;
+    out_index_t *out_index = NULL;
+    out_index_t *out_index_outputdir_single_fast5 = NULL;
     FILE *slow5_file_pointer = NULL;
     FILE *slow5_file_pointer_outputdir_single_fast5 = NULL;
     std::string slow5_path;
@@ -111,7 +114,10 @@ void f2s_child_worker(opt_t *user_opts, std::vector<std::string>& fast5_files, r
                     ERROR("%s","Could not initialise the SLOW5 header.");
                     exit(EXIT_FAILURE);
                 }
-                ret = read_fast5(user_opts, &fast5_file, slow5File, 0, &warning_map);
+                if(user_opts->flag_index){
+                    out_index = out_index_init(slow5_path.c_str(), slow5File->header->version);
+                }
+                ret = read_fast5(user_opts, &fast5_file, slow5File, out_index, 0, &warning_map);
                 if(ret < 0){
                     ERROR("Bad fast5: Could not read contents of the fast5 file '%s'.", fast5_files[i].c_str());
                     exit(EXIT_FAILURE);
@@ -123,6 +129,12 @@ void f2s_child_worker(opt_t *user_opts, std::vector<std::string>& fast5_files, r
                     }
                 }
                 slow5_close(slow5File);
+                if(out_index){
+                    if(out_index_close(out_index) != 0){
+                        exit(EXIT_FAILURE);
+                    }
+                    out_index = NULL;
+                }
                 slow5_path = std::string(output_dir);
 
             }else{ // single-fast5
@@ -145,8 +157,11 @@ void f2s_child_worker(opt_t *user_opts, std::vector<std::string>& fast5_files, r
                         ERROR("%s","Could not initialise the SLOW5 header.");
                         exit(EXIT_FAILURE);
                     }
+                    if(user_opts->flag_index){
+                        out_index_outputdir_single_fast5 = out_index_init(slow5_path_outputdir_single_fast5.c_str(), slow5File_outputdir_single_fast5->header->version);
+                    }
                 }
-                ret = read_fast5(user_opts, &fast5_file, slow5File_outputdir_single_fast5, call_count++, &warning_map);
+                ret = read_fast5(user_opts, &fast5_file, slow5File_outputdir_single_fast5, out_index_outputdir_single_fast5, call_count++, &warning_map);
                 if(ret<0){
                     ERROR("Could not read contents of the fast5 file '%s'.", fast5_files[i].c_str());
                     exit(EXIT_FAILURE);
@@ -180,8 +195,11 @@ void f2s_child_worker(opt_t *user_opts, std::vector<std::string>& fast5_files, r
                     ERROR("%s","Could not initialise the SLOW5 header.");
                     exit(EXIT_FAILURE);
                 }
+                if(user_opts->flag_index){
+                    out_index = out_index_init(slow5_path.c_str(), slow5File->header->version);
+                }
             }
-            ret = read_fast5(user_opts, &fast5_file, slow5File, call_count++, &warning_map);
+            ret = read_fast5(user_opts, &fast5_file, slow5File, out_index, call_count++, &warning_map);
             if(ret<0){
                 ERROR("Could not read contents of the fast5 file '%s'.", fast5_files[i].c_str());
                 exit(EXIT_FAILURE);
@@ -198,6 +216,9 @@ void f2s_child_worker(opt_t *user_opts, std::vector<std::string>& fast5_files, r
             }
         }
         slow5_close(slow5File_outputdir_single_fast5);
+        if(out_index_outputdir_single_fast5 && out_index_close(out_index_outputdir_single_fast5) != 0){
+            exit(EXIT_FAILURE);
+        }
     }
     if(slow5File && !output_dir) {
         if(user_opts->fmt_out == SLOW5_FORMAT_BINARY){
@@ -207,6 +228,9 @@ void f2s_child_worker(opt_t *user_opts, std::vector<std::string>& fast5_files, r
             }
         }
         slow5_close(slow5File); //if stdout was used stdout is now closed.
+        if(out_index && out_index_close(out_index) != 0){
+            exit(EXIT_FAILURE);
+        }
     }
     INFO("Summary - total fast5: %lu, bad fast5: %lu", readsCount->total_5, readsCount->bad_5_file);
 }
@@ -336,6 +360,7 @@ int f2s_main(int argc, char **argv, struct program_meta *meta) {
             {"allow",       no_argument,       NULL, 'a'},  //8
             {"retain",      no_argument,       NULL,  0 },  //9
             {"dump-all",    required_argument, NULL,  0 },  //10
+            {"index",       no_argument,       NULL,  0 },  //11
             {NULL, 0, NULL, 0 }
     };
 
@@ -388,6 +413,9 @@ int f2s_main(int argc, char **argv, struct program_meta *meta) {
                     case 10:
                         user_opts.arg_dump_all = optarg;
                         break;
+                    case 11:
+                        user_opts.flag_index = 1;
+                        break;
                     default:
                         fprintf(stderr, HELP_SMALL_MSG, argv[0]);
                         EXIT_MSG(EXIT_FAILURE, argv, meta);
@@ -428,6 +456,10 @@ int f2s_main(int argc, char **argv, struct program_meta *meta) {
         ERROR("Both output file name (-o) and output directory (-d) cannot be set simultaneously. %s","");
         return EXIT_FAILURE;
     }
+    if(user_opts.flag_index && !user_opts.arg_fname_out && !user_opts.arg_dir_out){
+        ERROR("--index needs an output file (-o) or directory (-d)%s", "");
+        return EXIT_FAILURE;
+    }
 
     // Check for remaining files to parse
     if (optind >= argc) {
@@ -0,0 +1,361 @@
+/**
+ * @file filter.c
+ * @brief record filter expressions (--filter) compiled against a header
+ * @author Hasindu Gamaarachchi (hasindu@garvan.org.au)
+ * @date 17/10/2026
+ */
+#include <ctype.h>
+#include <math.h>
+#include <string>
+#include <vector>
+#include "filter.h"
+#include "error.h"
+
+extern int slow5tools_verbosity_level;
+
+enum { FILTER_OR, FILTER_AND, FILTER_NOT, FILTER_CMP };
+enum { FILTER_EQ, FILTER_NE, FILTER_LT, FILTER_LE, FILTER_GT, FILTER_GE };
+
+/* the field of a comparison */
+enum {
+    FILTER_READ_ID,
+    FILTER_READ_GROUP,
+    FILTER_DIGITISATION,
+    FILTER_OFFSET,
+    FILTER_RANGE,
+    FILTER_SAMPLING_RATE,
+    FILTER_LEN_RAW_SIGNAL,
+    FILTER_AUX,
+};
+
+static const char *filter_primary_fields[FILTER_AUX] = {"read_id", "read_group", "digitisation", "offset", "range", "sampling_rate", "len_raw_signal"};
+
+typedef struct {
+    int type;                   // FILTER_OR, FILTER_AND, FILTER_NOT or FILTER_CMP
+    int a;                      // operands of FILTER_OR, FILTER_AND and FILTER_NOT
+    int b;
+    int field;                  // of FILTER_CMP
+    std::string aux;            // name of the aux field
+    enum slow5_aux_type aux_type;
+    int op;
+    int is_str;                 // the field and value are compared as strings
+    long double num;            // the value, for a number or an enum label (its index)
+    std::string str;            // the value, for a string
+} filter_node_t;
+
+struct filter {
+    std::vector<filter_node_t> nodes;
+    int root;
+    std::vector<uint8_t> need_aux;
+};
+
+typedef struct {
+    const char *expr;
+    size_t pos;
+    const struct slow5_file *sp;
+    filter_t *f;
+    std::string err;            // what is wrong at pos
+} filter_parser_t;
+
+static void filter_skip_space(filter_parser_t *p) {
+    while (isspace((unsigned char) p->expr[p->pos])) {
+        p->pos++;
+    }
+}
+
+/* take token if the expression continues with it */
+static int filter_match(filter_parser_t *p, const char *token) {
+    filter_skip_space(p);
+    size_t n = strlen(token);
+    if (strncmp(p->expr + p->pos, token, n) != 0) {
+        return 0;
+    }
+    p->pos += n;
+    return 1;
+}
+
+static int filter_fail(filter_parser_t *p, const std::string &err) {
+    if (p->err.empty()) {
+        p->err = err;
+    }
+    return -1;
+}
+
+static int filter_add(filter_parser_t *p, int type, int a, int b) {
+    filter_node_t node = filter_node_t();
+    node.type = type;
+    node.a = a;
+    node.b = b;
+    p->f->nodes.push_back(node);
+    return p->f->nodes.size() - 1;
+}
+
+/* a quoted value, or the characters up to a space, parenthesis or operator */
+static int filter_value(filter_parser_t *p, std::string *value) {
+    filter_skip_space(p);
+    char c = p->expr[p->pos];
+    if (c == '\'' || c == '"') {
+        const char *end = strchr(p->expr + p->pos + 1, c);
+        if (end == NULL) {
+            return filter_fail(p, "unterminated quote");
+        }
+        value->assign(p->expr + p->pos + 1, end);
+        p->pos = end + 1 - p->expr;
+        return 0;
+    }
+    size_t start = p->pos;
+    while (p->expr[p->pos] != '\0' && !isspace((unsigned char) p->expr[p->pos]) && !strchr("()&|!<>=", p->expr[p->pos])) {
+        p->pos++;
+    }
+    if (p->pos == start) {
+        return filter_fail(p, "expected a value");
+    }
+    value->assign(p->expr + start, p->pos - start);
+    return 0;
+}
+
+static int filter_parse_cmp(filter_parser_t *p) {
+    filter_skip_space(p);
+    size_t start = p->pos;
+    while (isalnum((unsigned char) p->expr[p->pos]) || p->expr[p->pos] == '_') {
+        p->pos++;
+    }
+    if (p->pos == start) {
+        return filter_fail(p, "expected a field");
+    }
+    filter_node_t node;
+    node.type = FILTER_CMP;
+    node.a = node.b = -1;
+    node.aux_type = SLOW5_INT8_T;
+    node.is_str = 0;
+    node.num = 0;
+    std::string name(p->expr + start, p->pos - start);
+
+    node.field = 0;
+    while (node.field < FILTER_AUX && name != filter_primary_fields[node.field]) {
+        node.field++;
+    }
+    struct slow5_aux_meta *aux_meta = p->sp->header->aux_meta;
+    if (node.field == FILTER_AUX) {
+        uint32_t i = 0;
+        while (aux_meta && i < aux_meta->num && name != aux_meta->attrs[i]) {
+            i++;
+        }
+        if (name == "raw_signal") {
+            p->pos = start;
+            return filter_fail(p, "'raw_signal' cannot be compared");
+        }
+        if (aux_meta == NULL || i == aux_meta->num) {
+            p->pos = start;
+            return filter_fail(p, "'" + name + "' is not a field of the file");
+        }
+        node.aux = name;
+        node.aux_type = aux_meta->types[i];
+        if (SLOW5_IS_PTR(node.aux_type) && node.aux_type != SLOW5_STRING) {
+            p->pos = start;
+            return filter_fail(p, "'" + name + "' is an array, which cannot be compared");
+        }
+        p->f->need_aux[i] = 1;
+        node.is_str = node.aux_type == SLOW5_STRING || node.aux_type == SLOW5_CHAR;
+    } else {
+        node.is_str = node.field == FILTER_READ_ID;
+    }
+
+    // the two character operators first
+    static const char *ops[] = {"==", "!=", "<=", ">=", "<", ">"};
+    static const int op_codes[] = {FILTER_EQ, FILTER_NE, FILTER_LE, FILTER_GE, FILTER_LT, FILTER_GT};
+    int k = 0;
+    while (k < 6 && !filter_match(p, ops[k])) {
+        k++;
+    }
+    if (k == 6) {
+        return filter_fail(p, "expected a comparison after '" + name + "'");
+    }
+    node.op = op_codes[k];
+    if ((node.is_str || node.aux_type == SLOW5_ENUM) && node.op != FILTER_EQ && node.op != FILTER_NE) {
+        return filter_fail(p, "'" + name + "' can only be compared with == and !=");
+    }
+
+    size_t value_pos = p->pos;
+    if (filter_value(p, &node.str) != 0) {
+        return -1;
+    }
+    if (node.field == FILTER_AUX && node.aux_type == SLOW5_ENUM) {
+        uint8_t num_labels = 0;
+        char **labels = slow5_get_aux_enum_labels(p->sp->header, name.c_str(), &num_labels);
+        int j = 0;
+        while (labels && j < num_labels && node.str != labels[j]) {
+            j++;
+        }
+        if (labels == NULL || j == num_labels) {
+            p->pos = value_pos;
+            return filter_fail(p, "'" + node.str + "' is not a label of '" + name + "'");
+        }
+        node.num = j;
+    } else if (!node.is_str) {
+        char *end = NULL;
+        node.num = strtold(node.str.c_str(), &end);
+        if (end == node.str.c_str() || *end != '\0') {
+            p->pos = value_pos;
+            return filter_fail(p, "'" + node.str + "' is not a number");
+        }
+    }
+    p->f->nodes.push_back(node);
+    return p->f->nodes.size() - 1;
+}
+
+static int filter_parse_or(filter_parser_t *p);
+
+static int filter_parse_unary(filter_parser_t *p) {
+    filter_skip_space(p);
+    if (p->expr[p->pos] == '!' && p->expr[p->pos + 1] != '=') {
+        p->pos++;
+        int a = filter_parse_unary(p);
+        return a < 0 ? -1 : filter_add(p, FILTER_NOT, a, -1);
+    }
+    if (filter_match(p, "(")) {
+        int a = filter_parse_or(p);
+        if (a < 0) {
+            return -1;
+        }
+        if (!filter_match(p, ")")) {
+            return filter_fail(p, "expected ')'");
+        }
+        return a;
+    }
+    return filter_parse_cmp(p);
+}
+
+static int filter_parse_and(filter_parser_t *p) {
+    int a = filter_parse_unary(p);
+    while (a >= 0 && filter_match(p, "&&")) {
+        int b = filter_parse_unary(p);
+        a = b < 0 ? -1 : filter_add(p, FILTER_AND, a, b);
+    }
+    return a;
+}
+
+static int filter_parse_or(filter_parser_t *p) {
+    int a = filter_parse_and(p);
+    while (a >= 0 && filter_match(p, "||")) {
+        int b = filter_parse_and(p);
+        a = b < 0 ? -1 : filter_add(p, FILTER_OR, a, b);
+    }
+    return a;
+}
+
+filter_t *filter_init(const char *expr, const struct slow5_file *sp) {
+    filter_t *f = new filter_t();
+    struct slow5_aux_meta *aux_meta = sp->header->aux_meta;
+    f->need_aux.assign((aux_meta ? aux_meta->num : 0) + 1, 0);
+
+    filter_parser_t p;
+    p.expr = expr;
+    p.pos = 0;
+    p.sp = sp;
+    p.f = f;
+    f->root = filter_parse_or(&p);
+    filter_skip_space(&p);
+    if (f->root >= 0 && p.expr[p.pos] != '\0') {
+        f->root = filter_fail(&p, "unexpected '" + std::string(p.expr + p.pos) + "'");
+    }
+    if (f->root < 0) {
+        ERROR("Invalid filter '%s': %s at character %zu.", expr, p.err.c_str(), p.pos + 1);
+        delete f;
+        return NULL;
+    }
+    return f;
+}
+
+const uint8_t *filter_need_aux(const filter_t *f) {
+    return f->need_aux.data();
+}
+
+/* the value of the numeric field of node in rec; 0 if rec does not have it */
+static int filter_num(const filter_node_t *node, const struct slow5_rec *rec, long double *x) {
+    int err = 0;
+    const char *name = node->aux.c_str();
+    switch (node->field) {
+        case FILTER_READ_GROUP: *x = rec->read_group; return 1;
+        case FILTER_DIGITISATION: *x = rec->digitisation; return !isnan(rec->digitisation);
+        case FILTER_OFFSET: *x = rec->offset; return !isnan(rec->offset);
+        case FILTER_RANGE: *x = rec->range; return !isnan(rec->range);
+        case FILTER_SAMPLING_RATE: *x = rec->sampling_rate; return !isnan(rec->sampling_rate);
+        case FILTER_LEN_RAW_SIGNAL: *x = rec->len_raw_signal; return 1;
+    }
+#define FILTER_AUX_NUM(type, get, is_null) { \
+        type v = get(rec, name, &err); \
+        if (err != 0 || (is_null)) { \
+            return 0; \
+        } \
+        *x = v; \
+        return 1; \
+    }
+    switch (node->aux_type) {
+        case SLOW5_INT8_T: FILTER_AUX_NUM(int8_t, slow5_aux_get_int8, v == SLOW5_INT8_T_NULL)
+        case SLOW5_INT16_T: FILTER_AUX_NUM(int16_t, slow5_aux_get_int16, v == SLOW5_INT16_T_NULL)
+        case SLOW5_INT32_T: FILTER_AUX_NUM(int32_t, slow5_aux_get_int32, v == SLOW5_INT32_T_NULL)
+        case SLOW5_INT64_T: FILTER_AUX_NUM(int64_t, slow5_aux_get_int64, v == SLOW5_INT64_T_NULL)
+        case SLOW5_UINT8_T: FILTER_AUX_NUM(uint8_t, slow5_aux_get_uint8, v == SLOW5_UINT8_T_NULL)
+        case SLOW5_UINT16_T: FILTER_AUX_NUM(uint16_t, slow5_aux_get_uint16, v == SLOW5_UINT16_T_NULL)
+        case SLOW5_UINT32_T: FILTER_AUX_NUM(uint32_t, slow5_aux_get_uint32, v == SLOW5_UINT32_T_NULL)
+        case SLOW5_UINT64_T: FILTER_AUX_NUM(uint64_t, slow5_aux_get_uint64, v == SLOW5_UINT64_T_NULL)
+        case SLOW5_FLOAT: FILTER_AUX_NUM(float, slow5_aux_get_float, isnan(v))
+        case SLOW5_DOUBLE: FILTER_AUX_NUM(double, slow5_aux_get_double, isnan(v))
+        case SLOW5_ENUM: FILTER_AUX_NUM(uint8_t, slow5_aux_get_enum, v == SLOW5_ENUM_NULL)
+        default: return 0;
+    }
+#undef FILTER_AUX_NUM
+}
+
+static int filter_eval(const filter_t *f, int n, const struct slow5_rec *rec) {
+    const filter_node_t *node = &f->nodes[n];
+    switch (node->type) {
+        case FILTER_OR: return filter_eval(f, node->a, rec) || filter_eval(f, node->b, rec);
+        case FILTER_AND: return filter_eval(f, node->a, rec) && filter_eval(f, node->b, rec);
+        case FILTER_NOT: return !filter_eval(f, node->a, rec);
+    }
+
+    if (node->is_str) {
+        const char *str = NULL;
+        uint64_t len = 0;
+        int err = 0;
+        char c;
+        if (node->field == FILTER_READ_ID) {
+            str = rec->read_id;
+            len = strlen(str);
+        } else if (node->aux_type == SLOW5_CHAR) {
+            c = slow5_aux_get_char(rec, node->aux.c_str(), &err);
+            str = c == SLOW5_CHAR_NULL ? NULL : &c;
+            len = 1;
+        } else {
+            str = slow5_aux_get_string(rec, node->aux.c_str(), &len, &err);
+        }
+        if (err != 0 || str == NULL) {
+            return 0;
+        }
+        int eq = len == node->str.size() && memcmp(str, node->str.data(), len) == 0;
+        return node->op == FILTER_EQ ? eq : !eq;
+    }
+
+    long double x;
+    if (!filter_num(node, rec, &x)) {
+        return 0;
+    }
+    switch (node->op) {
+        case FILTER_EQ: return x == node->num;
+        case FILTER_NE: return x != node->num;
+        case FILTER_LT: return x < node->num;
+        case FILTER_LE: return x <= node->num;
+        case FILTER_GT: return x > node->num;
+        default: return x >= node->num;
+    }
+}
+
+int filter_pass(const filter_t *f, const struct slow5_rec *rec) {
+    return filter_eval(f, f->root, rec);
+}
+
+void filter_free(filter_t *f) {
+    delete f;
+}
@@ -0,0 +1,28 @@
+// record filter expressions (--filter) compiled against the header of a file
+
+#ifndef FILTER_H
+#define FILTER_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <slow5/slow5.h>
+
+/*
+ * An expression is comparisons of a field with a value, combined with &&, || and ! and grouped with
+ * parentheses, e.g. 'len_raw_signal>4000 && (end_reason==signal_positive || read_group!=0)'.
+ * A field is a primary field other than raw_signal, or an aux field of the header that is not an array.
+ * Numbers compare with ==, !=, <, <=, > and >=; read_id, strings, chars and enum labels with == and !=.
+ * A value with spaces or operator characters is quoted with ' or ". A record missing the field (a '.'
+ * in SLOW5) fails every comparison with it.
+ */
+typedef struct filter filter_t;
+
+/* compile expr against the header of sp; prints what is wrong and returns NULL if it is not valid */
+filter_t *filter_init(const char *expr, const struct slow5_file *sp);
+/* a flag per aux field of the header, in its order: whether the filter reads it (see lazy_rec_depress_parse()) */
+const uint8_t *filter_need_aux(const filter_t *f);
+/* whether rec passes; rec needs its primary fields and the aux fields of filter_need_aux(). Safe from any thread */
+int filter_pass(const filter_t *f, const struct slow5_rec *rec);
+void filter_free(filter_t *f);
+
+#endif
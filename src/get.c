@@ -6,13 +6,21 @@
  */
 #include <getopt.h>
 #include <stdio.h>
+#include <unistd.h>
+#include <inttypes.h>
+#include <algorithm>
+#include <string>
 
 #include <slow5/slow5.h>
 #include "thread.h"
+#include "reader.h"
+#include "index_map.h"
 #include "cmd.h"
 #include "misc.h"
 
 #define READ_ID_INIT_CAPACITY (128)
+#define GET_COALESCE_GAP (1 << 16) //records at most this many bytes apart are fetched with one read
+#define GET_EXTENT_MAX (1 << 22) //bytes fetched with one read, unless a single record is larger
 
 #define USAGE_MSG "Usage: %s [OPTIONS] [SLOW5_FILE] [READ_ID]...\n"
 #define HELP_LARGE_MSG \
@@ -26,6 +34,7 @@
     HELP_MSG_PRESS \
     HELP_MSG_THREADS \
     HELP_MSG_BATCH \
+    HELP_MSG_MMAP \
     "    -l --list [FILE]              list of read ids provided as a single-column text file with one read id per line.\n" \
     "    --skip                        warn and continue if a read_id was not found.\n" \
     "    --index [FILE]                path to a custom slow5 index (experimental).\n" \
@@ -34,65 +43,212 @@
 
 extern int slow5tools_verbosity_level;
 
-void work_per_single_read_get(core_t *core, db_t *db, int32_t i) {
-
-    char *id = db->read_id[i];
-
-    int len = 0;
-    //fprintf(stderr, "Fetching %s\n", id); // TODO print here or during ordered loop later?
-    slow5_rec_t *record=NULL;
-
-    len = slow5_get(id,&record,core->fp);
+/* a batch of read ids to be fetched */
+typedef struct {
+    int64_t n_batch;    // number of records in this batch
+    int64_t n_err;      // number of errors in this batch
+    char **read_id;     // the list of read ids (input)
+    raw_record_t *read_record; // the list of fetched records (output)
+    struct slow5_rec_idx *rec_idx; // where each record is in the file; size 0 if the read id is not in the index
+    int64_t *order;     // the records in ascending file offset
+} get_batch_t;
+
+/* records close together in the file, fetched with a single read */
+typedef struct {
+    uint64_t offset;    // of the first record
+    uint64_t size;      // bytes up to the end of the last record
+    int64_t first;      // the first record of the extent in get_batch_t::order
+    int64_t n;          // number of records
+} get_extent_t;
+
+/* the extents of a get_batch_t, each fetched by one thread */
+typedef struct {
+    int64_t n_batch;    // number of extents
+    get_extent_t *extent;
+    size_t *cost;       // bytes of each extent, to balance the threads
+    get_batch_t *db;
+} get_fetch_t;
+
+/* where the record of read_id is in the file, from the sorted index if there is one */
+static int get_lookup(core_t *core, const char *read_id, struct slow5_rec_idx *rec_idx) {
+    if (core->im) {
+        return index_map_get(core->im, read_id, rec_idx);
+    }
+    khash_t(slow5_s2i) *hash = core->fp->index->hash;
+    khint_t k = kh_get(slow5_s2i, hash, read_id);
+    if (k == kh_end(hash)) {
+        return -1;
+    }
+    *rec_idx = kh_value(hash, k);
+    return 0;
+}
 
-    if (record == NULL || len < 0) {
-        ++ db->n_err;
-        db->read_record[i].buffer = NULL;
-        db->read_record[i].len = -1;
-    }else {
-        if (core->benchmark == false){
-            size_t record_size;
-            struct slow5_press* compress = slow5_press_init(core->press_method);
-            if(!compress){
-                ERROR("Could not initialize the slow5 compression method%s","");
-                exit(EXIT_FAILURE);
+/*
+ * Looks up the records of db in the index and groups them in ascending file offset into extents
+ * of records at most GET_COALESCE_GAP bytes apart, so that random read ids are fetched with a
+ * forward sweep of the file and neighbouring records with one read. Returns the number of bytes
+ * the extents span.
+ */
+static uint64_t get_schedule(core_t *core, get_batch_t *db, get_fetch_t *fetch) {
+    int64_t n = 0;
+    for (int64_t i = 0; i < db->n_batch; i++) {
+        if (get_lookup(core, db->read_id[i], &db->rec_idx[i]) != 0) {
+            WARNING("Read ID '%s' was not found in the index.", db->read_id[i]);
+            db->rec_idx[i].offset = 0;
+            db->rec_idx[i].size = 0;
+            continue;
+        }
+        db->order[n++] = i;
+    }
+    struct slow5_rec_idx *rec_idx = db->rec_idx;
+    std::sort(db->order, db->order + n, [rec_idx](int64_t a, int64_t b) {
+        return rec_idx[a].offset < rec_idx[b].offset;
+    });
+
+    uint64_t total = 0;
+    fetch->n_batch = 0;
+    for (int64_t j = 0; j < n; j++) {
+        struct slow5_rec_idx *idx = &rec_idx[db->order[j]];
+        get_extent_t *ext = fetch->n_batch > 0 ? &fetch->extent[fetch->n_batch - 1] : NULL;
+        uint64_t end = idx->offset + idx->size;
+        if (ext && idx->offset <= ext->offset + ext->size + GET_COALESCE_GAP && end - ext->offset <= GET_EXTENT_MAX) {
+            if (end > ext->offset + ext->size) {
+                ext->size = end - ext->offset;
             }
-            db->read_record[i].buffer = slow5_rec_to_mem(record,core->fp->header->aux_meta, core->format_out, compress, &record_size);
-            db->read_record[i].len = record_size;
-            slow5_press_free(compress);
+            ext->n++;
+            continue;
         }
-        slow5_rec_free(record);
+        if (ext) {
+            total += ext->size;
+        }
+        ext = &fetch->extent[fetch->n_batch++];
+        ext->offset = idx->offset;
+        ext->size = idx->size;
+        ext->first = j;
+        ext->n = 1;
+    }
+    for (int64_t e = 0; e < fetch->n_batch; e++) {
+        fetch->cost[e] = fetch->extent[e].size;
     }
-    free(id);
+    if (fetch->n_batch > 0) {
+        total += fetch->extent[fetch->n_batch - 1].size;
+    }
+    return total;
 }
 
-bool fetch_record(slow5_file_t *fp, const char *read_id, char **argv, program_meta *meta, slow5_fmt format_out,
-                  slow5_press_method_t press_method, bool benchmark, FILE *slow5_file_pointer) {
+static int get_pread_all(int fd, char *buf, size_t n, uint64_t offset) {
+    while (n > 0) {
+        ssize_t ret = pread(fd, buf, n, offset);
+        if (ret == -1 && errno == EINTR) {
+            continue;
+        }
+        if (ret <= 0) {
+            if (ret == 0) {
+                errno = 0; // past the end of the file
+            }
+            return -1;
+        }
+        buf += ret;
+        n -= ret;
+        offset += ret;
+    }
+    return 0;
+}
 
-    bool success = true;
+/* decompress and parse a record as read from its index offset and size, as slow5_get() does */
+static int get_parse(slow5_file_t *fp, const char *read_id, const char *mem, uint64_t size, slow5_rec_t **record) {
+    size_t bytes;
+    char *rec;
+    if (fp->format == SLOW5_FORMAT_BINARY) {
+        if (size < sizeof (slow5_rec_size_t)) {
+            return -1;
+        }
+        // skip the size of the record
+        bytes = size - sizeof (slow5_rec_size_t);
+        rec = (char *) malloc(bytes);
+        MALLOC_CHK(rec);
+        memcpy(rec, mem + sizeof (slow5_rec_size_t), bytes);
+    } else {
+        if (size == 0) {
+            return -1;
+        }
+        // the newline becomes the terminator
+        bytes = size - 1;
+        rec = (char *) malloc(size);
+        MALLOC_CHK(rec);
+        memcpy(rec, mem, bytes);
+        rec[bytes] = '\0';
+    }
+    int ret = slow5_rec_depress_parse(&rec, &bytes, read_id, record, fp);
+    free(rec);
+    return ret;
+}
 
-    int len = 0;
-    //fprintf(stderr, "Fetching %s\n", read_id);
-    slow5_rec_t *record=NULL;
+/* as get_parse() but the record is decompressed from the map of core->mr */
+static int get_mapped(core_t *core, const struct slow5_rec_idx *idx, slow5_rec_t **record) {
+    char *mem;
+    size_t bytes;
+    if (mmap_reader_get(core->mr, idx->offset, &mem, &bytes) != 0) {
+        return -1;
+    }
+    return mmap_rec_depress_parse(mem, bytes, record, core->fp);
+}
 
-    len = slow5_get(read_id, &record,fp);
+static void get_record_out(core_t *core, get_batch_t *db, int64_t i, slow5_rec_t *record) {
+    db->read_record[i].buffer = NULL;
+    db->read_record[i].len = 0;
+    if (core->benchmark == false){
+        size_t record_size;
+        struct slow5_press* compress = press_cache_get(core->press_method);
+        if(!compress){
+            ERROR("Could not initialize the slow5 compression method%s","");
+            exit(EXIT_FAILURE);
+        }
+        db->read_record[i].buffer = slow5_rec_to_mem(record,core->fp->header->aux_meta, core->format_out, compress, &record_size);
+        db->read_record[i].len = record_size;
+    }
+}
 
-    if (record == NULL || len < 0) {
-        success = false;
+/* fetch the records of extent e with one read and decode them into their slots of db */
+void work_per_extent_get(core_t *core, get_fetch_t *fetch, int32_t e) {
+
+    get_extent_t *ext = &fetch->extent[e];
+    get_batch_t *db = fetch->db;
+
+    char *buf = NULL;
+    if (core->mr == NULL) {
+        buf = (char *) malloc(ext->size);
+        MALLOC_CHK(buf);
+        if (get_pread_all(fileno(core->fp->fp), buf, ext->size, ext->offset) != 0) {
+            ERROR("Could not read %" PRIu64 " bytes at offset %" PRIu64 " - %s. Is the index out of date?",
+                  ext->size, ext->offset, errno ? strerror(errno) : "unexpected end of file");
+            free(buf);
+            buf = NULL;
+        }
+    }
 
-    } else {
-        if (benchmark == false){
-            struct slow5_press* compress = slow5_press_init(press_method);
-            if(!compress){
-                ERROR("Could not initialize the slow5 compression method%s","");
-                exit(EXIT_FAILURE);
+    for (int64_t j = 0; j < ext->n; j++) {
+        int64_t i = db->order[ext->first + j];
+        struct slow5_rec_idx *idx = &db->rec_idx[i];
+        slow5_rec_t *record = NULL;
+        int ret = -1;
+        if (core->mr) {
+            ret = get_mapped(core, idx, &record);
+        } else if (buf) {
+            ret = get_parse(core->fp, db->read_id[i], buf + (idx->offset - ext->offset), idx->size, &record);
+        }
+        if (ret != 0) {
+            if (core->mr || buf) {
+                ERROR("Malformed record for read ID '%s', is the index out of date?", db->read_id[i]);
             }
-            slow5_rec_fwrite(slow5_file_pointer,record,fp->header->aux_meta, format_out, compress);
-            slow5_press_free(compress);
+            db->read_record[i].buffer = NULL;
+            db->read_record[i].len = -1;
+        } else {
+            get_record_out(core, db, i, record);
         }
         slow5_rec_free(record);
     }
-
-    return success;
+    free(buf);
 }
 
 int get_main(int argc, char **argv, struct program_meta *meta) {
@@ -119,6 +275,7 @@ int get_main(int argc, char **argv, struct program_meta *meta) {
         {"help",        no_argument, NULL, 'h' }, //8
         {"benchmark",   no_argument, NULL, 'e' }, //9
         {"index",       required_argument, NULL, 0 }, //10
+        {"mmap",        no_argument, NULL, 0 }, //11
         {NULL, 0, NULL, 0 }
     };
 
@@ -179,6 +336,9 @@ int get_main(int argc, char **argv, struct program_meta *meta) {
                     case 10:
                         slow5_index = optarg;
                         break;
+                    case 11:
+                        user_opts.flag_mmap = 1;
+                        break;
                 }
                 break;
 
@@ -282,7 +442,21 @@ int get_main(int argc, char **argv, struct program_meta *meta) {
         }
     }
 
-    if(slow5_index == NULL){
+    // a sorted index is mapped and searched in place, the slow5 index is loaded whole
+    index_map_t *im = NULL;
+    std::string sidx_path = slow5_index ? slow5_index : std::string(f_in_name) + INDEX_MAP_EXTENSION;
+    if (sidx_path.size() > strlen(INDEX_MAP_EXTENSION) && sidx_path.compare(sidx_path.size() - strlen(INDEX_MAP_EXTENSION), std::string::npos, INDEX_MAP_EXTENSION) == 0) {
+        im = index_map_open(sidx_path.c_str(), slow5file);
+        if (im == NULL && slow5_index != NULL) {
+            ERROR("Error loading the sorted index %s for %s\n", slow5_index, f_in_name);
+            EXIT_MSG(EXIT_FAILURE, argv, meta);
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (im != NULL) {
+        VERBOSE("Using the sorted index %s of %" PRIu64 " read ids", sidx_path.c_str(), index_map_num_ids(im));
+    } else if(slow5_index == NULL){
         int ret_idx = slow5_idx_load(slow5file);
         if (ret_idx < 0) {
             ERROR("Error loading index file for %s\n", f_in_name);
@@ -299,28 +473,55 @@ int get_main(int argc, char **argv, struct program_meta *meta) {
         }
     }
 
-    if (read_stdin) {
-        // Time spend reading slow5
-        double read_time = 0;
-
-        // Setup multithreading structures
-        core_t core;
-        core.num_thread = user_opts.num_threads;
-        core.fp = slow5file;
-        core.format_out = user_opts.fmt_out;
-        core.press_method = press_out;
-        core.benchmark = benchmark;
-
-        db_t db = { 0 };
-        int64_t cap_ids = READ_ID_INIT_CAPACITY;
-        db.read_id = (char **) malloc(cap_ids * sizeof(char*));
-        db.read_record = (raw_record_t*) malloc(cap_ids * sizeof(raw_record_t));
-        MALLOC_CHK(db.read_id);
-        MALLOC_CHK(db.read_record);
-        bool end_of_file = false;
-        while (!end_of_file) {
-            int64_t num_ids = 0;
-            while (num_ids < user_opts.read_id_batch_capacity) {
+    // Time spend reading slow5
+    double read_time = 0;
+
+    // Setup multithreading structures
+    core_t core;
+    core.num_thread = user_opts.num_threads;
+    core.fp = slow5file;
+    core.format_out = user_opts.fmt_out;
+    core.press_method = press_out;
+    core.benchmark = benchmark;
+    core.mr = NULL;
+    core.im = im;
+    if (user_opts.flag_mmap) {
+        core.mr = mmap_reader_init(slow5file, 0);
+        if (core.mr == NULL) {
+            WARNING("Could not map '%s', reading it with pread.", f_in_name);
+        }
+    }
+
+    get_batch_t db = { 0 };
+    get_fetch_t fetch = { 0 };
+    int64_t cap_ids = READ_ID_INIT_CAPACITY;
+    db.read_id = (char **) malloc(cap_ids * sizeof(char*));
+    db.read_record = (raw_record_t*) malloc(cap_ids * sizeof(raw_record_t));
+    db.rec_idx = (struct slow5_rec_idx *) malloc(cap_ids * sizeof *db.rec_idx);
+    db.order = (int64_t *) malloc(cap_ids * sizeof *db.order);
+    fetch.extent = (get_extent_t *) malloc(cap_ids * sizeof *fetch.extent);
+    fetch.cost = (size_t *) malloc(cap_ids * sizeof *fetch.cost);
+    fetch.db = &db;
+    MALLOC_CHK(db.read_id);
+    MALLOC_CHK(db.read_record);
+    MALLOC_CHK(db.rec_idx);
+    MALLOC_CHK(db.order);
+    MALLOC_CHK(fetch.extent);
+    MALLOC_CHK(fetch.cost);
+    int next_arg = optind + 1; // read ids given on the command line
+    bool end_of_file = false;
+    while (!end_of_file) {
+        int64_t num_ids = 0;
+        while (num_ids < user_opts.read_id_batch_capacity) {
+            char *curr_id;
+            if (!read_stdin) {
+                if (next_arg == argc) {
+                    end_of_file = true;
+                    break;
+                }
+                curr_id = strdup(argv[next_arg++]);
+                MALLOC_CHK(curr_id);
+            } else {
                 char *buf = NULL;
                 size_t cap_buf = 0;
                 ssize_t nread;
@@ -342,63 +543,94 @@ int get_main(int argc, char **argv, struct program_meta *meta) {
                     free(buf);
                     continue;
                 }
-                char *curr_id = strndup(buf, len_buf);
+                curr_id = strndup(buf, len_buf);
                 curr_id[len_buf] = '\0'; // Add string terminator '\0'
                 free(buf); // Free buffer
-                if (num_ids >= cap_ids) {
-                    // Double read id list capacity
-                    cap_ids *= 2;
-                    db.read_id = (char **) realloc(db.read_id, cap_ids * sizeof *db.read_id);
-                    db.read_record = (raw_record_t*) realloc(db.read_record, cap_ids * sizeof *db.read_record);
-                }
-                db.read_id[num_ids] = curr_id;
-                ++ num_ids;
             }
+            if (num_ids >= cap_ids) {
+                // Double read id list capacity
+                cap_ids *= 2;
+                db.read_id = (char **) realloc(db.read_id, cap_ids * sizeof *db.read_id);
+                db.read_record = (raw_record_t*) realloc(db.read_record, cap_ids * sizeof *db.read_record);
+                db.rec_idx = (struct slow5_rec_idx *) realloc(db.rec_idx, cap_ids * sizeof *db.rec_idx);
+                db.order = (int64_t *) realloc(db.order, cap_ids * sizeof *db.order);
+                fetch.extent = (get_extent_t *) realloc(fetch.extent, cap_ids * sizeof *fetch.extent);
+                fetch.cost = (size_t *) realloc(fetch.cost, cap_ids * sizeof *fetch.cost);
+                MALLOC_CHK(db.read_id);
+                MALLOC_CHK(db.read_record);
+                MALLOC_CHK(db.rec_idx);
+                MALLOC_CHK(db.order);
+                MALLOC_CHK(fetch.extent);
+                MALLOC_CHK(fetch.cost);
+            }
+            db.read_id[num_ids] = curr_id;
+            ++ num_ids;
+        }
 
-            db.n_batch = num_ids;
-
-            // Measure reading time
-            double start = slow5_realtime();
-
-            // Fetch records for read ids in the batch
-            work_db(&core, &db, work_per_single_read_get);
+        db.n_batch = num_ids;
 
-            double end = slow5_realtime();
-            read_time += end - start;
+        // Measure reading time
+        double start = slow5_realtime();
+        profile_mark_t mark;
+        profile_mark(&mark);
 
-            VERBOSE("Fetched %ld reads of %ld", num_ids - db.n_err, num_ids);
+        // Fetch records for read ids in the batch in file order, output stays in the given order
+        uint64_t bytes_in = get_schedule(&core, &db, &fetch);
+        work_db(&core, &fetch, work_fn<get_fetch_t, work_per_extent_get>(), fetch.cost);
 
-            // Print records
-            if(benchmark == false){
-                for (int64_t i = 0; i < num_ids; ++ i) {
-                    void *buffer = db.read_record[i].buffer;
-                    int len = db.read_record[i].len;
-                    if (buffer == NULL || len < 0) {
-                        if(skip_flag) continue;
-                        ERROR("Could not write the fetched read.%s","");
-                        return EXIT_FAILURE;
-                    } else {
-                        fwrite(buffer,1,len,user_opts.f_out);
-                        free(buffer);
-                    }
-                }
+        db.n_err = 0;
+        for (int64_t i = 0; i < num_ids; ++ i) {
+            if (db.rec_idx[i].size == 0) {
+                db.read_record[i].buffer = NULL;
+                db.read_record[i].len = -1;
             }
+            if (db.read_record[i].len < 0) {
+                ++ db.n_err;
+            }
+            free(db.read_id[i]);
         }
-        // Print total time to read slow5
-        VERBOSE("read time = %.3f sec", read_time);
-        // Free everything
-        free(db.read_id);
-        free(db.read_record);
-    } else {
-        for (int i = optind + 1; i < argc; ++ i){
-            bool success = fetch_record(slow5file, argv[i], argv, meta, user_opts.fmt_out, press_out, benchmark, user_opts.f_out);
-            if (!success) {
-                if(skip_flag) continue;
-                ERROR("Could not fetch records.%s","");
-                return EXIT_FAILURE;
+
+        double end = slow5_realtime();
+        read_time += end - start;
+        profile_stage("fetch", &mark, num_ids, bytes_in, 0);
+
+        VERBOSE("Fetched %ld reads of %ld with %ld reads of the file", num_ids - db.n_err, num_ids, fetch.n_batch);
+
+        // Print records
+        if(benchmark == false){
+            size_t bytes_out = 0;
+            profile_mark(&mark);
+            for (int64_t i = 0; i < num_ids; ++ i) {
+                void *buffer = db.read_record[i].buffer;
+                int len = db.read_record[i].len;
+                if (buffer == NULL || len < 0) {
+                    if(skip_flag) continue;
+                    ERROR("Could not write the fetched read.%s","");
+                    return EXIT_FAILURE;
+                } else {
+                    fwrite(buffer,1,len,user_opts.f_out);
+                    bytes_out += len;
+                    free(buffer);
+                }
             }
+            profile_stage("write", &mark, num_ids, 0, bytes_out);
         }
     }
+    // Print total time to read slow5
+    VERBOSE("read time = %.3f sec", read_time);
+    // Free everything
+    free(db.read_id);
+    free(db.read_record);
+    free(db.rec_idx);
+    free(db.order);
+    free(fetch.extent);
+    free(fetch.cost);
+    if (core.mr) {
+        mmap_reader_free(core.mr);
+    }
+    if (im) {
+        index_map_close(im);
+    }
 
     if(benchmark == false){
         if (user_opts.fmt_out == SLOW5_FORMAT_BINARY) {
@@ -6,11 +6,22 @@
  */
 #include <stdio.h>
 #include <getopt.h>
+#include <sys/stat.h>
 
 #include <slow5/slow5.h>
+#include <string>
+#include <vector>
 #include "error.h"
 #include "cmd.h"
 #include "misc.h"
+#include "thread.h"
+#include "reader.h"
+#include "index_map.h"
+#include "out_index.h"
+#include "slow5_extra.h"
+#include "slow5_idx.h"
+
+#define INDEX_PARTS_PER_THREAD 4 //parts of a SLOW5 file per thread, so that threads finishing early take more
 
 #define USAGE_MSG "Usage: %s  [SLOW5|BLOW5_FILE]\n"
 #define HELP_LARGE_MSG \
@@ -18,11 +29,414 @@
     "Create a slow5 or blow5 index file.\n" \
     "\n" \
     "OPTIONS:\n" \
+    "    -t, --threads INT\n" \
+    "        Number of threads [" TO_STR(DEFAULT_NUM_THREADS) "]. With 1, the file is indexed by slow5lib in a single pass.\n" \
+    "    -K, --batchsize INT\n" \
+    "        Number of BLOW5 records whose read ids are decoded at once [" TO_STR(DEFAULT_BATCH_SIZE) "].\n" \
+    "    --incremental\n" \
+    "        Only index the records appended to the file since FILE.idx was built or last updated.\n" \
+    "    --sorted\n" \
+    "        Also write FILE" INDEX_MAP_EXTENSION ", a sorted index that get maps instead of loading.\n" \
     "    -h, --help\n" \
     "        Display this message and exit.\n" \
 
 extern int slow5tools_verbosity_level;
 
+/* the records of a part of a SLOW5 file, both ends at the start of a line */
+typedef struct {
+    uint64_t start;
+    uint64_t end;
+    std::vector<char *> ids;
+    std::vector<struct slow5_rec_idx> recs;
+    int err;
+} index_part_t;
+
+/* the parts of a SLOW5 file, each scanned by one thread */
+typedef struct {
+    int64_t n_batch;
+    index_part_t *part;
+    const char *path;
+} index_parts_t;
+
+/* scan the lines of part i with a stream of its own; the read id of a record is its first column */
+void work_per_part_index(core_t *core, index_parts_t *db, int32_t i) {
+    index_part_t *part = &db->part[i];
+    FILE *fp = fopen(db->path, "r");
+    if (fp == NULL || fseeko(fp, part->start, SEEK_SET) == -1) {
+        ERROR("File '%s' could not be read - %s.", db->path, strerror(errno));
+        part->err = 1;
+        if (fp) {
+            fclose(fp);
+        }
+        return;
+    }
+
+    char *buf = NULL;
+    size_t cap = 0;
+    uint64_t offset = part->start;
+    while (offset < part->end) {
+        ssize_t len = getline(&buf, &cap, fp);
+        if (len == -1) {
+            ERROR("File '%s' ended before byte %" PRIu64 ".", db->path, part->end);
+            part->err = 1;
+            break;
+        }
+        char *tab = (char *) memchr(buf, '\t', len);
+        size_t id_len = tab ? (size_t) (tab - buf) : (size_t) len - (buf[len - 1] == '\n');
+        char *id = strndup(buf, id_len);
+        MALLOC_CHK(id);
+        struct slow5_rec_idx rec = {offset, (uint64_t) len};
+        part->ids.push_back(id);
+        part->recs.push_back(rec);
+        offset += len;
+    }
+    free(buf);
+    fclose(fp);
+}
+
+/* the first byte after the newline at or after pos, or end */
+static uint64_t index_next_line(FILE *fp, uint64_t pos, uint64_t end) {
+    if (fseeko(fp, pos - 1, SEEK_SET) == -1) {
+        return end;
+    }
+    int c;
+    while (pos - 1 < end && (c = fgetc(fp)) != EOF && c != '\n') {
+        pos++;
+    }
+    return pos < end ? pos : end;
+}
+
+/* index a SLOW5 file split at line boundaries into parts scanned in parallel; the partial tables are merged in file order */
+static int index_build_ascii(slow5_file_t *sp, struct slow5_idx *index, int32_t num_thread) {
+    struct stat st;
+    if (fstat(fileno(sp->fp), &st) == -1) {
+        ERROR("Could not stat '%s' - %s.", sp->meta.pathname, strerror(errno));
+        return -1;
+    }
+    uint64_t start = sp->meta.start_rec_offset;
+    uint64_t end = st.st_size;
+
+    index_parts_t db;
+    db.n_batch = (int64_t) num_thread * INDEX_PARTS_PER_THREAD;
+    db.part = new index_part_t[db.n_batch];
+    db.path = sp->meta.pathname;
+    FILE *fp = fopen(db.path, "r");
+    if (fp == NULL) {
+        ERROR("File '%s' could not be opened - %s.", db.path, strerror(errno));
+        delete[] db.part;
+        return -1;
+    }
+    uint64_t prev = start;
+    for (int64_t i = 0; i < db.n_batch; i++) {
+        db.part[i].start = prev;
+        db.part[i].end = i == db.n_batch - 1 ? end : index_next_line(fp, start + (end - start) * (i + 1) / db.n_batch, end);
+        if (db.part[i].end < prev) {
+            db.part[i].end = prev;
+        }
+        db.part[i].err = 0;
+        prev = db.part[i].end;
+    }
+    fclose(fp);
+
+    core_t core;
+    core.num_thread = num_thread;
+    core.fp = sp;
+    work_db(&core, &db, work_fn<index_parts_t, work_per_part_index>());
+
+    int ret = 0;
+    for (int64_t i = 0; i < db.n_batch; i++) {
+        index_part_t *part = &db.part[i];
+        size_t j = 0;
+        for (; ret == 0 && !part->err && j < part->ids.size(); j++) {
+            if (slow5_idx_insert(index, part->ids[j], part->recs[j].offset, part->recs[j].size) != 0) {
+                ERROR("Could not add read ID '%s' to the index, is it duplicated?", part->ids[j]);
+                free(part->ids[j++]);
+                ret = -1;
+            }
+        }
+        for (; j < part->ids.size(); j++) {
+            free(part->ids[j]);
+        }
+        if (part->err) {
+            ret = -1;
+        }
+    }
+    delete[] db.part;
+    return ret;
+}
+
+/* decode the read id of BLOW5 record i into db->read_record[i], decompressing the record if it is */
+void work_per_single_read_id(core_t *core, rec_batch_t *db, int32_t i) {
+    if ((db->read_record[i].buffer = out_index_mem_id(core->fp, db->mem_records[i], db->mem_bytes[i])) == NULL) {
+        ERROR("Could not decode the read ID of the record%s", "");
+    }
+}
+
+/* index a BLOW5 file: the records are taken in order (mapped if possible) and their read ids decoded in parallel */
+static int index_build_blow5(slow5_file_t *sp, struct slow5_idx *index, int32_t num_thread, int64_t batch_size) {
+    core_t core;
+    core.num_thread = num_thread;
+    core.fp = sp;
+    mmap_reader_t *mr = mmap_reader_init(sp, 1);
+
+    rec_batch_t db = { 0 };
+    db.mem_records = (char **) malloc(batch_size * sizeof *db.mem_records);
+    db.mem_bytes = (size_t *) malloc(batch_size * sizeof *db.mem_bytes);
+    db.read_record = (raw_record_t *) malloc(batch_size * sizeof *db.read_record);
+    MALLOC_CHK(db.mem_records);
+    MALLOC_CHK(db.mem_bytes);
+    MALLOC_CHK(db.read_record);
+    db.mapped = mr != NULL;
+
+    uint64_t offset = sp->meta.start_rec_offset;
+    int ret = 0;
+    int eof = 0;
+    while (!eof && ret == 0) {
+        db.n_batch = 0;
+        while (db.n_batch < batch_size) {
+            char *mem;
+            size_t bytes;
+            if (mr) {
+                int r = mmap_reader_next(mr, &mem, &bytes);
+                if (r <= 0) {
+                    ret = r;
+                    eof = 1;
+                    break;
+                }
+            } else if ((mem = (char *) slow5_get_next_mem(&bytes, sp)) == NULL) {
+                if (slow5_errno != SLOW5_ERR_EOF) {
+                    ERROR("Could not read the next record%s", "");
+                    ret = -1;
+                }
+                eof = 1;
+                break;
+            }
+            db.mem_records[db.n_batch] = mem;
+            db.mem_bytes[db.n_batch] = bytes;
+            db.n_batch++;
+        }
+
+        work_db(&core, &db, work_fn<rec_batch_t, work_per_single_read_id>(), db.mem_bytes);
+
+        for (int64_t i = 0; i < db.n_batch; i++) {
+            char *id = (char *) db.read_record[i].buffer;
+            if (ret == 0 && id == NULL) {
+                ret = -1;
+            } else if (ret == 0 && slow5_idx_insert(index, id, offset, sizeof (slow5_rec_size_t) + db.mem_bytes[i]) != 0) {
+                ERROR("Could not add read ID '%s' to the index, is it duplicated?", id);
+                free(id);
+                ret = -1;
+            } else if (ret != 0) {
+                free(id);
+            }
+            offset += sizeof (slow5_rec_size_t) + db.mem_bytes[i];
+            if (!db.mapped) {
+                free(db.mem_records[i]);
+            }
+        }
+    }
+
+    free(db.mem_records);
+    free(db.mem_bytes);
+    free(db.read_record);
+    if (mr) {
+        mmap_reader_free(mr);
+    }
+    return ret;
+}
+
+/* as slow5_idx_create() with num_thread threads; the index is left in sp->index */
+static int index_build_parallel(slow5_file_t *sp, int32_t num_thread, int64_t batch_size) {
+    struct slow5_idx *index = out_index_empty(sp->meta.pathname, sp->header->version, batch_size);
+    int ret = sp->format == SLOW5_FORMAT_BINARY ? index_build_blow5(sp, index, num_thread, batch_size)
+                                                : index_build_ascii(sp, index, num_thread);
+    if (ret != 0 || out_index_save(index, sp->header->version) != 0) {
+        slow5_idx_free(index);
+        return -1;
+    }
+    VERBOSE("Indexed %" PRIu64 " records with %d threads", index->num_ids, num_thread);
+    sp->index = index;
+    return 0;
+}
+
+/*
+ * Index the BLOW5 records from byte from to the EOF marker, or up to a record that has not been
+ * written whole yet if the file is still growing. The records are preaded a batch at a time and
+ * their read ids decoded by the threads. *end is set to the end of the last record indexed.
+ */
+static int index_append_blow5(slow5_file_t *sp, struct slow5_idx *index, uint64_t from, int32_t num_thread, int64_t batch_size, uint64_t *end) {
+    int fd = fileno(sp->fp);
+    struct stat st;
+    if (fstat(fd, &st) == -1) {
+        ERROR("Could not stat '%s' - %s.", sp->meta.pathname, strerror(errno));
+        return -1;
+    }
+    uint64_t size = st.st_size;
+    const char eof[] = SLOW5_BINARY_EOF;
+
+    core_t core;
+    core.num_thread = num_thread;
+    core.fp = sp;
+
+    rec_batch_t db = { 0 };
+    db.mem_records = (char **) malloc(batch_size * sizeof *db.mem_records);
+    db.mem_bytes = (size_t *) malloc(batch_size * sizeof *db.mem_bytes);
+    db.read_record = (raw_record_t *) malloc(batch_size * sizeof *db.read_record);
+    MALLOC_CHK(db.mem_records);
+    MALLOC_CHK(db.mem_bytes);
+    MALLOC_CHK(db.read_record);
+
+    uint64_t pos = from;
+    int ret = 0;
+    int done = 0;
+    while (!done && ret == 0) {
+        db.n_batch = 0;
+        while (db.n_batch < batch_size) {
+            char marker[sizeof eof];
+            slow5_rec_size_t bytes;
+            if (size - pos == sizeof eof && pread(fd, marker, sizeof eof, pos) == (ssize_t) sizeof eof && memcmp(marker, eof, sizeof eof) == 0) {
+                done = 1; // complete file
+                break;
+            }
+            if (size - pos < sizeof bytes || pread(fd, &bytes, sizeof bytes, pos) != (ssize_t) sizeof bytes ||
+                    size - pos - sizeof bytes < bytes) {
+                if (pos < size) {
+                    VERBOSE("The record at byte %" PRIu64 " is not complete yet, leaving it for the next update", pos);
+                }
+                done = 1;
+                break;
+            }
+            char *mem = (char *) malloc(bytes);
+            MALLOC_CHK(mem);
+            if (pread(fd, mem, bytes, pos + sizeof bytes) != (ssize_t) bytes) {
+                ERROR("Could not read the record at byte %" PRIu64 " - %s.", pos, strerror(errno));
+                free(mem);
+                ret = -1;
+                break;
+            }
+            db.mem_records[db.n_batch] = mem;
+            db.mem_bytes[db.n_batch] = bytes;
+            db.n_batch++;
+            pos += sizeof bytes + bytes;
+        }
+
+        work_db(&core, &db, work_fn<rec_batch_t, work_per_single_read_id>(), db.mem_bytes);
+
+        for (int64_t i = 0; i < db.n_batch; i++) {
+            char *id = (char *) db.read_record[i].buffer;
+            if (ret == 0 && id == NULL) {
+                ret = -1;
+            } else if (ret == 0 && slow5_idx_insert(index, id, from, sizeof (slow5_rec_size_t) + db.mem_bytes[i]) != 0) {
+                ERROR("Could not add read ID '%s' to the index, is it duplicated?", id);
+                free(id);
+                ret = -1;
+            } else if (ret != 0) {
+                free(id);
+            }
+            from += sizeof (slow5_rec_size_t) + db.mem_bytes[i];
+            free(db.mem_records[i]);
+        }
+    }
+
+    free(db.mem_records);
+    free(db.mem_bytes);
+    free(db.read_record);
+    *end = from;
+    return ret;
+}
+
+/* as index_append_blow5() for the complete lines of a SLOW5 file from byte from */
+static int index_append_ascii(slow5_file_t *sp, struct slow5_idx *index, uint64_t from, uint64_t *end) {
+    FILE *fp = fopen(sp->meta.pathname, "r");
+    if (fp == NULL || fseeko(fp, from, SEEK_SET) == -1) {
+        ERROR("File '%s' could not be read - %s.", sp->meta.pathname, strerror(errno));
+        if (fp) {
+            fclose(fp);
+        }
+        return -1;
+    }
+    int ret = 0;
+    char *buf = NULL;
+    size_t cap = 0;
+    ssize_t len;
+    while ((len = getline(&buf, &cap, fp)) != -1) {
+        if (buf[len - 1] != '\n') {
+            VERBOSE("The line at byte %" PRIu64 " is not complete yet, leaving it for the next update", from);
+            break;
+        }
+        char *tab = (char *) memchr(buf, '\t', len);
+        char *id = strndup(buf, tab ? (size_t) (tab - buf) : (size_t) len - 1);
+        MALLOC_CHK(id);
+        if (slow5_idx_insert(index, id, from, len) != 0) {
+            ERROR("Could not add read ID '%s' to the index, is it duplicated?", id);
+            free(id);
+            ret = -1;
+            break;
+        }
+        from += len;
+    }
+    free(buf);
+    fclose(fp);
+    *end = from;
+    return ret;
+}
+
+/*
+ * Extend the index of sp with the records appended to the file since the index was built or last
+ * updated, or index the complete records so far if there is no index yet. The indexed records are
+ * assumed unchanged: the scan starts at the end of the last indexed record, after checking that a
+ * record does end there.
+ */
+static int index_update(slow5_file_t *sp, int32_t num_thread, int64_t batch_size) {
+    std::string idx_path = std::string(sp->meta.pathname) + SLOW5_INDEX_EXTENSION;
+    if (access(idx_path.c_str(), R_OK) != 0) {
+        sp->index = out_index_empty(sp->meta.pathname, sp->header->version, batch_size);
+    } else if (slow5_idx_load(sp) != 0) {
+        return -1;
+    }
+    struct slow5_idx *index = sp->index;
+
+    uint64_t last = sp->meta.start_rec_offset;
+    for (uint64_t i = 0; i < index->num_ids; i++) {
+        struct slow5_rec_idx *rec = &kh_value(index->hash, kh_get(slow5_s2i, index->hash, index->ids[i]));
+        if (rec->offset + rec->size > last) {
+            last = rec->offset + rec->size;
+        }
+    }
+
+    // the last indexed record must still be where the index says
+    int fd = fileno(sp->fp);
+    if (index->num_ids > 0) {
+        const char *last_id = index->ids[index->num_ids - 1];
+        struct slow5_rec_idx *rec = &kh_value(index->hash, kh_get(slow5_s2i, index->hash, last_id));
+        int ok;
+        if (sp->format == SLOW5_FORMAT_BINARY) {
+            slow5_rec_size_t bytes;
+            ok = pread(fd, &bytes, sizeof bytes, rec->offset) == (ssize_t) sizeof bytes && sizeof bytes + bytes == rec->size;
+        } else {
+            char c;
+            ok = pread(fd, &c, 1, rec->offset + rec->size - 1) == 1 && c == '\n';
+        }
+        if (!ok || rec->offset + rec->size != last) {
+            ERROR("The index of '%s' does not match the file, was it rewritten rather than appended to? Rebuild the index without --incremental.", sp->meta.pathname);
+            return -1;
+        }
+    }
+
+    uint64_t n_old = index->num_ids;
+    uint64_t end;
+    int ret = sp->format == SLOW5_FORMAT_BINARY ? index_append_blow5(sp, index, last, num_thread, batch_size, &end)
+                                                : index_append_ascii(sp, index, last, &end);
+    if (ret != 0) {
+        return -1;
+    }
+    VERBOSE("Indexed %" PRIu64 " new records in bytes %" PRIu64 " to %" PRIu64, index->num_ids - n_old, last, end);
+    if (index->num_ids == n_old && n_old > 0) {
+        return 0;
+    }
+    return out_index_save(index, sp->header->version);
+}
+
 int index_main(int argc, char **argv, struct program_meta *meta) {
 
     // Debug: print arguments
@@ -36,13 +450,24 @@ int index_main(int argc, char **argv, struct program_meta *meta) {
     }
 
     static struct option long_opts[] = {
-        {"help", no_argument, NULL, 'h' },
+        {"help", no_argument, NULL, 'h' },  //0
+        {"sorted", no_argument, NULL, 0 },  //1
+        {"threads", required_argument, NULL, 't' },  //2
+        {"batchsize", required_argument, NULL, 'K' },  //3
+        {"incremental", no_argument, NULL, 0 },  //4
         {NULL, 0, NULL, 0 }
     };
 
+    int sorted = 0;
+    int incremental = 0;
+
+    opt_t user_opts;
+    init_opt(&user_opts);
+
     int opt;
+    int longindex = 0;
     // Parse options
-    while ((opt = getopt_long(argc, argv, "h", long_opts, NULL)) != -1) {
+    while ((opt = getopt_long(argc, argv, "ht:K:", long_opts, &longindex)) != -1) {
 
         DEBUG("opt='%c', optarg=\"%s\", optind=%d, opterr=%d, optopt='%c'",
                   opt, optarg, optind, opterr, optopt);
@@ -54,6 +479,22 @@ int index_main(int argc, char **argv, struct program_meta *meta) {
 
                 EXIT_MSG(EXIT_SUCCESS, argv, meta);
                 exit(EXIT_SUCCESS);
+            case 't':
+                user_opts.arg_num_threads = optarg;
+                break;
+            case 'K':
+                user_opts.arg_batch = optarg;
+                break;
+            case 0  :
+                switch (longindex) {
+                    case 1:
+                        sorted = 1;
+                        break;
+                    case 4:
+                        incremental = 1;
+                        break;
+                }
+                break;
             default: // case '?'
                 fprintf(stderr, HELP_SMALL_MSG, argv[0]);
                 EXIT_MSG(EXIT_FAILURE, argv, meta);
@@ -61,6 +502,15 @@ int index_main(int argc, char **argv, struct program_meta *meta) {
         }
     }
 
+    if(parse_num_threads(&user_opts,argc,argv,meta) < 0){
+        EXIT_MSG(EXIT_FAILURE, argv, meta);
+        return EXIT_FAILURE;
+    }
+    if(parse_batch_size(&user_opts,argc,argv) < 0){
+        EXIT_MSG(EXIT_FAILURE, argv, meta);
+        return EXIT_FAILURE;
+    }
+
     // Check for remaining files to parse
     if (optind >= argc) {
         ERROR("missing slow5 or blow5 file%s", "");
@@ -82,13 +532,30 @@ int index_main(int argc, char **argv, struct program_meta *meta) {
     slow5_file_t *file=slow5_open(f_in_name,"r");
     F_CHK(file,f_in_name);
 
-    if (slow5_idx_create(file) != 0) {
+    int ret;
+    if (incremental) {
+        ret = index_update(file, user_opts.num_threads, user_opts.read_id_batch_capacity);
+    } else {
+        ret = user_opts.num_threads > 1 ? index_build_parallel(file, user_opts.num_threads, user_opts.read_id_batch_capacity)
+                                        : slow5_idx_create(file);
+    }
+    if (ret != 0) {
         fprintf(stderr, "Error running slow5idx_build on %s\n",
                 f_in_name);
         EXIT_MSG(EXIT_FAILURE, argv, meta);
         return EXIT_FAILURE;
     }
 
+    // an existing sorted index is kept up to date, otherwise get would ignore it as stale
+    std::string sidx_path = std::string(f_in_name) + INDEX_MAP_EXTENSION;
+    if (sorted || (incremental && access(sidx_path.c_str(), F_OK) == 0)) {
+        if ((file->index == NULL && slow5_idx_load(file) != 0) || index_map_write(file, sidx_path.c_str()) != 0) {
+            ERROR("Could not write the sorted index '%s'", sidx_path.c_str());
+            EXIT_MSG(EXIT_FAILURE, argv, meta);
+            return EXIT_FAILURE;
+        }
+    }
+
     slow5_close(file);
 
     EXIT_MSG(EXIT_SUCCESS, argv, meta);
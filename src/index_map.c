@@ -0,0 +1,199 @@
+/**
+ * @file index_map.c
+ * @brief sorted read id index that is memory mapped and searched in place
+ * @author Hasindu Gamaarachchi (hasindu@garvan.org.au)
+ * @date 17/10/2026
+ */
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <inttypes.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+#include "index_map.h"
+#include "error.h"
+
+extern int slow5tools_verbosity_level;
+
+struct index_map {
+    char *base;
+    size_t len;
+    uint64_t num_ids;
+    const index_map_entry_t *entries;
+    const char *pool;
+    uint64_t pool_bytes;
+};
+
+static inline uint64_t index_map_prefix(const char *id) {
+    uint64_t prefix = 0;
+    int i = 0;
+    for (; i < 8 && id[i] != '\0'; i++) {
+        prefix = prefix << 8 | (unsigned char) id[i];
+    }
+    return i == 0 ? 0 : prefix << (8 * (8 - i));
+}
+
+int index_map_write(struct slow5_file *sp, const char *path) {
+    struct slow5_idx *index = sp->index;
+    uint64_t n = index->num_ids;
+
+    struct stat st;
+    if (fstat(fileno(sp->fp), &st) == -1) {
+        ERROR("Could not stat '%s' - %s.", sp->meta.pathname, strerror(errno));
+        return -1;
+    }
+
+    std::vector<const char *> ids(index->ids, index->ids + n);
+    std::sort(ids.begin(), ids.end(), [](const char *a, const char *b) {
+        return strcmp(a, b) < 0;
+    });
+
+    index_map_hdr_t hdr;
+    memset(&hdr, 0, sizeof hdr);
+    memcpy(hdr.magic, INDEX_MAP_MAGIC, sizeof hdr.magic);
+    hdr.num_ids = n;
+    hdr.pool_bytes = 0;
+    hdr.data_bytes = st.st_size;
+    for (uint64_t i = 0; i < n; i++) {
+        hdr.pool_bytes += strlen(ids[i]) + 1;
+    }
+
+    // written aside and renamed, so that a reader never maps a partial index
+    std::string tmp_path = std::string(path) + ".tmp";
+    FILE *fp = fopen(tmp_path.c_str(), "w");
+    if (fp == NULL) {
+        ERROR("File '%s' could not be opened - %s.", tmp_path.c_str(), strerror(errno));
+        return -1;
+    }
+    int ok = fwrite(&hdr, sizeof hdr, 1, fp) == 1;
+    uint64_t pos = 0;
+    for (uint64_t i = 0; ok && i < n; i++) {
+        khint_t k = kh_get(slow5_s2i, index->hash, ids[i]);
+        index_map_entry_t e;
+        e.prefix = index_map_prefix(ids[i]);
+        e.id = pos;
+        e.offset = kh_value(index->hash, k).offset;
+        e.size = kh_value(index->hash, k).size;
+        ok = fwrite(&e, sizeof e, 1, fp) == 1;
+        pos += strlen(ids[i]) + 1;
+        if (i > 0 && strcmp(ids[i - 1], ids[i]) == 0) {
+            ERROR("Duplicate read ID '%s' in the index.", ids[i]);
+            ok = 0;
+        }
+    }
+    for (uint64_t i = 0; ok && i < n; i++) {
+        ok = fwrite(ids[i], strlen(ids[i]) + 1, 1, fp) == 1;
+    }
+    if (!ok) {
+        ERROR("Writing '%s' failed - %s.", tmp_path.c_str(), strerror(errno));
+    }
+    if (fclose(fp) == EOF && ok) {
+        ERROR("File '%s' failed on closing - %s.", tmp_path.c_str(), strerror(errno));
+        ok = 0;
+    }
+    if (ok && rename(tmp_path.c_str(), path) == -1) {
+        ERROR("Could not rename '%s' to '%s' - %s.", tmp_path.c_str(), path, strerror(errno));
+        ok = 0;
+    }
+    if (!ok) {
+        unlink(tmp_path.c_str());
+        return -1;
+    }
+    VERBOSE("Wrote the sorted index of %" PRIu64 " read ids to '%s'", n, path);
+    return 0;
+}
+
+index_map_t *index_map_open(const char *path, const struct slow5_file *sp) {
+    int fd = open(path, O_RDONLY);
+    if (fd == -1) {
+        return NULL;
+    }
+    struct stat st, data_st;
+    if (fstat(fd, &st) == -1 || fstat(fileno(sp->fp), &data_st) == -1) {
+        close(fd);
+        return NULL;
+    }
+    if ((uint64_t) st.st_size < sizeof (index_map_hdr_t)) {
+        WARNING("Sorted index '%s' is malformed, ignoring it.", path);
+        close(fd);
+        return NULL;
+    }
+
+    void *base = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) {
+        WARNING("Could not map '%s' - %s.", path, strerror(errno));
+        return NULL;
+    }
+    madvise(base, st.st_size, MADV_RANDOM);
+
+    const index_map_hdr_t *hdr = (const index_map_hdr_t *) base;
+    const char *err = NULL;
+    if (memcmp(hdr->magic, INDEX_MAP_MAGIC, sizeof hdr->magic) != 0 ||
+            hdr->num_ids > (st.st_size - sizeof *hdr) / sizeof (index_map_entry_t) ||
+            sizeof *hdr + hdr->num_ids * sizeof (index_map_entry_t) + hdr->pool_bytes != (uint64_t) st.st_size ||
+            (hdr->pool_bytes > 0 && ((const char *) base)[st.st_size - 1] != '\0')) {
+        err = "is malformed";
+    } else if (hdr->data_bytes != (uint64_t) data_st.st_size) {
+        err = "is not of the current file";
+    } else if (st.st_mtime < data_st.st_mtime) {
+        err = "is older than the file";
+    }
+    if (err) {
+        WARNING("Sorted index '%s' %s, ignoring it.", path, err);
+        munmap(base, st.st_size);
+        return NULL;
+    }
+
+    index_map_t *im = (index_map_t *) malloc(sizeof *im);
+    MALLOC_CHK(im);
+    im->base = (char *) base;
+    im->len = st.st_size;
+    im->num_ids = hdr->num_ids;
+    im->entries = (const index_map_entry_t *) (im->base + sizeof *hdr);
+    im->pool = (const char *) (im->entries + im->num_ids);
+    im->pool_bytes = hdr->pool_bytes;
+    return im;
+}
+
+int index_map_get(const index_map_t *im, const char *read_id, struct slow5_rec_idx *rec_idx) {
+    uint64_t prefix = index_map_prefix(read_id);
+    uint64_t lo = 0;
+    uint64_t hi = im->num_ids;
+    while (lo < hi) {
+        uint64_t mid = lo + (hi - lo) / 2;
+        const index_map_entry_t *e = &im->entries[mid];
+        int cmp;
+        if (e->prefix != prefix) {
+            cmp = e->prefix < prefix ? -1 : 1;
+        } else if (e->id >= im->pool_bytes) {
+            return -1;
+        } else {
+            cmp = strcmp(im->pool + e->id, read_id);
+        }
+        if (cmp == 0) {
+            rec_idx->offset = e->offset;
+            rec_idx->size = e->size;
+            return 0;
+        }
+        if (cmp < 0) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return -1;
+}
+
+uint64_t index_map_num_ids(const index_map_t *im) {
+    return im->num_ids;
+}
+
+void index_map_close(index_map_t *im) {
+    if (munmap(im->base, im->len) == -1) {
+        WARNING("munmap failed - %s.", strerror(errno));
+    }
+    free(im);
+}
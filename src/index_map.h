@@ -0,0 +1,46 @@
+// sorted read id index that is memory mapped and searched in place
+
+#ifndef INDEX_MAP_H
+#define INDEX_MAP_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <slow5/slow5.h>
+
+#define INDEX_MAP_EXTENSION ".sidx" //appended to the SLOW5/BLOW5 file name
+#define INDEX_MAP_MAGIC "S5SIDX\1" //with its null, the first 8 bytes of the file
+
+/*
+ * file layout, in the byte order of the machine that wrote it:
+ * - index_map_hdr_t
+ * - num_ids index_map_entry_t sorted by read id (strcmp order)
+ * - pool_bytes of null terminated read ids
+ * A read id is found with a binary search over the entries, so opening the index costs one mmap and
+ * a lookup touches about log2(num_ids) entries and pool strings, whatever the size of the file.
+ */
+typedef struct {
+    char magic[8];
+    uint64_t num_ids;
+    uint64_t pool_bytes;
+    uint64_t data_bytes;    // size of the indexed SLOW5/BLOW5 file, to tell a stale index
+} index_map_hdr_t;
+
+typedef struct {
+    uint64_t prefix;        // the first 8 bytes of the read id as a big endian number, zero padded, so prefixes order as the ids
+    uint64_t id;            // position of the read id in the pool
+    uint64_t offset;        // of the record, as in the slow5 index
+    uint64_t size;          // of the record, as in the slow5 index
+} index_map_entry_t;
+
+typedef struct index_map index_map_t;
+
+/* write the loaded index of sp (slow5_idx_load()) as a sorted index to path; returns 0 or -1 */
+int index_map_write(struct slow5_file *sp, const char *path);
+/* map the sorted index at path made for sp; NULL if it is missing, malformed or not of the current file */
+index_map_t *index_map_open(const char *path, const struct slow5_file *sp);
+/* look up read_id; returns 0 with *rec_idx set, -1 if it is not in the index. Safe from any thread */
+int index_map_get(const index_map_t *im, const char *read_id, struct slow5_rec_idx *rec_idx);
+uint64_t index_map_num_ids(const index_map_t *im);
+void index_map_close(index_map_t *im);
+
+#endif
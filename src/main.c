@@ -11,6 +11,8 @@
 #include "error.h"
 #include "cmd.h"
 #include "misc.h"
+#include "thread.h"
+#include "profile.h"
 #include "config.h"
 #ifdef HAVE_EXECINFO_H
     #include <execinfo.h>
@@ -28,6 +30,7 @@
     "    -v, --verbose    Verbosity level.\n" \
     "    -V, --version    Output version information and exit.\n" \
     "    --cite           Prints the citation.\n" \
+    "    --profile FILE   Write stage timings, throughput and resource use of the command to FILE as JSON.\n" \
     "\n" \
     "COMMANDS:\n" \
     "    f2s or fast5toslow5   convert fast5 file(s) to SLOW5/BLOW5\n" \
@@ -160,6 +163,7 @@ int main(const int argc, char **argv){
             {"verbose", required_argument, NULL, 'v'}, //1
             {"version", no_argument, NULL, 'V'}, //2
             {"cite", no_argument, NULL, 0}, //3
+            {"profile", required_argument, NULL, 0}, //4
             {NULL, 0, NULL, 0 }
         };
 
@@ -197,6 +201,9 @@ int main(const int argc, char **argv){
                             ret = EXIT_SUCCESS;
                             break_flag = true;
                             break;
+                        case 4:
+                            profile_init(optarg);
+                            break;
                     }
                     break;
                 default: // case '?'
@@ -250,6 +257,13 @@ int main(const int argc, char **argv){
                         DEBUG("using command '%s'", cmds[i].name);
                         ret = cmds[i].main(argc - optind_copy, cmd_argv + optind_copy, &meta);
 
+                        // Join the worker pool started by the command, if any
+                        work_pool_destroy();
+
+                        if (profile_write(argc, argv, ret, init_realtime) < 0) {
+                            ret = EXIT_FAILURE;
+                        }
+
                         break;
                     }
                 }
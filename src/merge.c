@@ -19,6 +19,9 @@
 #include "slow5_extra.h"
 #include "misc.h"
 #include "thread.h"
+#include "reader.h"
+#include "writer.h"
+#include "out_index.h"
 
 #define USAGE_MSG "Usage: %s [OPTIONS] [SLOW5_FILE/DIR] ...\n"
 #define HELP_LARGE_MSG \
@@ -30,7 +33,9 @@
     HELP_MSG_OUTPUT_FILE \
     HELP_MSG_PRESS \
     HELP_MSG_THREADS \
-    HELP_MSG_BATCH \
+    HELP_MSG_BATCH_ADAPTIVE \
+    HELP_MSG_WRITER \
+    HELP_MSG_INDEX_OUT \
     HELP_MSG_LOSSLESS  \
     HELP_MSG_CONTINUE_MERGE \
     HELP_MSG_HELP \
@@ -38,18 +43,34 @@
 
 extern int slow5tools_verbosity_level;
 
+/* a batch of records read from the input files */
+typedef struct {
+    int64_t n_batch;    // number of records in this batch
+    char** mem_records; // list of batch_rec_next() records, those of BLOW5 files in the batch arena
+    size_t* mem_bytes; // lengths of batch_rec_next() records
+    raw_record_t *read_record; // the list of output records
+    slow5_file_t **slow5_file_pointers; // input file of each record
+    const int *slow5_file_indices; // index of the input file of each record
+    const std::vector<std::vector<size_t>> *list; // output read group of each input file and read group
+} merge_batch_t;
+
 int compare_headers(slow5_hdr_t *output_header, slow5_hdr_t *input_header, int64_t output_g, int64_t input_g, const char *i_file_path, char *j_run_id);
 
-void parallel_reads_model(core_t *core, db_t *db, int32_t i) {
+void parallel_reads_model(core_t *core, merge_batch_t *db, int32_t i) {
     //
     struct slow5_rec *read = NULL;
-    if (slow5_rec_depress_parse(&db->mem_records[i], &db->mem_bytes[i], NULL, &read, db->slow5_file_pointers[i]) != 0) {
+    slow5_file_t *from = db->slow5_file_pointers[i];
+    if (from->format == SLOW5_FORMAT_BINARY) { // in the batch arena
+        if (mmap_rec_depress_parse(db->mem_records[i], db->mem_bytes[i], &read, from) != 0) {
+            exit(EXIT_FAILURE);
+        }
+    } else if (slow5_rec_depress_parse(&db->mem_records[i], &db->mem_bytes[i], NULL, &read, from) != 0) {
         exit(EXIT_FAILURE);
     } else {
         free(db->mem_records[i]);
     }
-    read->read_group = db->list[db->slow5_file_indices[i]][read->read_group]; //write records of the ith slow5file with the updated read_group value
-    struct slow5_press *press_ptr = slow5_press_init(core->press_method);
+    read->read_group = (*db->list)[db->slow5_file_indices[i]][read->read_group]; //write records of the ith slow5file with the updated read_group value
+    struct slow5_press *press_ptr = press_cache_get(core->press_method);
     if(!press_ptr){
         ERROR("Could not initialize the slow5 compression method%s","");
         exit(EXIT_FAILURE);
@@ -60,12 +81,14 @@ void parallel_reads_model(core_t *core, db_t *db, int32_t i) {
         aux_meta = NULL;
     }
     if ((db->read_record[i].buffer = slow5_rec_to_mem(read, aux_meta, core->format_out, press_ptr, &len)) == NULL) {
-        slow5_press_free(press_ptr);
         slow5_rec_free(read);
         exit(EXIT_FAILURE);
     }
-    slow5_press_free(press_ptr);
     db->read_record[i].len = len;
+    if (core->index_out) {
+        db->read_record[i].read_id = strdup(read->read_id);
+        MALLOC_CHK(db->read_record[i].read_id);
+    }
     slow5_rec_free(read);
 }
 
@@ -91,6 +114,10 @@ int merge_main(int argc, char **argv, struct program_meta *meta){
             {"allow", no_argument, NULL, 'a'},               //6
             {"output", required_argument, NULL, 'o'},        //7
             {"batchsize", required_argument, NULL, 'K'},     //8
+            {"max-mem", required_argument, NULL, 'M'},       //9
+            {"write-buf", required_argument, NULL, 'W'},     //10
+            {"direct", no_argument, NULL, 'D'},              //11
+            {"index", no_argument, NULL, 'I'},               //12
             {NULL, 0, NULL, 0 }
     };
 
@@ -129,6 +156,18 @@ int merge_main(int argc, char **argv, struct program_meta *meta){
             case 'K':
                 user_opts.arg_batch = optarg;
                 break;
+            case 'M':
+                user_opts.arg_max_mem = optarg;
+                break;
+            case 'W':
+                user_opts.arg_write_buf = optarg;
+                break;
+            case 'D':
+                user_opts.flag_direct = 1;
+                break;
+            case 'I':
+                user_opts.flag_index = 1;
+                break;
             case 0  :
                 switch (longindex) {
                     case 2:
@@ -153,6 +192,14 @@ int merge_main(int argc, char **argv, struct program_meta *meta){
         EXIT_MSG(EXIT_FAILURE, argv, meta);
         return EXIT_FAILURE;
     }
+    if(parse_max_mem(&user_opts,argc,argv) < 0){
+        EXIT_MSG(EXIT_FAILURE, argv, meta);
+        return EXIT_FAILURE;
+    }
+    if(parse_write_buf(&user_opts,argc,argv) < 0){
+        EXIT_MSG(EXIT_FAILURE, argv, meta);
+        return EXIT_FAILURE;
+    }
     if(parse_arg_lossless(&user_opts, argc, argv, meta) < 0){
         EXIT_MSG(EXIT_FAILURE, argv, meta);
         return EXIT_FAILURE;
@@ -169,6 +216,11 @@ int merge_main(int argc, char **argv, struct program_meta *meta){
         EXIT_MSG(EXIT_FAILURE, argv, meta);
         return EXIT_FAILURE;
     }
+    if (user_opts.flag_index && user_opts.arg_fname_out == NULL) {
+        ERROR("--index needs an output file (-o)%s", "");
+        EXIT_MSG(EXIT_FAILURE, argv, meta);
+        return EXIT_FAILURE;
+    }
 
     // Check for remaining files to parse
     if (optind >= argc) {
@@ -362,16 +414,22 @@ int merge_main(int argc, char **argv, struct program_meta *meta){
         ERROR("Could not write the header to %s\n", user_opts.arg_fname_out);
         return EXIT_FAILURE;
     }
+    writer_t *writer = writer_init(slow5File->fp, user_opts.write_buf, user_opts.flag_direct);
+    if (writer == NULL) {
+        return EXIT_FAILURE;
+    }
+    out_index_t *oi = user_opts.flag_index ? out_index_init(user_opts.arg_fname_out, slow5File->header->version) : NULL;
 
     double time_get_to_mem = 0;
     double time_thread_execution = 0;
     int flag_end_of_records = 0;
     double time_write = 0;
 
-    int64_t batch_size = user_opts.read_id_batch_capacity;
+    batch_ctl_t ctl;
+    batch_ctl_init(&ctl, &user_opts, 1);
     size_t slow5_file_index = 0;
     std::queue<struct slow5_file*> open_files_pointers;
-    std::vector<int> slow5_file_indices(batch_size);
+    std::vector<int> slow5_file_indices;
 
     struct slow5_file *from = slow5_open(slow5_files[slow5_file_index].c_str(), "r");
     if (from == NULL) {
@@ -380,23 +438,28 @@ int merge_main(int argc, char **argv, struct program_meta *meta){
     }
     open_files_pointers.push(from);
     size_t open_file_from = slow5_file_index;
+    arena_t arena; // per-batch arrays and BLOW5 records, reused across batches
+    arena_init(&arena, 0);
     while(1) {
-        db_t db = { 0 };
-        db.mem_records = (char **) malloc(batch_size * sizeof(char*));
-        db.mem_bytes = (size_t *) malloc(batch_size * sizeof(size_t));
-        db.slow5_file_pointers = (slow5_file_t **) malloc(batch_size * sizeof(slow5_file_t*));
-
-        MALLOC_CHK(db.mem_records);
-        MALLOC_CHK(db.mem_bytes);
-        MALLOC_CHK(db.slow5_file_pointers);
+        merge_batch_t db = { 0 };
+        int64_t batch_size = ctl.batch_size;
+        slow5_file_indices.resize(batch_size);
+        arena_reset(&arena);
+        db.mem_records = (char **) arena_alloc(&arena, batch_size * sizeof(char*));
+        db.mem_bytes = (size_t *) arena_alloc(&arena, batch_size * sizeof(size_t));
+        db.slow5_file_pointers = (slow5_file_t **) arena_alloc(&arena, batch_size * sizeof(slow5_file_t*));
 
         int64_t record_count = 0;
         size_t bytes;
+        size_t bytes_in = 0;
         char *mem;
         double realtime = slow5_realtime();
-        while (record_count < batch_size) {
-            if (!(mem = (char *) slow5_get_next_mem(&bytes, from))) {
-                if (slow5_errno != SLOW5_ERR_EOF) {
+        profile_mark_t start;
+        profile_mark(&start);
+        while (!batch_ctl_full(&ctl, record_count, bytes_in)) {
+            int ret = batch_rec_next(from, &arena, &mem, &bytes);
+            if (ret <= 0) {
+                if (ret < 0) {
                     return EXIT_FAILURE;
                 } else { //EOF file reached
                     slow5_file_index++;
@@ -418,12 +481,15 @@ int merge_main(int argc, char **argv, struct program_meta *meta){
                 db.mem_bytes[record_count] = bytes;
                 db.slow5_file_pointers[record_count] = from;
                 slow5_file_indices[record_count] = slow5_file_index;
+                bytes_in += bytes;
                 record_count++;
             }
         }
 
         time_get_to_mem += slow5_realtime() - realtime;
+        profile_stage("read", &start, record_count, bytes_in, 0);
         realtime = slow5_realtime();
+        profile_mark(&start);
         // Setup multithreading structures
         core_t core;
         core.num_thread = user_opts.num_threads;
@@ -431,27 +497,39 @@ int merge_main(int argc, char **argv, struct program_meta *meta){
         core.format_out = user_opts.fmt_out;
         core.press_method = method;
         core.lossy = user_opts.flag_lossy;
+        core.index_out = oi != NULL;
 
         db.n_batch = record_count;
-        db.read_record = (raw_record_t*) malloc(record_count * sizeof *db.read_record);
-        MALLOC_CHK(db.read_record);
-        db.list = list;
-        db.slow5_file_indices = slow5_file_indices;
-        work_db(&core,&db,parallel_reads_model);
-        time_thread_execution += slow5_realtime() - realtime;
+        db.read_record = (raw_record_t*) arena_alloc(&arena, record_count * sizeof *db.read_record);
+        db.list = &list;
+        db.slow5_file_indices = slow5_file_indices.data();
+        work_db(&core,&db,work_fn<merge_batch_t, parallel_reads_model>(),db.mem_bytes);
+        double time_batch = slow5_realtime() - realtime;
+        time_thread_execution += time_batch;
+        profile_stage("process", &start, record_count, 0, 0);
 
         realtime = slow5_realtime();
+        profile_mark(&start);
+        size_t bytes_out = 0;
+        for (int64_t i = 0; i < record_count; i++) {
+            uint64_t offset = writer_tell(writer);
+            if (writer_add(writer, db.read_record[i].buffer, db.read_record[i].len) != 0) {
+                return EXIT_FAILURE;
+            }
+            if (oi) {
+                out_index_add(oi, db.read_record[i].read_id, offset, db.read_record[i].len);
+            }
+            bytes_out += db.read_record[i].len;
+        }
+        if (writer_flush(writer) != 0) {
+            return EXIT_FAILURE;
+        }
         for (int64_t i = 0; i < record_count; i++) {
-            fwrite(db.read_record[i].buffer,1,db.read_record[i].len,slow5File->fp);
             free(db.read_record[i].buffer);
         }
         time_write += slow5_realtime() - realtime;
-
-        // Free everything
-        free(db.mem_bytes);
-        free(db.mem_records);
-        free(db.read_record);
-        free(db.slow5_file_pointers);
+        profile_stage("write", &start, record_count, 0, bytes_out);
+        batch_ctl_update(&ctl, record_count, bytes_in, bytes_out, time_batch);
 
         for(size_t j=open_file_from; j<slow5_file_index; j++){
             if (slow5_close(open_files_pointers.front()) == EOF) { //close file
@@ -465,6 +543,10 @@ int merge_main(int argc, char **argv, struct program_meta *meta){
             break;
         }
     }
+    arena_free(&arena);
+    if (writer_close(writer) != 0) {
+        return EXIT_FAILURE;
+    }
     DEBUG("time_get_to_mem\t%.3fs", time_get_to_mem);
     DEBUG("time_thread_execution\t%.3fs", time_thread_execution);
     DEBUG("time_write\t%.3fs", time_write);
@@ -474,6 +556,9 @@ int merge_main(int argc, char **argv, struct program_meta *meta){
         slow5_eof_fwrite(slow5File->fp);
     }
     slow5_close(slow5File);
+    if (oi && out_index_close(oi) != 0) {
+        return EXIT_FAILURE;
+    }
 
     EXIT_MSG(EXIT_SUCCESS, argv, meta);
     return EXIT_SUCCESS;
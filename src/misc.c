@@ -42,6 +42,9 @@ void init_opt(opt_t *opt){
     opt->arg_signal_press_out = NULL;
     opt->arg_num_threads = NULL;
     opt->arg_batch = NULL;
+    opt->arg_max_mem = NULL;
+    opt->arg_write_buf = NULL;
+    opt->arg_num_readers = NULL;
     opt->arg_dir_out = NULL;
     opt->arg_lossless = NULL;
     opt->arg_dump_all = NULL;
@@ -56,11 +59,17 @@ void init_opt(opt_t *opt){
     opt->num_threads = DEFAULT_NUM_THREADS;
     opt->num_processes = DEFAULT_NUM_PROCESSES;
     opt->read_id_batch_capacity = DEFAULT_BATCH_SIZE;
+    opt->max_mem = DEFAULT_MAX_MEM;
+    opt->write_buf = DEFAULT_WRITE_BUF;
+    opt->num_readers = DEFAULT_NUM_READERS;
     opt->flag_lossy = DEFAULT_AUXILIARY_FIELDS_NOT_OUT;
     opt->flag_allow_run_id_mismatch = DEFAULT_ALLOW_RUN_ID_MISMATCH;
     opt->flag_retain_dir_structure = DEFAULT_RETAIN_DIR_STRUCTURE;
     opt->flag_dump_all = DEFAULT_DUMP_ALL;
     opt->flag_continue_merge = DEFAULT_CONTINUE_MERGE;
+    opt->flag_mmap = 0;
+    opt->flag_direct = 0;
+    opt->flag_index = 0;
 }
 
 int parse_num_threads(opt_t *opt, int argc, char **argv, struct program_meta *meta){
@@ -149,6 +158,62 @@ int parse_batch_size(opt_t *opt, int argc, char **argv){
     return 0;
 }
 
+// SIZE in bytes, optionally suffixed with K, M, G or T (powers of 1024); -1 if arg is not one
+static int parse_size(const char *arg, size_t *size){
+    char *endptr;
+    double ret = strtod(arg, &endptr);
+    double unit = 1;
+
+    switch (*endptr) {
+        case 'K': case 'k': unit = 1024.0; endptr++; break;
+        case 'M': case 'm': unit = 1024.0 * 1024; endptr++; break;
+        case 'G': case 'g': unit = 1024.0 * 1024 * 1024; endptr++; break;
+        case 'T': case 't': unit = 1024.0 * 1024 * 1024 * 1024; endptr++; break;
+    }
+    if (*endptr == 'B' || *endptr == 'b') {
+        endptr++;
+    }
+    if (endptr == arg || *endptr != '\0' || ret <= 0) {
+        return -1;
+    }
+    *size = (size_t) (ret * unit);
+    return 0;
+}
+
+int parse_max_mem(opt_t *opt, int argc, char **argv){
+    if(opt->arg_max_mem != NULL && parse_size(opt->arg_max_mem, &opt->max_mem) < 0){
+        ERROR("invalid memory limit -- '%s'", opt->arg_max_mem);
+        fprintf(stderr, HELP_SMALL_MSG, argv[0]);
+        return -1;
+    }
+    return 0;
+}
+
+int parse_write_buf(opt_t *opt, int argc, char **argv){
+    if(opt->arg_write_buf != NULL && parse_size(opt->arg_write_buf, &opt->write_buf) < 0){
+        ERROR("invalid write buffer size -- '%s'", opt->arg_write_buf);
+        fprintf(stderr, HELP_SMALL_MSG, argv[0]);
+        return -1;
+    }
+    return 0;
+}
+
+int parse_num_readers(opt_t *opt, int argc, char **argv){
+    if (opt->arg_num_readers != NULL) {
+        char *endptr;
+        long ret = strtol(opt->arg_num_readers, &endptr, 10);
+
+        if (*endptr == '\0' && ret > 0 && ret <= MAX_NUM_READERS) {
+            opt->num_readers = ret;
+        } else {
+            ERROR("invalid number of readers -- '%s'", opt->arg_num_readers);
+            fprintf(stderr, HELP_SMALL_MSG, argv[0]);
+            return -1;
+        }
+    }
+    return 0;
+}
+
 int parse_format_args(opt_t *opt, int argc, char **argv, struct program_meta *meta){
     // Parse format arguments
     if (opt->arg_fmt_in != NULL) {
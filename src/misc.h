@@ -49,11 +49,17 @@ typedef struct {
     size_t num_threads;
     size_t num_processes;
     int64_t read_id_batch_capacity;
+    size_t max_mem;
+    size_t write_buf;
+    int32_t num_readers;
     int flag_lossy;
     int flag_allow_run_id_mismatch;
     int flag_retain_dir_structure;
     int flag_dump_all;
     int flag_continue_merge;
+    int flag_mmap;
+    int flag_direct;
+    int flag_index;
 
     // Input arguments
     char *arg_fname_in;
@@ -65,6 +71,9 @@ typedef struct {
     char *arg_num_threads;
     char *arg_num_processes;
     char *arg_batch;
+    char *arg_max_mem;
+    char *arg_write_buf;
+    char *arg_num_readers;
     char *arg_dir_out;
     char *arg_lossless;
     char *arg_dump_all;
@@ -130,6 +139,9 @@ int parse_num_processes(opt_t *opt, int argc, char **argv, struct program_meta *
 int parse_arg_lossless(opt_t *opt, int argc, char **argv, struct program_meta *meta);
 int parse_arg_dump_all(opt_t *opt, int argc, char **argv, struct program_meta *meta);
 int parse_batch_size(opt_t *opt, int argc, char **arg);
+int parse_max_mem(opt_t *opt, int argc, char **argv);
+int parse_write_buf(opt_t *opt, int argc, char **argv);
+int parse_num_readers(opt_t *opt, int argc, char **argv);
 int parse_format_args(opt_t *opt, int argc, char **argv, struct program_meta *meta);
 int auto_detect_formats(opt_t *opt, int set_default_output_format = 1);
 int parse_compression_opts(opt_t *opt);
@@ -0,0 +1,132 @@
+/**
+ * @file out_index.c
+ * @brief slow5 index of an output file, built while its records are written
+ * @author Hasindu Gamaarachchi (hasindu@garvan.org.au)
+ * @date 17/10/2026
+ */
+#include <unistd.h>
+#include <inttypes.h>
+#include <string>
+#include "out_index.h"
+#include "error.h"
+#include "thread.h"
+#include "slow5_extra.h"
+#include "slow5_idx.h"
+
+extern int slow5tools_verbosity_level;
+
+struct slow5_idx *out_index_empty(const char *data_path, struct slow5_version version, int64_t cap_ids) {
+    struct slow5_idx *index = (struct slow5_idx *) calloc(1, sizeof *index);
+    MALLOC_CHK(index);
+    index->hash = kh_init(slow5_s2i);
+    index->cap_ids = cap_ids > 0 ? cap_ids : 1;
+    index->ids = (char **) malloc(index->cap_ids * sizeof *index->ids);
+    MALLOC_CHK(index->ids);
+    index->version = version;
+    index->pathname = slow5_get_idx_path(data_path);
+    MALLOC_CHK(index->pathname);
+    return index;
+}
+
+int out_index_save(struct slow5_idx *index, struct slow5_version version) {
+    std::string tmp_path = std::string(index->pathname) + ".tmp";
+    if (index->fp != NULL) {
+        fclose(index->fp);
+    }
+    index->fp = fopen(tmp_path.c_str(), "w");
+    if (index->fp == NULL) {
+        ERROR("File '%s' could not be opened - %s.", tmp_path.c_str(), strerror(errno));
+        return -1;
+    }
+    slow5_idx_write(index, version);
+    int ret = 0;
+    if (fclose(index->fp) == EOF) {
+        ERROR("File '%s' failed on closing - %s.", tmp_path.c_str(), strerror(errno));
+        ret = -1;
+    }
+    index->fp = NULL;
+    if (ret == 0 && rename(tmp_path.c_str(), index->pathname) == -1) {
+        ERROR("Could not rename '%s' to '%s' - %s.", tmp_path.c_str(), index->pathname, strerror(errno));
+        ret = -1;
+    }
+    if (ret != 0) {
+        unlink(tmp_path.c_str());
+    }
+    return ret;
+}
+
+char *out_index_rec_id(const char *rec, size_t bytes) {
+    slow5_rid_len_t id_len = 0;
+    if (bytes < sizeof id_len) {
+        return NULL;
+    }
+    memcpy(&id_len, rec, sizeof id_len);
+    if (bytes - sizeof id_len < id_len) {
+        return NULL;
+    }
+    char *id = strndup(rec + sizeof id_len, id_len);
+    MALLOC_CHK(id);
+    return id;
+}
+
+char *out_index_mem_id(const struct slow5_file *sp, const char *mem, size_t bytes) {
+    if (sp->format == SLOW5_FORMAT_ASCII) {
+        const char *tab = (const char *) memchr(mem, '\t', bytes);
+        if (tab == NULL) {
+            return NULL;
+        }
+        char *id = strndup(mem, tab - mem);
+        MALLOC_CHK(id);
+        return id;
+    }
+    if (sp->compress->record_press->method == SLOW5_COMPRESS_NONE) {
+        return out_index_rec_id(mem, bytes);
+    }
+    slow5_press_method_t method = {sp->compress->record_press->method, sp->compress->signal_press->method};
+    struct slow5_press *press = press_cache_get(method);
+    size_t n;
+    char *rec = press ? (char *) slow5_ptr_depress(press->record_press, mem, bytes, &n) : NULL;
+    if (rec == NULL) {
+        return NULL;
+    }
+    char *id = out_index_rec_id(rec, n);
+    free(rec);
+    return id;
+}
+
+out_index_t *out_index_init(const char *out_path, struct slow5_version version) {
+    out_index_t *oi = (out_index_t *) calloc(1, sizeof *oi);
+    MALLOC_CHK(oi);
+    oi->index = out_index_empty(out_path, version, 1024);
+    oi->version = version;
+    return oi;
+}
+
+void out_index_add(out_index_t *oi, char *read_id, uint64_t offset, uint64_t size) {
+    if (oi->err) {
+        free(read_id);
+        return;
+    }
+    if (read_id == NULL) {
+        ERROR("Could not decode the read ID of the record at byte %" PRIu64 " of the output, not writing '%s'.", offset, oi->index->pathname);
+        oi->err = 1;
+    } else if (slow5_idx_insert(oi->index, read_id, offset, size) != 0) {
+        ERROR("Duplicate read ID '%s' in the output, not writing '%s'.", read_id, oi->index->pathname);
+        free(read_id);
+        oi->err = 1;
+    }
+}
+
+int out_index_close(out_index_t *oi) {
+    int ret = oi->err ? -1 : out_index_save(oi->index, oi->version);
+    if (ret == 0) {
+        VERBOSE("Wrote the index of %" PRIu64 " records to '%s'", oi->index->num_ids, oi->index->pathname);
+    }
+    out_index_free(oi);
+    return ret;
+}
+
+void out_index_free(out_index_t *oi) {
+    slow5_idx_free(oi->index);
+    free(oi);
+}
@@ -0,0 +1,36 @@
+// slow5 index (.idx) of an output file, built while its records are written
+
+#ifndef OUT_INDEX_H
+#define OUT_INDEX_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <slow5/slow5.h>
+
+/* the records of an output file as they are written; an error (e.g. a duplicate read id) is kept
+   and reported once, and the index is then not written */
+typedef struct {
+    struct slow5_idx *index;
+    struct slow5_version version;
+    int err;
+} out_index_t;
+
+/* an index without records of the SLOW5/BLOW5 file at data_path, to be written to data_path.idx */
+struct slow5_idx *out_index_empty(const char *data_path, struct slow5_version version, int64_t cap_ids);
+/* write index to its path; it is written aside and renamed, so that get never loads a partial index */
+int out_index_save(struct slow5_idx *index, struct slow5_version version);
+/* the read id of a BLOW5 record after record decompression, malloced; NULL if the record is malformed */
+char *out_index_rec_id(const char *rec, size_t bytes);
+/* the read id of a record of sp as from slow5_get_next_mem(), malloced; NULL if it cannot be decoded */
+char *out_index_mem_id(const struct slow5_file *sp, const char *mem, size_t bytes);
+
+/* index of the output file at out_path whose header has the given version */
+out_index_t *out_index_init(const char *out_path, struct slow5_version version);
+/* the record of read_id is size bytes at offset of the output; takes read_id, which is NULL if it could not be decoded */
+void out_index_add(out_index_t *oi, char *read_id, uint64_t offset, uint64_t size);
+/* write the index, to be called after the output file is complete and closed, and free oi. Returns -1 on error */
+int out_index_close(out_index_t *oi);
+/* free oi without writing the index, e.g. when writing the output failed */
+void out_index_free(out_index_t *oi);
+
+#endif
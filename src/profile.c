@@ -0,0 +1,197 @@
+/**
+ * @file profile.c
+ * @brief --profile: per-stage timings, throughput and thread utilisation written as JSON
+ * @author Hasindu Gamaarachchi (hasindu@garvan.org.au)
+ * @date 17/10/2026
+ */
+#include <inttypes.h>
+#include <pthread.h>
+#include "profile.h"
+#include "error.h"
+
+extern int slow5tools_verbosity_level;
+
+int profile_on = 0;
+
+typedef struct {
+    const char *name;
+    int64_t calls;
+    double real;
+    double cpu;
+    int64_t records;
+    uint64_t bytes_in;
+    uint64_t bytes_out;
+} profile_stage_t;
+
+typedef struct {
+    int64_t batches;
+    double busy;        // wall time running records
+    double busy_cpu;    // CPU time running records
+    double dispatched;  // wall time of the batches this worker took part in
+} profile_thread_t;
+
+static struct {
+    char *path;
+    pthread_mutex_t lock;
+    profile_stage_t stages[PROFILE_MAX_STAGES];
+    int32_t n_stages;
+    profile_thread_t *threads;
+    int32_t n_threads;
+    int64_t dispatches;
+} prof;
+
+int profile_init(const char *path) {
+    prof.path = strdup(path);
+    MALLOC_CHK(prof.path);
+    NEG_CHK(pthread_mutex_init(&prof.lock, NULL));
+    prof.n_stages = 0;
+    prof.threads = NULL;
+    prof.n_threads = 0;
+    prof.dispatches = 0;
+    profile_on = 1;
+    return 0;
+}
+
+void profile_stage(const char *name, const profile_mark_t *start, int64_t records, uint64_t bytes_in, uint64_t bytes_out) {
+    if (!profile_on) {
+        return;
+    }
+    double real = slow5_realtime() - start->real;
+    double cpu = profile_thread_cputime() - start->cpu;
+
+    pthread_mutex_lock(&prof.lock);
+    int32_t i;
+    for (i = 0; i < prof.n_stages; i++) {
+        if (strcmp(prof.stages[i].name, name) == 0) {
+            break;
+        }
+    }
+    if (i == prof.n_stages) {
+        if (prof.n_stages == PROFILE_MAX_STAGES) {
+            pthread_mutex_unlock(&prof.lock);
+            return;
+        }
+        prof.stages[i] = (profile_stage_t) { 0 };
+        prof.stages[i].name = name;
+        prof.n_stages++;
+    }
+    profile_stage_t *s = &prof.stages[i];
+    s->calls++;
+    s->real += real;
+    s->cpu += cpu;
+    s->records += records;
+    s->bytes_in += bytes_in;
+    s->bytes_out += bytes_out;
+    pthread_mutex_unlock(&prof.lock);
+}
+
+void profile_threads_reserve(int32_t num_thread) {
+    if (!profile_on || num_thread <= prof.n_threads) {
+        return;
+    }
+    prof.threads = (profile_thread_t *) realloc(prof.threads, num_thread * sizeof *prof.threads);
+    MALLOC_CHK(prof.threads);
+    memset(prof.threads + prof.n_threads, 0, (num_thread - prof.n_threads) * sizeof *prof.threads);
+    prof.n_threads = num_thread;
+}
+
+void profile_thread_busy(int32_t t, const profile_mark_t *start) {
+    if (!profile_on || t >= prof.n_threads) {
+        return;
+    }
+    profile_thread_t *th = &prof.threads[t];
+    th->batches++;
+    th->busy += slow5_realtime() - start->real;
+    th->busy_cpu += profile_thread_cputime() - start->cpu;
+}
+
+void profile_dispatch(int32_t num_thread, const profile_mark_t *start) {
+    if (!profile_on) {
+        return;
+    }
+    double real = slow5_realtime() - start->real;
+    int32_t t;
+    for (t = 0; t < num_thread && t < prof.n_threads; t++) {
+        prof.threads[t].dispatched += real;
+    }
+    prof.dispatches++;
+}
+
+static void profile_json_str(FILE *fp, const char *s) {
+    fputc('"', fp);
+    for (; *s; s++) {
+        unsigned char c = (unsigned char) *s;
+        if (c == '"' || c == '\\') {
+            fprintf(fp, "\\%c", c);
+        } else if (c < 0x20) {
+            fprintf(fp, "\\u%04x", c);
+        } else {
+            fputc(c, fp);
+        }
+    }
+    fputc('"', fp);
+}
+
+int profile_write(int argc, char **argv, int exit_status, double realtime0) {
+    if (!profile_on) {
+        return 0;
+    }
+    int ret = 0;
+    double real = slow5_realtime() - realtime0;
+
+    FILE *fp = fopen(prof.path, "w");
+    if (fp == NULL) {
+        ERROR("File '%s' could not be opened - %s.", prof.path, strerror(errno));
+        ret = -1;
+    } else {
+        fprintf(fp, "{\n  \"argv\": [");
+        for (int i = 0; i < argc; i++) {
+            if (i) {
+                fprintf(fp, ", ");
+            }
+            profile_json_str(fp, argv[i]);
+        }
+        fprintf(fp, "],\n");
+        fprintf(fp, "  \"exit_status\": %d,\n", exit_status);
+        fprintf(fp, "  \"wall_time\": %.6f,\n", real);
+        fprintf(fp, "  \"cpu_time\": %.6f,\n", slow5_cputime());
+        fprintf(fp, "  \"cpu_time_children\": %.6f,\n", slow5_cputime_child());
+        fprintf(fp, "  \"peak_rss\": %ld,\n", slow5_peakrss());
+        fprintf(fp, "  \"peak_rss_children\": %ld,\n", slow5_peakrss_child());
+
+        fprintf(fp, "  \"stages\": {");
+        for (int32_t i = 0; i < prof.n_stages; i++) {
+            profile_stage_t *s = &prof.stages[i];
+            fprintf(fp, "%s\n    ", i ? "," : "");
+            profile_json_str(fp, s->name);
+            fprintf(fp, ": {\"calls\": %" PRId64 ", \"wall_time\": %.6f, \"cpu_time\": %.6f, "
+                        "\"records\": %" PRId64 ", \"bytes_in\": %" PRIu64 ", \"bytes_out\": %" PRIu64 ", "
+                        "\"records_per_sec\": %.1f}",
+                    s->calls, s->real, s->cpu, s->records, s->bytes_in, s->bytes_out,
+                    s->real > 0 ? s->records / s->real : 0.0);
+        }
+        fprintf(fp, "%s},\n", prof.n_stages ? "\n  " : "");
+
+        fprintf(fp, "  \"batches\": %" PRId64 ",\n", prof.dispatches);
+        fprintf(fp, "  \"threads\": [");
+        for (int32_t t = 0; t < prof.n_threads; t++) {
+            profile_thread_t *th = &prof.threads[t];
+            double idle = th->dispatched > th->busy ? th->dispatched - th->busy : 0;
+            fprintf(fp, "%s\n    {\"thread\": %d, \"batches\": %" PRId64 ", \"busy_time\": %.6f, "
+                        "\"busy_cpu_time\": %.6f, \"idle_time\": %.6f}",
+                    t ? "," : "", t, th->batches, th->busy, th->busy_cpu, idle);
+        }
+        fprintf(fp, "%s]\n}\n", prof.n_threads ? "\n  " : "");
+
+        if (fclose(fp) == EOF) {
+            ERROR("File '%s' failed on closing - %s.", prof.path, strerror(errno));
+            ret = -1;
+        }
+    }
+
+    free(prof.path);
+    free(prof.threads);
+    pthread_mutex_destroy(&prof.lock);
+    profile_on = 0;
+    return ret;
+}
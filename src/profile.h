@@ -0,0 +1,46 @@
+// --profile: per-stage timings, throughput and thread utilisation written as JSON
+
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include <stdint.h>
+#include <time.h>
+#include "misc.h"
+
+#define PROFILE_MAX_STAGES 32 //distinct stage names recorded in a run
+
+/* set by profile_init(); every probe is a no-op unless it is */
+extern int profile_on;
+
+/* the start of a timed interval, wall clock and the CPU time of the calling thread */
+typedef struct {
+    double real;
+    double cpu;
+} profile_mark_t;
+
+static inline double profile_thread_cputime(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static inline void profile_mark(profile_mark_t *m) {
+    if (profile_on) {
+        m->real = slow5_realtime();
+        m->cpu = profile_thread_cputime();
+    }
+}
+
+int profile_init(const char *path);
+/* add the interval since start to stage name (a string literal) with what it processed; safe from any thread */
+void profile_stage(const char *name, const profile_mark_t *start, int64_t records, uint64_t bytes_in, uint64_t bytes_out);
+/* make room for num_thread workers; called by the dispatching thread before the workers run */
+void profile_threads_reserve(int32_t num_thread);
+/* worker t spent the interval since start on its share of a batch; each worker only touches its own slot */
+void profile_thread_busy(int32_t t, const profile_mark_t *start);
+/* a batch was dispatched to num_thread workers and all of them finished in the interval since start */
+void profile_dispatch(int32_t num_thread, const profile_mark_t *start);
+/* write the JSON report for the command argv and free everything; realtime0 is the start of the program */
+int profile_write(int argc, char **argv, int exit_status, double realtime0);
+
+#endif
@@ -6,23 +6,312 @@
  */
 
 #include <getopt.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <inttypes.h>
+#include <string>
+#include <vector>
 #include "error.h"
 #include "cmd.h"
 #include "misc.h"
 #include "slow5_extra.h"
+#include "read_fast5.h"
+#include "reader.h"
+#include "thread.h"
 
 
-#define USAGE_MSG "Usage: %s  [SLOW5_FILE]\n"
+#define USAGE_MSG "Usage: %s [OPTIONS] [SLOW5_FILE/DIR ...]\n"
 #define HELP_LARGE_MSG \
     "Performs a quick check if a SLOW5/BLOW5 file is intact. That is, quickcheck checks if the file begins with a valid header (SLOW5 or BLOW5), attempt to decode the first SLOW5 record and then seeks to the end of the file and checks if proper EOF exists (BLOW5 only)." \
     "If the file is intact, the commands exists with 0. Otherwise exists with a non-zero error code.\n" \
+    "Given several files or directories, checks the files with several threads and prints a tab separated line for each and a line of the totals; exits with a non-zero error code if any file is not intact.\n" \
     USAGE_MSG \
     "\n" \
     "OPTIONS:\n" \
     "    -h, --help         display this message and exit\n" \
+    "    -t, --threads INT  number of threads decoding the records with --deep, or checking files when given several [" TO_STR(DEFAULT_NUM_THREADS) "]\n" \
+    "    -K, --batchsize INT number of records loaded to the memory at once with --deep [" TO_STR(DEFAULT_BATCH_SIZE) "]\n" \
+    "        --deep         also walk every record boundary and decompress and parse every record\n" \
+    "        --check-index  with --deep, also check that FILE.idx has every record at its offset and size\n" \
 
 extern int slow5tools_verbosity_level;
 
+/* outcome of a record with --deep */
+enum {
+    QC_REC_OK = 0,
+    QC_REC_DECODE,      // does not decompress or parse
+    QC_REC_NO_INDEX,    // its read id is not in the index
+    QC_REC_INDEX,       // the index has it at another offset or size
+};
+
+/* a batch of consecutive records of a file checked with --deep */
+typedef struct {
+    int64_t n_batch;
+    char **mem_records;     // as from slow5_get_next_mem()
+    size_t *mem_bytes;
+    uint64_t *offsets;      // of each record in the file
+    uint64_t *sizes;        // of each record in the file, as in the index
+    int *status;            // QC_REC_*
+} quickcheck_batch_t;
+
+static void quickcheck_rec(core_t *core, quickcheck_batch_t *db, int32_t i) {
+    struct slow5_idx *index = (struct slow5_idx *) core->param;
+    slow5_rec_t *rec = NULL;
+    char *mem = db->mem_records[i];
+    size_t bytes = db->mem_bytes[i];
+    db->status[i] = QC_REC_OK;
+    if (slow5_decode(&mem, &bytes, &rec, core->fp) < 0) {
+        db->status[i] = QC_REC_DECODE;
+    } else if (index) {
+        khint_t k = kh_get(slow5_s2i, index->hash, rec->read_id);
+        if (k == kh_end(index->hash)) {
+            db->status[i] = QC_REC_NO_INDEX;
+        } else if (kh_value(index->hash, k).offset != db->offsets[i] || kh_value(index->hash, k).size != db->sizes[i]) {
+            db->status[i] = QC_REC_INDEX;
+        }
+    }
+    slow5_rec_free(rec);
+    free(mem);
+}
+
+/* the next BLOW5 record from the stream of sp at *pos, without its length prefix; 0 at the end of the records, -1 if the prefix is past the end */
+static int quickcheck_next_blow5(slow5_file_t *sp, uint64_t pos, uint64_t end, char **mem, size_t *bytes) {
+    if (pos == end) {
+        return 0;
+    }
+    slow5_rec_size_t size;
+    if (end - pos < sizeof size || fread(&size, sizeof size, 1, sp->fp) != 1 || size > end - pos - sizeof size) {
+        return -1;
+    }
+    *mem = (char *) malloc(size);
+    MALLOC_CHK(*mem);
+    if (fread(*mem, 1, size, sp->fp) != size) {
+        free(*mem);
+        return -1;
+    }
+    *bytes = size;
+    return 1;
+}
+
+/*
+ * Walk all records of sp from the first, checking that each BLOW5 record starts where the previous
+ * one ended and that the last one ends at the EOF marker, and decode them all with
+ * opt->num_threads threads. With index, also check that it has each record at its offset and size
+ * and no other records. Returns an empty string if all is well, else what is wrong and where.
+ */
+static std::string quickcheck_deep(slow5_file_t *sp, const opt_t *opt, struct slow5_idx *index) {
+    uint64_t pos = sp->meta.start_rec_offset;
+    const char eof[] = SLOW5_BINARY_EOF;
+    struct stat st;
+    if (fstat(fileno(sp->fp), &st) == -1 || fseeko(sp->fp, pos, SEEK_SET) != 0) {
+        return "cannot be read from its first record";
+    }
+    uint64_t end = sp->format == SLOW5_FORMAT_BINARY ? st.st_size - sizeof eof : st.st_size;
+#ifdef POSIX_FADV_SEQUENTIAL
+    posix_fadvise(fileno(sp->fp), pos, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+
+    std::string err;
+    batch_ctl_t ctl;
+    batch_ctl_init(&ctl, opt, 1);
+    arena_t arena; // per-batch arrays, reused across batches
+    arena_init(&arena, 0);
+    uint64_t num_records = 0;
+    int flag_end_of_file = 0;
+    while (err.empty() && !flag_end_of_file) {
+        quickcheck_batch_t db;
+        int64_t batch_size = ctl.batch_size;
+        arena_reset(&arena);
+        db.mem_records = (char **) arena_alloc(&arena, batch_size * sizeof *db.mem_records);
+        db.mem_bytes = (size_t *) arena_alloc(&arena, batch_size * sizeof *db.mem_bytes);
+        db.offsets = (uint64_t *) arena_alloc(&arena, batch_size * sizeof *db.offsets);
+        db.sizes = (uint64_t *) arena_alloc(&arena, batch_size * sizeof *db.sizes);
+        db.status = (int *) arena_alloc(&arena, batch_size * sizeof *db.status);
+        int64_t n = 0;
+        size_t bytes_in = 0;
+        while (!batch_ctl_full(&ctl, n, bytes_in)) {
+            char *mem;
+            size_t bytes;
+            int ret;
+            if (sp->format == SLOW5_FORMAT_BINARY) {
+                ret = quickcheck_next_blow5(sp, pos, end, &mem, &bytes);
+            } else {
+                ret = slow5_get_next_bytes(&mem, &bytes, sp) < 0 ? (slow5_errno == SLOW5_ERR_EOF ? 0 : -1) : 1;
+            }
+            if (ret <= 0) {
+                if (ret < 0) {
+                    err = (sp->format == SLOW5_FORMAT_BINARY ? "has a bad record length at byte " : "cannot be read at byte ") + std::to_string(pos);
+                }
+                flag_end_of_file = 1;
+                break;
+            }
+            uint64_t size = sp->format == SLOW5_FORMAT_BINARY ? sizeof (slow5_rec_size_t) + bytes : bytes + 1;
+            db.mem_records[n] = mem;
+            db.mem_bytes[n] = bytes;
+            db.offsets[n] = pos;
+            db.sizes[n] = size;
+            pos += size;
+            bytes_in += bytes;
+            n++;
+        }
+
+        double realtime = slow5_realtime();
+        core_t core;
+        core.num_thread = opt->num_threads;
+        core.fp = sp;
+        core.param = index;
+        db.n_batch = n;
+        work_db(&core, &db, work_fn<quickcheck_batch_t, quickcheck_rec>(), db.mem_bytes);
+        batch_ctl_update(&ctl, n, bytes_in, 0, slow5_realtime() - realtime);
+        num_records += n;
+
+        // the first bad record of the batch comes before a bad length found while reading it
+        for (int64_t i = 0; i < n; i++) {
+            if (db.status[i] == QC_REC_DECODE) {
+                err = "has a record that cannot be decoded at byte " + std::to_string(db.offsets[i]);
+            } else if (db.status[i] == QC_REC_NO_INDEX) {
+                err = "has a record that is not in the index at byte " + std::to_string(db.offsets[i]);
+            } else if (db.status[i] == QC_REC_INDEX) {
+                err = "has a record that the index has elsewhere at byte " + std::to_string(db.offsets[i]);
+            } else {
+                continue;
+            }
+            break;
+        }
+    }
+    arena_free(&arena);
+
+    if (err.empty() && index && index->num_ids != num_records) {
+        err = "has " + std::to_string(num_records) + " records but its index " + std::to_string(index->num_ids);
+    }
+    VERBOSE("%s: %" PRIu64 " records checked", sp->meta.pathname, num_records);
+    return err;
+}
+
+/* how to check a file */
+typedef struct {
+    int deep;
+    int check_index;
+    opt_t opt;      // for --deep
+} quickcheck_opt_t;
+
+/* check the file at path; an empty string if it is intact, else what is wrong with it */
+static std::string quickcheck_file(const char *path, const quickcheck_opt_t *qo) {
+    slow5_file_t* slow5File = slow5_open(path, "r");
+    if(!slow5File){
+        return "cannot be opened";
+    }
+
+    std::string err;
+    slow5_rec_t *rec = NULL;
+    if(slow5_get_next(&rec,slow5File) < 0){
+        err = "does not have a proper slow5 record/format";
+    }
+    slow5_rec_free(rec);
+
+    if(err.empty() && slow5File->format==SLOW5_FORMAT_BINARY){
+        const char eof[] = SLOW5_BINARY_EOF;
+        if(fseek(slow5File->fp , 0, SEEK_END) !=0 ){
+            err = "fseek to the end of the BLOW5 file failed";
+        } else if(slow5_is_eof(slow5File->fp, eof, sizeof eof)!=1){
+            err = "has no valid slow5 eof marker at the end of the BLOW5 file";
+        }
+    }
+
+    if(err.empty() && qo->deep){
+        struct slow5_idx *index = NULL;
+        if (qo->check_index) {
+            std::string idx_path = std::string(path) + SLOW5_INDEX_EXTENSION;
+            // slow5_idx_load() would build and write an index that does not exist yet
+            if (access(idx_path.c_str(), R_OK) != 0) {
+                err = "has no index to check";
+            } else if (slow5_idx_load(slow5File) != 0) {
+                err = "has an index that cannot be loaded";
+            } else {
+                index = slow5File->index;
+            }
+        }
+        if (err.empty()) {
+            err = quickcheck_deep(slow5File, &qo->opt, index);
+        }
+    }
+    slow5_close(slow5File);
+    return err;
+}
+
+/* a batch of files, each checked by one thread */
+typedef struct {
+    int64_t n_batch;
+    const char **paths;
+    std::string *errs;      // empty for the intact files
+    const quickcheck_opt_t *qo;
+} quickcheck_files_batch_t;
+
+static void quickcheck_work(core_t *core, quickcheck_files_batch_t *db, int32_t i) {
+    db->errs[i] = quickcheck_file(db->paths[i], db->qo);
+}
+
+#define QUICKCHECK_FILES_BATCH 1024 // files checked before their lines are printed
+
+/*
+ * check many files and directories with num_threads threads; a tab separated line for each file
+ * in the order found, then the totals. With --deep each file is decoded by the thread checking it.
+ */
+static int quickcheck_files(int num_args, char **args, int32_t num_threads, const quickcheck_opt_t *qo) {
+    std::vector<std::string> paths;
+    for (int i = 0; i < num_args; i++) {
+        if (is_directory(args[i])) {
+            list_all_items(args[i], paths, 0, ".slow5");
+        } else {
+            paths.push_back(args[i]);
+        }
+    }
+    if (paths.empty()) {
+        ERROR("No slow5/blow5 files found.%s","");
+        return EXIT_FAILURE;
+    }
+
+    quickcheck_opt_t file_qo = *qo;
+    file_qo.opt.num_threads = 1;
+    core_t core;
+    core.num_thread = num_threads;
+    std::vector<const char *> batch_paths(QUICKCHECK_FILES_BATCH);
+    std::vector<std::string> errs(QUICKCHECK_FILES_BATCH);
+    std::vector<size_t> cost(QUICKCHECK_FILES_BATCH);
+    uint64_t num_bad = 0;
+
+    fprintf(stdout, "#file\tstatus\terror\n");
+    for (size_t from = 0; from < paths.size(); from += QUICKCHECK_FILES_BATCH) {
+        quickcheck_files_batch_t db;
+        db.n_batch = paths.size() - from < QUICKCHECK_FILES_BATCH ? paths.size() - from : QUICKCHECK_FILES_BATCH;
+        db.paths = batch_paths.data();
+        db.errs = errs.data();
+        db.qo = &file_qo;
+        for (int64_t i = 0; i < db.n_batch; i++) {
+            batch_paths[i] = paths[from + i].c_str();
+            struct stat st;
+            cost[i] = qo->deep && stat(batch_paths[i], &st) == 0 ? st.st_size : 1;
+        }
+        // a quick check reads the header, a record and the end of a file whatever its size, a deep one all of it
+        work_db(&core, &db, work_fn<quickcheck_files_batch_t, quickcheck_work>(), cost.data());
+
+        for (int64_t i = 0; i < db.n_batch; i++) {
+            int bad = !errs[i].empty();
+            num_bad += bad;
+            fprintf(stdout, "%s\t%s\t%s\n", batch_paths[i], bad ? "bad" : "ok", bad ? errs[i].c_str() : ".");
+        }
+    }
+    // the totals, as a comment line so that the table can be read without it
+    fprintf(stdout, "#total\t%zu/%zu ok\t.\n", paths.size() - num_bad, paths.size());
+
+    if (num_bad > 0) {
+        ERROR("%" PRIu64 " of %zu files are not intact.", num_bad, paths.size());
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
+
 int quickcheck_main(int argc, char **argv, struct program_meta *meta){
 
     // Debug: print arguments
@@ -30,15 +319,25 @@ int quickcheck_main(int argc, char **argv, struct program_meta *meta){
 
     static struct option long_opts[] = {
             {"help", no_argument, NULL, 'h' }, //0
+            {"threads", required_argument, NULL, 't' }, //1
+            {"batchsize", required_argument, NULL, 'K' }, //2
+            {"deep", no_argument, NULL, 0 }, //3
+            {"check-index", no_argument, NULL, 0 }, //4
             {NULL, 0, NULL, 0 }
     };
 
+    opt_t user_opts;
+    init_opt(&user_opts);
+    quickcheck_opt_t qo;
+    qo.deep = 0;
+    qo.check_index = 0;
+
     // Input arguments
     int longindex = 0;
     int opt;
 
     // Parse options
-    while ((opt = getopt_long(argc, argv, "h", long_opts, &longindex)) != -1) {
+    while ((opt = getopt_long(argc, argv, "ht:K:", long_opts, &longindex)) != -1) {
         DEBUG("opt='%c', optarg=\"%s\", optind=%d, opterr=%d, optopt='%c'",
                   opt, optarg, optind, opterr, optopt);
         switch (opt) {
@@ -49,6 +348,19 @@ int quickcheck_main(int argc, char **argv, struct program_meta *meta){
 
                 EXIT_MSG(EXIT_SUCCESS, argv, meta);
                 exit(EXIT_SUCCESS);
+            case 't':
+                user_opts.arg_num_threads = optarg;
+                break;
+            case 'K':
+                user_opts.arg_batch = optarg;
+                break;
+            case 0  :
+                if (longindex == 3) {
+                    qo.deep = 1;
+                } else if (longindex == 4) {
+                    qo.check_index = 1;
+                }
+                break;
             default: // case '?'
                 fprintf(stderr, HELP_SMALL_MSG, argv[0]);
                 EXIT_MSG(EXIT_FAILURE, argv, meta);
@@ -56,47 +368,33 @@ int quickcheck_main(int argc, char **argv, struct program_meta *meta){
         }
     }
 
-    if (argc - optind < 1){
-        ERROR("%s", "Not enough arguments");
-        fprintf(stderr, HELP_SMALL_MSG, argv[0]);
+    if(parse_num_threads(&user_opts,argc,argv,meta) < 0 || parse_batch_size(&user_opts,argc,argv) < 0){
         EXIT_MSG(EXIT_FAILURE, argv, meta);
-        exit(EXIT_FAILURE);
+        return EXIT_FAILURE;
     }
+    if (qo.check_index && !qo.deep) {
+        ERROR("%s", "--check-index needs --deep");
+        EXIT_MSG(EXIT_FAILURE, argv, meta);
+        return EXIT_FAILURE;
+    }
+    qo.opt = user_opts;
 
-    if (argc - optind > 1){
-        ERROR("%s", "Too many arguments");
+    if (argc - optind < 1){
+        ERROR("%s", "Not enough arguments");
         fprintf(stderr, HELP_SMALL_MSG, argv[0]);
         EXIT_MSG(EXIT_FAILURE, argv, meta);
         exit(EXIT_FAILURE);
     }
 
-
-    slow5_file_t* slow5File = slow5_open(argv[optind], "r");
-    if(!slow5File){
-        ERROR("Opening %s failed\n", argv[optind]);
-        exit(EXIT_FAILURE);
+    if (argc - optind > 1 || is_directory(argv[optind])){
+        return quickcheck_files(argc - optind, argv + optind, user_opts.num_threads, &qo);
     }
 
-    int ret_get_next = 0;
-    slow5_rec_t *rec = NULL;
-    if((ret_get_next=slow5_get_next(&rec,slow5File)) < 0){
-        ERROR("%s does not have a proper slow5 record/format", argv[optind]);
+    std::string err = quickcheck_file(argv[optind], &qo);
+    if (!err.empty()) {
+        ERROR("%s %s", argv[optind], err.c_str());
         exit(EXIT_FAILURE);
     }
-    slow5_rec_free(rec);
-
-    if(slow5File->format==SLOW5_FORMAT_BINARY){
-        if(fseek(slow5File->fp , 0, SEEK_END) !=0 ){
-            ERROR("%s","Fseek to the end of the BLOW file failed.");
-            exit(EXIT_FAILURE);
-        }
-        const char eof[] = SLOW5_BINARY_EOF;
-        if(slow5_is_eof(slow5File->fp, eof, sizeof eof)!=1){
-            ERROR("%s","No valid slow5 eof marker at the end of the BLOW5 file.");
-            exit(EXIT_FAILURE);
-        }
-    }
-    slow5_close(slow5File);
 
     return EXIT_SUCCESS;
 }
@@ -174,10 +174,17 @@ int print_slow5_header(operator_obj* operator_data) {
 }
 
 int print_record(operator_obj* operator_data) {
-    if(slow5_rec_fwrite(operator_data->slow5File->fp, operator_data->slow5_record, operator_data->slow5File->header->aux_meta, operator_data->format_out, operator_data->press_ptr) == -1){
+    FILE *fp = operator_data->slow5File->fp;
+    off_t offset = operator_data->out_index ? ftello(fp) : 0;
+    if(slow5_rec_fwrite(fp, operator_data->slow5_record, operator_data->slow5File->header->aux_meta, operator_data->format_out, operator_data->press_ptr) == -1){
         ERROR("Could not write the SLOW5 record for read id '%s' to %s.", operator_data->slow5_record->read_id, operator_data->slow5File->meta.pathname);
         return -1;
     }
+    if(operator_data->out_index){
+        char *read_id = strdup(operator_data->slow5_record->read_id);
+        MALLOC_CHK(read_id);
+        out_index_add(operator_data->out_index, read_id, offset, ftello(fp) - offset);
+    }
     return 0;
 }
 
@@ -211,6 +218,7 @@ fast5_file_t fast5_open(const char* filename) {
 int read_fast5(opt_t *user_opts,
                fast5_file_t *fast5_file,
                slow5_file_t *slow5File,
+               out_index_t *out_index,
                int write_header_flag,
                std::unordered_map<std::string, uint32_t>* warning_map) {
 
@@ -236,6 +244,7 @@ int read_fast5(opt_t *user_opts,
 
     tracker.fast5_path = fast5_file->fast5_path;
     tracker.slow5File = slow5File;
+    tracker.out_index = out_index;
 
     int flag_context_tags = 0;
     int flag_tracking_id = 0;
@@ -1,9 +1,11 @@
 // definitions used for FAST5 to SLOW5 conversion (some of the functions must be moved to elsewhere as they are common)
 #include <unordered_map>
 #include "misc.h"
+#include "out_index.h"
 #include <vector>
 
 //void free_attributes(group_flags group_flag, operator_obj* operator_data);
+bool is_directory(const std::string& file_name);
 std::vector< std::string > list_directory(const std::string& file_name);
 
 void list_all_items(const std::string& path, std::vector<std::string>& files, int count_dir, const char* extension);
@@ -84,6 +86,7 @@ struct operator_obj {
     hsize_t* num_read_groups;
     size_t* nreads;
     slow5_file_t* slow5File;
+    out_index_t *out_index;     // with --index, the index of slow5File; NULL otherwise
     std::unordered_map<std::string, uint32_t>* warning_map;
     int *primary_fields_count;
 };
@@ -92,6 +95,7 @@ struct operator_obj {
 int read_fast5(opt_t *user_opts,
                fast5_file_t *fast5_file,
                slow5_file_t *slow5File,
+               out_index_t *out_index,
                int write_header_flag,
                std::unordered_map<std::string, uint32_t>* warning_map);
 fast5_file_t fast5_open(const char* filename);
@@ -0,0 +1,579 @@
+/**
+ * @file reader.c
+ * @brief reading SLOW5/BLOW5 records into batches
+ * @author Hasindu Gamaarachchi (hasindu@garvan.org.au)
+ * @date 17/10/2026
+ */
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <algorithm>
+#include "reader.h"
+#include "error.h"
+#include "thread.h"
+#include "slow5_extra.h"
+
+extern int slow5tools_verbosity_level;
+
+/* byte limit of a single batch: the budget is shared by the batches in flight, each holding its input and output records */
+static inline void batch_ctl_set_max_bytes(batch_ctl_t *ctl) {
+    if (ctl->max_mem > 0) {
+        ctl->max_bytes = (size_t) (ctl->max_mem / (ctl->in_flight * (1.0 + ctl->out_ratio)));
+        if (ctl->max_bytes == 0) {
+            ctl->max_bytes = 1;
+        }
+    }
+}
+
+void batch_ctl_init(batch_ctl_t *ctl, const opt_t *opt, int32_t in_flight) {
+    ctl->batch_size = opt->read_id_batch_capacity > 0 ? opt->read_id_batch_capacity : 1;
+    ctl->min_size = opt->num_threads > 0 ? opt->num_threads : 1;
+    ctl->max_size = BATCH_MAX_SIZE;
+    if (ctl->min_size > ctl->batch_size) {
+        ctl->min_size = ctl->batch_size;
+    }
+    if (ctl->max_size < ctl->batch_size) {
+        ctl->max_size = ctl->batch_size;
+    }
+    ctl->max_mem = opt->max_mem;
+    ctl->in_flight = in_flight > 0 ? in_flight : 1;
+    ctl->out_ratio = 1.0; // until a batch has been seen
+    ctl->max_bytes = 0;
+    batch_ctl_set_max_bytes(ctl);
+}
+
+void batch_ctl_update(batch_ctl_t *ctl, int64_t n, size_t bytes_in, size_t bytes_out, double time) {
+    if (n <= 0 || bytes_in == 0) {
+        return;
+    }
+
+    ctl->out_ratio = 0.5 * ctl->out_ratio + 0.5 * ((double) bytes_out / bytes_in);
+    batch_ctl_set_max_bytes(ctl);
+
+    int byte_limited = ctl->max_bytes > 0 && bytes_in >= ctl->max_bytes;
+    if (time < BATCH_TARGET_TIME / 2 && n >= ctl->batch_size && !byte_limited) {
+        // too little work per batch to keep the threads busy
+        ctl->batch_size = ctl->batch_size * 2 < ctl->max_size ? ctl->batch_size * 2 : ctl->max_size;
+    } else if (time > BATCH_TARGET_TIME * 2 || (byte_limited && n < ctl->batch_size / 2)) {
+        // batches are slow or limited by memory
+        ctl->batch_size = ctl->batch_size / 2 > ctl->min_size ? ctl->batch_size / 2 : ctl->min_size;
+    }
+    DEBUG("batch of %" PRId64 " records, %zu bytes in, %zu bytes out, %.3fs; next batch %" PRId64 " records, %zu bytes",
+          n, bytes_in, bytes_out, time, ctl->batch_size, ctl->max_bytes);
+}
+
+/*
+ * Range readers split the records of a BLOW5 file into segments of about a batch each. Reader r
+ * preads segments r, r+N, r+2N, ... into batches and queues them; the consumer takes segment k
+ * from the queue of reader k%N, so batches come out in file order while all N readers keep
+ * READER_QUEUE_DEPTH batches ahead. The record offsets come from the index if the file has one,
+ * otherwise from hopping over the record length prefixes.
+ */
+struct range_reader {
+    int fd;
+    uint64_t *offsets;          // start of each record, then the end of the records
+    int64_t *segs;              // first record of each segment, then the number of records
+    int64_t n_segs;
+    int64_t next;               // next segment for the consumer
+    int32_t num_readers;
+    pthread_t *tids;
+    work_queue_t **queues;      // one per reader
+    int stop;                   // set when the consumer gives up early
+};
+
+typedef struct {
+    range_reader_t *rr;
+    int32_t r;
+} range_reader_arg_t;
+
+/* record offsets by hopping over the length prefixes; the pages read are at record starts only */
+static int64_t range_offsets_scan(int fd, uint64_t start, uint64_t end, uint64_t **offsets) {
+    int64_t n = 0;
+    int64_t cap = 1024;
+    uint64_t *off = (uint64_t *) malloc(cap * sizeof *off);
+    MALLOC_CHK(off);
+
+    uint64_t pos = start;
+    while (pos < end) {
+        slow5_rec_size_t size;
+        if (pread(fd, &size, sizeof size, pos) != (ssize_t) sizeof size || pos + sizeof size + size > end) {
+            ERROR("Malformed record at byte %" PRIu64, pos);
+            free(off);
+            return -1;
+        }
+        if (n + 1 == cap) {
+            cap *= 2;
+            off = (uint64_t *) realloc(off, cap * sizeof *off);
+            MALLOC_CHK(off);
+        }
+        off[n++] = pos;
+        pos += sizeof size + size;
+    }
+    off[n] = end;
+    *offsets = off;
+    return n;
+}
+
+/* record offsets from the index of from, if there is one; -1 if not or if it does not fit the file */
+static int64_t range_offsets_index(struct slow5_file *from, uint64_t start, uint64_t end, uint64_t **offsets) {
+    std::string idx_path = std::string(from->meta.pathname) + SLOW5_INDEX_EXTENSION;
+    // slow5_idx_load() would build and write an index that does not exist yet
+    if (access(idx_path.c_str(), R_OK) != 0 || slow5_idx_load(from) != 0) {
+        return -1;
+    }
+
+    int64_t n = from->index->num_ids;
+    uint64_t *off = (uint64_t *) malloc((n + 1) * sizeof *off);
+    MALLOC_CHK(off);
+    for (int64_t i = 0; i < n; i++) {
+        khint_t k = kh_get(slow5_s2i, from->index->hash, from->index->ids[i]);
+        off[i] = kh_value(from->index->hash, k).offset;
+    }
+    std::sort(off, off + n);
+    off[n] = end;
+
+    int ok = n == 0 ? start == end : off[0] == start;
+    for (int64_t i = 0; ok && i < n; i++) {
+        ok = off[i] + sizeof (slow5_rec_size_t) <= off[i + 1];
+    }
+    if (!ok) {
+        WARNING("Index '%s' does not match the file, scanning the records instead", idx_path.c_str());
+        free(off);
+        return -1;
+    }
+    *offsets = off;
+    return n;
+}
+
+/* read the records of segment s; the length prefix of each is checked against the offsets */
+static range_batch_t *range_read_seg(range_reader_t *rr, int64_t s) {
+    int64_t first = rr->segs[s];
+    int64_t n = rr->segs[s + 1] - first;
+
+    range_batch_t *b = (range_batch_t *) malloc(sizeof *b);
+    MALLOC_CHK(b);
+    b->n_batch = n;
+    b->bytes = 0;
+    b->mem_records = (char **) malloc(n * sizeof *b->mem_records);
+    b->mem_bytes = (size_t *) malloc(n * sizeof *b->mem_bytes);
+    MALLOC_CHK(b->mem_records);
+    MALLOC_CHK(b->mem_bytes);
+
+    for (int64_t i = 0; i < n; i++) {
+        uint64_t off = rr->offsets[first + i];
+        slow5_rec_size_t size = rr->offsets[first + i + 1] - off - sizeof size;
+        slow5_rec_size_t prefix;
+        char *mem = (char *) malloc(size);
+        MALLOC_CHK(mem);
+
+        struct iovec iov[2] = { { &prefix, sizeof prefix }, { mem, size } };
+        ssize_t got = preadv(rr->fd, iov, 2, off);
+        if (got != (ssize_t) (sizeof prefix + size) || prefix != size) {
+            if (got == -1) {
+                ERROR("Reading the record at byte %" PRIu64 " failed - %s.", off, strerror(errno));
+            } else {
+                ERROR("Malformed record at byte %" PRIu64 ", is the index out of date?", off);
+            }
+            free(mem);
+            for (int64_t j = 0; j < i; j++) {
+                free(b->mem_records[j]);
+            }
+            b->n_batch = 0;
+            range_batch_free(b);
+            return NULL;
+        }
+        b->mem_records[i] = mem;
+        b->mem_bytes[i] = size;
+        b->bytes += size;
+    }
+    return b;
+}
+
+static void *range_reader_thread(void *voidarg) {
+    range_reader_arg_t *arg = (range_reader_arg_t *) voidarg;
+    range_reader_t *rr = arg->rr;
+
+    for (int64_t s = arg->r; s < rr->n_segs && !__atomic_load_n(&rr->stop, __ATOMIC_RELAXED); s += rr->num_readers) {
+        profile_mark_t start;
+        profile_mark(&start);
+        range_batch_t *b = range_read_seg(rr, s);
+        if (b == NULL) {
+            break;
+        }
+        profile_stage("read", &start, b->n_batch, b->bytes, 0);
+        work_queue_push(rr->queues[arg->r], b);
+    }
+    work_queue_close(rr->queues[arg->r]);
+    free(arg);
+    return NULL;
+}
+
+range_reader_t *range_reader_init(struct slow5_file *from, int32_t num_readers, int64_t batch_size, size_t max_bytes) {
+    if (from->format != SLOW5_FORMAT_BINARY) {
+        return NULL;
+    }
+    int fd = fileno(from->fp);
+    off_t start = ftello(from->fp);
+    struct stat st;
+    const char eof[] = SLOW5_BINARY_EOF;
+    if (start < 0 || fstat(fd, &st) == -1 || !S_ISREG(st.st_mode) || st.st_size < start + (off_t) sizeof eof) {
+        return NULL;
+    }
+    uint64_t end = st.st_size - sizeof eof;
+
+    double realtime = slow5_realtime();
+    uint64_t *offsets = NULL;
+    int64_t n = range_offsets_index(from, start, end, &offsets);
+    if (n < 0) {
+        n = range_offsets_scan(fd, start, end, &offsets);
+        if (n < 0) {
+            return NULL;
+        }
+    }
+
+    range_reader_t *rr = (range_reader_t *) calloc(1, sizeof *rr);
+    MALLOC_CHK(rr);
+    rr->fd = fd;
+    rr->offsets = offsets;
+    rr->num_readers = num_readers;
+
+    // segments of batch_size records, cut short at max_bytes
+    int64_t cap = n / batch_size + 2;
+    rr->segs = (int64_t *) malloc(cap * sizeof *rr->segs);
+    MALLOC_CHK(rr->segs);
+    int64_t i = 0;
+    while (i < n) {
+        int64_t j = i + 1;
+        while (j < n && j - i < batch_size && (max_bytes == 0 || offsets[j + 1] - offsets[i] <= max_bytes)) {
+            j++;
+        }
+        if (rr->n_segs + 1 == cap) {
+            cap *= 2;
+            rr->segs = (int64_t *) realloc(rr->segs, cap * sizeof *rr->segs);
+            MALLOC_CHK(rr->segs);
+        }
+        rr->segs[rr->n_segs++] = i;
+        i = j;
+    }
+    rr->segs[rr->n_segs] = n;
+    VERBOSE("%" PRId64 " records in %" PRId64 " segments for %d readers - took %.3fs", n, rr->n_segs, num_readers, slow5_realtime() - realtime);
+
+    rr->tids = (pthread_t *) malloc(num_readers * sizeof *rr->tids);
+    rr->queues = (work_queue_t **) malloc(num_readers * sizeof *rr->queues);
+    MALLOC_CHK(rr->tids);
+    MALLOC_CHK(rr->queues);
+    for (int32_t r = 0; r < num_readers; r++) {
+        rr->queues[r] = work_queue_init(READER_QUEUE_DEPTH);
+    }
+    for (int32_t r = 0; r < num_readers; r++) {
+        range_reader_arg_t *arg = (range_reader_arg_t *) malloc(sizeof *arg);
+        MALLOC_CHK(arg);
+        arg->rr = rr;
+        arg->r = r;
+        NEG_CHK(pthread_create(&rr->tids[r], NULL, range_reader_thread, (void *) arg));
+    }
+    return rr;
+}
+
+int range_reader_next(range_reader_t *rr, range_batch_t **batch) {
+    if (rr->next == rr->n_segs) {
+        return 0;
+    }
+    *batch = (range_batch_t *) work_queue_pop(rr->queues[rr->next % rr->num_readers]);
+    if (*batch == NULL) { // the reader gave up on this segment
+        return -1;
+    }
+    rr->next++;
+    return 1;
+}
+
+void range_batch_free(range_batch_t *batch) {
+    free(batch->mem_records);
+    free(batch->mem_bytes);
+    free(batch);
+}
+
+void range_reader_free(range_reader_t *rr) {
+    __atomic_store_n(&rr->stop, 1, __ATOMIC_RELAXED);
+    for (int32_t r = 0; r < rr->num_readers; r++) {
+        range_batch_t *b;
+        while ((b = (range_batch_t *) work_queue_pop(rr->queues[r])) != NULL) {
+            for (int64_t i = 0; i < b->n_batch; i++) {
+                free(b->mem_records[i]);
+            }
+            range_batch_free(b);
+        }
+    }
+    for (int32_t r = 0; r < rr->num_readers; r++) {
+        NEG_CHK(pthread_join(rr->tids[r], NULL));
+        work_queue_free(rr->queues[r]);
+    }
+    free(rr->tids);
+    free(rr->queues);
+    free(rr->segs);
+    free(rr->offsets);
+    free(rr);
+}
+
+/*
+ * The mmap reader maps the whole file and hands out pointers to the records in the map, so the
+ * compressed bytes are neither copied into a stdio buffer nor into a record of their own; the
+ * workers decompress straight from the mapped pages. The map is private and writable so that a
+ * parser touching the bytes would get its own copy of the page instead of a fault. Sequential
+ * readers ask for the pages READER_MMAP_WILLNEED bytes ahead of the last record taken.
+ */
+struct mmap_reader {
+    char *base;
+    size_t len;
+    uint64_t start;             // first record
+    uint64_t end;               // end of the records (the EOF marker)
+    uint64_t pos;               // next record for mmap_reader_next
+    uint64_t advised;           // pages before this have been asked for
+    int sequential;
+};
+
+static void mmap_reader_advise(mmap_reader_t *mr, uint64_t upto) {
+    while (mr->advised < upto && mr->advised < mr->len) {
+        size_t len = mr->len - mr->advised < READER_MMAP_WILLNEED ? mr->len - mr->advised : READER_MMAP_WILLNEED;
+        if (madvise(mr->base + mr->advised, len, MADV_WILLNEED) == -1) {
+            DEBUG("madvise(MADV_WILLNEED) failed - %s", strerror(errno));
+        }
+        mr->advised += len;
+    }
+}
+
+mmap_reader_t *mmap_reader_init(struct slow5_file *from, int sequential) {
+    if (from->format != SLOW5_FORMAT_BINARY) {
+        return NULL;
+    }
+    int fd = fileno(from->fp);
+    off_t start = from->meta.start_rec_offset; // the stream may have moved, e.g. by building the index
+    struct stat st;
+    const char eof[] = SLOW5_BINARY_EOF;
+    if (fstat(fd, &st) == -1 || !S_ISREG(st.st_mode) || st.st_size < start + (off_t) sizeof eof) {
+        return NULL;
+    }
+
+    void *base = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    if (base == MAP_FAILED) {
+        WARNING("Could not map '%s' - %s.", from->meta.pathname, strerror(errno));
+        return NULL;
+    }
+    if (madvise(base, st.st_size, sequential ? MADV_SEQUENTIAL : MADV_RANDOM) == -1) {
+        DEBUG("madvise failed - %s", strerror(errno));
+    }
+
+    mmap_reader_t *mr = (mmap_reader_t *) malloc(sizeof *mr);
+    MALLOC_CHK(mr);
+    mr->base = (char *) base;
+    mr->len = st.st_size;
+    mr->start = start;
+    mr->end = st.st_size - sizeof eof;
+    mr->pos = start;
+    mr->advised = start & ~((uint64_t) sysconf(_SC_PAGESIZE) - 1);
+    mr->sequential = sequential;
+    if (memcmp(mr->base + mr->end, eof, sizeof eof) != 0) {
+        WARNING("'%s' does not end with the BLOW5 EOF marker, not mapping it.", from->meta.pathname);
+        mmap_reader_free(mr);
+        return NULL;
+    }
+    if (sequential) {
+        mmap_reader_advise(mr, mr->pos + READER_MMAP_WILLNEED);
+    }
+    return mr;
+}
+
+int mmap_reader_get(mmap_reader_t *mr, uint64_t offset, char **mem, size_t *bytes) {
+    slow5_rec_size_t size;
+    if (offset < mr->start || offset + sizeof size > mr->end) {
+        return -1;
+    }
+    memcpy(&size, mr->base + offset, sizeof size);
+    if (size > mr->end - offset - sizeof size) {
+        return -1;
+    }
+    *mem = mr->base + offset + sizeof size;
+    *bytes = size;
+    return 0;
+}
+
+int mmap_reader_next(mmap_reader_t *mr, char **mem, size_t *bytes) {
+    if (mr->pos == mr->end) {
+        return 0;
+    }
+    if (mmap_reader_get(mr, mr->pos, mem, bytes) != 0) {
+        ERROR("Malformed record at byte %" PRIu64, mr->pos);
+        return -1;
+    }
+    mr->pos += sizeof (slow5_rec_size_t) + *bytes;
+    if (mr->sequential && mr->pos + READER_MMAP_WILLNEED / 2 > mr->advised) {
+        mmap_reader_advise(mr, mr->pos + READER_MMAP_WILLNEED);
+    }
+    return 1;
+}
+
+char *rec_depress(char *mem, size_t *bytes, struct slow5_file *from) {
+    if (from->compress->record_press->method == SLOW5_COMPRESS_NONE) {
+        return mem;
+    }
+    slow5_press_method_t method = {from->compress->record_press->method, from->compress->signal_press->method};
+    struct slow5_press *press = press_cache_get(method);
+    size_t n;
+    char *rec = press ? (char *) slow5_ptr_depress(press->record_press, mem, *bytes, &n) : NULL;
+    if (rec != NULL) {
+        *bytes = n;
+    }
+    return rec;
+}
+
+int rec_parse_full(char *rec, size_t bytes, struct slow5_rec **read, struct slow5_file *from) {
+    if (*read == NULL && (*read = slow5_rec_init()) == NULL) {
+        return -1;
+    }
+    if (slow5_rec_parse(rec, bytes, NULL, *read, SLOW5_FORMAT_BINARY, from->header->aux_meta, from->compress->signal_press->method) != 0) {
+        ERROR("Could not parse the record%s", "");
+        return -1;
+    }
+    return 0;
+}
+
+int mmap_rec_depress_parse(char *mem, size_t bytes, struct slow5_rec **read, struct slow5_file *from) {
+    char *rec = rec_depress(mem, &bytes, from);
+    if (rec == NULL) {
+        ERROR("Could not decompress the record%s", "");
+        return -1;
+    }
+    int ret = rec_parse_full(rec, bytes, read, from);
+    if (rec != mem) {
+        free(rec);
+    }
+    return ret;
+}
+
+/* take n bytes at *pos of the record */
+static inline int reader_take(const char *rec, size_t bytes, size_t *pos, void *dst, size_t n) {
+    if (bytes - *pos < n) {
+        return -1;
+    }
+    memcpy(dst, rec + *pos, n);
+    *pos += n;
+    return 0;
+}
+
+/* parse a decompressed BLOW5 record, skipping the raw signal and the aux fields not in need_aux */
+static int lazy_rec_parse(const char *rec, size_t bytes, struct slow5_rec *read, const struct slow5_file *from, const uint8_t *need_aux) {
+    size_t pos = 0;
+    slow5_rid_len_t id_len;
+    if (reader_take(rec, bytes, &pos, &id_len, sizeof id_len) != 0 || bytes - pos < id_len) {
+        return -1;
+    }
+    read->read_id = strndup(rec + pos, id_len);
+    MALLOC_CHK(read->read_id);
+    read->read_id_len = id_len;
+    pos += id_len;
+    if (reader_take(rec, bytes, &pos, &read->read_group, sizeof read->read_group) != 0 ||
+            reader_take(rec, bytes, &pos, &read->digitisation, sizeof read->digitisation) != 0 ||
+            reader_take(rec, bytes, &pos, &read->offset, sizeof read->offset) != 0 ||
+            reader_take(rec, bytes, &pos, &read->range, sizeof read->range) != 0 ||
+            reader_take(rec, bytes, &pos, &read->sampling_rate, sizeof read->sampling_rate) != 0 ||
+            reader_take(rec, bytes, &pos, &read->len_raw_signal, sizeof read->len_raw_signal) != 0) {
+        return -1;
+    }
+    // a compressed signal is preceded by its size
+    uint64_t signal_bytes;
+    if (from->compress->signal_press->method == SLOW5_COMPRESS_NONE) {
+        if (read->len_raw_signal > (bytes - pos) / sizeof (int16_t)) {
+            return -1;
+        }
+        signal_bytes = read->len_raw_signal * sizeof (int16_t);
+    } else if (reader_take(rec, bytes, &pos, &signal_bytes, sizeof signal_bytes) != 0) {
+        return -1;
+    }
+    if (bytes - pos < signal_bytes) {
+        return -1;
+    }
+    pos += signal_bytes;
+
+    struct slow5_aux_meta *aux_meta = from->header->aux_meta;
+    for (uint32_t i = 0; aux_meta && i < aux_meta->num; i++) {
+        uint64_t len = 1;
+        if (SLOW5_IS_PTR(aux_meta->types[i]) && reader_take(rec, bytes, &pos, &len, sizeof len) != 0) {
+            return -1;
+        }
+        if ((bytes - pos) / aux_meta->sizes[i] < len) {
+            return -1;
+        }
+        if (need_aux[i]) {
+            int ret = SLOW5_IS_PTR(aux_meta->types[i]) ?
+                    slow5_rec_set_array(read, aux_meta, aux_meta->attrs[i], rec + pos, len) :
+                    slow5_rec_set(read, aux_meta, aux_meta->attrs[i], rec + pos);
+            if (ret != 0) {
+                return -1;
+            }
+        }
+        pos += len * aux_meta->sizes[i];
+    }
+    return pos == bytes ? 0 : -1;
+}
+
+int rec_parse_lazy(const char *rec, size_t bytes, struct slow5_rec **read, const struct slow5_file *from, const uint8_t *need_aux) {
+    if ((*read = slow5_rec_init()) == NULL) {
+        return -1;
+    }
+    int ret = lazy_rec_parse(rec, bytes, *read, from, need_aux);
+    if (ret != 0) {
+        slow5_rec_free(*read);
+        *read = NULL;
+    }
+    return ret;
+}
+
+int lazy_rec_depress_parse(char *mem, size_t bytes, struct slow5_rec **read, struct slow5_file *from, const uint8_t *need_aux) {
+    char *rec = rec_depress(mem, &bytes, from);
+    if (rec == NULL) {
+        return -1;
+    }
+    int ret = rec_parse_lazy(rec, bytes, read, from, need_aux);
+    if (rec != mem) {
+        free(rec);
+    }
+    return ret;
+}
+
+void mmap_reader_free(mmap_reader_t *mr) {
+    if (munmap(mr->base, mr->len) == -1) {
+        WARNING("munmap failed - %s.", strerror(errno));
+    }
+    free(mr);
+}
+
+int batch_rec_next(struct slow5_file *from, arena_t *arena, char **mem, size_t *bytes) {
+    if (from->format != SLOW5_FORMAT_BINARY) {
+        if ((*mem = (char *) slow5_get_next_mem(bytes, from)) == NULL) {
+            return slow5_errno == SLOW5_ERR_EOF ? 0 : -1;
+        }
+        return 1;
+    }
+    const char eof[] = SLOW5_BINARY_EOF;
+    slow5_rec_size_t size;
+    size_t got = fread(&size, 1, sizeof size, from->fp);
+    if (got < sizeof size) {
+        // the EOF marker is shorter than a record length and ends the file
+        if (got == sizeof eof && memcmp(&size, eof, sizeof eof) == 0 && fgetc(from->fp) == EOF && !ferror(from->fp)) {
+            return 0;
+        }
+        ERROR("'%s' does not end with a complete record or the BLOW5 EOF marker.", from->meta.pathname);
+        return -1;
+    }
+    char *rec = (char *) arena_alloc(arena, sizeof size + size);
+    memcpy(rec, &size, sizeof size);
+    *mem = rec + sizeof size;
+    if (fread(*mem, 1, size, from->fp) != size) {
+        ERROR("Could not read a record of %" PRIu64 " bytes from '%s'.", (uint64_t) size, from->meta.pathname);
+        return -1;
+    }
+    *bytes = size;
+    return 1;
+}
@@ -0,0 +1,88 @@
+// reading SLOW5/BLOW5 records into batches
+
+#ifndef READER_H
+#define READER_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "misc.h"
+#include "thread.h"
+
+#define BATCH_TARGET_TIME 0.5 //seconds a batch should take to process; batches much faster are grown and much slower are shrunk
+#define BATCH_MAX_SIZE (1 << 20) //upper limit of records in a batch
+#define READER_QUEUE_DEPTH 2 //batches a range reader may read ahead of the consumer
+#define READER_MMAP_WILLNEED (1 << 26) //bytes of a mapped file asked to be paged in ahead of the records taken
+
+/* adaptive batch size; tracks the record count and input bytes of the next batch so that a batch
+   takes about BATCH_TARGET_TIME to process and the batches in flight stay within --max-mem */
+typedef struct {
+    int64_t batch_size;     // records to read into the next batch
+    int64_t min_size;       // lower limit of batch_size (one record per thread)
+    int64_t max_size;       // upper limit of batch_size
+    size_t max_bytes;       // input bytes of a batch at which reading stops, 0 for no limit
+    size_t max_mem;         // --max-mem budget for all batches in flight, 0 for no limit
+    int32_t in_flight;      // number of batches held in memory at once
+    double out_ratio;       // output bytes per input byte, running estimate
+} batch_ctl_t;
+
+void batch_ctl_init(batch_ctl_t *ctl, const opt_t *opt, int32_t in_flight);
+/* feed back a processed batch of n records, bytes_in input bytes and bytes_out output bytes that took time seconds to process */
+void batch_ctl_update(batch_ctl_t *ctl, int64_t n, size_t bytes_in, size_t bytes_out, double time);
+
+/* whether a batch with n records and bytes input bytes is complete; a batch always takes at least one record */
+static inline int batch_ctl_full(const batch_ctl_t *ctl, int64_t n, size_t bytes) {
+    return n >= ctl->batch_size || (n > 0 && ctl->max_bytes > 0 && bytes >= ctl->max_bytes);
+}
+
+/* a batch of consecutive records read by a range_reader_t; the records are owned by the consumer,
+   range_batch_free() only frees the arrays */
+typedef struct {
+    int64_t n_batch;
+    char **mem_records;     // as from slow5_get_next_mem()
+    size_t *mem_bytes;
+    size_t bytes;           // total of mem_bytes
+} range_batch_t;
+
+/* reads a BLOW5 file with several threads, each preading its own segments; see reader.c */
+typedef struct range_reader range_reader_t;
+
+range_reader_t *range_reader_init(struct slow5_file *from, int32_t num_readers, int64_t batch_size, size_t max_bytes);
+/* the next batch in file order; returns 1 with *batch set, 0 at the end of the file, -1 on error */
+int range_reader_next(range_reader_t *rr, range_batch_t **batch);
+void range_batch_free(range_batch_t *batch);
+/* stops and joins the readers, frees what the consumer did not take */
+void range_reader_free(range_reader_t *rr);
+
+/* reads a BLOW5 file through a memory map; the records taken are pointers into the map, see reader.c */
+typedef struct mmap_reader mmap_reader_t;
+
+/* NULL if from is not a BLOW5 regular file or cannot be mapped; sequential is 0 for random access (get) */
+mmap_reader_t *mmap_reader_init(struct slow5_file *from, int sequential);
+/* the next record in file order, as from slow5_get_next_mem() but not to be freed; returns 1, 0 at the end of the file, -1 on error */
+int mmap_reader_next(mmap_reader_t *mr, char **mem, size_t *bytes);
+/* the record starting at byte offset (from the index); returns 0 or -1 if there is no record there */
+int mmap_reader_get(mmap_reader_t *mr, uint64_t offset, char **mem, size_t *bytes);
+/* as slow5_rec_depress_parse() for a record the caller owns (mapped, or read by batch_rec_next() into an arena); the record is decompressed from where it is and left as it is */
+int mmap_rec_depress_parse(char *mem, size_t bytes, struct slow5_rec **read, struct slow5_file *from);
+void mmap_reader_free(mmap_reader_t *mr);
+
+/* the next record of from through stdio, as from slow5_get_next_mem(); a BLOW5 record is read into arena,
+   preceded by its length prefix as a mapped one is, to be parsed with mmap_rec_depress_parse() and released
+   with the arena, a SLOW5 one is malloc'd. Returns 1, 0 at the end of the file, -1 on error */
+int batch_rec_next(struct slow5_file *from, arena_t *arena, char **mem, size_t *bytes);
+
+/* as mmap_rec_depress_parse() for a BLOW5 record, but the raw signal is skipped without being decompressed
+   and of the aux fields only those set in need_aux (one per aux field of the header, in its order) are set;
+   returns -1 with *read NULL if the record is not as expected */
+int lazy_rec_depress_parse(char *mem, size_t bytes, struct slow5_rec **read, struct slow5_file *from, const uint8_t *need_aux);
+
+/* the two steps of the parsers above, for a caller that parses a record more than once without decompressing it again:
+   rec_depress() gives the BLOW5 record at mem decompressed with *bytes set to its length, or mem itself if the records
+   of from are not compressed (only a result other than mem is to be freed); NULL on error */
+char *rec_depress(char *mem, size_t *bytes, struct slow5_file *from);
+/* the whole of a decompressed record, as mmap_rec_depress_parse() */
+int rec_parse_full(char *rec, size_t bytes, struct slow5_rec **read, struct slow5_file *from);
+/* the record without its raw signal, as lazy_rec_depress_parse() */
+int rec_parse_lazy(const char *rec, size_t bytes, struct slow5_rec **read, const struct slow5_file *from, const uint8_t *need_aux);
+
+#endif
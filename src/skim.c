@@ -6,11 +6,18 @@
  */
 
 #include <getopt.h>
+#include <math.h>
+#include <string>
+#include <vector>
 #include "error.h"
 #include "cmd.h"
 #include "misc.h"
 #include "thread.h"
+#include "reader.h"
+#include "writer.h"
+#include "filter.h"
 #include <slow5/slow5.h>
+#include "slow5_extra.h"
 #include "slow5_misc.h"
 
 #define USAGE_MSG "Usage: %s [OPTIONS] [SLOW5_FILE]\n"
@@ -21,9 +28,14 @@
     "\n" \
     "OPTIONS:\n" \
     HELP_MSG_THREADS \
-    HELP_MSG_BATCH \
+    HELP_MSG_BATCH_ADAPTIVE \
+    HELP_MSG_READERS \
+    HELP_MSG_MMAP \
+    HELP_MSG_WRITER \
     "    --hdr              		  print the header only\n" \
     "    --rid              		  print the list of read ids only\n" \
+    "    --fields STR       		  print only these comma separated fields, e.g. read_id,len_raw_signal,end_reason\n" \
+    "    --filter EXPR      		  print only the records passing EXPR, e.g. 'len_raw_signal>4000 && end_reason==signal_positive'\n" \
     HELP_MSG_HELP \
 
 extern int slow5tools_verbosity_level;
@@ -56,13 +68,149 @@ static void print_hdr(slow5_file_t* sp){
     slow5_hdr_print(sp->header,SLOW5_FORMAT_ASCII,press_method);
 }
 
+#define SKIM_NUM_CACHE_SIZE 256 //number of formatted doubles (and floats) kept by a thread, a power of 2
+#define SKIM_NUM_STR_MAX 31 //longest formatted number kept in the cache
+
+/* a formatted double or float, keyed by its bits */
+typedef struct {
+    uint64_t bits;
+    uint8_t len;                // 0 if the entry is empty
+    char str[SKIM_NUM_STR_MAX];
+} skim_num_t;
+
+/* output lines a thread formatted in the current batch; kept by the thread and reused across batches */
+typedef struct skim_out {
+    char *buf;
+    size_t len;
+    size_t cap;
+    uint64_t batch;             // the batch the lines in buf belong to
+    skim_num_t dbl[SKIM_NUM_CACHE_SIZE];
+    skim_num_t flt[SKIM_NUM_CACHE_SIZE];
+    struct skim_out *next;
+} skim_out_t;
+
+/* room for len more bytes at the end of out */
+static inline char *skim_reserve(skim_out_t *out, size_t len) {
+    if (out->cap - out->len < len) {
+        while (out->cap - out->len < len) {
+            out->cap = out->cap ? out->cap * 2 : 65536;
+        }
+        out->buf = (char *) realloc(out->buf, out->cap);
+        MALLOC_CHK(out->buf);
+    }
+    return out->buf + out->len;
+}
+
+static inline void skim_put(skim_out_t *out, const char *str, size_t len) {
+    memcpy(skim_reserve(out, len), str, len);
+    out->len += len;
+}
+
+static inline void skim_put_u64(skim_out_t *out, uint64_t x) {
+    char tmp[20];
+    int i = sizeof tmp;
+    do {
+        tmp[--i] = '0' + x % 10;
+        x /= 10;
+    } while (x);
+    skim_put(out, tmp + i, sizeof tmp - i);
+}
+
+static inline void skim_put_i64(skim_out_t *out, int64_t x) {
+    if (x < 0) {
+        skim_put(out, "-", 1);
+        skim_put_u64(out, -(uint64_t) x);
+    } else {
+        skim_put_u64(out, x);
+    }
+}
+
+/*
+ * The text of slow5_double_to_str() (and slow5_float_to_str()) for x, written to str without
+ * allocating: an integral value without a fraction, else %f without its trailing zeros. 0 for the
+ * values that are left to slow5lib: not finite, -0, of 2^53 or more, or with a fraction %f rounds away.
+ */
+static inline size_t skim_num_fmt(char *str, double x) {
+    if (!(fabs(x) < 9007199254740992.0) || (x == 0 && signbit(x))) {
+        return 0;
+    }
+    if (floor(x) == x) {
+        char tmp[20];
+        int64_t v = (int64_t) x;
+        uint64_t u = v < 0 ? -(uint64_t) v : v;
+        int i = sizeof tmp;
+        do {
+            tmp[--i] = '0' + u % 10;
+            u /= 10;
+        } while (u);
+        size_t len = 0;
+        if (v < 0) {
+            str[len++] = '-';
+        }
+        memcpy(str + len, tmp + i, sizeof tmp - i);
+        return len + sizeof tmp - i;
+    }
+    // at most a sign, 16 integer digits, the point and 6 decimals
+    int len = snprintf(str, SKIM_NUM_STR_MAX, "%f", x);
+    if (len <= 0 || len >= SKIM_NUM_STR_MAX) {
+        return 0;
+    }
+    while (str[len - 1] == '0') {
+        len--;
+    }
+    return str[len - 1] == '.' ? 0 : len;
+}
+
+/* a formatted number from the cache, formatting it on a miss; the text is that of slow5lib */
+static inline void skim_put_num(skim_out_t *out, skim_num_t *cache, uint64_t bits, double x, char *(*fmt)(uint64_t, size_t *)) {
+    skim_num_t *e = &cache[((bits ^ bits >> 31) * 0x9E3779B97F4A7C15ULL) >> 56 & (SKIM_NUM_CACHE_SIZE - 1)];
+    if (e->len == 0 || e->bits != bits) {
+        char tmp[SKIM_NUM_STR_MAX];
+        size_t len = skim_num_fmt(tmp, x);
+        if (len == 0) { // the rare values skim_num_fmt() does not take
+            char *str = fmt(bits, &len);
+            MALLOC_CHK(str);
+            skim_put(out, str, len);
+            free(str);
+            return;
+        }
+        memcpy(e->str, tmp, len);
+        e->len = len;
+        e->bits = bits;
+    }
+    skim_put(out, e->str, e->len);
+}
+
+static char *skim_double_fmt(uint64_t bits, size_t *len) {
+    double x;
+    memcpy(&x, &bits, sizeof x);
+    return slow5_double_to_str(x, len);
+}
+
+static char *skim_float_fmt(uint64_t bits, size_t *len) {
+    uint32_t b = bits;
+    float x;
+    memcpy(&x, &b, sizeof x);
+    return slow5_float_to_str(x, len);
+}
+
+static inline void skim_put_double(skim_out_t *out, double x) {
+    uint64_t bits;
+    memcpy(&bits, &x, sizeof bits);
+    skim_put_num(out, out->dbl, bits, x, skim_double_fmt);
+}
+
+static inline void skim_put_float(skim_out_t *out, float x) {
+    uint32_t bits;
+    memcpy(&bits, &x, sizeof bits);
+    skim_put_num(out, out->flt, bits, x, skim_float_fmt);
+}
+
 struct aux_print_param {
     slow5_file_t *sp;
     slow5_rec_t *rec;
     char* field;
-    char* buff;
-    size_t c;
-    size_t n;
+    skim_out_t *out;
 };
 
 /* Following can be docorated by some macro magic, but this is easier for now
@@ -70,14 +218,10 @@ struct aux_print_param {
 */
 
 static inline void cpy_str(struct aux_print_param *p, uint64_t len,const char *str){
-    if(p->c-p->n-3 <= len){ // 3 is for '\t' and later '\n', '\0'
-        p->c *= 2;
-        p->buff = (char *)realloc(p->buff,p->c * sizeof(char));
-        MALLOC_CHK(p->buff);
-    }
-    p->buff[p->n++] = '\t';
-    memcpy(p->buff+p->n,str,len);
-    p->n += len;
+    char *dst = skim_reserve(p->out, len + 1);
+    dst[0] = '\t';
+    memcpy(dst + 1, str, len);
+    p->out->len += len + 1;
 }
 static void channel_number_print(struct aux_print_param *p){ //char*
     int ret=0;
@@ -103,10 +247,8 @@ static void median_before_print(struct aux_print_param *p){ //double
         exit(EXIT_FAILURE);
     }
     if(!isnan(t)){  //SLOW5_DOUBLE_NULL is the generic NaN value returned by nan("""") and thus t != SLOW5_DOUBLE_NULL is not correct
-        size_t len;
-        char *str = slow5_double_to_str(t, &len);
-        cpy_str(p,len,str);
-        free(str);
+        skim_put(p->out, "\t", 1);
+        skim_put_double(p->out, t);
     } else {
         cpy_str(p,1,".");
     }
@@ -120,10 +262,8 @@ static void read_number_print(struct aux_print_param *p){ //int32_t
         exit(EXIT_FAILURE);
     }
     if(t != SLOW5_INT32_T_NULL){
-        char *str = NULL;
-        int len = slow5_asprintf(&str,"%" PRId32 ,t);
-        cpy_str(p,len,str);
-        free(str);
+        skim_put(p->out, "\t", 1);
+        skim_put_i64(p->out, t);
     } else {
         cpy_str(p,1,".");
     }
@@ -137,10 +277,8 @@ static void start_mux_print(struct aux_print_param *p){ //uint8_t
         exit(EXIT_FAILURE);
     }
     if(t != SLOW5_UINT8_T_NULL){
-        char *str = NULL;
-        int len = slow5_asprintf(&str,"%" PRIu8 ,t);
-        cpy_str(p,len,str);
-        free(str);
+        skim_put(p->out, "\t", 1);
+        skim_put_u64(p->out, t);
     } else {
         cpy_str(p,1,".");
     }
@@ -154,10 +292,8 @@ static void start_time_num_minknow_events_print(struct aux_print_param *p){ //ui
         exit(EXIT_FAILURE);
     }
     if(t != SLOW5_UINT64_T_NULL){
-        char *str = NULL;
-        int len = slow5_asprintf(&str,"%" PRIu64 ,t);
-        cpy_str(p,len,str);
-        free(str);
+        skim_put(p->out, "\t", 1);
+        skim_put_u64(p->out, t);
     } else {
         cpy_str(p,1,".");
     }
@@ -192,10 +328,8 @@ static void float_print(struct aux_print_param *p){ //float
         exit(EXIT_FAILURE);
     }
     if(!isnan(t)){  //SLOW5_FLOAT_NULL is the generic NaN value returned by nan("""") and thus t != SLOW5_FLOAT_NULL is not correct
-        size_t len;
-        char *str = slow5_float_to_str(t, &len);
-        cpy_str(p,len,str);
-        free(str);
+        skim_put(p->out, "\t", 1);
+        skim_put_float(p->out, t);
     } else {
         cpy_str(p,1,".");
     }
@@ -210,10 +344,8 @@ static void num_reads_since_mux_change_print(struct aux_print_param *p){ //uint3
         exit(EXIT_FAILURE);
     }
     if(t != SLOW5_UINT32_T_NULL){
-        char *str = NULL;
-        int len = slow5_asprintf(&str,"%" PRIu32 ,t);
-        cpy_str(p,len,str);
-        free(str);
+        skim_put(p->out, "\t", 1);
+        skim_put_u64(p->out, t);
     } else {
         cpy_str(p,1,".");
     }
@@ -259,103 +391,232 @@ static void (*aux_print_func(char *field))(struct aux_print_param *p){
     return aux_func;
 }
 
-typedef struct {
-    struct aux_print_param p;
-    char **aux;
-    uint64_t num_aux;
-    void (**aux_func)(struct aux_print_param *);
-} skim_param_t;
-
-static char* process_read2(slow5_rec_t *rec, struct aux_print_param p, char **aux, uint64_t num_aux, void (**aux_func)(struct aux_print_param *)){
-    char *mem = NULL;
-    char *digitisation_str = slow5_double_to_str(rec->digitisation, NULL);
-    char *offset_str = slow5_double_to_str(rec->offset, NULL);
-    char *range_str = slow5_double_to_str(rec->range, NULL);
-    char *sampling_rate_str = slow5_double_to_str(rec->sampling_rate, NULL);
-
-    int curr_len_tmp = slow5_asprintf(&mem,"%s\t%" PRIu32 "\t%s\t%s\t%s\t%s\t%" PRIu64 "\t.",
-            rec->read_id, rec->read_group, digitisation_str, offset_str, range_str, sampling_rate_str, rec->len_raw_signal);
-
-    free(digitisation_str);
-    free(offset_str);
-    free(range_str);
-    free(sampling_rate_str);
-    if (curr_len_tmp <= 0) {
-        fprintf(stderr, "Error in printing read record\n");
-        exit(EXIT_FAILURE);
+static void read_id_print(struct aux_print_param *p){
+    cpy_str(p,strlen(p->rec->read_id),p->rec->read_id);
+}
+static void read_group_print(struct aux_print_param *p){
+    skim_put(p->out, "\t", 1);
+    skim_put_u64(p->out, p->rec->read_group);
+}
+static void digitisation_print(struct aux_print_param *p){
+    skim_put(p->out, "\t", 1);
+    skim_put_double(p->out, p->rec->digitisation);
+}
+static void offset_print(struct aux_print_param *p){
+    skim_put(p->out, "\t", 1);
+    skim_put_double(p->out, p->rec->offset);
+}
+static void range_print(struct aux_print_param *p){
+    skim_put(p->out, "\t", 1);
+    skim_put_double(p->out, p->rec->range);
+}
+static void sampling_rate_print(struct aux_print_param *p){
+    skim_put(p->out, "\t", 1);
+    skim_put_double(p->out, p->rec->sampling_rate);
+}
+static void len_raw_signal_print(struct aux_print_param *p){
+    skim_put(p->out, "\t", 1);
+    skim_put_u64(p->out, p->rec->len_raw_signal);
+}
+static void raw_signal_print(struct aux_print_param *p){
+    if(p->rec->len_raw_signal == 0){
+        cpy_str(p,1,".");
+        return;
     }
-    size_t c = curr_len_tmp+1024;
-    char *buff = (char *) malloc(c* sizeof(char));
-    MALLOC_CHK(buff);
-    size_t n=curr_len_tmp;
-    strcpy(buff,mem);
-    free(mem);
-
-    if(aux != NULL){
-        p.rec = rec;
-        p.buff = buff;
-        p.c = c;
-        p.n = n;
-
-        for(uint64_t i=0; i<num_aux; i++) {
-            p.field = aux[i];
-            if(aux_func[i] !=NULL) aux_func[i](&p);
+    for(uint64_t i=0; i<p->rec->len_raw_signal; i++){
+        skim_put(p->out, i ? "," : "\t", 1);
+        skim_put_i64(p->out, p->rec->raw_signal[i]);
+    }
+}
+
+#define SKIM_NUM_PRIMARY 8
+static const char *skim_primary_fields[SKIM_NUM_PRIMARY] = {"read_id", "read_group", "digitisation", "offset", "range", "sampling_rate", "len_raw_signal", "raw_signal"};
+
+/* printer of a primary field; NULL if field is not one */
+static void (*primary_print_func(const char *field))(struct aux_print_param *p){
+    static void (*funcs[SKIM_NUM_PRIMARY])(struct aux_print_param *) = {read_id_print, read_group_print, digitisation_print, offset_print, range_print, sampling_rate_print, len_raw_signal_print, raw_signal_print};
+    for(int i=0; i<SKIM_NUM_PRIMARY; i++){
+        if(strcmp(field,skim_primary_fields[i])==0){
+            return funcs[i];
         }
-        n=p.n;
-        c=p.c;
     }
-    assert(c-2>=n);
-    buff[n] = '\n';
-    buff[n+1] = '\0';
+    return NULL;
+}
+
+typedef struct {
+    struct aux_print_param p;
+    char **fields;              // the columns, in the output order
+    uint64_t num_fields;
+    void (**field_func)(struct aux_print_param *); // the printer of each column
+    int lazy;                   // BLOW5 records are parsed without the raw signal, with only the aux fields in need_aux
+    uint8_t *need_aux;          // of each aux field of the header, whether a column prints it
+    uint64_t run;               // tells the output buffers of this skim from those of an earlier one
+    uint64_t batch;             // incremented before each batch is formatted
+    pthread_mutex_t lock;
+    skim_out_t *outs;           // the output buffers of all threads, freed at the end
+} skim_param_t;
 
-    return buff;
+/* where the output line of a record is */
+typedef struct {
+    skim_out_t *out;
+    size_t offset;
+    size_t len;
+} skim_line_t;
 
+/* a batch of raw records to be skimmed */
+typedef struct {
+    int64_t n_batch;    // number of records in this batch
+    char** mem_records; // list of slow5_get_next_bytes() records
+    size_t* mem_bytes; // lengths of slow5_get_next_bytes() records
+    int mapped;         // mem_records point into a mmap_reader_t map or the batch arena and are not freed
+    skim_line_t *lines; // the output line of each record
+} skim_batch_t;
+
+static uint64_t skim_run_next = 0;
+static __thread skim_out_t *skim_out_tls = NULL;
+static __thread uint64_t skim_out_run = 0;
+
+/* the output buffer of this thread, emptied when a new batch starts */
+static skim_out_t *skim_out_get(skim_param_t *param) {
+    if (skim_out_run != param->run) {
+        skim_out_tls = (skim_out_t *) calloc(1, sizeof *skim_out_tls);
+        MALLOC_CHK(skim_out_tls);
+        skim_out_run = param->run;
+        pthread_mutex_lock(&param->lock);
+        skim_out_tls->next = param->outs;
+        param->outs = skim_out_tls;
+        pthread_mutex_unlock(&param->lock);
+    }
+    if (skim_out_tls->batch != param->batch) {
+        skim_out_tls->len = 0;
+        skim_out_tls->batch = param->batch;
+    }
+    return skim_out_tls;
 }
 
+/* append the output line of rec to p->out, with a tab before each column (that of the first is not printed) */
+static void process_read2(slow5_rec_t *rec, struct aux_print_param p, char **fields, uint64_t num_fields, void (**field_func)(struct aux_print_param *)){
+    p.rec = rec;
+    for(uint64_t i=0; i<num_fields; i++) {
+        p.field = fields[i];
+        field_func[i](&p);
+    }
+    skim_put(p.out, "\n", 1);
+}
 
-void process_read(core_t *core, db_t *db, int32_t i) {
+void process_read(core_t *core, skim_batch_t *db, int32_t i) {
     //
+    skim_param_t *param = (skim_param_t *) core->param;
     struct slow5_rec *read = NULL;
     char *record = db->mem_records[i];
-    if (slow5_decode(&record, &db->mem_bytes[i], &read, core->fp) < 0 ) {
+    // a record the lazy parser does not take is decoded in full
+    if (param->lazy && lazy_rec_depress_parse(record, db->mem_bytes[i], &read, core->fp, param->need_aux) == 0) {
+        if (!db->mapped) {
+            free(record);
+        }
+    } else if (db->mapped) {
+        if (mmap_rec_depress_parse(record, db->mem_bytes[i], &read, core->fp) != 0) {
+            exit(EXIT_FAILURE);
+        }
+    } else if (slow5_decode(&record, &db->mem_bytes[i], &read, core->fp) < 0 ) {
         exit(EXIT_FAILURE);
     } else {
         free(record);
     }
 
-    skim_param_t *param = (skim_param_t *) core->param;
+    if (core->filter && !filter_pass(core->filter, read)) {
+        db->lines[i].out = NULL;
+        slow5_rec_free(read);
+        return;
+    }
 
     struct aux_print_param p = param->p;
-    char **aux = param->aux;
-    uint64_t num_aux  = param->num_aux;
-    void (**aux_func)(struct aux_print_param *) = param->aux_func;
-
-    db->read_record[i].buffer = process_read2(read,p,aux,num_aux,aux_func);
+    char **fields = param->fields;
+    uint64_t num_fields  = param->num_fields;
+    void (**field_func)(struct aux_print_param *) = param->field_func;
+
+    p.out = skim_out_get(param);
+    size_t start = p.out->len;
+    process_read2(read,p,fields,num_fields,field_func);
+    db->lines[i].out = p.out;
+    db->lines[i].offset = start + 1; // the tab before the first column
+    db->lines[i].len = p.out->len - start - 1;
     slow5_rec_free(read);
 }
 
-static void skim_data_parallel(slow5_file_t* sp,size_t num_threads, int64_t batch_size){
+/* the columns to print: fields_arg is a comma separated list of fields, NULL for all but the raw signal */
+static void skim_fields(slow5_file_t *sp, const char *fields_arg, skim_param_t *param){
+    uint64_t num_aux = 0;
+    char **aux = slow5_get_aux_names(sp->header, &num_aux);
+    std::vector<std::string> names;
+    if(fields_arg == NULL){
+        names.assign(skim_primary_fields, skim_primary_fields + SKIM_NUM_PRIMARY);
+        names.insert(names.end(), aux, aux + num_aux);
+    } else {
+        const char *c = fields_arg;
+        while(1){
+            const char *comma = strchr(c, ',');
+            names.push_back(comma ? std::string(c, comma - c) : std::string(c));
+            if(comma == NULL){
+                break;
+            }
+            c = comma + 1;
+        }
+    }
+
+    param->num_fields = names.size();
+    param->fields = (char **) malloc(param->num_fields * sizeof *param->fields);
+    param->field_func = (void ((**)(struct aux_print_param *)))malloc(sizeof(void (*)(struct aux_print_param *))*param->num_fields);
+    param->need_aux = (uint8_t *) calloc(num_aux + 1, sizeof *param->need_aux);
+    MALLOC_CHK(param->fields);
+    MALLOC_CHK(param->field_func);
+    MALLOC_CHK(param->need_aux);
+    param->lazy = sp->format == SLOW5_FORMAT_BINARY;
+
+    for(uint64_t i=0; i<param->num_fields; i++){
+        const char *name = names[i].c_str();
+        param->fields[i] = strdup(name);
+        MALLOC_CHK(param->fields[i]);
+        if(fields_arg == NULL && strcmp(name,"raw_signal")==0){ // not printed by default
+            param->field_func[i] = just_the_dot;
+        } else if((param->field_func[i] = primary_print_func(name)) != NULL){
+            if(param->field_func[i] == raw_signal_print){
+                param->lazy = 0;
+            }
+        } else {
+            uint64_t j = 0;
+            while(j<num_aux && strcmp(aux[j],name)!=0){
+                j++;
+            }
+            if(j==num_aux){
+                ERROR("Field '%s' is not in '%s'.", name, sp->meta.pathname);
+                exit(EXIT_FAILURE);
+            }
+            param->need_aux[j] = 1;
+            param->field_func[i] = aux_print_func(param->fields[i]);
+        }
+    }
+}
+
+static void skim_data_parallel(slow5_file_t* sp, const opt_t *opt, const char *fields_arg, const filter_t *filter){
     int ret = 0;
     slow5_rec_t *rec = NULL;
 
-    uint64_t num_aux = 0;
-    char **aux = slow5_get_aux_names(sp->header, &num_aux);
-    void (**aux_func)(struct aux_print_param *) = NULL;
     struct aux_print_param p;
     p.sp = sp;
 
-    if(aux!=NULL){
-        aux_func = (void ((**)(struct aux_print_param *)))malloc(sizeof(void (*)(struct aux_print_param *))*num_aux);
-        MALLOC_CHK(aux_func);
-
-        for(uint64_t i=0; i<num_aux; i++){
-            aux_func[i] = aux_print_func(aux[i]);
+    skim_param_t param;
+    skim_fields(sp, fields_arg, &param);
+    if(filter){ // the fields the filter reads are parsed too
+        const uint8_t *need = filter_need_aux(filter);
+        for(uint32_t i=0; sp->header->aux_meta && i<sp->header->aux_meta->num; i++){
+            param.need_aux[i] |= need[i];
         }
     }
 
-    printf("#read_id\tread_group\tdigitisation\toffset\trange\tsampling_rate\tlen_raw_signal\traw_signal");
-    for(uint64_t i=0; i<num_aux; i++) {
-        printf("\t%s",aux[i]);
+    printf("#");
+    for(uint64_t i=0; i<param.num_fields; i++) {
+        printf(i ? "\t%s" : "%s",param.fields[i]);
     }
     printf("\n");
 
@@ -364,80 +625,197 @@ static void skim_data_parallel(slow5_file_t* sp,size_t num_threads, int64_t batc
     double time_write = 0;
     int flag_end_of_file = 0;
 
-    skim_param_t param;
     param.p = p;
-    param.aux = aux;
-    param.num_aux = num_aux;
-    param.aux_func = aux_func;
+    param.run = __sync_add_and_fetch(&skim_run_next, 1);
+    param.batch = 0;
+    pthread_mutex_init(&param.lock, NULL);
+    param.outs = NULL;
+
+    writer_t *writer = writer_init(stdout, opt->write_buf, opt->flag_direct);
+    if (writer == NULL) {
+        exit(EXIT_FAILURE);
+    }
 
+    batch_ctl_t ctl;
+    batch_ctl_init(&ctl, opt, 1);
+    arena_t arena; // per-batch arrays and BLOW5 records, reused across batches
+    arena_init(&arena, 0);
+    mmap_reader_t *mr = NULL;
+    if (opt->flag_mmap) {
+        mr = mmap_reader_init(sp, 1);
+        if (mr == NULL) {
+            WARNING("Could not map '%s', reading it through stdio.", sp->meta.pathname);
+        }
+    }
+    range_reader_t *rr = NULL;
+    if (mr == NULL && opt->num_readers > 1) {
+        // segments hold at most ctl.batch_size records, which then stays fixed
+        rr = range_reader_init(sp, opt->num_readers, ctl.batch_size, ctl.max_bytes);
+        if (rr == NULL) {
+            WARNING("Could not read '%s' with %d readers, reading it sequentially.", sp->meta.pathname, opt->num_readers);
+        }
+    }
     while(1) {
 
-        db_t db = { 0 };
-        db.mem_records = (char **) malloc(batch_size * sizeof(char*));
-        db.mem_bytes = (size_t *) malloc(batch_size * sizeof(size_t));
-        MALLOC_CHK(db.mem_records);
-        MALLOC_CHK(db.mem_bytes);
+        skim_batch_t db = { 0 };
+        int64_t batch_size = ctl.batch_size;
+        arena_reset(&arena);
+        db.mem_records = (char **) arena_alloc(&arena, batch_size * sizeof(char*));
+        db.mem_bytes = (size_t *) arena_alloc(&arena, batch_size * sizeof(size_t));
         int64_t record_count = 0;
         size_t bytes;
+        size_t bytes_in = 0;
+        profile_mark_t start;
+        profile_mark(&start);
         char *mem = NULL;
         double realtime = slow5_realtime();
-        while (record_count < batch_size) {
-            if ((ret = slow5_get_next_bytes(&mem,&bytes,sp)) <0) {
-                if (slow5_errno != SLOW5_ERR_EOF) {
-                    exit(EXIT_FAILURE);
-                } else {
+        if (rr) {
+            range_batch_t *rb;
+            int rr_ret = range_reader_next(rr, &rb);
+            if (rr_ret < 0) {
+                exit(EXIT_FAILURE);
+            } else if (rr_ret == 0) {
+                flag_end_of_file = 1;
+            } else {
+                record_count = rb->n_batch;
+                bytes_in = rb->bytes;
+                memcpy(db.mem_records, rb->mem_records, record_count * sizeof(char*));
+                memcpy(db.mem_bytes, rb->mem_bytes, record_count * sizeof(size_t));
+                range_batch_free(rb);
+            }
+        } else if (mr) {
+            db.mapped = 1;
+            while (!batch_ctl_full(&ctl, record_count, bytes_in)) {
+                int mr_ret = mmap_reader_next(mr, &mem, &bytes);
+                if (mr_ret <= 0) {
+                    if (mr_ret < 0) {
+                        exit(EXIT_FAILURE);
+                    }
                     flag_end_of_file = 1;
                     break;
                 }
-            } else {
-                db.mem_records[record_count] = (char *)mem;
+                db.mem_records[record_count] = mem;
                 db.mem_bytes[record_count] = bytes;
+                bytes_in += bytes;
                 record_count++;
             }
+        } else if (sp->format == SLOW5_FORMAT_BINARY) {
+            db.mapped = 1;
+            while (!batch_ctl_full(&ctl, record_count, bytes_in)) {
+                int br_ret = batch_rec_next(sp, &arena, &mem, &bytes);
+                if (br_ret <= 0) {
+                    if (br_ret < 0) {
+                        exit(EXIT_FAILURE);
+                    }
+                    ret = SLOW5_ERR_EOF;
+                    flag_end_of_file = 1;
+                    break;
+                }
+                db.mem_records[record_count] = mem;
+                db.mem_bytes[record_count] = bytes;
+                bytes_in += bytes;
+                record_count++;
+            }
+        } else {
+            while (!batch_ctl_full(&ctl, record_count, bytes_in)) {
+                if ((ret = slow5_get_next_bytes(&mem,&bytes,sp)) <0) {
+                    if (slow5_errno != SLOW5_ERR_EOF) {
+                        exit(EXIT_FAILURE);
+                    } else {
+                        flag_end_of_file = 1;
+                        break;
+                    }
+                } else {
+                    db.mem_records[record_count] = (char *)mem;
+                    db.mem_bytes[record_count] = bytes;
+                    bytes_in += bytes;
+                    record_count++;
+                }
+            }
         }
         time_get_to_mem += slow5_realtime() - realtime;
+        if (!rr) { // the readers record their own time
+            profile_stage("read", &start, record_count, bytes_in, 0);
+        }
 
         realtime = slow5_realtime();
+        profile_mark(&start);
         // Setup multithreading structures
         core_t core;
-        core.num_thread = num_threads;
+        core.num_thread = opt->num_threads;
         core.fp = sp;
         core.param = &param;
+        core.filter = filter;
 
         db.n_batch = record_count;
-        db.read_record = (raw_record_t*) malloc(record_count * sizeof *db.read_record);
-        MALLOC_CHK(db.read_record);
-        work_db(&core,&db,process_read);
-        time_thread_execution += slow5_realtime() - realtime;
+        db.lines = (skim_line_t*) arena_alloc(&arena, record_count * sizeof *db.lines);
+        param.batch++;
+        work_db(&core,&db,work_fn<skim_batch_t, process_read>(),db.mem_bytes);
+        double time_batch = slow5_realtime() - realtime;
+        time_thread_execution += time_batch;
+        profile_stage("process", &start, record_count, 0, 0);
 
         realtime = slow5_realtime();
+        profile_mark(&start);
+        size_t bytes_out = 0;
         for (int64_t i = 0; i < record_count; i++) {
-            char *buff = (char *)db.read_record[i].buffer;
-            printf("%s", buff);
-            free(buff);
+            skim_line_t *line = &db.lines[i];
+            if (line->out == NULL) { // left out by --filter
+                continue;
+            }
+            if (writer_add(writer, line->out->buf + line->offset, line->len) != 0) {
+                exit(EXIT_FAILURE);
+            }
+            bytes_out += line->len;
+        }
+        // lines longer than WRITER_COPY_MAX are only referenced by the writer, so flush before the buffers are reused
+        if (writer_flush(writer) != 0) {
+            exit(EXIT_FAILURE);
         }
         time_write += slow5_realtime() - realtime;
-
-        // Free everything
-        free(db.mem_bytes);
-        free(db.mem_records);
-        free(db.read_record);
+        profile_stage("write", &start, record_count, 0, bytes_out);
+        if (!rr) {
+            batch_ctl_update(&ctl, record_count, bytes_in, bytes_out, time_batch);
+        }
 
         if(flag_end_of_file == 1){
             break;
         }
 
     }
+    // the other readers exit on their own errors, only slow5_get_next_bytes leaves one in ret
+    if(rr == NULL && mr == NULL && ret != SLOW5_ERR_EOF){  //check if proper end of file has been reached
+        fprintf(stderr,"Error in slow5_get_next. Error code %d\n",ret);
+        exit(EXIT_FAILURE);
+    }
+    if (rr) {
+        range_reader_free(rr);
+    }
+    if (mr) {
+        mmap_reader_free(mr);
+    }
+    arena_free(&arena);
+    if (writer_close(writer) != 0) {
+        exit(EXIT_FAILURE);
+    }
 
     DEBUG("time_get_to_mem\t%.3fs", time_get_to_mem);
     DEBUG("time_skim\t%.3fs", time_thread_execution);
     DEBUG("time_write\t%.3fs", time_write);
 
-    free(aux_func);
-    if(ret != SLOW5_ERR_EOF){  //check if proper end of file has been reached
-        fprintf(stderr,"Error in slow5_get_next. Error code %d\n",ret);
-        exit(EXIT_FAILURE);
+    while (param.outs) {
+        skim_out_t *next = param.outs->next;
+        free(param.outs->buf);
+        free(param.outs);
+        param.outs = next;
+    }
+    pthread_mutex_destroy(&param.lock);
+    for(uint64_t i=0; i<param.num_fields; i++){
+        free(param.fields[i]);
     }
+    free(param.fields);
+    free(param.field_func);
+    free(param.need_aux);
     slow5_rec_free(rec);
 
 }
@@ -455,6 +833,13 @@ int skim_main(int argc, char **argv, struct program_meta *meta){
             {"hdr", no_argument, NULL, 0 }, //2
             {"threads",required_argument,  NULL, 't' }, //3
             {"batchsize",required_argument, NULL, 'K'}, //4
+            {"max-mem",required_argument, NULL, 'M'}, //5
+            {"readers",required_argument, NULL, 'R'}, //6
+            {"mmap", no_argument, NULL, 'm'}, //7
+            {"write-buf",required_argument, NULL, 'W'}, //8
+            {"direct", no_argument, NULL, 'D'}, //9
+            {"fields", required_argument, NULL, 0}, //10
+            {"filter", required_argument, NULL, 0}, //11
             {NULL, 0, NULL, 0 }
     };
 
@@ -466,6 +851,8 @@ int skim_main(int argc, char **argv, struct program_meta *meta){
     int opt;
     int rid=0;
     int hdr=0;
+    const char *fields = NULL;
+    const char *filter_expr = NULL;
 
     // Parse options
     while ((opt = getopt_long(argc, argv, "ht:K:", long_opts, &longindex)) != -1) {
@@ -482,6 +869,21 @@ int skim_main(int argc, char **argv, struct program_meta *meta){
             case 'K':
                 user_opts.arg_batch = optarg;
                 break;
+            case 'M':
+                user_opts.arg_max_mem = optarg;
+                break;
+            case 'R':
+                user_opts.arg_num_readers = optarg;
+                break;
+            case 'm':
+                user_opts.flag_mmap = 1;
+                break;
+            case 'W':
+                user_opts.arg_write_buf = optarg;
+                break;
+            case 'D':
+                user_opts.flag_direct = 1;
+                break;
             case 't':
                 user_opts.arg_num_threads = optarg;
                 break;
@@ -493,6 +895,12 @@ int skim_main(int argc, char **argv, struct program_meta *meta){
                     case 2:
                         hdr = 2;
                         break;
+                    case 10:
+                        fields = optarg;
+                        break;
+                    case 11:
+                        filter_expr = optarg;
+                        break;
                     default:
                         fprintf(stderr, HELP_SMALL_MSG, argv[0]);
                         EXIT_MSG(EXIT_FAILURE, argv, meta);
@@ -514,6 +922,18 @@ int skim_main(int argc, char **argv, struct program_meta *meta){
         EXIT_MSG(EXIT_FAILURE, argv, meta);
         return EXIT_FAILURE;
     }
+    if(parse_max_mem(&user_opts,argc,argv) < 0){
+        EXIT_MSG(EXIT_FAILURE, argv, meta);
+        return EXIT_FAILURE;
+    }
+    if(parse_num_readers(&user_opts,argc,argv) < 0){
+        EXIT_MSG(EXIT_FAILURE, argv, meta);
+        return EXIT_FAILURE;
+    }
+    if(parse_write_buf(&user_opts,argc,argv) < 0){
+        EXIT_MSG(EXIT_FAILURE, argv, meta);
+        return EXIT_FAILURE;
+    }
 
     if (argc - optind < 1){
         ERROR("%s", "Not enough arguments");
@@ -534,6 +954,10 @@ int skim_main(int argc, char **argv, struct program_meta *meta){
         ERROR("%s", "Incompatible options: --rid and --hdr cannot be specified together");
         exit(EXIT_FAILURE);
     }
+    if((fields || filter_expr) && (rid || hdr)){
+        ERROR("%s", "Incompatible options: --fields and --filter cannot be specified with --rid or --hdr");
+        exit(EXIT_FAILURE);
+    }
 
     slow5_file_t* slow5File = slow5_open(argv[optind], "r");
     if(!slow5File){
@@ -548,7 +972,14 @@ int skim_main(int argc, char **argv, struct program_meta *meta){
         print_hdr(slow5File);
     }
     else {
-        skim_data_parallel(slow5File, user_opts.num_threads, user_opts.read_id_batch_capacity);
+        filter_t *filter = NULL;
+        if(filter_expr && (filter = filter_init(filter_expr, slow5File)) == NULL){
+            exit(EXIT_FAILURE);
+        }
+        skim_data_parallel(slow5File, &user_opts, fields, filter);
+        if(filter){
+            filter_free(filter);
+        }
     }
 
     slow5_close(slow5File);
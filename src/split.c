@@ -16,6 +16,9 @@
 #include "slow5_extra.h"
 #include "read_fast5.h"
 #include "thread.h"
+#include "reader.h"
+#include "writer.h"
+#include "out_index.h"
 #include "demux.h"
 
 #define USAGE_MSG "Usage: %s [OPTIONS] [SLOW5_FILE/DIR] ...\n"
@@ -35,7 +38,9 @@
     "        --demux-rid [STR]         specify read IDs column name ['parent_read_id']\n" \
     "    -u, --demux-uniq [STR]        multi-category reads to category named STR\n" \
     HELP_MSG_THREADS \
-    HELP_MSG_BATCH \
+    HELP_MSG_BATCH_ADAPTIVE \
+    HELP_MSG_WRITER \
+    HELP_MSG_INDEX_OUT \
     HELP_MSG_LOSSLESS \
     HELP_MSG_HELP \
     HELP_FORMATS_METHODS
@@ -55,6 +60,15 @@ typedef struct {
     struct bsum_meta bs_meta; // Barcode summary metadata
 }meta_split_method;
 
+/* a batch of records to be split by read group */
+typedef struct {
+    int64_t n_batch;    // number of records in this batch
+    char** mem_records; // list of batch_rec_next() records, those of a BLOW5 file in the batch arena
+    size_t* mem_bytes; // lengths of batch_rec_next() records
+    raw_record_t *read_record; // the list of output records
+    uint32_t* read_group_vector; // read group of each record
+} split_batch_t;
+
 int split_func(std::vector<std::string> slow5_files_input, opt_t user_opts, meta_split_method  meta_split_method_object);
 
 int read_file_split_func(std::basic_string<char> &input_slow5_path, slow5_file_t * input_slow5_file_i, opt_t user_opts, std::string extension,
@@ -63,11 +77,13 @@ int read_file_split_func(std::basic_string<char> &input_slow5_path, slow5_file_t
 
 int single_threaded_split_execution(std::basic_string<char> &input_slow5_path, opt_t user_opts, std::string extension,
                                               slow5_press_method_t press_out, int64_t read_limit,
-                                              int64_t *record_count_ptr, int* flag_EOF_ptr, slow5_file_t * input_slow5_file_i, slow5_file_t * slow5_file_out);
+                                              int64_t *record_count_ptr, int* flag_EOF_ptr, slow5_file_t * input_slow5_file_i, slow5_file_t * slow5_file_out,
+                                              out_index_t *out_index);
 
 int multi_threaded_split_execution(std::basic_string<char> &input_slow5_path, opt_t user_opts, std::string extension,
                                              slow5_press_method_t press_out, int64_t read_limit,
-                                             int64_t *record_count_ptr, int* flag_EOF_ptr, slow5_file_t * input_slow5_file_i, std::vector<slow5_file_t*> output_slow5_files);
+                                             int64_t *record_count_ptr, int* flag_EOF_ptr, slow5_file_t * input_slow5_file_i, std::vector<slow5_file_t*> output_slow5_files,
+                                             batch_ctl_t *ctl, std::vector<out_index_t*> &out_indexes);
 
 int group_split_func(std::basic_string<char> &input_slow5_path, slow5_file_t * input_slow5_file_i, opt_t user_opts, std::string extension,
                          slow5_press_method_t press_out, meta_split_method meta_split_method_object,
@@ -77,10 +93,14 @@ int create_output_slow5(slow5_file_t *input_slow5_file_i, slow5_file_t *&slow5_f
                         std::basic_string<char> &input_slow5_path, char** slow5_path_out_char_array, slow5_press_method_t press_out,
                         std::string extension, uint32_t file_index, uint32_t read_group_index);
 
-void split_thread_func(core_t *core, db_t *db, int32_t i) {
+void split_thread_func(core_t *core, split_batch_t *db, int32_t i) {
     //
     struct slow5_rec *read = NULL;
-    if (slow5_rec_depress_parse(&db->mem_records[i], &db->mem_bytes[i], NULL, &read, core->fp) != 0) {
+    if (core->fp->format == SLOW5_FORMAT_BINARY) { // in the batch arena
+        if (mmap_rec_depress_parse(db->mem_records[i], db->mem_bytes[i], &read, core->fp) != 0) {
+            exit(EXIT_FAILURE);
+        }
+    } else if (slow5_rec_depress_parse(&db->mem_records[i], &db->mem_bytes[i], NULL, &read, core->fp) != 0) {
         ERROR("Could not decompress the slow5 record%s","");
         exit(EXIT_FAILURE);
     } else {
@@ -88,7 +108,7 @@ void split_thread_func(core_t *core, db_t *db, int32_t i) {
     }
     db->read_group_vector[i] = read->read_group;
     read->read_group = 0;
-    struct slow5_press *press_ptr = slow5_press_init(core->press_method);
+    struct slow5_press *press_ptr = press_cache_get(core->press_method);
     if(!press_ptr){
         ERROR("Could not initialize the slow5 compression method%s","");
         exit(EXIT_FAILURE);
@@ -99,12 +119,14 @@ void split_thread_func(core_t *core, db_t *db, int32_t i) {
         aux_meta = NULL;
     }
     if ((db->read_record[i].buffer = slow5_rec_to_mem(read, aux_meta, core->format_out, press_ptr, &len)) == NULL) {
-        slow5_press_free(press_ptr);
         slow5_rec_free(read);
         exit(EXIT_FAILURE);
     }
-    slow5_press_free(press_ptr);
     db->read_record[i].len = len;
+    if (core->index_out) {
+        db->read_record[i].read_id = strdup(read->read_id);
+        MALLOC_CHK(db->read_record[i].read_id);
+    }
     slow5_rec_free(read);
 }
 
@@ -139,6 +161,10 @@ int split_main(int argc, char **argv, struct program_meta *meta){
             {"demux-code",  required_argument, NULL, 0}, //13
             {"demux-rid",   required_argument, NULL, 0}, //14
             {"demux-uniq",  required_argument, NULL, 'u'}, //15
+            {"max-mem",     required_argument, NULL, 'M'}, //16
+            {"write-buf",   required_argument, NULL, 'W'}, //17
+            {"direct",      no_argument, NULL, 'D'}, //18
+            {"index",       no_argument, NULL, 'I'}, //19
             {NULL, 0, NULL, 0 }
     };
 
@@ -209,6 +235,18 @@ int split_main(int argc, char **argv, struct program_meta *meta){
             case 'K':
                 user_opts.arg_batch = optarg;
                 break;
+            case 'M':
+                user_opts.arg_max_mem = optarg;
+                break;
+            case 'W':
+                user_opts.arg_write_buf = optarg;
+                break;
+            case 'D':
+                user_opts.flag_direct = 1;
+                break;
+            case 'I':
+                user_opts.flag_index = 1;
+                break;
             case 0:
                 lopt = long_opts[longindex].name;
                 if (!strcmp(lopt, "demux-code")) {
@@ -232,6 +270,14 @@ int split_main(int argc, char **argv, struct program_meta *meta){
         EXIT_MSG(EXIT_FAILURE, argv, meta);
         return EXIT_FAILURE;
     }
+    if(parse_max_mem(&user_opts,argc,argv) < 0){
+        EXIT_MSG(EXIT_FAILURE, argv, meta);
+        return EXIT_FAILURE;
+    }
+    if(parse_write_buf(&user_opts,argc,argv) < 0){
+        EXIT_MSG(EXIT_FAILURE, argv, meta);
+        return EXIT_FAILURE;
+    }
     if(parse_arg_lossless(&user_opts, argc, argv, meta) < 0){
         EXIT_MSG(EXIT_FAILURE, argv, meta);
         return EXIT_FAILURE;
@@ -375,6 +421,8 @@ int read_file_split_func(std::basic_string<char> &input_slow5_path, slow5_file_t
                     int flag_single_threaded_execution) {
     int flag_EOF = 0;
     int64_t rem = 0;
+    batch_ctl_t ctl; // carried across the output files
+    batch_ctl_init(&ctl, &user_opts, 1);
     int64_t limit = 0;
     if(meta_split_method_object.splitMethod==FILE_SPLIT){
         long current_pos = ftell(input_slow5_file_i->fp);
@@ -405,13 +453,17 @@ int read_file_split_func(std::basic_string<char> &input_slow5_path, slow5_file_t
         if(ret_create_output_slow5){
             return -1;
         }
+        std::vector<out_index_t*> out_indexes(read_group_count_i, NULL);
+        if (user_opts.flag_index) {
+            out_indexes[0] = out_index_init(slow5_path_out, output_slow5_files[0]->header->version);
+        }
         int64_t record_count = 0;
         if(flag_single_threaded_execution){
             int ret_single_threaded_split_execution = single_threaded_split_execution(input_slow5_path,
                                                                                                 user_opts, extension,
                                                                                                 press_out,
                                                                                                 number_of_records_per_file,
-                                                                                                &record_count, &flag_EOF, input_slow5_file_i, output_slow5_files[0]);
+                                                                                                &record_count, &flag_EOF, input_slow5_file_i, output_slow5_files[0], out_indexes[0]);
             if(ret_single_threaded_split_execution){
                 return -1;
             }
@@ -420,7 +472,7 @@ int read_file_split_func(std::basic_string<char> &input_slow5_path, slow5_file_t
                                                                                               user_opts, extension,
                                                                                               press_out,
                                                                                               number_of_records_per_file,
-                                                                                              &record_count, &flag_EOF, input_slow5_file_i, output_slow5_files);
+                                                                                              &record_count, &flag_EOF, input_slow5_file_i, output_slow5_files, &ctl, out_indexes);
             if(ret_multi_threaded_split_execution){
                 return -1;
             }
@@ -429,6 +481,13 @@ int read_file_split_func(std::basic_string<char> &input_slow5_path, slow5_file_t
             slow5_eof_fwrite(output_slow5_files[0]->fp);
         }
         slow5_close(output_slow5_files[0]);
+        if (out_indexes[0]) {
+            if (flag_EOF && record_count == 0) {
+                out_index_free(out_indexes[0]);
+            } else if (out_index_close(out_indexes[0]) != 0) {
+                return -1;
+            }
+        }
         if (flag_EOF) {
             if (record_count == 0) {
                 int del = remove(slow5_path_out);
@@ -452,24 +511,39 @@ int read_file_split_func(std::basic_string<char> &input_slow5_path, slow5_file_t
 
 int multi_threaded_split_execution(std::basic_string<char> &input_slow5_path, opt_t user_opts, std::string extension,
                                     slow5_press_method_t press_out, int64_t read_limit,
-                                    int64_t *record_count_ptr, int* flag_EOF_ptr, slow5_file_t * input_slow5_file_i, std::vector<slow5_file_t*> output_slow5_files) {
+                                    int64_t *record_count_ptr, int* flag_EOF_ptr, slow5_file_t * input_slow5_file_i, std::vector<slow5_file_t*> output_slow5_files,
+                                             batch_ctl_t *ctl, std::vector<out_index_t*> &out_indexes) {
 
     int64_t record_count = *record_count_ptr;
     int flag_EOF = *flag_EOF_ptr;
+    std::vector<writer_t*> writers(output_slow5_files.size(), NULL); // only the outputs opened, the first one when splitting by reads
+    for (size_t j = 0; j < output_slow5_files.size(); j++) {
+        if (output_slow5_files[j] && (writers[j] = writer_init(output_slow5_files[j]->fp, user_opts.write_buf, user_opts.flag_direct)) == NULL) {
+            return -1;
+        }
+    }
+    arena_t arena; // per-batch arrays and BLOW5 records, reused across batches
+    arena_init(&arena, 0);
     while(record_count<read_limit){
-        int64_t batch_size = (user_opts.read_id_batch_capacity<read_limit)?user_opts.read_id_batch_capacity:read_limit;
-        db_t db = {0};
-        db.mem_records = (char **) malloc(batch_size * sizeof(char *));
-        db.mem_bytes = (size_t *) malloc(batch_size * sizeof(size_t));
-        MALLOC_CHK(db.mem_records);
-        MALLOC_CHK(db.mem_bytes);
+        // never read past the records that go to this output file
+        int64_t batch_size = (ctl->batch_size<read_limit-record_count)?ctl->batch_size:read_limit-record_count;
+        split_batch_t db = {0};
+        arena_reset(&arena);
+        db.mem_records = (char **) arena_alloc(&arena, batch_size * sizeof(char *));
+        db.mem_bytes = (size_t *) arena_alloc(&arena, batch_size * sizeof(size_t));
         int64_t record_count_local = 0;
         size_t bytes;
+        size_t bytes_in = 0;
         char *mem;
-        while (record_count_local < batch_size) {
-            if (!(mem = (char *) slow5_get_next_mem(&bytes, input_slow5_file_i))) {
-                if (slow5_errno != SLOW5_ERR_EOF) {
+        double realtime = slow5_realtime();
+        profile_mark_t start;
+        profile_mark(&start);
+        while (record_count_local < batch_size && !batch_ctl_full(ctl, record_count_local, bytes_in)) {
+            int ret = batch_rec_next(input_slow5_file_i, &arena, &mem, &bytes);
+            if (ret <= 0) {
+                if (ret < 0) {
                     ERROR("Could not read file %s", input_slow5_path.c_str());
+                    arena_free(&arena);
                     return -1;
                 } else { //EOF file reached
                     flag_EOF = 1;
@@ -478,11 +552,16 @@ int multi_threaded_split_execution(std::basic_string<char> &input_slow5_path, op
             } else {
                 db.mem_records[record_count_local] = mem;
                 db.mem_bytes[record_count_local] = bytes;
+                bytes_in += bytes;
                 record_count_local++;
                 record_count++;
             }
         }
 
+        profile_stage("read", &start, record_count_local, bytes_in, 0);
+        profile_mark_t start_process;
+        profile_mark(&start_process);
+
         // Setup multithreading structures
         core_t core;
         core.num_thread = user_opts.num_threads;
@@ -491,28 +570,51 @@ int multi_threaded_split_execution(std::basic_string<char> &input_slow5_path, op
         core.format_out = user_opts.fmt_out;
         core.press_method = press_out;
         core.lossy = user_opts.flag_lossy;
+        core.index_out = user_opts.flag_index;
 
-        db.read_group_vector = (uint32_t *) malloc(record_count_local * sizeof(uint32_t));
-        MALLOC_CHK(db.read_group_vector);
+        db.read_group_vector = (uint32_t *) arena_alloc(&arena, record_count_local * sizeof(uint32_t));
         db.n_batch = record_count_local;
-        db.read_record = (raw_record_t *) malloc(record_count_local * sizeof *db.read_record);
-        MALLOC_CHK(db.read_record);
-        work_db(&core, &db, split_thread_func);
+        db.read_record = (raw_record_t *) arena_alloc(&arena, record_count_local * sizeof *db.read_record);
+        work_db(&core, &db, work_fn<split_batch_t, split_thread_func>(), db.mem_bytes);
+        double time_batch = slow5_realtime() - realtime;
+        profile_stage("process", &start_process, record_count_local, 0, 0);
 
+        profile_mark(&start);
+        size_t bytes_out = 0;
+        for (int64_t i = 0; i < record_count_local; i++) {
+            uint32_t j = db.read_group_vector[i];
+            uint64_t offset = writer_tell(writers[j]);
+            if (writer_add(writers[j], db.read_record[i].buffer, db.read_record[i].len) != 0) {
+                arena_free(&arena);
+                return -1;
+            }
+            if (out_indexes[j]) {
+                out_index_add(out_indexes[j], db.read_record[i].read_id, offset, db.read_record[i].len);
+            }
+            bytes_out += db.read_record[i].len;
+        }
+        for (size_t j = 0; j < writers.size(); j++) {
+            if (writers[j] && writer_flush(writers[j]) != 0) {
+                arena_free(&arena);
+                return -1;
+            }
+        }
         for (int64_t i = 0; i < record_count_local; i++) {
-            fwrite(db.read_record[i].buffer, 1, db.read_record[i].len, output_slow5_files[db.read_group_vector[i]]->fp);
             free(db.read_record[i].buffer);
         }
-        // Free everything
-        free(db.mem_bytes);
-        free(db.mem_records);
-        free(db.read_record);
-        free(db.read_group_vector);
+        profile_stage("write", &start, record_count_local, 0, bytes_out);
+        batch_ctl_update(ctl, record_count_local, bytes_in, bytes_out, time_batch);
 
         if(flag_EOF){
             break;
         }
     }
+    arena_free(&arena);
+    for (size_t j = 0; j < writers.size(); j++) {
+        if (writers[j] && writer_close(writers[j]) != 0) {
+            return -1;
+        }
+    }
     *flag_EOF_ptr = flag_EOF;
     *record_count_ptr = record_count;
 
@@ -521,7 +623,8 @@ int multi_threaded_split_execution(std::basic_string<char> &input_slow5_path, op
 
 int single_threaded_split_execution(std::basic_string<char> &input_slow5_path, opt_t user_opts, std::string extension,
                                      slow5_press_method_t press_out, int64_t read_limit,
-                                     int64_t *record_count_ptr, int* flag_EOF_ptr, slow5_file_t * input_slow5_file_i, slow5_file_t * slow5_file_out) {
+                                     int64_t *record_count_ptr, int* flag_EOF_ptr, slow5_file_t * input_slow5_file_i, slow5_file_t * slow5_file_out,
+                                     out_index_t *out_index) {
     int64_t record_count = *record_count_ptr;
     int flag_EOF = *flag_EOF_ptr;
     size_t bytes;
@@ -537,6 +640,7 @@ int single_threaded_split_execution(std::basic_string<char> &input_slow5_path, o
                 break;
             }
         }
+        off_t offset = out_index ? ftello(slow5_file_out->fp) : 0;
         if(user_opts.fmt_out == SLOW5_FORMAT_BINARY){
             record_size = bytes;
             fwrite(&record_size, 1, sizeof record_size, slow5_file_out->fp);
@@ -545,6 +649,11 @@ int single_threaded_split_execution(std::basic_string<char> &input_slow5_path, o
         if(user_opts.fmt_out == SLOW5_FORMAT_ASCII){
             fwrite("\n",1,1,slow5_file_out->fp);
         }
+        if (out_index) {
+            // the records are copied as they are, so the read id is decoded from the input record
+            size_t size = user_opts.fmt_out == SLOW5_FORMAT_BINARY ? sizeof record_size + bytes : bytes + 1;
+            out_index_add(out_index, out_index_mem_id(input_slow5_file_i, buffer, bytes), offset, size);
+        }
         free(buffer);
         record_count++;
     }
@@ -558,9 +667,13 @@ int group_split_func(std::basic_string<char> &input_slow5_path, slow5_file_t * i
                      int flag_single_threaded_execution){
     uint32_t read_group_count_i = input_slow5_file_i->header->num_read_groups;
     std::vector<slow5_file_t*> output_slow5_files(read_group_count_i);
+    std::vector<out_index_t*> out_indexes(read_group_count_i, NULL);
     for(uint32_t j=0; j<read_group_count_i; j++){
         char* slow5_path_out;
         int ret_create_output_slow5 = create_output_slow5(input_slow5_file_i, output_slow5_files[j], user_opts, input_slow5_path, &slow5_path_out, press_out, extension, j, j);
+        if (ret_create_output_slow5 == 0 && user_opts.flag_index) {
+            out_indexes[j] = out_index_init(slow5_path_out, output_slow5_files[j]->header->version);
+        }
         free(slow5_path_out);
         if(ret_create_output_slow5){
             return -1;
@@ -569,7 +682,9 @@ int group_split_func(std::basic_string<char> &input_slow5_path, slow5_file_t * i
     int flag_EOF = 0;
     int64_t record_count = 0;
     int64_t number_of_records_per_file = INT64_MAX;
-    int ret_multi_threaded_split_execution = multi_threaded_split_execution(input_slow5_path, user_opts, extension, press_out, number_of_records_per_file, &record_count, &flag_EOF, input_slow5_file_i, output_slow5_files);
+    batch_ctl_t ctl;
+    batch_ctl_init(&ctl, &user_opts, 1);
+    int ret_multi_threaded_split_execution = multi_threaded_split_execution(input_slow5_path, user_opts, extension, press_out, number_of_records_per_file, &record_count, &flag_EOF, input_slow5_file_i, output_slow5_files, &ctl, out_indexes);
     if(ret_multi_threaded_split_execution){
         return -1;
     }
@@ -578,6 +693,9 @@ int group_split_func(std::basic_string<char> &input_slow5_path, slow5_file_t * i
             slow5_eof_fwrite(output_slow5_files[j]->fp);
         }
         slow5_close(output_slow5_files[j]);
+        if (out_indexes[j] && out_index_close(out_indexes[j]) != 0) {
+            return -1;
+        }
     }
     return 0;
 }
@@ -6,27 +6,674 @@
  */
 
 #include <getopt.h>
+#include <unistd.h>
 #include <sys/wait.h>
+#include <sys/stat.h>
 #include <string>
+#include <vector>
+#include <map>
+#include <algorithm>
 #include "error.h"
 #include "cmd.h"
 #include "slow5_extra.h"
+#include "slow5_idx.h"
 #include "read_fast5.h"
 #include "misc.h"
+#include "reader.h"
+#include "index_map.h"
+#include "thread.h"
 #include <slow5/slow5_press.h>
 
+#define STATS_SCAN_BUF (1024 * 1024) // bytes of a SLOW5 file read at once when counting its lines
 
-#define USAGE_MSG "Usage: %s [SLOW5_FILE]\n"
+
+#define USAGE_MSG "Usage: %s [OPTIONS] [SLOW5_FILE/DIR ...]\n"
 #define HELP_LARGE_MSG \
     "Prints statistics of a SLOW5/BLOW5 file to the stdout. If no argument is given details about slow5tools is printed. \n" \
+    "Given several files or directories, prints a tab separated line for each file, looked at by several threads, and a line of the totals.\n" \
     USAGE_MSG \
     "\n" \
     "OPTIONS:\n" \
-    "    -h, --help         display this message and exit\n" \
+    "    -h, --help             display this message and exit\n" \
+    "        --mmap             count (or with --full, read) the records of a BLOW5 file without an index through a memory map\n" \
+    "        --full             also decode every record and print signal length, read group, channel and end reason statistics\n" \
+    "    -t, --threads INT      number of threads decoding the records with --full, or looking at files given several [" TO_STR(DEFAULT_NUM_THREADS) "]\n" \
+    "    -K, --batchsize INT    initial number of records loaded to the memory at once with --full [" TO_STR(DEFAULT_BATCH_SIZE) "]\n" \
+    "        --max-mem SIZE     limit the memory used by the records loaded at once with --full, e.g. 8G [no limit]\n" \
 
 
 extern int slow5tools_verbosity_level;
 
+/*
+ * The number of entries of the slow5 index fp, read one after the other without building its hash,
+ * with *last set to the end of the record ending furthest into the file. -1 if fp is not a
+ * complete slow5 index.
+ */
+static int64_t stats_count_idx_entries(FILE *fp, uint64_t *last) {
+    const char magic[] = SLOW5_INDEX_MAGIC_NUMBER;
+    const char eof[] = SLOW5_INDEX_EOF;
+    char buf[sizeof eof];
+    if (fread(buf, 1, sizeof magic, fp) != sizeof magic || memcmp(buf, magic, sizeof magic) != 0 ||
+            fseeko(fp, SLOW5_INDEX_HEADER_SIZE_OFFSET, SEEK_SET) == -1) {
+        return -1;
+    }
+    int64_t n = 0;
+    while (1) {
+        uint16_t id_len;
+        if (fread(&id_len, 1, sizeof id_len, fp) != sizeof id_len) {
+            return -1;
+        }
+        // the index ends with its EOF marker, whose first bytes read as a read id length
+        if (memcmp(&id_len, eof, sizeof id_len) == 0) {
+            memcpy(buf, &id_len, sizeof id_len);
+            if (fread(buf + sizeof id_len, 1, sizeof eof - sizeof id_len, fp) == sizeof eof - sizeof id_len &&
+                    memcmp(buf, eof, sizeof eof) == 0 && fgetc(fp) == EOF) {
+                return n;
+            }
+            return -1;
+        }
+        uint64_t offset;
+        uint64_t size;
+        if (fseeko(fp, id_len, SEEK_CUR) == -1 || fread(&offset, 1, sizeof offset, fp) != sizeof offset ||
+                fread(&size, 1, sizeof size, fp) != sizeof size) {
+            return -1;
+        }
+        if (offset + size > *last) {
+            *last = offset + size;
+        }
+        n++;
+    }
+}
+
+/*
+ * The number of records from the index of sp: the sorted index if there is a current one, else
+ * the slow5 index. The slow5 index is only taken if it is not older than the file and its records
+ * end where those of the file do, so that the index of a file that has grown since is not used.
+ * It is streamed rather than loaded, as only the number of entries is needed.
+ * -1 if there is no such index.
+ */
+static int64_t stats_count_index(slow5_file_t *sp, const struct stat *st) {
+    std::string sidx_path = std::string(sp->meta.pathname) + INDEX_MAP_EXTENSION;
+    index_map_t *im = index_map_open(sidx_path.c_str(), sp);
+    if (im) {
+        int64_t n = index_map_num_ids(im);
+        index_map_close(im);
+        VERBOSE("took the number of records from '%s'", sidx_path.c_str());
+        return n;
+    }
+
+    std::string idx_path = std::string(sp->meta.pathname) + SLOW5_INDEX_EXTENSION;
+    struct stat idx_st;
+    FILE *fp;
+    if (stat(idx_path.c_str(), &idx_st) == -1 || idx_st.st_mtime < st->st_mtime || (fp = fopen(idx_path.c_str(), "rb")) == NULL) {
+        return -1;
+    }
+    uint64_t last = sp->meta.start_rec_offset;
+    int64_t n = stats_count_idx_entries(fp, &last);
+    fclose(fp);
+    if (n < 0) {
+        VERBOSE("'%s' is not a complete index, counting the records instead", idx_path.c_str());
+        return -1;
+    }
+    const char eof[] = SLOW5_BINARY_EOF;
+    uint64_t end = st->st_size - (sp->format == SLOW5_FORMAT_BINARY ? sizeof eof : 0);
+    if (last != end) {
+        VERBOSE("'%s' does not cover the whole file, counting the records instead", idx_path.c_str());
+        return -1;
+    }
+    VERBOSE("took the number of records from '%s'", idx_path.c_str());
+    return n;
+}
+
+/*
+ * The number of records of sp without decoding or copying them: a BLOW5 file is walked by its
+ * record length prefixes, reading only those, and the record lines of a SLOW5 file are counted in
+ * large reads. -1 on error.
+ */
+static int64_t stats_count_scan(slow5_file_t *sp, const struct stat *st) {
+    int fd = fileno(sp->fp);
+    uint64_t pos = sp->meta.start_rec_offset;
+    int64_t n = 0;
+
+    if (sp->format == SLOW5_FORMAT_BINARY) {
+        const char eof[] = SLOW5_BINARY_EOF;
+        char tail[sizeof eof];
+        if ((uint64_t) st->st_size < pos + sizeof eof ||
+                pread(fd, tail, sizeof tail, st->st_size - sizeof eof) != (ssize_t) sizeof tail ||
+                memcmp(tail, eof, sizeof eof) != 0) {
+            ERROR("'%s' does not end with the BLOW5 EOF marker.", sp->meta.pathname);
+            return -1;
+        }
+        uint64_t end = st->st_size - sizeof eof;
+        while (pos < end) {
+            slow5_rec_size_t size;
+            if (pread(fd, &size, sizeof size, pos) != (ssize_t) sizeof size || size > end - pos - sizeof size) {
+                ERROR("Malformed record at byte %" PRIu64, pos);
+                return -1;
+            }
+            pos += sizeof size + size;
+            n++;
+        }
+        return n;
+    }
+
+    char *buf = (char *) malloc(STATS_SCAN_BUF);
+    MALLOC_CHK(buf);
+    char last = '\n';
+    ssize_t got;
+    while ((got = pread(fd, buf, STATS_SCAN_BUF, pos)) > 0) {
+        for (const char *p = buf; (p = (const char *) memchr(p, '\n', buf + got - p)); p++) {
+            n++;
+        }
+        last = buf[got - 1];
+        pos += got;
+    }
+    free(buf);
+    if (got == -1) {
+        ERROR("Reading '%s' failed - %s.", sp->meta.pathname, strerror(errno));
+        return -1;
+    }
+    return last == '\n' ? n : n + 1; // the last record line need not end with a newline
+}
+
+/* what --full looks for in each record */
+typedef struct {
+    uint32_t num_read_groups;
+    int has_channel;            // the channel_number auxiliary field, a string
+    uint8_t num_end_reasons;    // labels of the end_reason auxiliary field, 0 if there is none
+    std::vector<std::string> end_reason_labels;
+    uint64_t run;               // tells the accumulators of this file from those of an earlier one
+    int err;                    // set by a thread that could not decode a record
+    pthread_mutex_t lock;
+    struct stats_acc *accs;     // one per thread that took part
+} stats_full_t;
+
+/* channel numbers in numeric order, as long as they are numbers */
+struct stats_channel_less {
+    bool operator()(const std::string &a, const std::string &b) const {
+        return a.size() != b.size() ? a.size() < b.size() : a < b;
+    }
+};
+
+/* the totals of the records a thread has decoded with --full; the accumulators of all threads are merged at the end */
+typedef struct stats_acc {
+    uint64_t records;
+    uint64_t samples;
+    uint64_t stored_bytes;      // of the records as in the file, compressed if the file is
+    std::vector<uint64_t> lengths;      // of the raw signal of each record
+    std::vector<uint64_t> read_groups;  // records per read group
+    std::map<std::string, uint64_t, stats_channel_less> channels; // records per channel_number
+    std::vector<uint64_t> end_reasons;  // records per end_reason label, then those without one
+    struct stats_acc *next;
+} stats_acc_t;
+
+static uint64_t stats_run_next = 0;
+static __thread stats_acc_t *stats_acc_tls = NULL;
+static __thread uint64_t stats_acc_run = 0;
+
+static stats_acc_t *stats_acc_init(const stats_full_t *full) {
+    stats_acc_t *acc = new stats_acc_t();
+    acc->records = 0;
+    acc->samples = 0;
+    acc->stored_bytes = 0;
+    acc->read_groups.assign(full->num_read_groups, 0);
+    acc->end_reasons.assign(full->num_end_reasons + 1, 0);
+    acc->next = NULL;
+    return acc;
+}
+
+/* the accumulator of the calling thread for this file, created the first time the thread gets a record of it */
+static stats_acc_t *stats_acc_get(stats_full_t *full) {
+    if (stats_acc_run != full->run) {
+        stats_acc_tls = stats_acc_init(full);
+        stats_acc_run = full->run;
+        pthread_mutex_lock(&full->lock);
+        stats_acc_tls->next = full->accs;
+        full->accs = stats_acc_tls;
+        pthread_mutex_unlock(&full->lock);
+    }
+    return stats_acc_tls;
+}
+
+static void stats_full_read(core_t *core, rec_batch_t *db, int32_t i) {
+    stats_full_t *full = (stats_full_t *) core->param;
+    stats_acc_t *acc = stats_acc_get(full);
+    size_t bytes = db->mem_bytes[i];
+
+    struct slow5_rec *read = NULL;
+    char *record = db->mem_records[i];
+    int ret = db->mapped ? mmap_rec_depress_parse(record, bytes, &read, core->fp) : slow5_decode(&record, &db->mem_bytes[i], &read, core->fp);
+    if (!db->mapped) {
+        free(record);
+    }
+    if (ret < 0) { // the other files go on, this one gets an error line
+        ERROR("Could not decode record %d of the batch of '%s'.", i, core->fp->meta.pathname);
+        __sync_fetch_and_or(&full->err, 1);
+        slow5_rec_free(read);
+        return;
+    }
+
+    acc->records++;
+    acc->samples += read->len_raw_signal;
+    acc->stored_bytes += bytes;
+    acc->lengths.push_back(read->len_raw_signal);
+    if (read->read_group < full->num_read_groups) {
+        acc->read_groups[read->read_group]++;
+    }
+    int err = 0;
+    if (full->has_channel) {
+        uint64_t len = 0;
+        char *channel = slow5_aux_get_string(read, "channel_number", &len, &err);
+        if (err == 0 && channel != NULL) {
+            acc->channels[std::string(channel, len)]++;
+        } else {
+            acc->channels["."]++;
+        }
+    }
+    if (full->num_end_reasons > 0) {
+        uint8_t end_reason = slow5_aux_get_enum(read, "end_reason", &err);
+        if (err != 0 || end_reason >= full->num_end_reasons) {
+            end_reason = full->num_end_reasons; // missing
+        }
+        acc->end_reasons[end_reason]++;
+    }
+    slow5_rec_free(read);
+}
+
+/* add the totals of from to to */
+static void stats_acc_merge(stats_acc_t *to, const stats_acc_t *from) {
+    to->records += from->records;
+    to->samples += from->samples;
+    to->stored_bytes += from->stored_bytes;
+    to->lengths.insert(to->lengths.end(), from->lengths.begin(), from->lengths.end());
+    for (size_t i = 0; i < to->read_groups.size(); i++) {
+        to->read_groups[i] += from->read_groups[i];
+    }
+    for (const auto &c : from->channels) {
+        to->channels[c.first] += c.second;
+    }
+    for (size_t i = 0; i < to->end_reasons.size(); i++) {
+        to->end_reasons[i] += from->end_reasons[i];
+    }
+}
+
+/*
+ * Decode all records of sp with opt->num_threads threads and return the merged totals, NULL on
+ * error, including a record that does not decode. Each thread adds the records it decodes to its own accumulator, so the threads share
+ * nothing but the batch.
+ */
+static stats_acc_t *stats_full(slow5_file_t *sp, const opt_t *opt, stats_full_t *full) {
+    full->num_read_groups = sp->header->num_read_groups;
+    full->has_channel = 0;
+    full->num_end_reasons = 0;
+    slow5_aux_meta_t *aux_meta = sp->header->aux_meta;
+    for (uint32_t i = 0; aux_meta && i < aux_meta->num; i++) {
+        if (strcmp(aux_meta->attrs[i], "channel_number") == 0 && aux_meta->types[i] == SLOW5_STRING) {
+            full->has_channel = 1;
+        } else if (strcmp(aux_meta->attrs[i], "end_reason") == 0 && aux_meta->types[i] == SLOW5_ENUM) {
+            full->num_end_reasons = aux_meta->enum_num_labels[i];
+            full->end_reason_labels.assign(aux_meta->enum_labels[i], aux_meta->enum_labels[i] + full->num_end_reasons);
+        }
+    }
+    full->run = __sync_add_and_fetch(&stats_run_next, 1);
+    full->err = 0;
+    full->accs = NULL;
+    pthread_mutex_init(&full->lock, NULL);
+
+    batch_ctl_t ctl;
+    batch_ctl_init(&ctl, opt, 1);
+    arena_t arena; // per-batch arrays, reused across batches
+    arena_init(&arena, 0);
+    mmap_reader_t *mr = NULL;
+    if (opt->flag_mmap) {
+        mr = mmap_reader_init(sp, 1);
+        if (mr == NULL) {
+            WARNING("Could not map '%s', reading it through stdio.", sp->meta.pathname);
+        }
+    }
+
+    int ok = 1;
+    int flag_end_of_file = 0;
+    while (ok && !flag_end_of_file) {
+        rec_batch_t db = { 0 };
+        arena_reset(&arena);
+        db.mem_records = (char **) arena_alloc(&arena, ctl.batch_size * sizeof(char*));
+        db.mem_bytes = (size_t *) arena_alloc(&arena, ctl.batch_size * sizeof(size_t));
+        db.mapped = mr != NULL;
+        int64_t record_count = 0;
+        size_t bytes_in = 0;
+        char *mem;
+        size_t bytes;
+        while (!batch_ctl_full(&ctl, record_count, bytes_in)) {
+            int ret = mr ? mmap_reader_next(mr, &mem, &bytes) : slow5_get_next_bytes(&mem, &bytes, sp);
+            if (mr ? ret <= 0 : ret < 0) {
+                if (mr ? ret < 0 : slow5_errno != SLOW5_ERR_EOF) {
+                    ERROR("Error reading the file.%s","");
+                    ok = 0;
+                }
+                flag_end_of_file = 1;
+                break;
+            }
+            db.mem_records[record_count] = mem;
+            db.mem_bytes[record_count] = bytes;
+            bytes_in += bytes;
+            record_count++;
+        }
+
+        double realtime = slow5_realtime();
+        core_t core;
+        core.num_thread = opt->num_threads;
+        core.fp = sp;
+        core.param = full;
+        db.n_batch = record_count;
+        work_db(&core, &db, work_fn<rec_batch_t, stats_full_read>(), db.mem_bytes);
+        batch_ctl_update(&ctl, record_count, bytes_in, 0, slow5_realtime() - realtime);
+        if (full->err) {
+            ok = 0;
+        }
+    }
+    if (mr) {
+        mmap_reader_free(mr);
+    }
+    arena_free(&arena);
+
+    stats_acc_t *total = stats_acc_init(full);
+    for (stats_acc_t *acc = full->accs; acc; ) {
+        stats_acc_t *next = acc->next;
+        stats_acc_merge(total, acc);
+        delete acc;
+        acc = next;
+    }
+    pthread_mutex_destroy(&full->lock);
+    if (!ok) {
+        delete total;
+        return NULL;
+    }
+    return total;
+}
+
+/* the length of the shortest of the longest records that together have at least half the samples; lengths are sorted */
+static uint64_t stats_n50(const std::vector<uint64_t> &lengths, uint64_t samples) {
+    uint64_t sum = 0;
+    for (size_t i = lengths.size(); i > 0; i--) {
+        sum += lengths[i - 1];
+        if (2 * sum >= samples) {
+            return lengths[i - 1];
+        }
+    }
+    return 0;
+}
+
+/* print the totals of --full, after the number of records */
+static void stats_full_print(stats_acc_t *total, const stats_full_t *full) {
+    std::vector<uint64_t> &lengths = total->lengths;
+    std::sort(lengths.begin(), lengths.end());
+
+    fprintf(stdout, "total samples\t%" PRIu64 "\n", total->samples);
+    fprintf(stdout, "mean signal length\t%.1f\n", total->records ? (double) total->samples / total->records : 0.0);
+    fprintf(stdout, "max signal length\t%" PRIu64 "\n", lengths.empty() ? 0 : lengths.back());
+    fprintf(stdout, "N50 signal length\t%" PRIu64 "\n", stats_n50(lengths, total->samples));
+
+    // bins of powers of two: bin 0 holds the empty records and bin k those in [2^(k-1), 2^k)
+    uint64_t bins[65] = { 0 };
+    int first = 64, last = 0;
+    for (uint64_t len : lengths) {
+        int k = len ? 64 - __builtin_clzll(len) : 0;
+        bins[k]++;
+        first = k < first ? k : first;
+        last = k > last ? k : last;
+    }
+    for (int k = first; k <= last; k++) {
+        uint64_t lo = k ? (uint64_t) 1 << (k - 1) : 0;
+        uint64_t hi = k < 64 ? (uint64_t) 1 << k : UINT64_MAX;
+        fprintf(stdout, "signal length [%" PRIu64 ",%" PRIu64 ")\t%" PRIu64 "\n", lo, hi, bins[k]);
+    }
+
+    for (uint32_t i = 0; i < full->num_read_groups; i++) {
+        fprintf(stdout, "records in read group %" PRIu32 "\t%" PRIu64 "\n", i, total->read_groups[i]);
+    }
+    for (uint8_t i = 0; i < full->num_end_reasons; i++) {
+        fprintf(stdout, "records with end_reason %s\t%" PRIu64 "\n", full->end_reason_labels[i].c_str(), total->end_reasons[i]);
+    }
+    if (full->num_end_reasons > 0 && total->end_reasons[full->num_end_reasons] > 0) {
+        fprintf(stdout, "records with end_reason .\t%" PRIu64 "\n", total->end_reasons[full->num_end_reasons]);
+    }
+    for (const auto &c : total->channels) {
+        fprintf(stdout, "records on channel %s\t%" PRIu64 "\n", c.first.c_str(), c.second);
+    }
+
+    fprintf(stdout, "stored record bytes\t%" PRIu64 "\n", total->stored_bytes);
+    fprintf(stdout, "raw signal bytes\t%" PRIu64 "\n", total->samples * sizeof (int16_t));
+    fprintf(stdout, "raw signal bytes per stored byte\t%.3f\n",
+            total->stored_bytes ? (double) (total->samples * sizeof (int16_t)) / total->stored_bytes : 0.0);
+}
+
+/* the names stats prints for the format and compression methods of a file */
+static const char *stats_format_name(enum slow5_fmt format) {
+    switch (format) {
+        case SLOW5_FORMAT_UNKNOWN: return "FORMAT_UNKNOWN";
+        case SLOW5_FORMAT_ASCII: return "SLOW5 ASCII";
+        case SLOW5_FORMAT_BINARY: return "BLOW5";
+        default: return "file format error";
+    }
+}
+
+static const char *stats_record_press_name(enum slow5_press_method method) {
+    switch (method) {
+        case SLOW5_COMPRESS_NONE: return "none";
+        case SLOW5_COMPRESS_ZLIB: return "zlib";
+        case SLOW5_COMPRESS_ZSTD: return "zstd";
+        default: return "compression error";
+    }
+}
+
+static const char *stats_signal_press_name(enum slow5_press_method method) {
+    switch (method) {
+        case SLOW5_COMPRESS_NONE: return "none";
+        case SLOW5_COMPRESS_SVB_ZD: return "svb-zd";
+        case SLOW5_COMPRESS_EX_ZD: return "ex-zd";
+        default: return "compression error";
+    }
+}
+
+/*
+ * The number of records of sp, -1 on error. With full, every record is decoded with
+ * opt->num_threads threads and *total is set to the totals of stats_full(), else the count is
+ * taken from the index or a scan where possible.
+ */
+static int64_t stats_count(slow5_file_t *sp, const opt_t *opt, stats_full_t *full, stats_acc_t **total) {
+    VERBOSE("counting number of slow5 records...%s","");
+
+    size_t bytes;
+    char *mem;
+    double time_get_to_mem = slow5_realtime();
+    struct stat st;
+    int regular = fstat(fileno(sp->fp), &st) == 0 && S_ISREG(st.st_mode);
+    int64_t record_count = regular && !full ? stats_count_index(sp, &st) : -1;
+    if (full) {
+        *total = stats_full(sp, opt, full);
+        if (*total == NULL) {
+            return -1;
+        }
+        record_count = (*total)->records;
+    } else if (record_count < 0 && regular && (!opt->flag_mmap || sp->format != SLOW5_FORMAT_BINARY)) {
+        record_count = stats_count_scan(sp, &st);
+        if (record_count < 0) {
+            ERROR("Error reading the file.%s","");
+            return -1;
+        }
+    } else if (record_count < 0) {
+        record_count = 0;
+        mmap_reader_t *mr = opt->flag_mmap ? mmap_reader_init(sp, 1) : NULL;
+        if (opt->flag_mmap && mr == NULL) {
+            WARNING("Could not map '%s', reading it through stdio.", sp->meta.pathname);
+        }
+        if (mr) {
+            int ret;
+            while ((ret = mmap_reader_next(mr, &mem, &bytes)) > 0) {
+                record_count++;
+            }
+            mmap_reader_free(mr);
+            if (ret < 0) {
+                ERROR("Error reading the file.%s","");
+                return -1;
+            }
+        } else {
+            while ((mem = (char *) slow5_get_next_mem(&bytes, sp))) {
+                free(mem);
+                record_count++;
+            }
+            if (slow5_errno != SLOW5_ERR_EOF) {
+                ERROR("Error reading the file.%s","");
+                return -1;
+            }
+        }
+    }
+    DEBUG("time_get_to_mem\t%.3fs", slow5_realtime()-time_get_to_mem);
+    return record_count;
+}
+
+/* what stats finds out about one of many files */
+typedef struct {
+    const char *path;
+    int ok;
+    enum slow5_fmt format;
+    struct slow5_version version;
+    enum slow5_press_method record_press;
+    enum slow5_press_method signal_press;
+    uint32_t num_read_groups;
+    uint32_t num_aux;
+    int64_t records;
+    stats_acc_t *total;     // with --full
+} stats_file_t;
+
+/* a batch of files, each looked at by one thread */
+typedef struct {
+    int64_t n_batch;
+    stats_file_t *files;
+    const opt_t *opt;       // for the files; with --full each file is decoded by its own thread alone
+    int flag_full;
+} stats_batch_t;
+
+static void stats_file_work(core_t *core, stats_batch_t *db, int32_t i) {
+    stats_file_t *f = &db->files[i];
+    f->ok = 0;
+    f->total = NULL;
+    slow5_file_t *sp = slow5_open(f->path, "r");
+    if (sp == NULL) {
+        ERROR("cannot open %s. skipping...", f->path);
+        return;
+    }
+    f->format = sp->format;
+    f->version = sp->header->version;
+    f->record_press = sp->compress->record_press->method;
+    f->signal_press = sp->compress->signal_press->method;
+    f->num_read_groups = sp->header->num_read_groups;
+    f->num_aux = sp->header->aux_meta ? sp->header->aux_meta->num : 0;
+    stats_full_t full;
+    f->records = stats_count(sp, db->opt, db->flag_full ? &full : NULL, &f->total);
+    if (f->records < 0) {
+        ERROR("Counting the records of %s failed.", f->path);
+    } else {
+        f->ok = 1;
+    }
+    slow5_close(sp);
+}
+
+#define STATS_FILES_BATCH 1024 // files looked at before their lines are printed
+
+/*
+ * stats of many files and directories: the files are looked at by opt->num_threads threads and a
+ * tab separated line is printed for each, in the order found, then a line of the totals
+ */
+static int stats_files(int num_args, char **args, const opt_t *opt, int flag_full) {
+    std::vector<std::string> paths;
+    for (int i = 0; i < num_args; i++) {
+        if (is_directory(args[i])) {
+            list_all_items(args[i], paths, 0, ".slow5");
+        } else {
+            paths.push_back(args[i]);
+        }
+    }
+    if (paths.empty()) {
+        ERROR("No slow5/blow5 files found.%s","");
+        return EXIT_FAILURE;
+    }
+
+    opt_t file_opt = *opt;
+    file_opt.num_threads = 1;
+    core_t core;
+    core.num_thread = opt->num_threads;
+
+    fprintf(stdout, "#file\tstatus\tformat\tversion\trecord_compression\tsignal_compression\tread_groups\taux_fields\trecords");
+    if (flag_full) {
+        fprintf(stdout, "\tsamples\tmax_signal_length\tN50_signal_length\tstored_record_bytes\traw_signal_bytes");
+    }
+    fprintf(stdout, "\n");
+
+    uint64_t num_ok = 0;
+    uint64_t records = 0;
+    stats_acc_t sum;    // of all records with --full, the lengths only of the records
+    sum.records = sum.samples = sum.stored_bytes = 0;
+    std::vector<stats_file_t> files(STATS_FILES_BATCH);
+    std::vector<size_t> cost(STATS_FILES_BATCH);
+    for (size_t from = 0; from < paths.size(); from += STATS_FILES_BATCH) {
+        stats_batch_t db;
+        db.n_batch = paths.size() - from < STATS_FILES_BATCH ? paths.size() - from : STATS_FILES_BATCH;
+        db.files = files.data();
+        db.opt = &file_opt;
+        db.flag_full = flag_full;
+        for (int64_t i = 0; i < db.n_batch; i++) {
+            files[i].path = paths[from + i].c_str();
+            struct stat st;
+            cost[i] = stat(files[i].path, &st) == 0 ? st.st_size : 0; // share the bytes rather than the files among the threads
+        }
+        work_db(&core, &db, work_fn<stats_batch_t, stats_file_work>(), cost.data());
+
+        for (int64_t i = 0; i < db.n_batch; i++) {
+            stats_file_t *f = &files[i];
+            if (!f->ok) {
+                fprintf(stdout, "%s\terror\t.\t.\t.\t.\t.\t.\t.%s\n", f->path, flag_full ? "\t.\t.\t.\t.\t." : "");
+                continue;
+            }
+            num_ok++;
+            records += f->records;
+            fprintf(stdout, "%s\tok\t%s\t%d.%d.%d\t%s\t%s\t%" PRIu32 "\t%" PRIu32 "\t%" PRId64,
+                    f->path, stats_format_name(f->format), f->version.major, f->version.minor, f->version.patch,
+                    stats_record_press_name(f->record_press), stats_signal_press_name(f->signal_press),
+                    f->num_read_groups, f->num_aux, f->records);
+            if (f->total) {
+                stats_acc_t *t = f->total;
+                std::sort(t->lengths.begin(), t->lengths.end());
+                fprintf(stdout, "\t%" PRIu64 "\t%" PRIu64 "\t%" PRIu64 "\t%" PRIu64 "\t%" PRIu64,
+                        t->samples, t->lengths.empty() ? 0 : t->lengths.back(), stats_n50(t->lengths, t->samples),
+                        t->stored_bytes, t->samples * sizeof (int16_t));
+                sum.samples += t->samples;
+                sum.stored_bytes += t->stored_bytes;
+                sum.lengths.insert(sum.lengths.end(), t->lengths.begin(), t->lengths.end());
+                delete t;
+            }
+            fprintf(stdout, "\n");
+        }
+    }
+
+    // the totals, as a comment line so that the table can be read without it
+    fprintf(stdout, "#total\t%" PRIu64 "/%zu ok\t.\t.\t.\t.\t.\t.\t%" PRIu64, num_ok, paths.size(), records);
+    if (flag_full) {
+        std::sort(sum.lengths.begin(), sum.lengths.end());
+        fprintf(stdout, "\t%" PRIu64 "\t%" PRIu64 "\t%" PRIu64 "\t%" PRIu64 "\t%" PRIu64,
+                sum.samples, sum.lengths.empty() ? 0 : sum.lengths.back(), stats_n50(sum.lengths, sum.samples),
+                sum.stored_bytes, sum.samples * sizeof (int16_t));
+    }
+    fprintf(stdout, "\n");
+
+    if (num_ok < paths.size()) {
+        ERROR("%zu of %zu files could not be read.", paths.size() - num_ok, paths.size());
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
+
 int stats_main(int argc, char **argv, struct program_meta *meta){
 
     // Debug: print arguments
@@ -64,15 +711,25 @@ int stats_main(int argc, char **argv, struct program_meta *meta){
 
     static struct option long_opts[] = {
             {"help", no_argument, NULL, 'h' }, //0
+            {"mmap", no_argument, NULL, 0 }, //1
+            {"full", no_argument, NULL, 0 }, //2
+            {"threads", required_argument, NULL, 't' }, //3
+            {"batchsize", required_argument, NULL, 'K' }, //4
+            {"max-mem", required_argument, NULL, 'M' }, //5
             {NULL, 0, NULL, 0 }
     };
 
+    opt_t user_opts;
+    init_opt(&user_opts);
+
     // Input arguments
     int longindex = 0;
     int opt;
+    int flag_mmap = 0;
+    int flag_full = 0;
 
     // Parse options
-    while ((opt = getopt_long(argc, argv, "h", long_opts, &longindex)) != -1) {
+    while ((opt = getopt_long(argc, argv, "ht:K:", long_opts, &longindex)) != -1) {
         DEBUG("opt='%c', optarg=\"%s\", optind=%d, opterr=%d, optopt='%c'",
                   opt, optarg, optind, opterr, optopt);
         switch (opt) {
@@ -82,12 +739,48 @@ int stats_main(int argc, char **argv, struct program_meta *meta){
 
                 EXIT_MSG(EXIT_SUCCESS, argv, meta);
                 exit(EXIT_SUCCESS);
+            case 't':
+                user_opts.arg_num_threads = optarg;
+                break;
+            case 'K':
+                user_opts.arg_batch = optarg;
+                break;
+            case 'M':
+                user_opts.arg_max_mem = optarg;
+                break;
+            case 0  :
+                if (longindex == 1) {
+                    flag_mmap = 1;
+                } else if (longindex == 2) {
+                    flag_full = 1;
+                }
+                break;
             default: // case '?'
                 fprintf(stderr, HELP_SMALL_MSG, argv[0]);
                 EXIT_MSG(EXIT_FAILURE, argv, meta);
                 return EXIT_FAILURE;
         }
     }
+
+    if (parse_num_threads(&user_opts, argc, argv, meta) < 0 ||
+            parse_batch_size(&user_opts, argc, argv) < 0 ||
+            parse_max_mem(&user_opts, argc, argv) < 0) {
+        EXIT_MSG(EXIT_FAILURE, argv, meta);
+        return EXIT_FAILURE;
+    }
+    user_opts.flag_mmap = flag_mmap;
+
+    if (argc - optind < 1) {
+        ERROR("%s", "Not enough arguments");
+        fprintf(stderr, HELP_SMALL_MSG, argv[0]);
+        EXIT_MSG(EXIT_FAILURE, argv, meta);
+        return EXIT_FAILURE;
+    }
+    int num_args = argc - optind;
+    if (num_args > 1 || is_directory(argv[optind])) {
+        return stats_files(argc - optind, argv + optind, &user_opts, flag_full);
+    }
+
     fprintf(stdout,"file path\t%s\n", argv[optind]);
 
     slow5_file_t* slow5File = slow5_open(argv[optind], "r");
@@ -97,42 +790,14 @@ int stats_main(int argc, char **argv, struct program_meta *meta){
     }
     uint32_t read_group_count_i = slow5File->header->num_read_groups;
 
-    std::string file_format = "file format error";
-    if(slow5File->format==SLOW5_FORMAT_UNKNOWN){
-        file_format = "FORMAT_UNKNOWN";
-    }else if(slow5File->format==SLOW5_FORMAT_ASCII){
-        file_format = "SLOW5 ASCII";
-    }else if(slow5File->format==SLOW5_FORMAT_BINARY){
-        file_format = "BLOW5";
-    }
-
     fprintf(stdout, "file version\t%d.%d.%d\n",slow5File->header->version.major, slow5File->header->version.minor, slow5File->header->version.patch);
 
-
     /* TODO print separate information for record and signal compression */
-    std::string compression_method = "compression error";
-    if(slow5File->compress->record_press->method==SLOW5_COMPRESS_NONE){
-        compression_method = "none";
-    }else if(slow5File->compress->record_press->method==SLOW5_COMPRESS_ZLIB){
-        compression_method = "zlib";
-    }else if(slow5File->compress->record_press->method==SLOW5_COMPRESS_ZSTD){
-        compression_method = "zstd";
-    }
-
-    fprintf(stdout, "file format\t%s\n", file_format.c_str());
-    fprintf(stdout, "record compression method\t%s\n", compression_method.c_str());
-
+    fprintf(stdout, "file format\t%s\n", stats_format_name(slow5File->format));
+    fprintf(stdout, "record compression method\t%s\n", stats_record_press_name(slow5File->compress->record_press->method));
 
     //todo: version check for signal_compression
-    std::string signal_compression_method = "compression error";
-    if(slow5File->compress->signal_press->method==SLOW5_COMPRESS_NONE){
-        signal_compression_method = "none";
-    }else if(slow5File->compress->signal_press->method==SLOW5_COMPRESS_SVB_ZD){
-        signal_compression_method = "svb-zd";
-    }else if(slow5File->compress->signal_press->method==SLOW5_COMPRESS_EX_ZD){
-        signal_compression_method = "ex-zd";
-    }
-    fprintf(stdout, "signal compression method\t%s\n", signal_compression_method.c_str());
+    fprintf(stdout, "signal compression method\t%s\n", stats_signal_press_name(slow5File->compress->signal_press->method));
 
     fprintf(stdout,"number of read groups\t%u\n", read_group_count_i);
 
@@ -152,25 +817,20 @@ int stats_main(int argc, char **argv, struct program_meta *meta){
         fprintf(stdout, "auxiliary fields\n");
     }
 
-    VERBOSE("counting number of slow5 records...%s","");
-
-    int64_t record_count = 0;
-    size_t bytes;
-    char *mem;
-    double time_get_to_mem = slow5_realtime();
-    while ((mem = (char *) slow5_get_next_mem(&bytes, slow5File))) {
-        free(mem);
-        record_count++;
-    }
-    if (slow5_errno != SLOW5_ERR_EOF) {
-        ERROR("Error reading the file.%s","");
+    stats_full_t full;
+    stats_acc_t *total = NULL;
+    int64_t record_count = stats_count(slow5File, &user_opts, flag_full ? &full : NULL, &total);
+    if (record_count < 0) {
         return EXIT_FAILURE;
     }
-    DEBUG("time_get_to_mem\t%.3fs", slow5_realtime()-time_get_to_mem);
-
-    slow5_close(slow5File);
 
     fprintf(stdout,"number of records\t%" PRId64 "\n", record_count);
+    if (total) {
+        stats_full_print(total, &full);
+        delete total;
+    }
+
+    slow5_close(slow5File);
 
     return EXIT_SUCCESS;
 }
@@ -5,123 +5,375 @@
  * @date 27/02/2021
  */
 #include "thread.h"
+#include "slow5_extra.h"
 
 /**********************************
  * what you may have to modify *
  * - core_t struct
- * - db_t struct
- * - work_per_single_read function
+ * - the batch struct of the command (e.g. rec_batch_t)
+ * - the per-record function, passed to work_db wrapped in work_fn
  * - main function
  * compile as *
  * - gcc -Wall thread.c -lpthread
  **********************************/
 
-static inline int32_t steal_work(pthread_arg_t* all_args, int32_t n_threads) {
-	int32_t i, c_i = -1;
-	int32_t k;
-	for (i = 0; i < n_threads; ++i){
-        pthread_arg_t args = all_args[i];
-        //fprintf(stderr,"endi : %d, starti : %d\n",args.endi,args.starti);
-		if (args.endi-args.starti > STEAL_THRESH) {
-            //fprintf(stderr,"gap : %d\n",args.endi-args.starti);
-            c_i = i;
-            break;
+/* compression contexts of the calling thread, reused across records and batches */
+static __thread press_cache_entry_t press_cache[PRESS_CACHE_SIZE];
+static __thread int32_t press_cache_n = 0;
+
+__thread int work_in_worker = 0;
+
+struct slow5_press* press_cache_get(slow5_press_method_t method){
+    int32_t i;
+    for (i = 0; i < press_cache_n; i++) {
+        if (press_cache[i].method.record_method == method.record_method &&
+            press_cache[i].method.signal_method == method.signal_method) {
+            return press_cache[i].press;
         }
     }
-    if(c_i<0){
-        return -1;
+
+    struct slow5_press* press = slow5_press_init(method);
+    if (press == NULL) {
+        return NULL;
+    }
+    if (press_cache_n == PRESS_CACHE_SIZE) { //full, replace the last one
+        slow5_press_free(press_cache[--press_cache_n].press);
     }
-	k = __sync_fetch_and_add(&(all_args[c_i].starti), 1);
-    //fprintf(stderr,"k : %d, end %d, start %d\n",k,all_args[c_i].endi,all_args[c_i].starti);
-	return k >= all_args[c_i].endi ? -1 : k;
+    press_cache[press_cache_n].method = method;
+    press_cache[press_cache_n].press = press;
+    press_cache_n++;
+    return press;
 }
 
+void press_cache_free(void){
+    int32_t i;
+    for (i = 0; i < press_cache_n; i++) {
+        slow5_press_free(press_cache[i].press);
+    }
+    press_cache_n = 0;
+}
 
 void* pthread_single(void* voidargs) {
-    int32_t i;
     pthread_arg_t* args = (pthread_arg_t*)voidargs;
-    db_t* db = args->db;
-    core_t* core = args->core;
+    work_in_worker = 1;
+    profile_mark_t start;
+    profile_mark(&start);
+    args->run(args);
+    profile_thread_busy(args->thread_index, &start);
+    press_cache_free();
+    //fprintf(stderr,"Thread %d done\n",(myargs->position)/THREADS);
+    pthread_exit(0);
+}
 
-#ifndef WORK_STEAL
-    for (i = args->starti; i < args->endi; i++) {
-        args->func(core,db,i);
-    }
-#else
-    pthread_arg_t* all_args = (pthread_arg_t*)(args->all_pthread_args);
-    //adapted from kthread.c in minimap2
-    for (;;) {
-		i = __sync_fetch_and_add(&args->starti, 1);
-		if (i >= args->endi) {
-            break;
+/* split the batch into num_thread contiguous ranges, of similar record counts or of similar total cost if given */
+static inline void pthread_set_args(pthread_arg_t* pt_args, int32_t num_thread, int64_t n_batch, const size_t* cost, void* task, void (*run)(pthread_arg_t*)) {
+    int32_t t;
+    int32_t i = 0;
+
+    if (cost == NULL) {
+        int32_t step = (n_batch + num_thread - 1) / num_thread;
+        for (t = 0; t < num_thread; t++) {
+            int32_t end = i + step > n_batch ? n_batch : i + step;
+            pt_args[t].range = RANGE_PACK(i, end);
+            i = end;
+        }
+    } else {
+        //every record costs at least 1 so that empty records are still spread
+        uint64_t total = 0;
+        for (int64_t j = 0; j < n_batch; j++) {
+            total += cost[j] + 1;
+        }
+        uint64_t acc = 0;
+        int32_t start = 0;
+        t = 0;
+        for (int64_t j = 0; j < n_batch && t < num_thread - 1; j++) {
+            acc += cost[j] + 1;
+            if (acc * num_thread >= total * (t + 1)) {
+                pt_args[t++].range = RANGE_PACK(start, j + 1);
+                start = j + 1;
+            }
+        }
+        pt_args[t++].range = RANGE_PACK(start, n_batch);
+        for (; t < num_thread; t++) {
+            pt_args[t].range = RANGE_PACK(n_batch, n_batch);
         }
-		args->func(core,db,i);
-	}
-	while ((i = steal_work(all_args,core->num_thread)) >= 0){
-		args->func(core,db,i);
     }
-#endif
 
-    //fprintf(stderr,"Thread %d done\n",(myargs->position)/THREADS);
-    pthread_exit(0);
+    for (t = 0; t < num_thread; t++) {
+        pt_args[t].task = task;
+        pt_args[t].run = run;
+        pt_args[t].num_thread = num_thread;
+        pt_args[t].thread_index = t;
+    #ifdef WORK_STEAL
+        pt_args[t].all_pthread_args =  (void *)pt_args;
+    #endif
+        //fprintf(stderr,"t%d : %d-%d\n",t,RANGE_START(pt_args[t].range),RANGE_END(pt_args[t].range));
+    }
 }
 
-void pthread_db(core_t* core, db_t* db, void (*func)(core_t*,db_t*,int)){
+void pthread_dispatch(int32_t num_thread, int64_t n_batch, const size_t* cost, void* task, void (*run)(pthread_arg_t*)){
     //create threads
-    pthread_t tids[core->num_thread];
-    pthread_arg_t pt_args[core->num_thread];
+    pthread_t tids[num_thread];
+    pthread_arg_t pt_args[num_thread];
     int32_t t, ret;
-    int32_t i = 0;
-    int32_t num_thread = core->num_thread;
-    int32_t step = (db->n_batch + num_thread - 1) / num_thread;
     //todo : check for higher num of threads than the data
     //current works but many threads are created despite
 
     //set the data structures
-    for (t = 0; t < num_thread; t++) {
-        pt_args[t].core = core;
-        pt_args[t].db = db;
-        pt_args[t].starti = i;
-        i += step;
-        if (i > db->n_batch) {
-            pt_args[t].endi = db->n_batch;
-        } else {
-            pt_args[t].endi = i;
-        }
-        pt_args[t].func=func;
-    #ifdef WORK_STEAL
-        pt_args[t].all_pthread_args =  (void *)pt_args;
-    #endif
-        //fprintf(stderr,"t%d : %d-%d\n",t,pt_args[t].starti,pt_args[t].endi);
-
-    }
+    pthread_set_args(pt_args, num_thread, n_batch, cost, task, run);
+    profile_threads_reserve(num_thread);
+    profile_mark_t start;
+    profile_mark(&start);
 
     //create threads
-    for(t = 0; t < core->num_thread; t++){
+    for(t = 0; t < num_thread; t++){
         ret = pthread_create(&tids[t], NULL, pthread_single,
                                 (void*)(&pt_args[t]));
         NEG_CHK(ret);
     }
 
     //pthread joining
-    for (t = 0; t < core->num_thread; t++) {
+    for (t = 0; t < num_thread; t++) {
         int ret = pthread_join(tids[t], NULL);
         NEG_CHK(ret);
     }
+    profile_dispatch(num_thread, &start);
 }
 
-/* process all reads in the given batch db */
-void work_db(core_t* core, db_t* db, void (*func)(core_t*,db_t*,int)){
+/* the pool that serves work_db; created on first use and kept until work_pool_destroy() */
+static work_pool_t *work_pool = NULL;
+
+/* a pool worker: sleeps until a new batch is published, runs its share and reports back */
+static void* pool_single(void* voidargs) {
+    pthread_arg_t* args = (pthread_arg_t*)voidargs;
+    work_pool_t* pool = (work_pool_t*)args->pool;
+    uint64_t seen = 0;
+    work_in_worker = 1;
 
-    if (core->num_thread == 1) {
-        int32_t i=0;
-        for (i = 0; i < db->n_batch; i++) {
-            func(core,db,i);
+    for (;;) {
+        pthread_mutex_lock(&pool->lock);
+        while (pool->generation == seen && !pool->shutdown) {
+            pthread_cond_wait(&pool->work_cv, &pool->lock);
+        }
+        if (pool->shutdown) {
+            pthread_mutex_unlock(&pool->lock);
+            break;
+        }
+        seen = pool->generation;
+        pthread_mutex_unlock(&pool->lock);
+
+        profile_mark_t start;
+        profile_mark(&start);
+        args->run(args);
+        profile_thread_busy(args->thread_index, &start);
+
+        pthread_mutex_lock(&pool->lock);
+        if (--pool->pending == 0) {
+            pthread_cond_signal(&pool->done_cv);
         }
+        pthread_mutex_unlock(&pool->lock);
+    }
+
+    press_cache_free();
+    pthread_exit(0);
+}
+
+work_pool_t* work_pool_init(int32_t num_thread){
+    int32_t t, ret;
 
+    work_pool_t* pool = (work_pool_t*)calloc(1, sizeof(work_pool_t));
+    MALLOC_CHK(pool);
+    pool->num_thread = num_thread;
+    pool->tids = (pthread_t*)malloc(num_thread * sizeof(pthread_t));
+    MALLOC_CHK(pool->tids);
+    pool->pt_args = (pthread_arg_t*)calloc(num_thread, sizeof(pthread_arg_t));
+    MALLOC_CHK(pool->pt_args);
+
+    NEG_CHK(pthread_mutex_init(&pool->lock, NULL));
+    NEG_CHK(pthread_cond_init(&pool->work_cv, NULL));
+    NEG_CHK(pthread_cond_init(&pool->done_cv, NULL));
+
+    for (t = 0; t < num_thread; t++) {
+        pool->pt_args[t].pool = pool;
+        ret = pthread_create(&pool->tids[t], NULL, pool_single,
+                                (void*)(&pool->pt_args[t]));
+        NEG_CHK(ret);
+    }
+
+    return pool;
+}
+
+void work_pool_free(work_pool_t* pool){
+    int32_t t;
+
+    pthread_mutex_lock(&pool->lock);
+    pool->shutdown = 1;
+    pthread_cond_broadcast(&pool->work_cv);
+    pthread_mutex_unlock(&pool->lock);
+
+    for (t = 0; t < pool->num_thread; t++) {
+        int ret = pthread_join(pool->tids[t], NULL);
+        NEG_CHK(ret);
+    }
+
+    pthread_mutex_destroy(&pool->lock);
+    pthread_cond_destroy(&pool->work_cv);
+    pthread_cond_destroy(&pool->done_cv);
+    free(pool->tids);
+    free(pool->pt_args);
+    free(pool);
+}
+
+void pool_db(work_pool_t* pool, int64_t n_batch, const size_t* cost, void* task, void (*run)(pthread_arg_t*)){
+
+    pthread_set_args(pool->pt_args, pool->num_thread, n_batch, cost, task, run);
+    profile_threads_reserve(pool->num_thread);
+    profile_mark_t start;
+    profile_mark(&start);
+
+    pthread_mutex_lock(&pool->lock);
+    pool->pending = pool->num_thread;
+    pool->generation++;
+    pthread_cond_broadcast(&pool->work_cv);
+    while (pool->pending > 0) {
+        pthread_cond_wait(&pool->done_cv, &pool->lock);
+    }
+    pthread_mutex_unlock(&pool->lock);
+    profile_dispatch(pool->num_thread, &start);
+}
+
+void work_pool_destroy(void){
+    if (work_pool != NULL) {
+        work_pool_free(work_pool);
+        work_pool = NULL;
     }
+    //contexts used by the calling thread when running with a single thread
+    press_cache_free();
+}
+
+void work_dispatch(int32_t num_thread, int64_t n_batch, const size_t* cost, void* task, void (*run)(pthread_arg_t*)){
+    if (work_pool != NULL && work_pool->num_thread != num_thread) {
+        work_pool_destroy();
+    }
+    if (work_pool == NULL) {
+        work_pool = work_pool_init(num_thread);
+    }
+    pool_db(work_pool, n_batch, cost, task, run);
+}
+
+work_queue_t* work_queue_init(int32_t cap){
+    work_queue_t* q = (work_queue_t*)calloc(1, sizeof(work_queue_t));
+    MALLOC_CHK(q);
+    q->items = (void**)malloc(cap * sizeof(void*));
+    MALLOC_CHK(q->items);
+    q->cap = cap;
+    NEG_CHK(pthread_mutex_init(&q->lock, NULL));
+    NEG_CHK(pthread_cond_init(&q->not_empty, NULL));
+    NEG_CHK(pthread_cond_init(&q->not_full, NULL));
+    return q;
+}
+
+void work_queue_free(work_queue_t* q){
+    pthread_mutex_destroy(&q->lock);
+    pthread_cond_destroy(&q->not_empty);
+    pthread_cond_destroy(&q->not_full);
+    free(q->items);
+    free(q);
+}
+
+/* blocks while the queue is full */
+void work_queue_push(work_queue_t* q, void* item){
+    pthread_mutex_lock(&q->lock);
+    while (q->count == q->cap) {
+        pthread_cond_wait(&q->not_full, &q->lock);
+    }
+    q->items[(q->head + q->count) % q->cap] = item;
+    q->count++;
+    pthread_cond_signal(&q->not_empty);
+    pthread_mutex_unlock(&q->lock);
+}
+
+/* blocks while the queue is empty; returns NULL once the queue is closed and drained */
+void* work_queue_pop(work_queue_t* q){
+    void* item = NULL;
+    pthread_mutex_lock(&q->lock);
+    while (q->count == 0 && !q->closed) {
+        pthread_cond_wait(&q->not_empty, &q->lock);
+    }
+    if (q->count > 0) {
+        item = q->items[q->head];
+        q->head = (q->head + 1) % q->cap;
+        q->count--;
+        pthread_cond_signal(&q->not_full);
+    }
+    pthread_mutex_unlock(&q->lock);
+    return item;
+}
+
+/* no more items will be pushed; wakes up any consumer waiting on an empty queue */
+void work_queue_close(work_queue_t* q){
+    pthread_mutex_lock(&q->lock);
+    q->closed = 1;
+    pthread_cond_broadcast(&q->not_empty);
+    pthread_mutex_unlock(&q->lock);
+}
+
+/* size of the block header, rounded up so that the data that follows is aligned */
+#define ARENA_HDR_SIZE ((sizeof(arena_block_t) + ARENA_ALIGN - 1) & ~((size_t)ARENA_ALIGN - 1))
+
+static arena_block_t* arena_block_new(size_t cap, arena_block_t* next){
+    arena_block_t* blk = (arena_block_t*)malloc(ARENA_HDR_SIZE + cap);
+    MALLOC_CHK(blk);
+    blk->next = next;
+    blk->cap = cap;
+    blk->used = 0;
+    return blk;
+}
+
+void arena_init(arena_t* arena, size_t block_size){
+    arena->head = NULL;
+    arena->block_size = block_size > 0 ? block_size : ARENA_BLOCK_SIZE;
+}
+
+void* arena_alloc(arena_t* arena, size_t n){
+    n = (n + ARENA_ALIGN - 1) & ~((size_t)ARENA_ALIGN - 1);
+    arena_block_t* blk = arena->head;
+    if (blk == NULL || blk->cap - blk->used < n) {
+        size_t cap = n > arena->block_size ? n : arena->block_size;
+        blk = arena->head = arena_block_new(cap, blk);
+    }
+    void* ptr = (char*)blk + ARENA_HDR_SIZE + blk->used;
+    blk->used += n;
+    return ptr;
+}
+
+/* release everything allocated since the last reset; a chain of blocks is coalesced into one so that
+ * the next batch of the same size fits in a single block and later resets are O(1) */
+void arena_reset(arena_t* arena){
+    arena_block_t* blk = arena->head;
+    if (blk == NULL) {
+        return;
+    }
+    if (blk->next == NULL) {
+        blk->used = 0;
+        return;
+    }
+    size_t cap = 0;
+    while (blk != NULL) {
+        arena_block_t* next = blk->next;
+        cap += blk->cap;
+        free(blk);
+        blk = next;
+    }
+    arena->head = arena_block_new(cap, NULL);
+}
 
-    else {
-        pthread_db(core,db,func);
+void arena_free(arena_t* arena){
+    arena_block_t* blk = arena->head;
+    while (blk != NULL) {
+        arena_block_t* next = blk->next;
+        free(blk);
+        blk = next;
     }
+    arena->head = NULL;
 }
@@ -8,14 +8,15 @@
 #include <string.h>
 #include <slow5/slow5.h>
 #include "error.h"
+#include "profile.h"
 #include <vector>
 #include <string>
 
 /**********************************
  * what you may have to modify *
  * - core_t struct
- * - db_t struct
- * - work_per_single_read function
+ * - the batch struct of the command (e.g. rec_batch_t)
+ * - the per-record function, passed to work_db wrapped in work_fn
  * - main function
  * compile as *
  * - gcc -Wall thread.c -lpthread
@@ -24,6 +25,16 @@
 #define WORK_STEAL 1 //simple work stealing enabled or not (no work stealing mean no load balancing)
 #define STEAL_THRESH 1 //stealing threshold
 
+/* the range [start, end) of a thread is packed into one 64-bit word so that the owner and thieves can update it with a single CAS */
+#define RANGE_PACK(start, end) (((uint64_t)(uint32_t)(start) << 32) | (uint32_t)(end))
+#define RANGE_START(range) ((int32_t)((range) >> 32))
+#define RANGE_END(range) ((int32_t)((range) & 0xffffffffu))
+
+#define PRESS_CACHE_SIZE 4 //compression contexts kept per thread
+
+#define ARENA_BLOCK_SIZE (1024*1024) //default size of an arena block
+#define ARENA_ALIGN 16
+
 #define NEG_CHK(ret) neg_chk(ret, __func__, __FILE__, __LINE__ - 1)
 
 /* core data structure that has information that are global to all the threads */
@@ -40,52 +51,95 @@ typedef struct {
     slow5_aux_meta_t* aux_meta;
     //skim
     void *param;
+    //get --mmap
+    struct mmap_reader *mr;
+    //get, with a sorted index
+    struct index_map *im;
+    //view, merge, split, demux with --index: set read_record[i].read_id
+    int index_out;
+    //view, skim with --filter: records that do not pass are left out
+    const struct filter *filter;
 } core_t;
 
 typedef struct{
     int len;
     void* buffer;
+    char *read_id;  // with --index, the read id of the record, handed to the output index by the writer
 } raw_record_t;
 
-/* data structure for a batch of reads*/
+/* a batch of raw records to be decoded and processed (view, degrade, skim);
+   commands with extra per-record state define their own batch struct */
 typedef struct {
     int64_t n_batch;    // number of records in this batch
-    int64_t n_err;      // number of errors in this batch
-    raw_record_t *read_record; // the list of read records (output) //change to whatever the data type
-    //for get
-    char **read_id;     // the list of read ids (input)
-    //for view
     char** mem_records; // list of slow5_get_next_mem() records
     size_t* mem_bytes; // lengths of slow5_get_next_mem() records
-    //for merge
-    std::vector<std::string> slow5_files;
-    std::vector<std::vector<size_t>> list;
-    std::vector<int> slow5_file_indices;
-    std::string output_dir;
-    slow5_file_t **slow5_file_pointers;
-    //for split
-    uint32_t* read_group_vector;
-} db_t;
+    raw_record_t *read_record; // the list of output records
+    int mapped;         // mem_records point into a mmap_reader_t map or the batch arena and are not freed
+} rec_batch_t;
 
 /* argument wrapper for the multithreaded framework used for data processing */
-typedef struct {
-    core_t* core;
-    db_t* db;
-    int32_t starti;
-    int32_t endi;
-    void (*func)(core_t*,db_t*,int);
+typedef struct pthread_arg {
+    void *task;         // the batch and its per-record function (a work_task)
+    void (*run)(struct pthread_arg*); // processes this thread's share of task
+    uint64_t range;     // remaining records of this thread, see RANGE_PACK
+    int32_t num_thread;
     int32_t thread_index;
 #ifdef WORK_STEAL
     void *all_pthread_args;
 #endif
+    void *pool;
 } pthread_arg_t;
 
+/* a block of a batch arena; the data follows the header */
+typedef struct arena_block {
+    struct arena_block *next;
+    size_t cap;
+    size_t used;
+} arena_block_t;
+
+/* bump allocator for memory that lives as long as a batch; not thread safe */
+typedef struct {
+    arena_block_t *head;
+    size_t block_size;
+} arena_t;
+
+/* a compression context of a thread, keyed by its method */
+typedef struct {
+    slow5_press_method_t method;
+    struct slow5_press *press;
+} press_cache_entry_t;
+
+/* long-lived worker pool; workers sleep on work_cv between batches */
+typedef struct {
+    int32_t num_thread;
+    pthread_t *tids;
+    pthread_arg_t *pt_args;
+    pthread_mutex_t lock;
+    pthread_cond_t work_cv;     // signalled when a new batch is published
+    pthread_cond_t done_cv;     // signalled when the last worker finishes a batch
+    uint64_t generation;        // incremented once per published batch
+    int32_t pending;            // workers yet to finish the current batch
+    int shutdown;
+} work_pool_t;
+
+/* bounded FIFO of pointers used to pass batches between pipeline stages */
+typedef struct {
+    void **items;
+    int32_t cap;
+    int32_t head;
+    int32_t count;
+    int closed;
+    pthread_mutex_t lock;
+    pthread_cond_t not_empty;
+    pthread_cond_t not_full;
+} work_queue_t;
+
 
 /*
 int main(void) {
 
     core_t core;
-    db_t db;
+    my_batch_t db;
 
     core.num_thread = 4;
     db.n_batch = 1000;
@@ -97,7 +151,7 @@ int main(void) {
         sprintf(db.read_id[i], "id%d", i);
     }
 
-    work_db(&core, &db);
+    work_db(&core, &db, work_fn<my_batch_t, work_per_single_read>());
 
     for (int i = 0; i < db.n_batch; ++ i) {
         free(db.read_id[i]);
@@ -111,9 +165,154 @@ int main(void) {
 */
 
 void* pthread_single(void* voidargs);
-void pthread_db(core_t* core, db_t* db, void (*func)(core_t*,db_t*,int));
-void work_per_single_read(core_t* core,db_t* db, int32_t i);
-/* process all reads in the given batch db */
-void work_db(core_t* core, db_t* db, void (*func)(core_t*,db_t*,int));
+/* run task on num_thread threads created and joined for this call */
+void pthread_dispatch(int32_t num_thread, int64_t n_batch, const size_t* cost, void* task, void (*run)(pthread_arg_t*));
+work_pool_t* work_pool_init(int32_t num_thread);
+void work_pool_free(work_pool_t* pool);
+/* run task on the threads of pool */
+void pool_db(work_pool_t* pool, int64_t n_batch, const size_t* cost, void* task, void (*run)(pthread_arg_t*));
+/* run task on the pool kept for the command, (re)creating it for num_thread threads if needed */
+void work_dispatch(int32_t num_thread, int64_t n_batch, const size_t* cost, void* task, void (*run)(pthread_arg_t*));
+/* join the threads of the pool used by work_db, if any */
+void work_pool_destroy(void);
+/* set in the threads of pthread_dispatch and of the pools */
+extern __thread int work_in_worker;
+
+/* compression context for method owned by the calling thread; do not free, it is reused by later records */
+struct slow5_press* press_cache_get(slow5_press_method_t method);
+/* free the compression contexts of the calling thread */
+void press_cache_free(void);
+
+void arena_init(arena_t* arena, size_t block_size);
+void* arena_alloc(arena_t* arena, size_t n);
+void arena_reset(arena_t* arena);
+void arena_free(arena_t* arena);
+
+work_queue_t* work_queue_init(int32_t cap);
+void work_queue_free(work_queue_t* q);
+void work_queue_push(work_queue_t* q, void* item);
+void* work_queue_pop(work_queue_t* q);
+void work_queue_close(work_queue_t* q);
+
+/* a batch and the function applied to each of its records */
+template <typename Batch, typename Func>
+struct work_task {
+    core_t* core;
+    Batch* db;
+    Func func;
+};
+
+/* wraps a per-record function into a functor type, so that work_db is instantiated for that
+   function and the per-record call can be inlined instead of going through a pointer */
+template <typename Batch, void (*F)(core_t*, Batch*, int32_t)>
+struct work_fn {
+    inline void operator()(core_t* core, Batch* db, int32_t i) const {
+        F(core, db, i);
+    }
+};
+
+/* take the next record from the range of args; -1 once the range is empty */
+static inline int32_t range_next(pthread_arg_t* args) {
+    uint64_t range = __atomic_load_n(&args->range, __ATOMIC_RELAXED);
+    for (;;) {
+        int32_t start = RANGE_START(range);
+        int32_t end = RANGE_END(range);
+        if (start >= end) {
+            return -1;
+        }
+        uint64_t seen = __sync_val_compare_and_swap(&args->range, range, RANGE_PACK(start + 1, end));
+        if (seen == range) {
+            return start;
+        }
+        range = seen;
+    }
+}
+
+/* move the upper half of the largest remaining range of the other threads into the (empty) range of args;
+   returns 0 once no range has more than STEAL_THRESH records left */
+static inline int steal_work(pthread_arg_t* args) {
+    pthread_arg_t* all_args = (pthread_arg_t*)(args->all_pthread_args);
+    for (;;) {
+        int32_t i, c_i = -1;
+        int32_t most = STEAL_THRESH;
+        uint64_t victim = 0;
+        for (i = 0; i < args->num_thread; ++i) {
+            uint64_t range = __atomic_load_n(&all_args[i].range, __ATOMIC_RELAXED);
+            int32_t left = RANGE_END(range) - RANGE_START(range);
+            if (left > most) {
+                most = left;
+                c_i = i;
+                victim = range;
+            }
+        }
+        if (c_i < 0) {
+            return 0;
+        }
+        int32_t start = RANGE_START(victim);
+        int32_t end = RANGE_END(victim);
+        int32_t mid = end - (end - start) / 2;
+        if (__sync_bool_compare_and_swap(&all_args[c_i].range, victim, RANGE_PACK(start, mid))) {
+            __atomic_store_n(&args->range, RANGE_PACK(mid, end), __ATOMIC_RELEASE);
+            return 1;
+        }
+        //the victim moved on in the meantime, look again
+    }
+}
+
+/* process the range assigned to a thread and then steal from the others */
+template <typename Batch, typename Func>
+void work_run(pthread_arg_t* args) {
+    int32_t i;
+    work_task<Batch, Func>* task = (work_task<Batch, Func>*)args->task;
+    core_t* core = task->core;
+    Batch* db = task->db;
+
+#ifndef WORK_STEAL
+    for (i = RANGE_START(args->range); i < RANGE_END(args->range); i++) {
+        task->func(core,db,i);
+    }
+#else
+    //adapted from kthread.c in minimap2, stealing half of the most loaded range at a time
+    do {
+        while ((i = range_next(args)) >= 0) {
+            task->func(core,db,i);
+        }
+    } while (steal_work(args));
+#endif
+}
+
+/* process all reads in the given batch db with func(core, db, i) for each record i;
+   if cost is given (e.g. db->mem_bytes), the initial ranges have similar total cost instead of similar record counts */
+template <typename Batch, typename Func>
+void work_db(core_t* core, Batch* db, Func func, const size_t* cost = NULL){
+
+    if (core->num_thread == 1) {
+        int32_t i=0;
+        profile_mark_t start;
+        profile_mark(&start);
+        for (i = 0; i < db->n_batch; i++) {
+            func(core,db,i);
+        }
+        // a worker running a batch of its own (e.g. a file of stats or quickcheck) has its time in its own slot already
+        if (profile_on && !work_in_worker) {
+            profile_threads_reserve(1);
+            profile_thread_busy(0, &start);
+            profile_dispatch(1, &start);
+        }
+
+    }
+
+    else {
+        work_task<Batch, Func> task = {core, db, func};
+        work_dispatch(core->num_thread, db->n_batch, cost, &task, work_run<Batch, Func>);
+    }
+}
+
+/* same as work_db, but creates and joins the threads for this batch only */
+template <typename Batch, typename Func>
+void pthread_db(core_t* core, Batch* db, Func func, const size_t* cost = NULL){
+    work_task<Batch, Func> task = {core, db, func};
+    pthread_dispatch(core->num_thread, db->n_batch, cost, &task, work_run<Batch, Func>);
+}
 
 #endif
@@ -9,9 +9,18 @@
 #include "cmd.h"
 #include "misc.h"
 #include "thread.h"
+#include "reader.h"
+#include "writer.h"
+#include "out_index.h"
+#include "filter.h"
 #include <slow5/slow5.h>
 #include "slow5_extra.h"
 #include <getopt.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#ifdef __linux__
+#include <sys/sendfile.h>
+#endif
 
 #define USAGE_MSG "Usage: %s [OPTIONS] [FILE]\n"
 #define HELP_LARGE_MSG \
@@ -23,39 +32,174 @@
     HELP_MSG_OUTPUT_FILE \
     HELP_MSG_PRESS \
     HELP_MSG_THREADS \
-    HELP_MSG_BATCH \
+    HELP_MSG_BATCH_ADAPTIVE \
+    HELP_MSG_READERS \
+    HELP_MSG_MMAP \
+    HELP_MSG_WRITER \
+    HELP_MSG_INDEX_OUT \
     "        --from FORMAT             specify input file format [auto]\n" \
+    "        --filter EXPR             write only the records passing EXPR, e.g. 'len_raw_signal>4000 && end_reason==signal_positive'\n" \
     HELP_MSG_HELP \
     HELP_FORMATS_METHODS
 
+// number of batches in flight between the reader, the workers and the writer
+#define VIEW_PIPELINE_DEPTH 3
+// bytes moved per copy_file_range/sendfile/read call when copying records as they are
+#define VIEW_COPY_CHUNK (1 << 24)
+
 extern int slow5tools_verbosity_level;
 
-int slow5_convert_parallel(struct slow5_file *from, FILE *to_fp, enum slow5_fmt to_format, slow5_press_method_t to_compress, size_t num_threads, int64_t batch_size, struct program_meta *meta);
+int slow5_convert_parallel(struct slow5_file *from, FILE *to_fp, enum slow5_fmt to_format, slow5_press_method_t to_compress, const opt_t *opt, out_index_t *oi, const filter_t *filter, struct program_meta *meta);
+
+/* a record left out by --filter, which the writer skips */
+static void view_drop_rec(rec_batch_t *db, int32_t i) {
+    db->read_record[i].buffer = NULL;
+    db->read_record[i].len = 0;
+    db->read_record[i].read_id = NULL;
+}
 
-void depress_parse_rec_to_mem(core_t *core, db_t *db, int32_t i) {
+/* with --filter, whether BLOW5 record i fails the filter, telling from a parse without the raw signal; it is then freed and dropped.
+   Otherwise *rec is the record as decompressed for the check (see rec_depress()) and *n its length, for the caller to go on from */
+static int view_filter_out(core_t *core, rec_batch_t *db, int32_t i, char **rec, size_t *n) {
+    *n = db->mem_bytes[i];
+    if ((*rec = rec_depress(db->mem_records[i], n, core->fp)) == NULL) {
+        ERROR("Could not decompress record %d of the batch", i);
+        exit(EXIT_FAILURE);
+    }
+    struct slow5_rec *read = NULL;
+    if (rec_parse_lazy(*rec, *n, &read, core->fp, filter_need_aux(core->filter)) != 0) {
+        return 0; // the full parse reports it
+    }
+    int pass = filter_pass(core->filter, read);
+    slow5_rec_free(read);
+    if (pass) {
+        return 0;
+    }
+    if (*rec != db->mem_records[i]) {
+        free(*rec);
+    }
+    if (!db->mapped) {
+        free(db->mem_records[i]);
+    }
+    view_drop_rec(db, i);
+    return 1;
+}
+
+void depress_parse_rec_to_mem(core_t *core, rec_batch_t *db, int32_t i) {
     //
+    int lazy_filter = core->filter && core->fp->format == SLOW5_FORMAT_BINARY;
     struct slow5_rec *read = NULL;
-    if (slow5_rec_depress_parse(&db->mem_records[i], &db->mem_bytes[i], NULL, &read, core->fp) != 0) {
+    if (lazy_filter) {
+        char *rec;
+        size_t n;
+        if (view_filter_out(core, db, i, &rec, &n)) {
+            return;
+        }
+        // the record passed, finish parsing it from where the filter left it
+        int ret = rec_parse_full(rec, n, &read, core->fp);
+        if (rec != db->mem_records[i]) {
+            free(rec);
+        }
+        if (ret != 0) {
+            exit(EXIT_FAILURE);
+        }
+        if (!db->mapped) {
+            free(db->mem_records[i]);
+        }
+    } else if (db->mapped) {
+        if (mmap_rec_depress_parse(db->mem_records[i], db->mem_bytes[i], &read, core->fp) != 0) {
+            exit(EXIT_FAILURE);
+        }
+    } else if (slow5_rec_depress_parse(&db->mem_records[i], &db->mem_bytes[i], NULL, &read, core->fp) != 0) {
         exit(EXIT_FAILURE);
     } else {
         free(db->mem_records[i]);
     }
-    struct slow5_press *press_ptr = slow5_press_init(core->press_method);
+    if (core->filter && !lazy_filter && !filter_pass(core->filter, read)) {
+        slow5_rec_free(read);
+        view_drop_rec(db, i);
+        return;
+    }
+    struct slow5_press *press_ptr = press_cache_get(core->press_method);
     if(!press_ptr){
         ERROR("Could not initialize the slow5 compression method%s","");
         exit(EXIT_FAILURE);
     }
     size_t len;
     if ((db->read_record[i].buffer = slow5_rec_to_mem(read, core->fp->header->aux_meta, core->format_out, press_ptr, &len)) == NULL) {
-        slow5_press_free(press_ptr);
         slow5_rec_free(read);
         exit(EXIT_FAILURE);
     }
-    slow5_press_free(press_ptr);
     db->read_record[i].len = len;
+    if (core->index_out) {
+        db->read_record[i].read_id = strdup(read->read_id);
+        MALLOC_CHK(db->read_record[i].read_id);
+    }
     slow5_rec_free(read);
 }
 
+/* BLOW5 to BLOW5 with the same signal compression: only the record compression is swapped, the
+   record is neither parsed nor is its signal decoded. With --index and the same record compression
+   too, the record is only decompressed for its read id and written as it is */
+void recompress_rec_to_mem(core_t *core, rec_batch_t *db, int32_t i) {
+    char *rec = NULL;
+    size_t n;
+    if (core->filter && view_filter_out(core, db, i, &rec, &n)) {
+        return;
+    }
+    struct slow5_press *out_press = press_cache_get(core->press_method);
+    if (!out_press) {
+        ERROR("Could not initialize the slow5 compression method%s","");
+        exit(EXIT_FAILURE);
+    }
+
+    if (rec == NULL) { // not already decompressed for --filter
+        n = db->mem_bytes[i];
+        if ((rec = rec_depress(db->mem_records[i], &n, core->fp)) == NULL) {
+            ERROR("Could not decompress record %d of the batch", i);
+            exit(EXIT_FAILURE);
+        }
+    }
+    if (core->index_out) {
+        db->read_record[i].read_id = out_index_rec_id((const char *) rec, n);
+    }
+
+    slow5_rec_size_t size = db->mem_bytes[i];
+    size_t m = size;
+    void *comp = NULL;
+    if (core->fp->compress->record_press->method != core->press_method.record_method) {
+        // as slow5_rec_to_mem() does, so that the cached stream of this thread starts each record anew
+        slow5_compress_footer_next(out_press->record_press);
+        comp = slow5_ptr_compress(out_press->record_press, rec, n, &m);
+        if (comp == NULL) {
+            ERROR("Could not compress record %d of the batch", i);
+            exit(EXIT_FAILURE);
+        }
+    }
+    if (rec != db->mem_records[i]) {
+        free(rec);
+    }
+
+    if (comp == NULL && db->mapped) {
+        // written from where it was read, after its length prefix (see view_writer)
+        db->read_record[i].buffer = db->mem_records[i] - sizeof size;
+        db->read_record[i].len = sizeof size + m;
+        return;
+    }
+    // a BLOW5 record is its compressed size followed by the compressed bytes
+    size = m;
+    char *buffer = (char *) malloc(sizeof size + m);
+    MALLOC_CHK(buffer);
+    memcpy(buffer, &size, sizeof size);
+    memcpy(buffer + sizeof size, comp ? comp : db->mem_records[i], m);
+    free(comp);
+    if (!db->mapped) {
+        free(db->mem_records[i]);
+    }
+    db->read_record[i].buffer = buffer;
+    db->read_record[i].len = sizeof size + m;
+}
+
 int view_main(int argc, char **argv, struct program_meta *meta) {
     int view_ret = EXIT_SUCCESS;
 
@@ -78,6 +222,13 @@ int view_main(int argc, char **argv, struct program_meta *meta) {
         {"to",              required_argument,  NULL, 'b'},
         {"threads",         required_argument,  NULL, 't' },
         {"batchsize",       required_argument, NULL, 'K'},
+        {"max-mem",         required_argument, NULL, 'M'},
+        {"readers",         required_argument, NULL, 'R'},
+        {"mmap",            no_argument,       NULL, 'm'},
+        {"write-buf",       required_argument, NULL, 'W'},
+        {"direct",          no_argument,       NULL, 'D'},
+        {"index",           no_argument,       NULL, 'I'},
+        {"filter",          required_argument, NULL, 'F'},
         {NULL, 0, NULL, 0}
     };
 
@@ -86,6 +237,7 @@ int view_main(int argc, char **argv, struct program_meta *meta) {
 
     int opt;
     int longindex = 0;
+    const char *filter_expr = NULL;
 
     // Parse options
     while ((opt = getopt_long(argc, argv, "s:c:f:ho:b:t:K:", long_opts, &longindex)) != -1) {
@@ -105,6 +257,27 @@ int view_main(int argc, char **argv, struct program_meta *meta) {
             case 'K':
                 user_opts.arg_batch = optarg;
                 break;
+            case 'M':
+                user_opts.arg_max_mem = optarg;
+                break;
+            case 'R':
+                user_opts.arg_num_readers = optarg;
+                break;
+            case 'm':
+                user_opts.flag_mmap = 1;
+                break;
+            case 'W':
+                user_opts.arg_write_buf = optarg;
+                break;
+            case 'D':
+                user_opts.flag_direct = 1;
+                break;
+            case 'I':
+                user_opts.flag_index = 1;
+                break;
+            case 'F':
+                filter_expr = optarg;
+                break;
             case 'h':
                 DEBUG("displaying large help message%s","");
                 fprintf(stdout, HELP_LARGE_MSG, argv[0]);
@@ -134,10 +307,27 @@ int view_main(int argc, char **argv, struct program_meta *meta) {
         EXIT_MSG(EXIT_FAILURE, argv, meta);
         return EXIT_FAILURE;
     }
+    if(parse_max_mem(&user_opts,argc,argv) < 0){
+        EXIT_MSG(EXIT_FAILURE, argv, meta);
+        return EXIT_FAILURE;
+    }
+    if(parse_num_readers(&user_opts,argc,argv) < 0){
+        EXIT_MSG(EXIT_FAILURE, argv, meta);
+        return EXIT_FAILURE;
+    }
+    if(parse_write_buf(&user_opts,argc,argv) < 0){
+        EXIT_MSG(EXIT_FAILURE, argv, meta);
+        return EXIT_FAILURE;
+    }
     if(parse_format_args(&user_opts,argc,argv,meta) < 0){
         EXIT_MSG(EXIT_FAILURE, argv, meta);
         return EXIT_FAILURE;
     }
+    if (user_opts.flag_index && user_opts.arg_fname_out == NULL) {
+        ERROR("--index needs an output file (-o)%s", "");
+        EXIT_MSG(EXIT_FAILURE, argv, meta);
+        return EXIT_FAILURE;
+    }
 
     // Check for an input file to parse
     if (optind >= argc) { // TODO use stdin if no file given
@@ -186,6 +376,8 @@ int view_main(int argc, char **argv, struct program_meta *meta) {
     }
 
     // Do the conversion
+    out_index_t *oi = NULL;
+    filter_t *filter = NULL;
     if ((user_opts.fmt_in == SLOW5_FORMAT_ASCII || user_opts.fmt_in == SLOW5_FORMAT_BINARY) &&
             (user_opts.fmt_out == SLOW5_FORMAT_ASCII || user_opts.fmt_out == SLOW5_FORMAT_BINARY)) {
 
@@ -197,18 +389,22 @@ int view_main(int argc, char **argv, struct program_meta *meta) {
             view_ret = EXIT_FAILURE;
         }
 
-        // TODO if output is the same format just duplicate file
+        if (s5p != NULL && user_opts.flag_index) {
+            oi = out_index_init(user_opts.arg_fname_out, s5p->header->version);
+        }
+
+        if (s5p != NULL && filter_expr != NULL && (filter = filter_init(filter_expr, s5p)) == NULL) {
+            view_ret = EXIT_FAILURE;
+        }
+
         slow5_press_method_t press_out = {user_opts.record_press_out,user_opts.signal_press_out};
-        if (slow5_convert_parallel(s5p, user_opts.f_out, (enum slow5_fmt) user_opts.fmt_out, press_out, user_opts.num_threads, user_opts.read_id_batch_capacity, meta) != 0) {
+        if (view_ret == EXIT_SUCCESS && slow5_convert_parallel(s5p, user_opts.f_out, (enum slow5_fmt) user_opts.fmt_out, press_out, &user_opts, oi, filter, meta) != 0) {
             ERROR("File conversion failed.%s", "");
             view_ret = EXIT_FAILURE;
         }
-
-        // TODO if output is the same format just duplicate file
-//        if (slow5_convert(s5p, f_out, (enum slow5_fmt) fmt_out, press_out) != 0) {
-//            ERROR("Conversion failed.%s", "");
-//            view_ret = EXIT_FAILURE;
-//        }
+        if (filter != NULL) {
+            filter_free(filter);
+        }
 
         if (slow5_close(s5p) == EOF) {
             ERROR("File '%s' failed on closing - %s.",
@@ -232,92 +428,438 @@ int view_main(int argc, char **argv, struct program_meta *meta) {
         }
     }
 
+    // the index goes last, so that it is not older than the file
+    if (oi != NULL) {
+        if (view_ret == EXIT_FAILURE) {
+            out_index_free(oi);
+        } else if (out_index_close(oi) != 0) {
+            view_ret = EXIT_FAILURE;
+        }
+    }
+
     if (view_ret == EXIT_FAILURE) {
         EXIT_MSG(EXIT_FAILURE, argv, meta);
     }
     return view_ret;
 }
 
-int slow5_convert_parallel(struct slow5_file *from, FILE *to_fp, enum slow5_fmt to_format, slow5_press_method_t to_compress, size_t num_threads, int64_t batch_size, struct program_meta *meta) {
-    if (from == NULL || to_fp == NULL || to_format == SLOW5_FORMAT_UNKNOWN) {
-        return -1;
-    }
+/* a batch in the pipeline with what the batch controller needs to know about it */
+typedef struct {
+    rec_batch_t db;
+    arena_t arena;      // the BLOW5 records read by view_reader, released when the batch comes back to it
+    int64_t cap;        // records the arrays of db can hold
+    size_t bytes_in;    // set by the reader
+    size_t bytes_out;   // set by the writer
+    double time;        // transcoding time, set by the main thread
+} view_batch_t;
+
+/* state shared by the reader, transcoding and writer stages of slow5_convert_parallel */
+typedef struct {
+    struct slow5_file *from;
+    batch_ctl_t ctl;        // only touched by the reader
+    range_reader_t *rr;     // with --readers, the parallel BLOW5 reader feeding view_range_reader
+    mmap_reader_t *mr;      // with --mmap, records are taken from the map by view_reader
+    writer_t *w;            // only touched by the writer
+    out_index_t *oi;        // with --index, only touched by the writer
+    int same_encoding;      // records read into an arena or the map are then written from there and not freed
+    work_queue_t *free_q;   // empty batches ready to be filled by the reader
+    work_queue_t *read_q;   // batches read and waiting to be transcoded
+    work_queue_t *write_q;  // transcoded batches waiting to be written, in input order
+    int read_err;
+    int write_err;
+    double time_get_to_mem;
+    double time_write;
+} view_pipeline_t;
+
+static void *view_reader(void *arg) {
+    view_pipeline_t *pl = (view_pipeline_t *) arg;
+    int flag_end_of_file = 0;
 
-    if (slow5_hdr_fwrite(to_fp, from->header, to_format, to_compress) == -1) {
-        return -2;
-    }
+    while (!flag_end_of_file) {
+        view_batch_t *vb = (view_batch_t *) work_queue_pop(pl->free_q);
+        rec_batch_t *db = &vb->db;
+        double realtime = slow5_realtime();
+        profile_mark_t start;
+        profile_mark(&start);
 
-    double time_get_to_mem = 0;
-    double time_thread_execution = 0;
-    double time_write = 0;
-    int flag_end_of_file = 0;
-    while(1) {
+        // a recycled batch has been through the whole pipeline, feed it back to size the next one
+        arena_reset(&vb->arena);
+        if (db->n_batch > 0) {
+            batch_ctl_update(&pl->ctl, db->n_batch, vb->bytes_in, vb->bytes_out, vb->time);
+        }
+        if (pl->ctl.batch_size > vb->cap) {
+            vb->cap = pl->ctl.batch_size;
+            db->mem_records = (char **) realloc(db->mem_records, vb->cap * sizeof(char*));
+            db->mem_bytes = (size_t *) realloc(db->mem_bytes, vb->cap * sizeof(size_t));
+            db->read_record = (raw_record_t*) realloc(db->read_record, vb->cap * sizeof *db->read_record);
+            MALLOC_CHK(db->mem_records);
+            MALLOC_CHK(db->mem_bytes);
+            MALLOC_CHK(db->read_record);
+        }
 
-        db_t db = { 0 };
-        db.mem_records = (char **) malloc(batch_size * sizeof(char*));
-        db.mem_bytes = (size_t *) malloc(batch_size * sizeof(size_t));
-        MALLOC_CHK(db.mem_records);
-        MALLOC_CHK(db.mem_bytes);
         int64_t record_count = 0;
         size_t bytes;
+        size_t bytes_in = 0;
         char *mem;
+        db->mapped = pl->mr != NULL || pl->from->format == SLOW5_FORMAT_BINARY;
+        while (!batch_ctl_full(&pl->ctl, record_count, bytes_in)) {
+            int ret = pl->mr ? mmap_reader_next(pl->mr, &mem, &bytes) : batch_rec_next(pl->from, &vb->arena, &mem, &bytes);
+            if (ret <= 0) {
+                pl->read_err = ret < 0;
+                flag_end_of_file = 1;
+                break;
+            }
+            db->mem_records[record_count] = mem;
+            db->mem_bytes[record_count] = bytes;
+            bytes_in += bytes;
+            record_count++;
+        }
+        db->n_batch = record_count;
+        vb->bytes_in = bytes_in;
+        pl->time_get_to_mem += slow5_realtime() - realtime;
+        profile_stage("read", &start, record_count, bytes_in, 0);
+        work_queue_push(pl->read_q, vb);
+    }
+
+    work_queue_close(pl->read_q);
+    return NULL;
+}
+
+/* the reader stage when --readers > 1; batches come ready-made from range_reader_next in file order */
+static void *view_range_reader(void *arg) {
+    view_pipeline_t *pl = (view_pipeline_t *) arg;
+
+    while (1) {
+        view_batch_t *vb = (view_batch_t *) work_queue_pop(pl->free_q);
+        rec_batch_t *db = &vb->db;
         double realtime = slow5_realtime();
-        while (record_count < batch_size) {
-            if (!(mem = (char *) slow5_get_next_mem(&bytes, from))) {
-                if (slow5_errno != SLOW5_ERR_EOF) {
-                    return EXIT_FAILURE;
-                } else {
-                    flag_end_of_file = 1;
-                    break;
+        range_batch_t *rb;
+        int ret = range_reader_next(pl->rr, &rb);
+        if (ret <= 0) {
+            if (ret < 0) {
+                pl->read_err = 1;
+            }
+            break;
+        }
+        if (rb->n_batch > vb->cap) {
+            vb->cap = rb->n_batch;
+            db->mem_records = (char **) realloc(db->mem_records, vb->cap * sizeof(char*));
+            db->mem_bytes = (size_t *) realloc(db->mem_bytes, vb->cap * sizeof(size_t));
+            db->read_record = (raw_record_t*) realloc(db->read_record, vb->cap * sizeof *db->read_record);
+            MALLOC_CHK(db->mem_records);
+            MALLOC_CHK(db->mem_bytes);
+            MALLOC_CHK(db->read_record);
+        }
+        memcpy(db->mem_records, rb->mem_records, rb->n_batch * sizeof(char*));
+        memcpy(db->mem_bytes, rb->mem_bytes, rb->n_batch * sizeof(size_t));
+        db->n_batch = rb->n_batch;
+        vb->bytes_in = rb->bytes;
+        range_batch_free(rb);
+        pl->time_get_to_mem += slow5_realtime() - realtime;
+        work_queue_push(pl->read_q, vb);
+    }
+
+    work_queue_close(pl->read_q);
+    return NULL;
+}
+
+static void *view_writer(void *arg) {
+    view_pipeline_t *pl = (view_pipeline_t *) arg;
+    view_batch_t *vb;
+
+    while ((vb = (view_batch_t *) work_queue_pop(pl->write_q)) != NULL) {
+        rec_batch_t *db = &vb->db;
+        double realtime = slow5_realtime();
+        profile_mark_t start;
+        profile_mark(&start);
+        size_t bytes_out = 0;
+        for (int64_t i = 0; i < db->n_batch && !pl->write_err; i++) {
+            raw_record_t *rec = &db->read_record[i];
+            if (rec->buffer == NULL) { // left out by --filter
+                continue;
+            }
+            uint64_t offset = writer_tell(pl->w);
+            bytes_out += rec->len;
+            if (writer_add(pl->w, rec->buffer, rec->len) != 0) {
+                pl->write_err = 1;
+            } else if (pl->oi) {
+                out_index_add(pl->oi, rec->read_id, offset, rec->len);
+                rec->read_id = NULL;
+            }
+        }
+        if (!pl->write_err && writer_flush(pl->w) != 0) {
+            pl->write_err = 1;
+        }
+        for (int64_t i = 0; i < db->n_batch; i++) {
+            if (!(pl->same_encoding && db->mapped)) {
+                free(db->read_record[i].buffer);
+            }
+            if (pl->oi) {
+                free(db->read_record[i].read_id);
+            }
+        }
+        vb->bytes_out = bytes_out;
+        pl->time_write += slow5_realtime() - realtime;
+        profile_stage("write", &start, db->n_batch, 0, bytes_out);
+        // hand the batch back to the reader
+        work_queue_push(pl->free_q, vb);
+    }
+
+    return NULL;
+}
+
+/*
+ * Copies the records of from, which are encoded as the output would be, to to_fp as they are. The
+ * kernel moves the bytes with copy_file_range or sendfile where it can, otherwise they are read and
+ * written in chunks. The BLOW5 end of file marker is not copied, the caller writes it. Returns 1
+ * without writing anything if the input does not end as expected, so that the caller can fall back
+ * to transcoding and report the problem on the record where it is; -1 on error, 0 on success.
+ */
+static int view_copy_records(struct slow5_file *from, FILE *to_fp) {
+    int in_fd = fileno(from->fp);
+    int out_fd = fileno(to_fp);
+    off_t in_off = ftello(from->fp);
+    struct stat st;
+
+    if (in_off < 0 || fstat(in_fd, &st) == -1 || !S_ISREG(st.st_mode)) {
+        return 1;
+    }
+    off_t in_end = st.st_size;
+    if (from->format == SLOW5_FORMAT_BINARY) {
+        const char eof[] = SLOW5_BINARY_EOF;
+        char buf[sizeof eof];
+        in_end -= sizeof eof;
+        if (in_end < in_off || pread(in_fd, buf, sizeof eof, in_end) != (ssize_t) sizeof eof || memcmp(buf, eof, sizeof eof) != 0) {
+            return 1;
+        }
+    }
+
+    if (fflush(to_fp) == EOF) {
+        ERROR("Writing the output failed - %s.", strerror(errno));
+        return -1;
+    }
+
+    profile_mark_t start;
+    profile_mark(&start);
+    uint64_t total = in_end - in_off;
+    int use_cfr = 1;
+    int use_sendfile = 1;
+    char *buf = NULL;
+    while (in_off < in_end) {
+        size_t len = in_end - in_off < VIEW_COPY_CHUNK ? in_end - in_off : VIEW_COPY_CHUNK;
+        ssize_t n = -1;
+#ifdef __linux__
+        if (use_cfr) {
+            n = copy_file_range(in_fd, &in_off, out_fd, NULL, len, 0);
+            if (n == -1 && (errno == ENOSYS || errno == EXDEV || errno == EINVAL || errno == EBADF || errno == EOPNOTSUPP)) {
+                use_cfr = 0; // e.g. output to a pipe or across file systems on older kernels
+                continue;
+            }
+        } else if (use_sendfile) {
+            n = sendfile(out_fd, in_fd, &in_off, len);
+            if (n == -1 && (errno == ENOSYS || errno == EINVAL)) {
+                use_sendfile = 0;
+                continue;
+            }
+        } else
+#endif
+        {
+            if (buf == NULL) {
+                buf = (char *) malloc(VIEW_COPY_CHUNK);
+                MALLOC_CHK(buf);
+            }
+            n = pread(in_fd, buf, len, in_off);
+            if (n > 0) {
+                ssize_t done = 0;
+                while (done < n) {
+                    ssize_t w = write(out_fd, buf + done, n - done);
+                    if (w == -1) {
+                        if (errno == EINTR) {
+                            continue;
+                        }
+                        n = -1;
+                        break;
+                    }
+                    done += w;
+                }
+                if (n > 0) {
+                    in_off += n;
                 }
-            } else {
-                db.mem_records[record_count] = mem;
-                db.mem_bytes[record_count] = bytes;
-                record_count++;
             }
         }
-        time_get_to_mem += slow5_realtime() - realtime;
+        if (n == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            ERROR("Copying the records failed - %s.", strerror(errno));
+            free(buf);
+            return -1;
+        }
+        if (n == 0) {
+            ERROR("Copying the records failed - %s.", "input file shrank");
+            free(buf);
+            return -1;
+        }
+    }
+    free(buf);
+    profile_stage("copy", &start, 0, total, total);
+    return 0;
+}
 
-        realtime = slow5_realtime();
-        // Setup multithreading structures
-        core_t core;
-        core.num_thread = num_threads;
-        core.fp = from;
-        core.format_out = to_format;
-        core.press_method = to_compress;
+/*
+ * Reads, transcodes and writes in three stages so that batch N+1 is read and batch N-1 is written while
+ * the worker threads transcode batch N. At most VIEW_PIPELINE_DEPTH batches are in flight; they are
+ * recycled through free_q so the memory is bounded. Batches travel through FIFO queues, so the
+ * output order is the input order. The reader sizes each batch from the batches that came back, see
+ * batch_ctl_t; with --max-mem the VIEW_PIPELINE_DEPTH batches together stay within the budget.
+ * When the output is encoded as the input the records are copied as they are instead, and when only
+ * the record compression differs records are recompressed without being parsed.
+ * With --readers N a BLOW5 input is read by N threads over disjoint byte ranges, see range_reader_t;
+ * the batches then keep the size the reader was set up with. With --mmap the records of a BLOW5
+ * input are instead taken from a memory map and decompressed by the workers in place.
+ * With oi (--index) the read id and output offset of every record written are added to oi, so the
+ * records always go through the pipeline. So do they with a filter (--filter), which the workers
+ * evaluate on each record before transcoding it; a BLOW5 record that fails it is parsed without its
+ * raw signal only.
+ */
+int slow5_convert_parallel(struct slow5_file *from, FILE *to_fp, enum slow5_fmt to_format, slow5_press_method_t to_compress, const opt_t *opt, out_index_t *oi, const filter_t *filter, struct program_meta *meta) {
+    if (from == NULL || to_fp == NULL || to_format == SLOW5_FORMAT_UNKNOWN) {
+        return -1;
+    }
 
-        db.n_batch = record_count;
-        db.read_record = (raw_record_t*) malloc(record_count * sizeof *db.read_record);
-        MALLOC_CHK(db.read_record);
-        work_db(&core,&db,depress_parse_rec_to_mem);
-        time_thread_execution += slow5_realtime() - realtime;
+    if (slow5_hdr_fwrite(to_fp, from->header, to_format, to_compress) == -1) {
+        return -2;
+    }
 
-        realtime = slow5_realtime();
-        for (int64_t i = 0; i < record_count; i++) {
-            fwrite(db.read_record[i].buffer,1,db.read_record[i].len,to_fp);
-            free(db.read_record[i].buffer);
+    int same_signal = from->format == SLOW5_FORMAT_BINARY && to_format == SLOW5_FORMAT_BINARY &&
+                      from->compress->signal_press->method == to_compress.signal_method;
+    int same_encoding = from->format == to_format &&
+                        (to_format == SLOW5_FORMAT_ASCII || (same_signal && from->compress->record_press->method == to_compress.record_method));
+    if (same_encoding && oi == NULL && filter == NULL) {
+        int ret = view_copy_records(from, to_fp);
+        if (ret == -1) {
+            return -2;
+        } else if (ret == 0) {
+            VERBOSE("Input is already %s with the requested compression, copied the records as they are", to_format == SLOW5_FORMAT_ASCII ? "SLOW5" : "BLOW5");
+            if (to_format == SLOW5_FORMAT_BINARY && slow5_eof_fwrite(to_fp) == -1) {
+                return -2;
+            }
+            return 0;
         }
-        time_write += slow5_realtime() - realtime;
+    }
 
-        // Free everything
-        free(db.mem_bytes);
-        free(db.mem_records);
-        free(db.read_record);
+    view_pipeline_t pl = { 0 };
+    pl.from = from;
+    pl.oi = oi;
+    pl.same_encoding = same_encoding;
+    pl.w = writer_init(to_fp, opt->write_buf, opt->flag_direct);
+    if (pl.w == NULL) {
+        return -2;
+    }
+    batch_ctl_init(&pl.ctl, opt, VIEW_PIPELINE_DEPTH);
+    int64_t batch_size = pl.ctl.batch_size;
+    pl.free_q = work_queue_init(VIEW_PIPELINE_DEPTH);
+    pl.read_q = work_queue_init(VIEW_PIPELINE_DEPTH);
+    pl.write_q = work_queue_init(VIEW_PIPELINE_DEPTH);
+    if (opt->flag_mmap) {
+        pl.mr = mmap_reader_init(from, 1);
+        if (pl.mr == NULL) {
+            WARNING("Could not map '%s', reading it through stdio.", from->meta.pathname);
+        }
+    }
+    if (pl.mr == NULL && opt->num_readers > 1) {
+        pl.rr = range_reader_init(from, opt->num_readers, pl.ctl.batch_size, pl.ctl.max_bytes);
+        if (pl.rr == NULL) {
+            WARNING("Could not read '%s' with %d readers, reading it sequentially.", from->meta.pathname, opt->num_readers);
+        }
+    }
 
-        if(flag_end_of_file == 1){
-            break;
+    view_batch_t vbs[VIEW_PIPELINE_DEPTH];
+    for (int i = 0; i < VIEW_PIPELINE_DEPTH; i++) {
+        rec_batch_t *db = &vbs[i].db;
+        vbs[i] = (view_batch_t) { 0 };
+        vbs[i].cap = batch_size;
+        arena_init(&vbs[i].arena, 0);
+        db->mem_records = (char **) malloc(batch_size * sizeof(char*));
+        db->mem_bytes = (size_t *) malloc(batch_size * sizeof(size_t));
+        db->read_record = (raw_record_t*) malloc(batch_size * sizeof *db->read_record);
+        MALLOC_CHK(db->mem_records);
+        MALLOC_CHK(db->mem_bytes);
+        MALLOC_CHK(db->read_record);
+        work_queue_push(pl.free_q, &vbs[i]);
+    }
+
+    // Setup multithreading structures
+    core_t core;
+    core.num_thread = opt->num_threads;
+    core.fp = from;
+    core.format_out = to_format;
+    core.press_method = to_compress;
+    core.index_out = oi != NULL;
+    core.filter = filter;
+
+    pthread_t reader_tid, writer_tid;
+    NEG_CHK(pthread_create(&reader_tid, NULL, pl.rr ? view_range_reader : view_reader, (void *) &pl));
+    NEG_CHK(pthread_create(&writer_tid, NULL, view_writer, (void *) &pl));
+
+    double time_thread_execution = 0;
+    view_batch_t *vb;
+    while ((vb = (view_batch_t *) work_queue_pop(pl.read_q)) != NULL) {
+        rec_batch_t *db = &vb->db;
+        double realtime = slow5_realtime();
+        profile_mark_t start;
+        profile_mark(&start);
+        if (same_signal) {
+            work_db(&core,db,work_fn<rec_batch_t, recompress_rec_to_mem>(),db->mem_bytes);
+        } else {
+            work_db(&core,db,work_fn<rec_batch_t, depress_parse_rec_to_mem>(),db->mem_bytes);
         }
+        vb->time = slow5_realtime() - realtime;
+        profile_stage("process", &start, db->n_batch, 0, 0);
+        time_thread_execution += vb->time;
+        work_queue_push(pl.write_q, vb);
+    }
+    work_queue_close(pl.write_q);
 
+    NEG_CHK(pthread_join(reader_tid, NULL));
+    NEG_CHK(pthread_join(writer_tid, NULL));
+    if (writer_close(pl.w) != 0) {
+        pl.write_err = 1;
     }
+
+    // Free everything
+    if (pl.rr) {
+        range_reader_free(pl.rr);
+    }
+    if (pl.mr) {
+        mmap_reader_free(pl.mr);
+    }
+    for (int i = 0; i < VIEW_PIPELINE_DEPTH; i++) {
+        free(vbs[i].db.mem_bytes);
+        free(vbs[i].db.mem_records);
+        free(vbs[i].db.read_record);
+        arena_free(&vbs[i].arena);
+    }
+    work_queue_free(pl.free_q);
+    work_queue_free(pl.read_q);
+    work_queue_free(pl.write_q);
+
+    if (pl.read_err) {
+        return EXIT_FAILURE;
+    }
+    if (pl.write_err) {
+        return -2;
+    }
+
     if (to_format == SLOW5_FORMAT_BINARY) {
         if (slow5_eof_fwrite(to_fp) == -1) {
             return -2;
         }
     }
 
-    DEBUG("time_get_to_mem\t%.3fs", time_get_to_mem);
+    DEBUG("time_get_to_mem\t%.3fs", pl.time_get_to_mem);
     DEBUG("time_depress_parse\t%.3fs", time_thread_execution);
-    DEBUG("time_write\t%.3fs", time_write);
+    DEBUG("time_write\t%.3fs", pl.time_write);
 
     return 0;
 }
@@ -0,0 +1,278 @@
+/**
+ * @file writer.c
+ * @brief writing batches of output records with few, large write calls
+ * @author Hasindu Gamaarachchi (hasindu@garvan.org.au)
+ * @date 17/10/2026
+ */
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <stdlib.h>
+#include "writer.h"
+#include "error.h"
+
+extern int slow5tools_verbosity_level;
+
+static int writer_writev_all(int fd, struct iovec *iov, int n) {
+    int i = 0;
+    while (i < n) {
+        ssize_t ret = writev(fd, iov + i, n - i);
+        if (ret == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        // skip what was written, the last piece may have gone out partly
+        size_t done = ret;
+        while (i < n && done >= iov[i].iov_len) {
+            done -= iov[i].iov_len;
+            i++;
+        }
+        if (i < n) {
+            iov[i].iov_base = (char *) iov[i].iov_base + done;
+            iov[i].iov_len -= done;
+        }
+    }
+    return 0;
+}
+
+static int writer_write_all(int fd, const char *p, size_t n) {
+    while (n > 0) {
+        ssize_t ret = write(fd, p, n);
+        if (ret == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        p += ret;
+        n -= ret;
+    }
+    return 0;
+}
+
+static int writer_set_direct(writer_t *w, int on) {
+    if (w->direct_on == on) {
+        return 0;
+    }
+#ifdef O_DIRECT
+    int flags = fcntl(w->fd, F_GETFL);
+    if (flags == -1 || fcntl(w->fd, F_SETFL, on ? flags | O_DIRECT : flags & ~O_DIRECT) == -1) {
+        return -1;
+    }
+    w->direct_on = on;
+    return 0;
+#else
+    errno = EINVAL;
+    return -1;
+#endif
+}
+
+/* write n bytes at p, with O_DIRECT if on and the file system takes it */
+static int writer_write_block(writer_t *w, const char *p, size_t n, int on) {
+    on = on && !w->direct_failed;
+    if (on && writer_set_direct(w, 1) != 0) {
+        WARNING("O_DIRECT is not supported for the output - %s. Writing through the page cache.", strerror(errno));
+        w->direct_failed = 1;
+        on = 0;
+    }
+    if (!on && writer_set_direct(w, 0) != 0) {
+        ERROR("Could not clear O_DIRECT on the output - %s.", strerror(errno));
+        return -1;
+    }
+    if (writer_write_all(w->fd, p, n) != 0) {
+        if (on && errno == EINVAL) { // some file systems accept the flag but not the writes
+            WARNING("O_DIRECT writes to the output failed - %s. Writing through the page cache.", strerror(errno));
+            w->direct_failed = 1;
+            return writer_write_block(w, p, n, 0);
+        }
+        ERROR("Writing the output failed - %s.", strerror(errno));
+        return -1;
+    }
+    w->bytes += n;
+    return 0;
+}
+
+/*
+ * Direct mode: write the whole blocks in buf with O_DIRECT and keep the rest. The block the header
+ * ended in is completed first without O_DIRECT, as is the tail of the output when final is set.
+ */
+static int writer_flush_direct(writer_t *w, int final) {
+    size_t first = (w->buf_start + WRITER_ALIGN - 1) & ~((size_t) WRITER_ALIGN - 1);
+    if (w->buf_start < first && (w->buf_len >= first || final)) {
+        size_t end = w->buf_len < first ? w->buf_len : first;
+        if (writer_write_block(w, w->buf + w->buf_start, end - w->buf_start, 0) != 0) {
+            return -1;
+        }
+        w->buf_start = end;
+    }
+    if (w->buf_start == first) {
+        size_t n = (w->buf_len - w->buf_start) & ~((size_t) WRITER_ALIGN - 1);
+        if (n > 0) {
+            if (writer_write_block(w, w->buf + w->buf_start, n, 1) != 0) {
+                return -1;
+            }
+            w->buf_start += n;
+        }
+    }
+    if (final && w->buf_start < w->buf_len) {
+        if (writer_write_block(w, w->buf + w->buf_start, w->buf_len - w->buf_start, 0) != 0) {
+            return -1;
+        }
+        w->buf_start = w->buf_len;
+    }
+    if (w->buf_start > 0 && w->buf_start % WRITER_ALIGN == 0) {
+        memmove(w->buf, w->buf + w->buf_start, w->buf_len - w->buf_start);
+        w->buf_len -= w->buf_start;
+        w->buf_start = 0;
+    }
+    return 0;
+}
+
+writer_t *writer_init(FILE *fp, size_t buf_size, int direct) {
+    if (fflush(fp) == EOF) {
+        ERROR("Writing the output failed - %s.", strerror(errno));
+        return NULL;
+    }
+
+    writer_t *w = (writer_t *) calloc(1, sizeof *w);
+    MALLOC_CHK(w);
+    w->fp = fp;
+    w->fd = fileno(fp);
+    if (buf_size == 0) {
+        buf_size = WRITER_BUF_SIZE;
+    }
+
+    off_t off = lseek(w->fd, 0, SEEK_CUR);
+    w->start = off;
+    if (direct) {
+#ifdef O_DIRECT
+        if (off == -1) {
+            WARNING("O_DIRECT needs the output to be a file, writing through the page cache%s.", "");
+            direct = 0;
+        }
+#else
+        WARNING("O_DIRECT is not available on this platform, writing through the page cache%s.", "");
+        direct = 0;
+#endif
+    }
+
+    if (direct) {
+        // whole blocks, at least one besides the one the header ended in
+        buf_size = (buf_size + WRITER_ALIGN - 1) & ~((size_t) WRITER_ALIGN - 1);
+        if (buf_size < 2 * WRITER_ALIGN) {
+            buf_size = 2 * WRITER_ALIGN;
+        }
+        void *buf = NULL;
+        if (posix_memalign(&buf, WRITER_ALIGN, buf_size) != 0) {
+            buf = NULL;
+        }
+        MALLOC_CHK(buf);
+        w->buf = (char *) buf;
+        w->direct = 1;
+        w->buf_start = off % WRITER_ALIGN;
+        w->buf_len = w->buf_start;
+    } else {
+        if (buf_size < WRITER_COPY_MAX) {
+            buf_size = WRITER_COPY_MAX;
+        }
+        w->buf = (char *) malloc(buf_size);
+        w->iov = (struct iovec *) malloc(WRITER_IOV_MAX * sizeof *w->iov);
+        MALLOC_CHK(w->buf);
+        MALLOC_CHK(w->iov);
+    }
+    w->buf_size = buf_size;
+    return w;
+}
+
+int writer_flush(writer_t *w) {
+    if (w->err) {
+        return -1;
+    }
+    if (w->direct || w->n_iov == 0) { // direct mode has copied everything already
+        return 0;
+    }
+    if (writer_writev_all(w->fd, w->iov, w->n_iov) != 0) {
+        ERROR("Writing the output failed - %s.", strerror(errno));
+        w->err = 1;
+        return -1;
+    }
+    w->bytes += w->pending;
+    w->n_iov = 0;
+    w->pending = 0;
+    w->buf_len = 0;
+    return 0;
+}
+
+int writer_add(writer_t *w, const void *buf, size_t len) {
+    if (w->err) {
+        return -1;
+    }
+    if (len == 0) {
+        return 0;
+    }
+    w->added += len;
+
+    if (w->direct) {
+        const char *p = (const char *) buf;
+        while (len > 0) {
+            size_t n = w->buf_size - w->buf_len < len ? w->buf_size - w->buf_len : len;
+            memcpy(w->buf + w->buf_len, p, n);
+            w->buf_len += n;
+            p += n;
+            len -= n;
+            if (w->buf_len == w->buf_size && writer_flush_direct(w, 0) != 0) {
+                w->err = 1;
+                return -1;
+            }
+        }
+        return 0;
+    }
+
+    if (len <= WRITER_COPY_MAX) {
+        if ((w->buf_len + len > w->buf_size || w->n_iov == WRITER_IOV_MAX) && writer_flush(w) != 0) {
+            return -1;
+        }
+        char *dst = w->buf + w->buf_len;
+        memcpy(dst, buf, len);
+        w->buf_len += len;
+        struct iovec *last = w->n_iov > 0 ? &w->iov[w->n_iov - 1] : NULL;
+        if (last && (char *) last->iov_base + last->iov_len == dst) {
+            last->iov_len += len;
+        } else {
+            w->iov[w->n_iov].iov_base = dst;
+            w->iov[w->n_iov].iov_len = len;
+            w->n_iov++;
+        }
+    } else {
+        if (w->n_iov == WRITER_IOV_MAX && writer_flush(w) != 0) {
+            return -1;
+        }
+        w->iov[w->n_iov].iov_base = (void *) buf;
+        w->iov[w->n_iov].iov_len = len;
+        w->n_iov++;
+    }
+    w->pending += len;
+
+    if (w->pending >= w->buf_size || w->n_iov == WRITER_IOV_MAX) {
+        return writer_flush(w);
+    }
+    return 0;
+}
+
+int writer_close(writer_t *w) {
+    int ret = w->err ? -1 : 0;
+    if (ret == 0) {
+        ret = w->direct ? writer_flush_direct(w, 1) : writer_flush(w);
+    }
+    if (w->direct_on && writer_set_direct(w, 0) != 0) {
+        ERROR("Could not clear O_DIRECT on the output - %s.", strerror(errno));
+        ret = -1;
+    }
+    free(w->buf);
+    free(w->iov);
+    free(w);
+    return ret;
+}
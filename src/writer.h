@@ -0,0 +1,55 @@
+// writing batches of output records with few, large write calls
+
+#ifndef WRITER_H
+#define WRITER_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/uio.h>
+
+#define WRITER_BUF_SIZE (1 << 22) //default bytes gathered before a write
+#define WRITER_COPY_MAX 4096 //records up to this size are copied into the buffer, larger ones are written from where they are
+#define WRITER_IOV_MAX 1024 //iovecs per writev call
+#define WRITER_ALIGN 4096 //O_DIRECT alignment of buffers, lengths and file offsets
+
+/*
+ * Writes to the file descriptor of an output FILE* that has already had its header written. Small
+ * records are copied into one buffer and large ones are referenced, and all of them go out with a
+ * single writev once buf_size bytes or WRITER_IOV_MAX pieces have been gathered. With direct, the
+ * records are copied into aligned blocks written with O_DIRECT, so that a huge output does not push
+ * everything else out of the page cache. The FILE* must not be written while the writer is open.
+ */
+typedef struct {
+    FILE *fp;
+    int fd;
+    size_t buf_size;
+    char *buf;              // copied records; aligned blocks in direct mode
+    size_t buf_len;
+    struct iovec *iov;      // pieces waiting for the next writev
+    int n_iov;
+    size_t pending;         // bytes in iov
+    int direct;             // write through aligned blocks
+    int direct_on;          // O_DIRECT is set on fd
+    int direct_failed;      // the file system refused O_DIRECT, blocks go through the page cache
+    size_t buf_start;       // direct mode: first byte of buf not written yet; buf[0] is at an aligned file offset
+    uint64_t bytes;         // total written
+    int64_t start;          // file offset the writer started at, -1 if the output is not seekable
+    uint64_t added;         // total given to writer_add()
+    int err;
+} writer_t;
+
+/* starts writing after what has been written to fp so far; falls back to buffered writes if direct is not possible */
+writer_t *writer_init(FILE *fp, size_t buf_size, int direct);
+/* gathers len bytes at buf; buf must stay valid until writer_flush() returns unless len <= WRITER_COPY_MAX */
+int writer_add(writer_t *w, const void *buf, size_t len);
+/* writes what has been gathered, after which the buffers given to writer_add() may be freed */
+int writer_flush(writer_t *w);
+/* the offset in the output file of the next byte given to writer_add(), for indexing the records written */
+static inline uint64_t writer_tell(const writer_t *w) {
+    return w->start + w->added;
+}
+/* writes everything left and frees w; fp may be written again afterwards. Returns -1 if any write failed */
+int writer_close(writer_t *w);
+
+#endif
@@ -0,0 +1,63 @@
+#!/bin/bash
+
+###############################################################################
+
+# time slow5tools get on random read ids of a large BLOW5 file
+# e.g. 1M random read ids of a 1 TB file on a spinning disk or a network filesystem,
+# against a baseline build that fetches the read ids in the order given (before get sorted them by file offset)
+
+NC='\033[0m' # No Color
+RED='\033[0;31m'
+GREEN='\033[0;32m'
+
+Usage="get_random_bench.sh [path to blow5 file] [number of random read ids] [path to slow5tools executable] [path to a baseline slow5tools executable (optional)]"
+
+if [[ "$#" -lt 3 ]]; then
+	echo "Usage: $Usage"
+	exit 1
+fi
+
+BLOW5=$1
+NUM_IDS=$2
+SLOWTOOLS=$3
+BASELINE=$4
+THREAD_LIST="32 16 8 4 1"
+TEST_DIR=$(mktemp -d)
+ID_LIST=$TEST_DIR/read_ids.txt
+
+die() {
+	echo -e "${RED}$1${NC}" >&2
+	exit 1
+}
+
+clean_file_system_cache() {
+	sync
+	echo 3 | tee /proc/sys/vm/drop_caches > /dev/null || echo "could not drop the page cache, timings are of warm reads" >&2
+}
+
+# the index is needed by get anyway; read ids are taken from the file and shuffled so that they are random relative to the file layout
+[ -f "$BLOW5.idx" ] || $SLOWTOOLS index "$BLOW5" || die "indexing $BLOW5 failed"
+$SLOWTOOLS skim --rid "$BLOW5" | shuf -n "$NUM_IDS" > "$ID_LIST" || die "sampling read ids failed"
+echo "$(wc -l < "$ID_LIST") random read ids of $BLOW5 ($(du -h "$BLOW5" | cut -f1))"
+
+run_get() {
+	clean_file_system_cache
+	/usr/bin/time -f "%e s, %M KB" $1 get "$BLOW5" -t $2 --list "$ID_LIST" -o "$TEST_DIR/out.blow5" 2>&1 | tail -1
+}
+
+echo -e "threads\tversion\ttime"
+for num_threads in $THREAD_LIST
+do
+	echo -e "$num_threads\tsorted\t$(run_get $SLOWTOOLS $num_threads)"
+	if [ -n "$BASELINE" ]; then
+		echo -e "$num_threads\tbaseline\t$(run_get $BASELINE $num_threads)"
+	fi
+done
+
+if [ -n "$BASELINE" ]; then
+	$BASELINE get "$BLOW5" --list "$ID_LIST" -o "$TEST_DIR/base.blow5" 2> /dev/null
+	cmp -s "$TEST_DIR/out.blow5" "$TEST_DIR/base.blow5" && echo -e "${GREEN}outputs are identical${NC}" || die "outputs differ"
+fi
+
+rm -r "$TEST_DIR"
+exit 0
@@ -0,0 +1,56 @@
+#!/bin/bash
+
+###############################################################################
+
+# records/s of slow5tools get against the number of threads
+# the records are fetched and decoded but not written (get --benchmark), so this measures the
+# random reads and decoding only; run it on the storage of interest (e.g. NVMe) with cold caches
+
+NC='\033[0m' # No Color
+RED='\033[0;31m'
+GREEN='\033[0;32m'
+
+Usage="get_threads_bench.sh [path to blow5 file] [number of random read ids] [path to slow5tools executable] [thread counts (optional, default \"1 2 4 8 16 32 64\")]"
+
+if [[ "$#" -lt 3 ]]; then
+	echo "Usage: $Usage"
+	exit 1
+fi
+
+BLOW5=$1
+NUM_IDS=$2
+SLOWTOOLS=$3
+THREAD_LIST=${4:-"1 2 4 8 16 32 64"}
+TEST_DIR=$(mktemp -d)
+ID_LIST=$TEST_DIR/read_ids.txt
+
+die() {
+	echo -e "${RED}$1${NC}" >&2
+	exit 1
+}
+
+clean_file_system_cache() {
+	sync
+	echo 3 | tee /proc/sys/vm/drop_caches > /dev/null || echo "could not drop the page cache, timings are of warm reads" >&2
+}
+
+[ -f "$BLOW5.idx" ] || $SLOWTOOLS index "$BLOW5" || die "indexing $BLOW5 failed"
+$SLOWTOOLS skim --rid "$BLOW5" | shuf -n "$NUM_IDS" > "$ID_LIST" || die "sampling read ids failed"
+NUM_IDS=$(wc -l < "$ID_LIST")
+echo "$NUM_IDS random read ids of $BLOW5 ($(du -h "$BLOW5" | cut -f1))"
+
+echo -e "threads\tseconds\trecords_per_s\tspeedup"
+BASE_TIME=
+for num_threads in $THREAD_LIST
+do
+	clean_file_system_cache
+	START=$(date +%s.%N)
+	$SLOWTOOLS get -e "$BLOW5" -t "$num_threads" --list "$ID_LIST" 2> /dev/null || die "get with $num_threads threads failed"
+	END=$(date +%s.%N)
+	TIME=$(echo "$END - $START" | bc)
+	[ -z "$BASE_TIME" ] && BASE_TIME=$TIME
+	echo -e "$num_threads\t$TIME\t$(echo "$NUM_IDS / $TIME" | bc)\t$(echo "scale=2; $BASE_TIME / $TIME" | bc)"
+done
+
+rm -r "$TEST_DIR"
+exit 0
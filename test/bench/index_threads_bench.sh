@@ -0,0 +1,56 @@
+#!/bin/bash
+
+###############################################################################
+
+# wall time of slow5tools index against the number of threads, e.g. on a multi-hundred-GB BLOW5 or SLOW5 file
+# -t 1 is the single pass of slow5lib; the index of every run is compared with that one
+
+NC='\033[0m' # No Color
+RED='\033[0;31m'
+GREEN='\033[0;32m'
+
+Usage="index_threads_bench.sh [path to slow5/blow5 file] [path to slow5tools executable] [thread counts (optional, default \"1 2 4 8 16 32\")]"
+
+if [[ "$#" -lt 2 ]]; then
+	echo "Usage: $Usage"
+	exit 1
+fi
+
+SLOW5=$1
+SLOWTOOLS=$2
+THREAD_LIST=${3:-"1 2 4 8 16 32"}
+REF_IDX=$(mktemp)
+
+die() {
+	echo -e "${RED}$1${NC}" >&2
+	rm -f "$REF_IDX"
+	exit 1
+}
+
+clean_file_system_cache() {
+	sync
+	echo 3 | tee /proc/sys/vm/drop_caches > /dev/null || echo "could not drop the page cache, timings are of warm reads" >&2
+}
+
+echo "$SLOW5 ($(du -h "$SLOW5" | cut -f1))"
+echo -e "threads\tseconds\tspeedup"
+BASE_TIME=
+for num_threads in $THREAD_LIST
+do
+	clean_file_system_cache
+	START=$(date +%s.%N)
+	$SLOWTOOLS index -t "$num_threads" "$SLOW5" 2> /dev/null || die "index with $num_threads threads failed"
+	END=$(date +%s.%N)
+	TIME=$(echo "$END - $START" | bc)
+	if [ -z "$BASE_TIME" ]; then
+		BASE_TIME=$TIME
+		cp "$SLOW5.idx" "$REF_IDX" || die "copying the index failed"
+	else
+		cmp -s "$SLOW5.idx" "$REF_IDX" || die "the index with $num_threads threads differs"
+	fi
+	echo -e "$num_threads\t$TIME\t$(echo "scale=2; $BASE_TIME / $TIME" | bc)"
+done
+
+echo -e "${GREEN}all indexes are identical${NC}"
+rm -f "$REF_IDX"
+exit 0
@@ -0,0 +1,108 @@
+/**
+ * @file mmap_read_bench.c
+ * @brief records/s and MB/s of reading a BLOW5 file through stdio vs the mmap reader
+ *
+ * Reads every record of a BLOW5 file, first with slow5_get_next_mem() and then with
+ * mmap_reader_next(), each once only taking the raw records and once also decompressing and
+ * parsing them (slow5_rec_depress_parse() vs mmap_rec_depress_parse()). The file is opened again
+ * for every run, so all but the first run read from the page cache; to compare cold reads drop
+ * the caches before each run and pass the run to do as the second argument.
+ *
+ * compile from the repository root after building slow5lib as *
+ * - g++ -x c++ -std=c++11 -O2 -I slow5lib/include -I slow5lib/src -I src test/bench/mmap_read_bench.c src/reader.c src/misc.c src/thread.c src/profile.c slow5lib/lib/libslow5.a -lpthread -lz -o mmap_read_bench
+ * run as *
+ * - ./mmap_read_bench reads.blow5 [stdio|stdio-parse|mmap|mmap-parse]
+ */
+
+#include <sys/time.h>
+#include "thread.h"
+#include "reader.h"
+#include "slow5_extra.h"
+
+int slow5tools_verbosity_level = LOG_VERBOSE;
+
+static double realtime(void) {
+    struct timeval tp;
+    gettimeofday(&tp, NULL);
+    return tp.tv_sec + tp.tv_usec * 1e-6;
+}
+
+/* read all records of path; returns the number of records, -1 on error */
+static int64_t read_all(const char *path, int use_mmap, int parse, size_t *bytes_total) {
+    slow5_file_t *sp = slow5_open(path, "r");
+    if (sp == NULL) {
+        ERROR("Could not open '%s'", path);
+        return -1;
+    }
+    mmap_reader_t *mr = NULL;
+    if (use_mmap && (mr = mmap_reader_init(sp, 1)) == NULL) {
+        ERROR("Could not map '%s', is it BLOW5?", path);
+        slow5_close(sp);
+        return -1;
+    }
+
+    int64_t n = 0;
+    *bytes_total = 0;
+    char *mem;
+    size_t bytes;
+    while (1) {
+        if (mr) {
+            int ret = mmap_reader_next(mr, &mem, &bytes);
+            if (ret <= 0) {
+                n = ret < 0 ? -1 : n;
+                break;
+            }
+        } else if ((mem = (char *) slow5_get_next_mem(&bytes, sp)) == NULL) {
+            n = slow5_errno == SLOW5_ERR_EOF ? n : -1;
+            break;
+        }
+        *bytes_total += bytes;
+        if (parse) {
+            slow5_rec_t *read = NULL;
+            int ret = mr ? mmap_rec_depress_parse(mem, bytes, &read, sp) : slow5_rec_depress_parse(&mem, &bytes, NULL, &read, sp);
+            if (ret != 0) {
+                n = -1;
+                break;
+            }
+            slow5_rec_free(read);
+        }
+        if (!mr) {
+            free(mem);
+        }
+        n++;
+    }
+
+    if (mr) {
+        mmap_reader_free(mr);
+    }
+    slow5_close(sp);
+    return n;
+}
+
+int main(int argc, char **argv) {
+
+    if (argc < 2) {
+        fprintf(stderr, "Usage: %s reads.blow5 [stdio|stdio-parse|mmap|mmap-parse]\n", argv[0]);
+        return 1;
+    }
+
+    const char *names[] = {"stdio", "stdio-parse", "mmap", "mmap-parse"};
+
+    fprintf(stdout, "reader\trecords\tseconds\trec_per_s\tMB_per_s\n");
+    for (int r = 0; r < 4; r++) {
+        if (argc > 2 && strcmp(argv[2], names[r]) != 0) {
+            continue;
+        }
+        size_t bytes;
+        double t0 = realtime();
+        int64_t n = read_all(argv[1], r >= 2, r % 2, &bytes);
+        double t = realtime() - t0;
+        if (n < 0) {
+            fprintf(stdout, "%s\tfailed\n", names[r]);
+            continue;
+        }
+        fprintf(stdout, "%s\t%" PRId64 "\t%.3f\t%.0f\t%.1f\n", names[r], n, t, n / t, bytes / t / (1024 * 1024));
+    }
+    press_cache_free();
+    return 0;
+}
@@ -0,0 +1,93 @@
+/**
+ * @file press_cache_bench.c
+ * @brief records/s of slow5_rec_to_mem with a compression context per record vs the per-thread cache
+ *
+ * Loads up to N records of a SLOW5/BLOW5 file into memory and encodes all of them as BLOW5 with
+ * zlib and zstd record compression (with and without svb-zd signal compression), first creating
+ * and freeing a slow5_press for every record and then using press_cache_get().
+ *
+ * compile from the repository root after building slow5lib (make zstd=1) as *
+ * - g++ -x c++ -std=c++11 -O2 -I slow5lib/include -I slow5lib/src -I src test/bench/press_cache_bench.c src/thread.c src/profile.c slow5lib/lib/libslow5.a -lpthread -lz -lzstd -o press_cache_bench
+ * run as *
+ * - ./press_cache_bench reads.blow5 [num_records]
+ */
+
+#include <sys/time.h>
+#include "thread.h"
+#include "slow5_extra.h"
+
+int slow5tools_verbosity_level = LOG_VERBOSE;
+
+static double realtime(void) {
+    struct timeval tp;
+    gettimeofday(&tp, NULL);
+    return tp.tv_sec + tp.tv_usec * 1e-6;
+}
+
+/* encode all records; with a fresh context per record if cached is 0 */
+static double encode_all(slow5_rec_t **recs, int64_t n, slow5_aux_meta_t *aux_meta, slow5_press_method_t method, int cached) {
+    double t0 = realtime();
+    for (int64_t i = 0; i < n; i++) {
+        struct slow5_press *press = cached ? press_cache_get(method) : slow5_press_init(method);
+        if (press == NULL) {
+            return -1;
+        }
+        size_t len;
+        void *mem = slow5_rec_to_mem(recs[i], aux_meta, SLOW5_FORMAT_BINARY, press, &len);
+        MALLOC_CHK(mem);
+        free(mem);
+        if (!cached) {
+            slow5_press_free(press);
+        }
+    }
+    return realtime() - t0;
+}
+
+int main(int argc, char **argv) {
+
+    if (argc < 2) {
+        fprintf(stderr, "Usage: %s reads.blow5 [num_records]\n", argv[0]);
+        return 1;
+    }
+    int64_t max_records = argc > 2 ? atoll(argv[2]) : 100000;
+
+    slow5_file_t *sp = slow5_open(argv[1], "r");
+    if (sp == NULL) {
+        ERROR("Could not open '%s'", argv[1]);
+        return 1;
+    }
+
+    slow5_rec_t **recs = (slow5_rec_t **)calloc(max_records, sizeof(slow5_rec_t *));
+    MALLOC_CHK(recs);
+    int64_t n = 0;
+    while (n < max_records && slow5_get_next(&recs[n], sp) >= 0) {
+        n++;
+    }
+
+    const slow5_press_method_t methods[] = {
+        {SLOW5_COMPRESS_ZLIB, SLOW5_COMPRESS_NONE},
+        {SLOW5_COMPRESS_ZLIB, SLOW5_COMPRESS_SVB_ZD},
+        {SLOW5_COMPRESS_ZSTD, SLOW5_COMPRESS_NONE},
+        {SLOW5_COMPRESS_ZSTD, SLOW5_COMPRESS_SVB_ZD},
+    };
+    const char *names[] = {"zlib,none", "zlib,svb-zd", "zstd,none", "zstd,svb-zd"};
+
+    fprintf(stdout, "method\trecords\tper_record_init_rec_per_s\tcached_rec_per_s\n");
+    for (size_t m = 0; m < sizeof(methods) / sizeof(methods[0]); m++) {
+        double fresh = encode_all(recs, n, sp->header->aux_meta, methods[m], 0);
+        double cached = encode_all(recs, n, sp->header->aux_meta, methods[m], 1);
+        if (fresh < 0 || cached < 0) {
+            fprintf(stdout, "%s\tunavailable\n", names[m]);
+            continue;
+        }
+        fprintf(stdout, "%s\t%" PRId64 "\t%.0f\t%.0f\n", names[m], n, n / fresh, n / cached);
+    }
+    press_cache_free();
+
+    for (int64_t i = 0; i < n; i++) {
+        slow5_rec_free(recs[i]);
+    }
+    free(recs);
+    slow5_close(sp);
+    return 0;
+}
@@ -0,0 +1,60 @@
+#!/bin/bash
+
+###############################################################################
+
+# lines/s of slow5tools skim against the number of threads
+# e.g. on a 10M read BLOW5 file, against a baseline build that formatted each line with asprintf;
+# the output goes to /dev/null (and is compared with that of the baseline if given)
+
+NC='\033[0m' # No Color
+RED='\033[0;31m'
+GREEN='\033[0;32m'
+
+Usage="skim_bench.sh [path to blow5 file] [path to slow5tools executable] [path to a baseline slow5tools executable (optional)] [thread counts (optional, default \"1 2 4 8 16 32\")]"
+
+if [[ "$#" -lt 2 ]]; then
+	echo "Usage: $Usage"
+	exit 1
+fi
+
+BLOW5=$1
+SLOWTOOLS=$2
+BASELINE=$3
+THREAD_LIST=${4:-"1 2 4 8 16 32"}
+TEST_DIR=$(mktemp -d)
+
+die() {
+	echo -e "${RED}$1${NC}" >&2
+	exit 1
+}
+
+# a first skim warms the page cache, so that the formatting and not the disk is timed
+NUM_LINES=$($SLOWTOOLS skim "$BLOW5" 2> /dev/null | tail -n +2 | wc -l)
+[ "$NUM_LINES" -gt 0 ] || die "skim of $BLOW5 failed"
+echo "$NUM_LINES records of $BLOW5 ($(du -h "$BLOW5" | cut -f1))"
+
+run_skim() {
+	START=$(date +%s.%N)
+	$1 skim "$BLOW5" -t $2 > /dev/null 2> /dev/null || die "$1 skim with $2 threads failed"
+	END=$(date +%s.%N)
+	TIME=$(echo "$END - $START" | bc)
+	echo -e "$TIME\t$(echo "$NUM_LINES / $TIME" | bc)"
+}
+
+echo -e "threads\tversion\tseconds\tlines_per_s"
+for num_threads in $THREAD_LIST
+do
+	echo -e "$num_threads\tcurrent\t$(run_skim $SLOWTOOLS $num_threads)"
+	if [ -n "$BASELINE" ]; then
+		echo -e "$num_threads\tbaseline\t$(run_skim $BASELINE $num_threads)"
+	fi
+done
+
+if [ -n "$BASELINE" ]; then
+	$SLOWTOOLS skim "$BLOW5" -t 8 > "$TEST_DIR/out.txt" 2> /dev/null
+	$BASELINE skim "$BLOW5" -t 8 > "$TEST_DIR/base.txt" 2> /dev/null
+	cmp -s "$TEST_DIR/out.txt" "$TEST_DIR/base.txt" && echo -e "${GREEN}outputs are identical${NC}" || die "outputs differ"
+fi
+
+rm -r "$TEST_DIR"
+exit 0
@@ -0,0 +1,80 @@
+/**
+ * @file work_db_bench.c
+ * @brief microbenchmark of the per-batch dispatch overhead of work_db
+ *
+ * Runs the same batches of small records through
+ * - pthread_db: threads created and joined for every batch, per-record call through a function pointer
+ * - work_db with a function pointer: the persistent pool, per-record call through a pointer
+ *   (the dispatch used before the typed batches)
+ * - work_db with work_fn: the persistent pool, per-record function inlined into the worker loop
+ * The per-record function is trivial, so the time measured is the dispatch cost.
+ *
+ * compile from the repository root as *
+ * - g++ -x c++ -std=c++11 -O2 -I slow5lib/include -I slow5lib/src -I src test/bench/work_db_bench.c src/thread.c src/profile.c slow5lib/lib/libslow5.a -lpthread -lz -o work_db_bench
+ * run as *
+ * - ./work_db_bench [num_thread] [batch_size] [num_batches]
+ */
+
+#include <sys/time.h>
+#include "thread.h"
+
+int slow5tools_verbosity_level = LOG_VERBOSE;
+
+typedef struct {
+    int64_t n_batch;
+    size_t *mem_bytes;
+} bench_batch_t;
+
+static double realtime(void) {
+    struct timeval tp;
+    gettimeofday(&tp, NULL);
+    return tp.tv_sec + tp.tv_usec * 1e-6;
+}
+
+static void touch_record(core_t* core, bench_batch_t* db, int32_t i) {
+    db->mem_bytes[i] = db->mem_bytes[i] * 31 + i;
+}
+
+/* the pointer is read through a volatile so that the compiler cannot resolve the call */
+static void (* volatile touch_record_ptr)(core_t*, bench_batch_t*, int32_t) = touch_record;
+
+int main(int argc, char **argv) {
+
+    int32_t num_thread = argc > 1 ? atoi(argv[1]) : 8;
+    int64_t batch_size = argc > 2 ? atoll(argv[2]) : 4096;
+    int64_t num_batches = argc > 3 ? atoll(argv[3]) : 2000;
+
+    core_t core;
+    core.num_thread = num_thread;
+    bench_batch_t db;
+    db.n_batch = batch_size;
+    db.mem_bytes = (size_t*)calloc(batch_size, sizeof(size_t));
+    MALLOC_CHK(db.mem_bytes);
+    void (*fn_ptr)(core_t*, bench_batch_t*, int32_t) = touch_record_ptr;
+
+    double t0 = realtime();
+    for (int64_t b = 0; b < num_batches; b++) {
+        pthread_db(&core, &db, fn_ptr);
+    }
+    double spawn = realtime() - t0;
+
+    t0 = realtime();
+    for (int64_t b = 0; b < num_batches; b++) {
+        work_db(&core, &db, fn_ptr);
+    }
+    double pool_ptr = realtime() - t0;
+
+    t0 = realtime();
+    for (int64_t b = 0; b < num_batches; b++) {
+        work_db(&core, &db, work_fn<bench_batch_t, touch_record>());
+    }
+    double pool_fn = realtime() - t0;
+    work_pool_destroy();
+
+    fprintf(stdout, "threads\tbatch_size\tbatches\tspawn_us_per_batch\tpool_fnptr_us_per_batch\tpool_functor_us_per_batch\n");
+    fprintf(stdout, "%d\t%" PRId64 "\t%" PRId64 "\t%.2f\t%.2f\t%.2f\n", num_thread, batch_size, num_batches,
+            spawn * 1e6 / num_batches, pool_ptr * 1e6 / num_batches, pool_fn * 1e6 / num_batches);
+
+    free(db.mem_bytes);
+    return 0;
+}
@@ -0,0 +1,112 @@
+/**
+ * @file work_steal_bench.c
+ * @brief scaling of work_db on skewed synthetic records, for 1-64 threads
+ *
+ * Each record costs a number of work units drawn from a heavy-tailed (Pareto) distribution,
+ * a few records being orders of magnitude more expensive than the rest, like ultra-long reads
+ * among short ones. The expensive records are clustered at the start of every batch, as
+ * happens when long reads are sequenced together. Each thread count is run with the initial
+ * ranges split by record count and by the cost hint, and every record is checked to be
+ * processed exactly once.
+ *
+ * compile from the repository root as *
+ * - g++ -x c++ -std=c++11 -O2 -I slow5lib/include -I slow5lib/src -I src test/bench/work_steal_bench.c src/thread.c src/profile.c slow5lib/lib/libslow5.a -lpthread -lz -o work_steal_bench
+ * run as *
+ * - ./work_steal_bench [batch_size] [num_batches] [max_threads]
+ */
+
+#include <math.h>
+#include <sys/time.h>
+#include "thread.h"
+
+int slow5tools_verbosity_level = LOG_VERBOSE;
+
+typedef struct {
+    int64_t n_batch;
+    size_t *mem_bytes;  // work units of each record, also passed as the cost hint
+    int32_t *done;      // times each record was processed
+    uint64_t *out;
+} skew_batch_t;
+
+static double realtime(void) {
+    struct timeval tp;
+    gettimeofday(&tp, NULL);
+    return tp.tv_sec + tp.tv_usec * 1e-6;
+}
+
+static void skew_record(core_t* core, skew_batch_t* db, int32_t i) {
+    uint64_t x = i;
+    for (size_t k = 0; k < db->mem_bytes[i]; k++) {
+        x = x * 6364136223846793005ULL + 1442695040888963407ULL;
+    }
+    db->out[i] = x;
+    __sync_fetch_and_add(&db->done[i], 1);
+}
+
+static double run(core_t* core, skew_batch_t* db, int64_t num_batches, int use_cost) {
+    double t0 = realtime();
+    for (int64_t b = 0; b < num_batches; b++) {
+        memset(db->done, 0, db->n_batch * sizeof(int32_t));
+        work_db(core, db, work_fn<skew_batch_t, skew_record>(), use_cost ? db->mem_bytes : NULL);
+        for (int64_t i = 0; i < db->n_batch; i++) {
+            if (db->done[i] != 1) {
+                ERROR("Record %" PRId64 " was processed %d times", i, db->done[i]);
+                exit(EXIT_FAILURE);
+            }
+        }
+    }
+    return realtime() - t0;
+}
+
+int main(int argc, char **argv) {
+
+    int64_t batch_size = argc > 1 ? atoll(argv[1]) : 4096;
+    int64_t num_batches = argc > 2 ? atoll(argv[2]) : 20;
+    int32_t max_threads = argc > 3 ? atoi(argv[3]) : 64;
+
+    skew_batch_t db;
+    db.n_batch = batch_size;
+    db.mem_bytes = (size_t*)malloc(batch_size * sizeof(size_t));
+    db.done = (int32_t*)malloc(batch_size * sizeof(int32_t));
+    db.out = (uint64_t*)malloc(batch_size * sizeof(uint64_t));
+    MALLOC_CHK(db.mem_bytes);
+    MALLOC_CHK(db.done);
+    MALLOC_CHK(db.out);
+
+    //Pareto with alpha 1.1, minimum 1000 units, capped at 10^8
+    srand(1);
+    for (int64_t i = 0; i < batch_size; i++) {
+        double u = (rand() + 1.0) / (RAND_MAX + 2.0);
+        double c = 1000.0 / pow(u, 1 / 1.1);
+        db.mem_bytes[i] = c > 1e8 ? 100000000 : (size_t)c;
+    }
+    //cluster the expensive records at the start of the batch
+    for (int64_t i = 0; i < batch_size / 16; i++) {
+        for (int64_t j = i + 1; j < batch_size; j++) {
+            if (db.mem_bytes[j] > db.mem_bytes[i]) {
+                size_t tmp = db.mem_bytes[i];
+                db.mem_bytes[i] = db.mem_bytes[j];
+                db.mem_bytes[j] = tmp;
+            }
+        }
+    }
+
+    core_t core;
+    double base = 0;
+    fprintf(stdout, "threads\tcount_split_s\tcost_split_s\tcount_speedup\tcost_speedup\n");
+    for (int32_t t = 1; t <= max_threads; t *= 2) {
+        core.num_thread = t;
+        double by_count = run(&core, &db, num_batches, 0);
+        double by_cost = run(&core, &db, num_batches, 1);
+        if (t == 1) {
+            base = by_count;
+        }
+        fprintf(stdout, "%d\t%.3f\t%.3f\t%.2f\t%.2f\n", t, by_count, by_cost, base / by_count, base / by_cost);
+    }
+    work_pool_destroy();
+
+    free(db.mem_bytes);
+    free(db.done);
+    free(db.out);
+    return 0;
+}
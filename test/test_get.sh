@@ -191,5 +191,25 @@ if [ $? -ne 0 ]; then
 fi
 info "testcase $TESTCASE passed"
 
+TESTCASE=12
+info "------------------- slow5tools get testcase $TESTCASE -------------------"
+cp "$RAW_DIR/example2.slow5" "$OUTPUT_DIR/example2_sorted.slow5" || die "testcase $TESTCASE failed"
+$SLOW5_EXEC index --sorted "$OUTPUT_DIR/example2_sorted.slow5" || die "testcase $TESTCASE failed"
+test -f "$OUTPUT_DIR/example2_sorted.slow5.sidx" || die "testcase $TESTCASE failed"
+$SLOW5_EXEC get "$OUTPUT_DIR/example2_sorted.slow5" r1 r5 r3 --to slow5 > "$OUTPUT_DIR/extracted_reads12.slow5" || die "testcase $TESTCASE failed"
+diff -q "$EXP_DIR/expected_extracted_reads2.slow5" "$OUTPUT_DIR/extracted_reads12.slow5" &>/dev/null
+if [ $? -ne 0 ]; then
+    info "${RED}ERROR: diff failed for 'slow5tools get testcase $TESTCASE'${NC}"
+    exit 1
+fi
+rm "$OUTPUT_DIR/example2_sorted.slow5.idx" || die "testcase $TESTCASE failed"
+$SLOW5_EXEC get "$OUTPUT_DIR/example2_sorted.slow5" --index "$OUTPUT_DIR/example2_sorted.slow5.sidx" --list "$RAW_DIR/list.txt" --to slow5 > "$OUTPUT_DIR/extracted_reads12.slow5" || die "testcase $TESTCASE failed"
+diff -q "$EXP_DIR/expected_extracted_reads3.slow5" "$OUTPUT_DIR/extracted_reads12.slow5" &>/dev/null
+if [ $? -ne 0 ]; then
+    info "${RED}ERROR: diff failed for 'slow5tools get testcase $TESTCASE'${NC}"
+    exit 1
+fi
+info "testcase $TESTCASE passed"
+
 rm -r $OUTPUT_DIR || die "Removing $OUTPUT_DIR failed" 1>&3 2>&4
 exit 0
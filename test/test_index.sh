@@ -117,6 +117,110 @@ echo "------------------- slow5tools index testcase ${TESTCASE_NO} -------------
 $SLOW5_EXEC index $SLOW5_DIR/duplicate_read.blow5 && die "testcase ${TESTCASE_NO} failed"
 echo -e "${GREEN}testcase ${TESTCASE_NO} passed${NC}"  1>&3 2>&4
 
+if [ -z "$bigend" ]; then
+echo
+TESTCASE_NO=7
+echo "------------------- slow5tools index testcase ${TESTCASE_NO} -------------------"
+$SLOW5_EXEC index -t 1 $SLOW5_DIR/example_multi_rg_v0.2.0.blow5 || die "testcase ${TESTCASE_NO} failed"
+diff -q $SLOW5_DIR/example_multi_rg_v0.2.0.blow5.idx.exp $SLOW5_DIR/example_multi_rg_v0.2.0.blow5.idx || die "ERROR: diff failed for testcase ${TESTCASE_NO}"
+$SLOW5_EXEC index -t 3 -K 2 $SLOW5_DIR/example_multi_rg_v0.2.0.blow5 || die "testcase ${TESTCASE_NO} failed"
+diff -q $SLOW5_DIR/example_multi_rg_v0.2.0.blow5.idx.exp $SLOW5_DIR/example_multi_rg_v0.2.0.blow5.idx || die "ERROR: diff failed for testcase ${TESTCASE_NO}"
+echo -e "${GREEN}testcase ${TESTCASE_NO} passed${NC}"  1>&3 2>&4
+fi
+
+echo
+TESTCASE_NO=8
+echo "------------------- slow5tools index testcase ${TESTCASE_NO} -------------------"
+$SLOW5_EXEC index -t 1 $SLOW5_DIR/example_multi_rg_v0.1.0.slow5 || die "testcase ${TESTCASE_NO} failed"
+diff -q $SLOW5_DIR/example_multi_rg_v0.1.0.slow5.idx.exp $SLOW5_DIR/example_multi_rg_v0.1.0.slow5.idx || die "ERROR: diff failed for testcase ${TESTCASE_NO}"
+$SLOW5_EXEC index -t 16 $SLOW5_DIR/example_multi_rg_v0.1.0.slow5 || die "testcase ${TESTCASE_NO} failed"
+diff -q $SLOW5_DIR/example_multi_rg_v0.1.0.slow5.idx.exp $SLOW5_DIR/example_multi_rg_v0.1.0.slow5.idx || die "ERROR: diff failed for testcase ${TESTCASE_NO}"
+echo -e "${GREEN}testcase ${TESTCASE_NO} passed${NC}"  1>&3 2>&4
+
+echo
+TESTCASE_NO=9
+echo "------------------- slow5tools index testcase ${TESTCASE_NO} -------------------"
+$SLOW5_EXEC index -t 1 $SLOW5_DIR/duplicate_read.blow5 && die "testcase ${TESTCASE_NO} failed"
+echo -e "${GREEN}testcase ${TESTCASE_NO} passed${NC}"  1>&3 2>&4
+
+echo
+TESTCASE_NO=10
+echo "------------------- slow5tools index testcase ${TESTCASE_NO} -------------------"
+# a SLOW5 file indexed while it grows: cut in the middle of a record, then complete
+GROWING=$OUTPUT_DIR/growing.slow5
+head -c 45000 $SLOW5_DIR/example_multi_rg_v0.1.0.slow5 > $GROWING
+$SLOW5_EXEC index --incremental $GROWING || die "testcase ${TESTCASE_NO} failed"
+cp $SLOW5_DIR/example_multi_rg_v0.1.0.slow5 $GROWING
+$SLOW5_EXEC index --incremental $GROWING || die "testcase ${TESTCASE_NO} failed"
+diff -q $SLOW5_DIR/example_multi_rg_v0.1.0.slow5.idx.exp $GROWING.idx || die "ERROR: diff failed for testcase ${TESTCASE_NO}"
+$SLOW5_EXEC index --incremental $GROWING || die "testcase ${TESTCASE_NO} failed"
+diff -q $SLOW5_DIR/example_multi_rg_v0.1.0.slow5.idx.exp $GROWING.idx || die "ERROR: diff failed for testcase ${TESTCASE_NO}"
+if [ -z "$bigend" ]; then
+# a BLOW5 file cut in the middle of a record (the fifth starts at byte 25602), then in the middle of
+# the length of one (the sixth starts at byte 47828), then complete with its EOF marker; each index
+# must be that of the complete records so far, built from scratch
+GROWING=$OUTPUT_DIR/growing.blow5
+SO_FAR=$OUTPUT_DIR/so_far.blow5
+BLOW5=$SLOW5_DIR/example_multi_rg_v0.1.0.blow5
+for CUT in 30000:25602 47832:47828
+do
+    head -c ${CUT%:*} $BLOW5 > $GROWING
+    $SLOW5_EXEC index --incremental -t 2 $GROWING || die "testcase ${TESTCASE_NO} failed"
+    { head -c ${CUT#*:} $BLOW5; printf '5WOLB'; } > $SO_FAR
+    $SLOW5_EXEC index $SO_FAR || die "testcase ${TESTCASE_NO} failed"
+    diff -q $SO_FAR.idx $GROWING.idx || die "ERROR: diff failed for testcase ${TESTCASE_NO} (cut at byte ${CUT%:*})"
+done
+cp $BLOW5 $GROWING
+$SLOW5_EXEC index --incremental -t 2 $GROWING || die "testcase ${TESTCASE_NO} failed"
+diff -q $SLOW5_DIR/example_multi_rg_v0.1.0.blow5.idx.exp $GROWING.idx || die "ERROR: diff failed for testcase ${TESTCASE_NO}"
+$SLOW5_EXEC index --incremental $GROWING || die "testcase ${TESTCASE_NO} failed"
+diff -q $SLOW5_DIR/example_multi_rg_v0.1.0.blow5.idx.exp $GROWING.idx || die "ERROR: diff failed for testcase ${TESTCASE_NO}"
+fi
+echo -e "${GREEN}testcase ${TESTCASE_NO} passed${NC}"  1>&3 2>&4
+
+echo
+TESTCASE_NO=11
+echo "------------------- slow5tools index testcase ${TESTCASE_NO} -------------------"
+# indexes written along with the output must match those made by reading the output again
+check_index_out() {
+    mv $1.idx $1.idx.out || die "testcase ${TESTCASE_NO} failed"
+    $SLOW5_EXEC index $1 || die "testcase ${TESTCASE_NO} failed"
+    diff -q $1.idx $1.idx.out || die "ERROR: diff failed for testcase ${TESTCASE_NO} ($1)"
+}
+$SLOW5_EXEC view --index $SLOW5_DIR/example_multi_rg_v0.1.0.blow5 -o $OUTPUT_DIR/view.slow5 || die "testcase ${TESTCASE_NO} failed"
+check_index_out $OUTPUT_DIR/view.slow5
+$SLOW5_EXEC view --index -t 3 -K 2 $SLOW5_DIR/example_multi_rg_v0.1.0.blow5 -c zlib -o $OUTPUT_DIR/view.blow5 || die "testcase ${TESTCASE_NO} failed"
+check_index_out $OUTPUT_DIR/view.blow5
+$SLOW5_EXEC merge --index $SLOW5_DIR/example_multi_rg_v0.1.0.blow5 -o $OUTPUT_DIR/merge.blow5 || die "testcase ${TESTCASE_NO} failed"
+check_index_out $OUTPUT_DIR/merge.blow5
+$SLOW5_EXEC cat --index $OUTPUT_DIR/view.blow5 -o $OUTPUT_DIR/cat.blow5 || die "testcase ${TESTCASE_NO} failed"
+check_index_out $OUTPUT_DIR/cat.blow5
+# split to another format goes through the threads, to the same one the records are copied as they are
+ELEVEN_READS=$REL_PATH/data/raw/split/single_group_slow5s/11reads.slow5
+$SLOW5_EXEC split --index -r 4 -t 2 -K 2 $ELEVEN_READS --to blow5 -d $OUTPUT_DIR/split_threads || die "testcase ${TESTCASE_NO} failed"
+$SLOW5_EXEC split --index -r 4 $ELEVEN_READS --to slow5 -d $OUTPUT_DIR/split_copy || die "testcase ${TESTCASE_NO} failed"
+$SLOW5_EXEC split --index -g -t 2 $SLOW5_DIR/example_multi_rg_v0.1.0.blow5 -d $OUTPUT_DIR/split_groups || die "testcase ${TESTCASE_NO} failed"
+$SLOW5_EXEC f2s --index -p 2 $REL_PATH/data/raw/f2s/multi-fast5 -d $OUTPUT_DIR/f2s_multi || die "testcase ${TESTCASE_NO} failed"
+$SLOW5_EXEC f2s --index $REL_PATH/data/raw/f2s/single-fast5 -d $OUTPUT_DIR/f2s_single || die "testcase ${TESTCASE_NO} failed"
+# demultiplexing writes a record to the file of each of its barcodes
+DEMUX=$REL_PATH/data/raw/split
+$SLOW5_EXEC split --index -x $DEMUX/demux1/barcode_summary.txt $DEMUX/demux1/example2_0.slow5 --to slow5 -d $OUTPUT_DIR/demux_slow5 || die "testcase ${TESTCASE_NO} failed"
+OUT_DIRS="split_threads split_copy split_groups f2s_multi f2s_single demux_slow5"
+if [ -z "$bigend" ]; then
+    $SLOW5_EXEC split --index -x $DEMUX/demux3/bs.txt $DEMUX/demux3/example2_0.slow5 --to blow5 -d $OUTPUT_DIR/demux_blow5 || die "testcase ${TESTCASE_NO} failed"
+    $SLOW5_EXEC split --index -t 2 -K 2 -x $DEMUX/demux4/summary $DEMUX/demux4/example2_0.blow5 --to blow5 -d $OUTPUT_DIR/demux_threads || die "testcase ${TESTCASE_NO} failed"
+    OUT_DIRS="$OUT_DIRS demux_blow5 demux_threads"
+fi
+for DIR in $OUT_DIRS
+do
+    ls $OUTPUT_DIR/$DIR/*.[bs]low5 > /dev/null || die "testcase ${TESTCASE_NO} failed: no output in $DIR"
+    for FILE in $OUTPUT_DIR/$DIR/*.[bs]low5
+    do
+        check_index_out $FILE
+    done
+done
+$SLOW5_EXEC view --index $SLOW5_DIR/example_multi_rg_v0.1.0.blow5 && die "testcase ${TESTCASE_NO} failed"
+echo -e "${GREEN}testcase ${TESTCASE_NO} passed${NC}"  1>&3 2>&4
 
 rm -r $OUTPUT_DIR || die "Removing $OUTPUT_DIR failed"
 
@@ -71,5 +71,66 @@ do
     TESTCASE=$((TESTCASE + 1))
 done
 
+info "testcase$TESTCASE"
+# several files at once: a line each and the totals, failing if any file is bad
+GOOD_PATHS=$(for each in $GOOD_LIST; do echo $RAW_DIR/$each; done)
+BAD_PATHS=$(for each in $BAD_LIST; do echo $RAW_DIR/$each; done)
+NUM_GOOD=$(echo $GOOD_LIST | wc -w)
+NUM_ALL=$(echo $GOOD_LIST $BAD_LIST | wc -w)
+OUT=$($SLOW5TOOLS quickcheck -t 2 $GOOD_PATHS 2> /dev/null) || die "testcase$TESTCASE: quickcheck failed"
+echo "$OUT" | grep -q "^#total.$NUM_GOOD/$NUM_GOOD ok" || die "testcase$TESTCASE: wrong totals"
+OUT=$($SLOW5TOOLS quickcheck -t 4 $GOOD_PATHS $BAD_PATHS 2> /dev/null) && die "testcase$TESTCASE: quickcheck should fail"
+echo "$OUT" | grep -q "^#total.$NUM_GOOD/$NUM_ALL ok" || die "testcase$TESTCASE: wrong totals"
+[ "$(echo "$OUT" | grep -c "	bad	")" -eq $((NUM_ALL - NUM_GOOD)) ] || die "testcase$TESTCASE: wrong bad files"
+TESTCASE=$((TESTCASE + 1))
+
+info "testcase$TESTCASE"
+# --deep decodes every record, --check-index also checks the index
+for each in $GOOD_LIST
+do
+    $SLOW5TOOLS quickcheck --deep -t 2 -K 3 $RAW_DIR/${each} 2> /dev/null || die "testcase$TESTCASE: quickcheck --deep failed on $each"
+done
+for each in $BAD_LIST
+do
+    $SLOW5TOOLS quickcheck --deep -t 2 $RAW_DIR/${each} 2> /dev/null && die "testcase$TESTCASE: quickcheck --deep should fail on $each"
+done
+$SLOW5TOOLS quickcheck --deep $GOOD_PATHS > /dev/null 2> /dev/null || die "testcase$TESTCASE: quickcheck --deep on several files failed"
+$SLOW5TOOLS quickcheck --check-index $RAW_DIR/exp_1_lossy_good.blow5 2> /dev/null && die "testcase$TESTCASE: --check-index without --deep should fail"
+TMP_DIR=$(mktemp -d)
+cp $RAW_DIR/exp_1_lossy_good.blow5 $TMP_DIR/ || die "testcase$TESTCASE: cp failed"
+$SLOW5TOOLS quickcheck --deep --check-index $TMP_DIR/exp_1_lossy_good.blow5 2> /dev/null && die "testcase$TESTCASE: --check-index without an index should fail"
+$SLOW5TOOLS index $TMP_DIR/exp_1_lossy_good.blow5 2> /dev/null || die "testcase$TESTCASE: index failed"
+$SLOW5TOOLS quickcheck --deep --check-index -t 2 $TMP_DIR/exp_1_lossy_good.blow5 2> /dev/null || die "testcase$TESTCASE: quickcheck --deep --check-index failed"
+rm -r $TMP_DIR
+TESTCASE=$((TESTCASE + 1))
+
+if [ -z "$bigend" ]; then
+info "testcase$TESTCASE"
+# a record broken in the middle of an otherwise valid file passes the quick check but not --deep
+TMP_DIR=$(mktemp -d)
+GOOD=$RAW_DIR/zlib_svb-zd_multi_rg_v0.2.0_good.blow5
+# its fifth record starts at byte 18403 and the third at byte 10702
+cp $GOOD $TMP_DIR/bad_rec.blow5 || die "testcase$TESTCASE: cp failed"
+dd if=/dev/zero of=$TMP_DIR/bad_rec.blow5 bs=1 seek=18511 count=64 conv=notrunc 2> /dev/null || die "testcase$TESTCASE: dd failed"
+$SLOW5TOOLS quickcheck $TMP_DIR/bad_rec.blow5 2> /dev/null || die "testcase$TESTCASE: quickcheck failed"
+$SLOW5TOOLS quickcheck --deep -t 2 -K 2 $TMP_DIR/bad_rec.blow5 2> $TMP_DIR/err.log && die "testcase$TESTCASE: quickcheck --deep should fail"
+grep -q "cannot be decoded at byte 18403[^0-9]" $TMP_DIR/err.log || die "testcase$TESTCASE: wrong offset of the bad record"
+cp $GOOD $TMP_DIR/bad_len.blow5 || die "testcase$TESTCASE: cp failed"
+printf '\377\377\377\377\377\377\377\177' | dd of=$TMP_DIR/bad_len.blow5 bs=1 seek=10702 conv=notrunc 2> /dev/null || die "testcase$TESTCASE: dd failed"
+$SLOW5TOOLS quickcheck $TMP_DIR/bad_len.blow5 2> /dev/null || die "testcase$TESTCASE: quickcheck failed"
+$SLOW5TOOLS quickcheck --deep $TMP_DIR/bad_len.blow5 2> $TMP_DIR/err.log && die "testcase$TESTCASE: quickcheck --deep should fail"
+grep -q "bad record length at byte 10702[^0-9]" $TMP_DIR/err.log || die "testcase$TESTCASE: wrong offset of the bad record length"
+# the index of the same records laid out differently does not match the file
+cp $GOOD $TMP_DIR/a.blow5 || die "testcase$TESTCASE: cp failed"
+$SLOW5TOOLS view -c none $GOOD -o $TMP_DIR/b.blow5 2> /dev/null || die "testcase$TESTCASE: view failed"
+$SLOW5TOOLS index $TMP_DIR/b.blow5 2> /dev/null || die "testcase$TESTCASE: index failed"
+cp $TMP_DIR/b.blow5.idx $TMP_DIR/a.blow5.idx || die "testcase$TESTCASE: cp failed"
+$SLOW5TOOLS quickcheck --deep --check-index $TMP_DIR/b.blow5 2> /dev/null || die "testcase$TESTCASE: quickcheck --deep --check-index failed"
+$SLOW5TOOLS quickcheck --deep --check-index $TMP_DIR/a.blow5 2> $TMP_DIR/err.log && die "testcase$TESTCASE: --check-index should fail with a mismatched index"
+grep -q "index" $TMP_DIR/err.log || die "testcase$TESTCASE: no index error"
+rm -r $TMP_DIR
+TESTCASE=$((TESTCASE + 1))
+fi
+
 info "all $TESTCASE testcases passed"
 exit 0
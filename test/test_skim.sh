@@ -77,6 +77,57 @@ info "testcase$TESTCASE"
 $SLOW5TOOLS skim $RAW_DIR/sequin_rna.blow5 > $OUTPUT_DIR/sequin_rna.txt  || die "testcase$TESTCASE: skim failed"
 diff $OUTPUT_DIR/sequin_rna.txt "$EXP_DIR/sequin_rna.exp"  > /dev/null || die "testcase$TESTCASE: diff failed"
 
+TESTCASE=3
+info "testcase$TESTCASE"
+# small batches over several threads, so that the per-thread output buffers are reused
+$SLOW5TOOLS skim -t 4 -K 3 $RAW_DIR/sp1_dna.blow5 > $OUTPUT_DIR/sp1_dna_t4.txt || die "testcase$TESTCASE: skim failed"
+diff $OUTPUT_DIR/sp1_dna_t4.txt "$EXP_DIR/sp1_dna.exp"  > /dev/null || die "testcase$TESTCASE: diff failed"
+
+TESTCASE=4
+info "testcase$TESTCASE"
+# a projection is the same as the columns cut from the full output
+$SLOW5TOOLS skim --fields read_id,len_raw_signal,end_reason $RAW_DIR/sp1_dna.blow5 > $OUTPUT_DIR/sp1_dna_fields.txt || die "testcase$TESTCASE: skim failed"
+cut -f1,7,13 "$EXP_DIR/sp1_dna.exp" > $OUTPUT_DIR/sp1_dna_fields.exp
+diff $OUTPUT_DIR/sp1_dna_fields.txt $OUTPUT_DIR/sp1_dna_fields.exp > /dev/null || die "testcase$TESTCASE: diff failed"
+$SLOW5TOOLS skim -t 2 --fields median_before,read_id,offset $RAW_DIR/sequin_rna.blow5 > $OUTPUT_DIR/sequin_rna_fields.txt || die "testcase$TESTCASE: skim failed"
+awk -F'\t' -v OFS='\t' '{print $11,$1,$4}' "$EXP_DIR/sequin_rna.exp" | sed 's/^\(.*\)\t#read_id/#\1\tread_id/' > $OUTPUT_DIR/sequin_rna_fields.exp
+diff $OUTPUT_DIR/sequin_rna_fields.txt $OUTPUT_DIR/sequin_rna_fields.exp > /dev/null || die "testcase$TESTCASE: diff failed"
+$SLOW5TOOLS skim --fields read_id,no_such_field $RAW_DIR/sp1_dna.blow5 > /dev/null 2>&1 && die "testcase$TESTCASE: an unknown field should fail"
+$SLOW5TOOLS skim --fields read_id --rid $RAW_DIR/sp1_dna.blow5 > /dev/null 2>&1 && die "testcase$TESTCASE: --fields with --rid should fail"
+
+TESTCASE=5
+info "testcase$TESTCASE"
+# a filter keeps the same lines as the equivalent awk filter on the full output
+$SLOW5TOOLS skim --filter 'len_raw_signal>4400 && end_reason==signal_positive' $RAW_DIR/sp1_dna.blow5 > $OUTPUT_DIR/sp1_dna_filter.txt || die "testcase$TESTCASE: skim failed"
+awk -F'\t' 'NR==1 || ($7>4400 && $13=="signal_positive")' "$EXP_DIR/sp1_dna.exp" > $OUTPUT_DIR/sp1_dna_filter.exp
+diff $OUTPUT_DIR/sp1_dna_filter.txt $OUTPUT_DIR/sp1_dna_filter.exp > /dev/null || die "testcase$TESTCASE: diff failed"
+$SLOW5TOOLS skim -t 2 -K 3 --fields read_id,start_time --filter '!(end_reason==signal_negative || start_mux<2)' $RAW_DIR/sequin_rna.blow5 > $OUTPUT_DIR/sequin_rna_filter.txt || die "testcase$TESTCASE: skim failed"
+awk -F'\t' -v OFS='\t' 'NR==1 || !($9=="signal_negative" || $13<2) {print $1,$14}' "$EXP_DIR/sequin_rna.exp" > $OUTPUT_DIR/sequin_rna_filter.exp
+diff $OUTPUT_DIR/sequin_rna_filter.txt $OUTPUT_DIR/sequin_rna_filter.exp > /dev/null || die "testcase$TESTCASE: diff failed"
+# view writes the records passing the filter
+$SLOW5TOOLS view --filter 'len_raw_signal>4400 && end_reason==signal_positive' $RAW_DIR/sp1_dna.blow5 -o $OUTPUT_DIR/sp1_dna_filter.blow5 || die "testcase$TESTCASE: view failed"
+$SLOW5TOOLS skim $OUTPUT_DIR/sp1_dna_filter.blow5 > $OUTPUT_DIR/sp1_dna_filter_view.txt || die "testcase$TESTCASE: skim failed"
+diff $OUTPUT_DIR/sp1_dna_filter_view.txt $OUTPUT_DIR/sp1_dna_filter.exp > /dev/null || die "testcase$TESTCASE: diff failed"
+$SLOW5TOOLS skim --filter 'len_raw_signal>>4400' $RAW_DIR/sp1_dna.blow5 > /dev/null 2>&1 && die "testcase$TESTCASE: an invalid filter should fail"
+$SLOW5TOOLS skim --filter 'end_reason==no_such_label' $RAW_DIR/sp1_dna.blow5 > /dev/null 2>&1 && die "testcase$TESTCASE: an unknown enum label should fail"
+$SLOW5TOOLS view --filter 'raw_signal>0' $RAW_DIR/sp1_dna.blow5 > /dev/null 2>&1 && die "testcase$TESTCASE: a filter on raw_signal should fail"
+
+TESTCASE=6
+info "testcase$TESTCASE"
+# several range readers write the same output and exit cleanly at the end of the file
+$SLOW5TOOLS skim --readers 2 -K 2 $RAW_DIR/sp1_dna.blow5 > $OUTPUT_DIR/sp1_dna_r2.txt || die "testcase$TESTCASE: skim --readers 2 failed"
+diff $OUTPUT_DIR/sp1_dna_r2.txt "$EXP_DIR/sp1_dna.exp"  > /dev/null || die "testcase$TESTCASE: diff failed"
+$SLOW5TOOLS skim --readers 2 -t 2 $RAW_DIR/sequin_rna.blow5 > $OUTPUT_DIR/sequin_rna_r2.txt || die "testcase$TESTCASE: skim --readers 2 failed"
+diff $OUTPUT_DIR/sequin_rna_r2.txt "$EXP_DIR/sequin_rna.exp"  > /dev/null || die "testcase$TESTCASE: diff failed"
+
+TESTCASE=7
+info "testcase$TESTCASE"
+# records decoded straight from the mapped file, with and without the lazy parser
+$SLOW5TOOLS skim --mmap -K 3 $RAW_DIR/sp1_dna.blow5 > $OUTPUT_DIR/sp1_dna_mmap.txt || die "testcase$TESTCASE: skim --mmap failed"
+diff $OUTPUT_DIR/sp1_dna_mmap.txt "$EXP_DIR/sp1_dna.exp"  > /dev/null || die "testcase$TESTCASE: diff failed"
+$SLOW5TOOLS skim --mmap -t 2 --fields read_id,len_raw_signal,end_reason $RAW_DIR/sp1_dna.blow5 > $OUTPUT_DIR/sp1_dna_mmap_fields.txt || die "testcase$TESTCASE: skim --mmap failed"
+diff $OUTPUT_DIR/sp1_dna_mmap_fields.txt $OUTPUT_DIR/sp1_dna_fields.exp > /dev/null || die "testcase$TESTCASE: diff failed"
+
 fi
 
 info "all $TESTCASE testcases passed"
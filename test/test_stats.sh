@@ -97,6 +97,60 @@ TESTCASE=7
 info "testcase$TESTCASE"
 $SLOW5TOOLS stats $RAW_DIR/zlib_svb-zd_multi_rg_v1.1.0.blow5> $OUTPUT_DIR/output.log && die "testcase$TESTCASE: stats failed"
 
+TESTCASE=8
+info "testcase$TESTCASE"
+# the record count without an index, from a current index and despite a stale one; the file path line differs
+stats_diff() {
+    $SLOW5TOOLS stats $1 > $OUTPUT_DIR/output.log || die "testcase$TESTCASE: stats failed"
+    diff <(tail -n +2 $OUTPUT_DIR/output.log) <(tail -n +2 "$EXP_DIR/$2.stdout") > /dev/null || die "testcase$TESTCASE: diff failed"
+}
+cp $RAW_DIR/zlib_svb-zd_multi_rg_v0.2.0.blow5 $OUTPUT_DIR/count.blow5 || die "testcase$TESTCASE: cp failed"
+stats_diff $OUTPUT_DIR/count.blow5 zlib_svb-zd_multi_rg_v0.2.0
+$SLOW5TOOLS index $OUTPUT_DIR/count.blow5 || die "testcase$TESTCASE: index failed"
+stats_diff $OUTPUT_DIR/count.blow5 zlib_svb-zd_multi_rg_v0.2.0
+head -c -3 $OUTPUT_DIR/count.blow5.idx > $OUTPUT_DIR/cut.idx && mv $OUTPUT_DIR/cut.idx $OUTPUT_DIR/count.blow5.idx || die "testcase$TESTCASE: head failed"
+stats_diff $OUTPUT_DIR/count.blow5 zlib_svb-zd_multi_rg_v0.2.0
+cp $RAW_DIR/exp_1_lossy.blow5 $OUTPUT_DIR/count.blow5 && touch $OUTPUT_DIR/count.blow5.idx || die "testcase$TESTCASE: cp failed"
+stats_diff $OUTPUT_DIR/count.blow5 exp_1_lossy
+cp $RAW_DIR/exp_1_lossless.slow5 $OUTPUT_DIR/count.slow5 || die "testcase$TESTCASE: cp failed"
+stats_diff $OUTPUT_DIR/count.slow5 exp_1_lossless
+
+TESTCASE=9
+info "testcase$TESTCASE"
+# --full keeps the summary as it is and adds to it the same totals whatever the number of threads
+$SLOW5TOOLS stats --full -t 1 $RAW_DIR/zlib_svb-zd_multi_rg_v0.2.0.blow5 > $OUTPUT_DIR/full_1.log || die "testcase$TESTCASE: stats failed"
+$SLOW5TOOLS stats --full -t 4 -K 2 $RAW_DIR/zlib_svb-zd_multi_rg_v0.2.0.blow5 > $OUTPUT_DIR/full_4.log || die "testcase$TESTCASE: stats failed"
+diff $OUTPUT_DIR/full_1.log $OUTPUT_DIR/full_4.log > /dev/null || die "testcase$TESTCASE: diff failed"
+diff <(head -n 9 $OUTPUT_DIR/full_1.log) "$EXP_DIR/zlib_svb-zd_multi_rg_v0.2.0.stdout" > /dev/null || die "testcase$TESTCASE: diff failed"
+grep -q "^N50 signal length" $OUTPUT_DIR/full_1.log || die "testcase$TESTCASE: no N50"
+$SLOW5TOOLS stats --full -t 3 $RAW_DIR/exp_1_lossless.slow5 > $OUTPUT_DIR/full_1.log || die "testcase$TESTCASE: stats failed"
+diff <(head -n 9 $OUTPUT_DIR/full_1.log) "$EXP_DIR/exp_1_lossless.stdout" > /dev/null || die "testcase$TESTCASE: diff failed"
+
+TESTCASE=10
+info "testcase$TESTCASE"
+# several files: a line each, in the order given, and the totals
+$SLOW5TOOLS stats -t 2 $RAW_DIR/exp_1_lossless.slow5 $RAW_DIR/zlib_svb-zd_multi_rg_v0.2.0.blow5 > $OUTPUT_DIR/output.log || die "testcase$TESTCASE: stats failed"
+[ "$(cut -f 1,2,9 $OUTPUT_DIR/output.log | tail -n +2 | tr '\n\t' ';,')" = "$RAW_DIR/exp_1_lossless.slow5,ok,1;$RAW_DIR/zlib_svb-zd_multi_rg_v0.2.0.blow5,ok,7;#total,2/2 ok,8;" ] || die "testcase$TESTCASE: wrong output"
+# a directory with a file that cannot be read
+$SLOW5TOOLS stats -t 3 $RAW_DIR > $OUTPUT_DIR/output.log && die "testcase$TESTCASE: stats should fail"
+grep -q "zlib_svb-zd_multi_rg_v1.1.0.blow5.error" $OUTPUT_DIR/output.log || die "testcase$TESTCASE: no error line"
+grep -q "^#total.4/5 ok" $OUTPUT_DIR/output.log || die "testcase$TESTCASE: wrong totals"
+
+TESTCASE=11
+info "testcase$TESTCASE"
+# a record that does not decode in the middle of a file fails that file only
+mkdir -p $OUTPUT_DIR/corrupt || die "could not create $OUTPUT_DIR/corrupt"
+cp $RAW_DIR/zlib_svb-zd_multi_rg_v0.2.0.blow5 $OUTPUT_DIR/corrupt/a_good.blow5 || die "testcase$TESTCASE: cp failed"
+cp $RAW_DIR/zlib_svb-zd_multi_rg_v0.2.0.blow5 $OUTPUT_DIR/corrupt/b_bad.blow5 || die "testcase$TESTCASE: cp failed"
+# the fifth record starts at byte 18403; zero some of its compressed bytes, leaving its length prefix as it is
+dd if=/dev/zero of=$OUTPUT_DIR/corrupt/b_bad.blow5 bs=1 seek=18511 count=64 conv=notrunc 2> /dev/null || die "testcase$TESTCASE: dd failed"
+$SLOW5TOOLS stats $OUTPUT_DIR/corrupt/b_bad.blow5 > /dev/null || die "testcase$TESTCASE: stats without --full should not decode the records"
+$SLOW5TOOLS stats --full $OUTPUT_DIR/corrupt/b_bad.blow5 > /dev/null 2>&1 && die "testcase$TESTCASE: stats --full should fail"
+$SLOW5TOOLS stats --full -t 2 $OUTPUT_DIR/corrupt > $OUTPUT_DIR/output.log 2> /dev/null && die "testcase$TESTCASE: stats --full should fail"
+grep -q "a_good.blow5.ok" $OUTPUT_DIR/output.log || die "testcase$TESTCASE: no line of the good file"
+grep -q "b_bad.blow5.error" $OUTPUT_DIR/output.log || die "testcase$TESTCASE: no error line"
+grep -q "^#total.1/2 ok" $OUTPUT_DIR/output.log || die "testcase$TESTCASE: wrong totals"
+
 rm -r "$OUTPUT_DIR" || die "could not delete $OUTPUT_DIR"
 info "all $TESTCASE testcases passed"
 exit 0
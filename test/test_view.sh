@@ -230,6 +230,72 @@ fi
     fi
 done
 
+if [ -z "$bigend" ]; then
+    ####### BLOW5 to BLOW5 with the same signal compression, several records
+    MULTI="$EXP/index/example_multi_rg_v0.2.0"
+    # same encoding: the records are copied as they are, with and without --index
+    ex "$S5T" view "$MULTI.blow5" -c zlib -s svb-zd -o "$OUT/one_fast5/out_multi_copy.blow5"
+    my_diff "$MULTI.blow5" "$OUT/one_fast5/out_multi_copy.blow5"
+    ex "$S5T" view "$MULTI.blow5" -c zlib -s svb-zd --index -o "$OUT/one_fast5/out_multi_copy.blow5"
+    my_diff "$MULTI.blow5" "$OUT/one_fast5/out_multi_copy.blow5"
+    my_diff "$MULTI.blow5.idx.exp" "$OUT/one_fast5/out_multi_copy.blow5.idx"
+    # only the record compression changes: zlib -> none -> zlib
+    ex "$S5T" view "$MULTI.blow5" -c none -s svb-zd -o "$OUT/one_fast5/out_multi_none.blow5"
+    ex "$S5T" view "$OUT/one_fast5/out_multi_none.blow5" -c zlib -s svb-zd -o "$OUT/one_fast5/out_multi_zlib.blow5"
+    my_diff "$MULTI.blow5" "$OUT/one_fast5/out_multi_zlib.blow5"
+    ex "$S5T" view "$OUT/one_fast5/out_multi_none.blow5" -c zlib -s svb-zd --index -o "$OUT/one_fast5/out_multi_zlib.blow5"
+    my_diff "$MULTI.blow5" "$OUT/one_fast5/out_multi_zlib.blow5"
+    my_diff "$MULTI.blow5.idx.exp" "$OUT/one_fast5/out_multi_zlib.blow5.idx"
+    if [ "$zstd" = "1" ]; then
+        # zstd -> zlib and zlib -> zstd
+        ex "$S5T" view "${MULTI}_zstd_svb-zd.blow5" -c zlib -s svb-zd -o "$OUT/one_fast5/out_multi_zlib.blow5"
+        my_diff "$MULTI.blow5" "$OUT/one_fast5/out_multi_zlib.blow5"
+        ex "$S5T" view "$MULTI.blow5" -c zstd -s svb-zd -o "$OUT/one_fast5/out_multi_zstd.blow5"
+        my_diff "${MULTI}_zstd_svb-zd.blow5" "$OUT/one_fast5/out_multi_zstd.blow5"
+    fi
+fi
+
+####### --filter, checked against the records the SLOW5 input keeps, with a full parse of each
+FILTER="$EXP/index/example_multi_rg_v0.1.0"
+FILTER_EXPR='len_raw_signal>4100'
+ex "$S5T" view "$FILTER.slow5" --filter "$FILTER_EXPR" -o "$OUT/one_fast5/out_filter_exp.slow5"
+if [ "$(grep -vc '^[#@]' "$OUT/one_fast5/out_filter_exp.slow5")" != "4" ]; then
+    fail "--filter kept other than 4 records"
+fi
+# BLOW5 records parsed without their signal for the filter, then in full
+ex "$S5T" view "$FILTER.blow5" --filter "$FILTER_EXPR" -o "$OUT/one_fast5/out_filter.slow5"
+my_diff "$OUT/one_fast5/out_filter_exp.slow5" "$OUT/one_fast5/out_filter.slow5"
+# the same signal compression: the records kept are only recompressed, from what the filter decompressed
+ex "$S5T" view "$FILTER.blow5" --filter "$FILTER_EXPR" -c zlib -s none -o "$OUT/one_fast5/out_filter_zlib.blow5"
+ex "$S5T" view "$OUT/one_fast5/out_filter_zlib.blow5" -o "$OUT/one_fast5/out_filter.slow5"
+my_diff "$OUT/one_fast5/out_filter_exp.slow5" "$OUT/one_fast5/out_filter.slow5"
+ex "$S5T" view "$OUT/one_fast5/out_filter_zlib.blow5" --filter "$FILTER_EXPR" -c none -s none -o "$OUT/one_fast5/out_filter_none.blow5"
+ex "$S5T" view "$OUT/one_fast5/out_filter_none.blow5" -o "$OUT/one_fast5/out_filter.slow5"
+my_diff "$OUT/one_fast5/out_filter_exp.slow5" "$OUT/one_fast5/out_filter.slow5"
+# with --index, for a record recompressed and for one written as it is; the index is that built from the output
+for press in zlib none; do
+    ex "$S5T" view "$FILTER.blow5" --filter "$FILTER_EXPR" -c $press -s none --index -o "$OUT/one_fast5/out_filter_index.blow5"
+    ex "$S5T" view "$OUT/one_fast5/out_filter_index.blow5" -o "$OUT/one_fast5/out_filter.slow5"
+    my_diff "$OUT/one_fast5/out_filter_exp.slow5" "$OUT/one_fast5/out_filter.slow5"
+    cp "$OUT/one_fast5/out_filter_index.blow5" "$OUT/one_fast5/out_filter_rebuilt.blow5"
+    rm -f "$OUT/one_fast5/out_filter_rebuilt.blow5.idx"
+    ex "$S5T" index "$OUT/one_fast5/out_filter_rebuilt.blow5"
+    my_diff "$OUT/one_fast5/out_filter_rebuilt.blow5.idx" "$OUT/one_fast5/out_filter_index.blow5.idx"
+done
+
+####### --profile writes the stages of the command with the threads that ran them as JSON
+rm -f "$OUT/one_fast5/profile.json"
+ex "$S5T" --profile "$OUT/one_fast5/profile.json" view -t 2 -K 2 "$EXP/index/example_multi_rg_v0.1.0.blow5" -o "$OUT/one_fast5/out_profile.slow5"
+my_diff "$EXP/index/example_multi_rg_v0.1.0.slow5" "$OUT/one_fast5/out_profile.slow5"
+for key in '"exit_status": 0' '"read": {' '"process": {' '"write": {' '"threads": \['; do
+    if ! grep -q "$key" "$OUT/one_fast5/profile.json"; then
+        fail "--profile wrote no $key"
+    fi
+done
+if command -v python3 > /dev/null && ! python3 -m json.tool "$OUT/one_fast5/profile.json" > /dev/null; then
+    fail "--profile wrote invalid JSON"
+fi
+
 # the following should exit with error
 
 #conflict in --to format and -o format